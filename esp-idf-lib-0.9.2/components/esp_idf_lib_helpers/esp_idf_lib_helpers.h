@@ -48,6 +48,7 @@
         || defined(CONFIG_IDF_TARGET_ESP32C6)
 #define HELPER_TARGET_IS_ESP32     (1)
 #define HELPER_TARGET_IS_ESP8266   (0)
+#define HELPER_TARGET_IS_LINUX     (0)
 
 /* HELPER_TARGET_IS_ESP8266
  * 1 when the target is esp8266
@@ -55,6 +56,15 @@
 #elif defined(CONFIG_IDF_TARGET_ESP8266)
 #define HELPER_TARGET_IS_ESP32     (0)
 #define HELPER_TARGET_IS_ESP8266   (1)
+#define HELPER_TARGET_IS_LINUX     (0)
+
+/* HELPER_TARGET_IS_LINUX
+ * 1 when the target is linux (host build, no I2C hardware)
+ */
+#elif defined(CONFIG_IDF_TARGET_LINUX)
+#define HELPER_TARGET_IS_ESP32     (0)
+#define HELPER_TARGET_IS_ESP8266   (0)
+#define HELPER_TARGET_IS_LINUX     (1)
 #else
 #error BUG: cannot determine the target
 #endif
@@ -76,6 +86,7 @@
 #pragma message(VAR_NAME_VALUE(CONFIG_IDF_TARGET_ESP32S2))
 #pragma message(VAR_NAME_VALUE(CONFIG_IDF_TARGET_ESP32))
 #pragma message(VAR_NAME_VALUE(CONFIG_IDF_TARGET_ESP8266))
+#pragma message(VAR_NAME_VALUE(CONFIG_IDF_TARGET_LINUX))
 #pragma message(VAR_NAME_VALUE(ESP_IDF_VERSION_MAJOR))
 #endif
 
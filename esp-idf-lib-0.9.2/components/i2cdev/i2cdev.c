@@ -37,20 +37,286 @@
 #include <esp_log.h>
 #include "i2cdev.h"
 
+// ESP-IDF I2C master driver, faked on the linux target for the host tests
+#if HELPER_TARGET_IS_LINUX && CONFIG_I2CDEV_LEGACY_DRIVER_FAKE
+#include "i2cdev_legacy_fake.h"
+#define LEGACY_DRIVER_FAKE 1
+#else
+#define LEGACY_DRIVER_FAKE 0
+#endif
+#define HW_BACKEND (!HELPER_TARGET_IS_LINUX || LEGACY_DRIVER_FAKE)
+
+#if CONFIG_I2CDEV_SCHEDULER
+#if HELPER_TARGET_IS_LINUX
+#include <time.h>
+#else
+#include <esp_timer.h>
+#endif
+#endif
+
 static const char *TAG = "i2cdev";
 
+#if CONFIG_I2CDEV_STATIC_CMD_LINK && ((HELPER_TARGET_IS_ESP32 && ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 4, 0)) || LEGACY_DRIVER_FAKE)
+#define STATIC_CMD_LINK 1
+// Every operation needs up to two transactions: register address write and read
+#define CMD_LINK_SIZE I2C_LINK_RECOMMENDED_SIZE(2 * CONFIG_I2CDEV_CMD_LINK_OPS)
+#else
+#define STATIC_CMD_LINK 0
+#endif
+
+#if CONFIG_I2CDEV_SCHEDULER
+// Task waiting for its turn on a port, on its own stack
+typedef struct port_waiter {
+    struct port_waiter *next;
+    int64_t deadline_us;
+    int rank;
+    SemaphoreHandle_t wake;
+    StaticSemaphore_t wake_buf;
+    bool granted;
+} port_waiter_t;
+
+// Wait statistics of the device at an address
+typedef struct {
+    bool used;
+    uint8_t addr;
+    i2c_dev_wait_stats_t stats;
+} dev_wait_stats_t;
+#endif
+
 typedef struct {
     SemaphoreHandle_t lock;
     i2c_config_t config;
     bool installed;
+    const i2c_dev_backend_t *backend;
+    void *backend_ctx;
+#if STATIC_CMD_LINK
+    i2c_cmd_handle_t static_cmd;
+    uint8_t cmd_link[CMD_LINK_SIZE] __attribute__((aligned(4)));
+#endif
+#if CONFIG_I2CDEV_SCHEDULER
+    // The port mutex is held by the owner of the port for the transfer, at
+    // most one more task (the next) is allowed to block on it
+    SemaphoreHandle_t sched;    // Protects the fields below
+    bool has_next;
+    port_waiter_t *waiters;     // Ordered by deadline, then rank
+    dev_wait_stats_t wait_stats[CONFIG_I2CDEV_SCHED_STATS_DEVICES];
+#endif
 } i2c_port_state_t;
 
 static i2c_port_state_t states[I2C_NUM_MAX];
 
+#if CONFIG_I2CDEV_SCHEDULER
+
+static int64_t now_us()
+{
+#if HELPER_TARGET_IS_LINUX
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    return esp_timer_get_time();
+#endif
+}
+
+static uint32_t max_wait_us(const i2c_dev_t *dev)
+{
+    if (dev && dev->max_wait_us)
+        return dev->max_wait_us;
+    switch (dev ? dev->sched_class : I2C_DEV_CLASS_NORMAL)
+    {
+        case I2C_DEV_CLASS_REALTIME:
+            return CONFIG_I2CDEV_SCHED_WAIT_REALTIME_US;
+        case I2C_DEV_CLASS_BACKGROUND:
+            return CONFIG_I2CDEV_SCHED_WAIT_BACKGROUND_US;
+        default:
+            return CONFIG_I2CDEV_SCHED_WAIT_NORMAL_US;
+    }
+}
+
+// Breaks ties between equal deadlines, higher goes first
+static int class_rank(const i2c_dev_t *dev)
+{
+    switch (dev ? dev->sched_class : I2C_DEV_CLASS_NORMAL)
+    {
+        case I2C_DEV_CLASS_REALTIME:
+            return 2;
+        case I2C_DEV_CLASS_BACKGROUND:
+            return 0;
+        default:
+            return 1;
+    }
+}
+
+// Called with the scheduler lock taken, NULL if the table of the port is full
+static i2c_dev_wait_stats_t *find_wait_stats(i2c_port_state_t *s, uint8_t addr, bool add)
+{
+    dev_wait_stats_t *free_entry = NULL;
+    for (int i = 0; i < CONFIG_I2CDEV_SCHED_STATS_DEVICES; i++)
+    {
+        dev_wait_stats_t *e = &s->wait_stats[i];
+        if (e->used && e->addr == addr)
+            return &e->stats;
+        if (!e->used && !free_entry)
+            free_entry = e;
+    }
+    if (!add || !free_entry)
+        return NULL;
+    memset(free_entry, 0, sizeof(dev_wait_stats_t));
+    free_entry->used = true;
+    free_entry->addr = addr;
+    return &free_entry->stats;
+}
+
+// Called with the scheduler lock taken
+static void account_wait(i2c_port_state_t *s, const i2c_dev_t *dev, int64_t since_us, bool contended)
+{
+    if (!dev) return;
+
+    i2c_dev_wait_stats_t *stats = find_wait_stats(s, dev->addr, true);
+    if (!stats) return;
+    uint32_t wait = now_us() - since_us;
+    stats->count++;
+    if (contended)
+        stats->contended++;
+    if (wait > max_wait_us(dev))
+        stats->missed++;
+    if (wait > stats->max_us)
+        stats->max_us = wait;
+    stats->total_us += wait;
+}
+
+// Whether waiter a takes its turn before waiter b
+static bool goes_before(const port_waiter_t *a, const port_waiter_t *b)
+{
+    return a->deadline_us < b->deadline_us || (a->deadline_us == b->deadline_us && a->rank > b->rank);
+}
+
+// Lets the first waiter block on the port mutex, called with the scheduler lock taken
+static void grant_next(i2c_port_state_t *s)
+{
+    port_waiter_t *w = s->waiters;
+    if (s->has_next || !w)
+        return;
+    s->waiters = w->next;
+    s->has_next = true;
+    w->granted = true;
+    xSemaphoreGive(w->wake);
+}
+
+/*
+ * Queues the task and waits until it is the next one, called with the
+ * scheduler lock taken, returns without it.
+ */
+static bool wait_turn(i2c_port_state_t *s, port_waiter_t *w, TickType_t timeout)
+{
+    // Behind the waiters with an earlier or equal deadline and rank
+    port_waiter_t **pos = &s->waiters;
+    while (*pos && !goes_before(w, *pos))
+        pos = &(*pos)->next;
+    w->next = *pos;
+    w->granted = false;
+    *pos = w;
+    xSemaphoreGive(s->sched);
+
+    xSemaphoreTake(w->wake, timeout);
+
+    // The turn may have been granted right after the timeout
+    xSemaphoreTake(s->sched, portMAX_DELAY);
+    if (!w->granted)
+    {
+        for (pos = &s->waiters; *pos != w; pos = &(*pos)->next)
+            ;
+        *pos = w->next;
+    }
+    xSemaphoreGive(s->sched);
+    return w->granted;
+}
+
+/*
+ * Only the next task blocks on the port mutex, so the kernel passes the
+ * priority of that task on to the owner. The other tasks wait in order of
+ * deadline until the next one becomes the owner. If a task with an earlier
+ * deadline arrived in the meantime, the new owner hands the port on to it
+ * before its transfer and queues again.
+ */
+static esp_err_t port_take(i2c_port_t port, const i2c_dev_t *dev)
+{
+    i2c_port_state_t *s = &states[port];
+    TickType_t timeout = pdMS_TO_TICKS(CONFIG_I2CDEV_TIMEOUT);
+
+    if (!xSemaphoreTake(s->sched, timeout))
+    {
+        ESP_LOGE(TAG, "Could not take port mutex %d", port);
+        return ESP_ERR_TIMEOUT;
+    }
+    int64_t since = now_us();
+    bool contended = s->has_next || s->waiters || uxSemaphoreGetCount(s->lock) == 0;
+    port_waiter_t w = {
+        .deadline_us = since + max_wait_us(dev),
+        .rank = class_rank(dev),
+    };
+    w.wake = xSemaphoreCreateBinaryStatic(&w.wake_buf);
+
+    bool taken;
+    while (true)
+    {
+        if (!s->has_next && !s->waiters)
+        {
+            s->has_next = true;
+            xSemaphoreGive(s->sched);
+        }
+        else if (!wait_turn(s, &w, timeout))
+        {
+            vSemaphoreDelete(w.wake);
+            ESP_LOGE(TAG, "Could not take port mutex %d", port);
+            return ESP_ERR_TIMEOUT;
+        }
+
+        taken = xSemaphoreTake(s->lock, timeout);
+
+        xSemaphoreTake(s->sched, portMAX_DELAY);
+        s->has_next = false;
+        if (!taken || !s->waiters || !goes_before(s->waiters, &w))
+            break;
+        // Nobody else blocks on the port mutex while the turn is handed on
+        xSemaphoreGive(s->lock);
+        grant_next(s);
+    }
+    if (taken)
+        account_wait(s, dev, since, contended);
+    grant_next(s);
+    xSemaphoreGive(s->sched);
+    vSemaphoreDelete(w.wake);
+
+    if (!taken)
+    {
+        ESP_LOGE(TAG, "Could not take port mutex %d", port);
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t port_give(i2c_port_t port)
+{
+    if (!xSemaphoreGive(states[port].lock))
+    {
+        ESP_LOGE(TAG, "Could not give port mutex %d", port);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+#endif /* CONFIG_I2CDEV_SCHEDULER */
+
 #if CONFIG_I2CDEV_NOLOCK
-#define SEMAPHORE_TAKE(port)
+#define SEMAPHORE_TAKE(port, dev)
+#elif CONFIG_I2CDEV_SCHEDULER
+#define SEMAPHORE_TAKE(port, dev) do { \
+        esp_err_t __ = port_take(port, dev); \
+        if (__ != ESP_OK) return __; \
+        } while (0)
 #else
-#define SEMAPHORE_TAKE(port) do { \
+#define SEMAPHORE_TAKE(port, dev) do { \
         if (!xSemaphoreTake(states[port].lock, pdMS_TO_TICKS(CONFIG_I2CDEV_TIMEOUT))) \
         { \
             ESP_LOGE(TAG, "Could not take port mutex %d", port); \
@@ -61,6 +327,11 @@ static i2c_port_state_t states[I2C_NUM_MAX];
 
 #if CONFIG_I2CDEV_NOLOCK
 #define SEMAPHORE_GIVE(port)
+#elif CONFIG_I2CDEV_SCHEDULER
+#define SEMAPHORE_GIVE(port) do { \
+        esp_err_t __ = port_give(port); \
+        if (__ != ESP_OK) return __; \
+        } while (0)
 #else
 #define SEMAPHORE_GIVE(port) do { \
         if (!xSemaphoreGive(states[port].lock)) \
@@ -71,6 +342,8 @@ static i2c_port_state_t states[I2C_NUM_MAX];
         } while (0)
 #endif
 
+static esp_err_t release_backend(i2c_port_t port);
+
 esp_err_t i2cdev_init()
 {
     memset(states, 0, sizeof(states));
@@ -84,6 +357,14 @@ esp_err_t i2cdev_init()
             ESP_LOGE(TAG, "Could not create port mutex %d", i);
             return ESP_FAIL;
         }
+#if CONFIG_I2CDEV_SCHEDULER
+        states[i].sched = xSemaphoreCreateMutex();
+        if (!states[i].sched)
+        {
+            ESP_LOGE(TAG, "Could not create port scheduler mutex %d", i);
+            return ESP_FAIL;
+        }
+#endif
     }
 #endif
 
@@ -96,21 +377,75 @@ esp_err_t i2cdev_done()
     {
         if (!states[i].lock) continue;
 
-        if (states[i].installed)
-        {
-            SEMAPHORE_TAKE(i);
-            i2c_driver_delete(i);
-            states[i].installed = false;
-            SEMAPHORE_GIVE(i);
-        }
+        SEMAPHORE_TAKE(i, NULL);
+        release_backend(i);
+        SEMAPHORE_GIVE(i);
 #if !CONFIG_I2CDEV_NOLOCK
         vSemaphoreDelete(states[i].lock);
+#endif
+#if CONFIG_I2CDEV_SCHEDULER
+        vSemaphoreDelete(states[i].sched);
+        states[i].sched = NULL;
 #endif
         states[i].lock = NULL;
     }
     return ESP_OK;
 }
 
+esp_err_t i2c_dev_set_backend(i2c_port_t port, const i2c_dev_backend_t *backend, void *ctx)
+{
+    if (port >= I2C_NUM_MAX) return ESP_ERR_INVALID_ARG;
+    if (backend && (!backend->probe || !backend->read || !backend->write)) return ESP_ERR_INVALID_ARG;
+
+    SEMAPHORE_TAKE(port, NULL);
+
+    esp_err_t res = release_backend(port);
+    if (res == ESP_OK)
+    {
+        states[port].backend = backend;
+        states[port].backend_ctx = ctx;
+        ESP_LOGD(TAG, "Backend of port %d changed", port);
+    }
+
+    SEMAPHORE_GIVE(port);
+    return res;
+}
+
+esp_err_t i2c_dev_get_wait_stats(const i2c_dev_t *dev, i2c_dev_wait_stats_t *stats, bool reset)
+{
+#if CONFIG_I2CDEV_SCHEDULER
+    if (!dev || !stats) return ESP_ERR_INVALID_ARG;
+    if (dev->port >= I2C_NUM_MAX) return ESP_ERR_INVALID_ARG;
+
+    i2c_port_state_t *s = &states[dev->port];
+    if (!xSemaphoreTake(s->sched, pdMS_TO_TICKS(CONFIG_I2CDEV_TIMEOUT)))
+    {
+        ESP_LOGE(TAG, "Could not take port scheduler mutex %d", dev->port);
+        return ESP_ERR_TIMEOUT;
+    }
+    esp_err_t res = ESP_OK;
+    i2c_dev_wait_stats_t *found = find_wait_stats(s, dev->addr, false);
+    if (found)
+    {
+        *stats = *found;
+        if (reset)
+            memset(found, 0, sizeof(i2c_dev_wait_stats_t));
+    }
+    else
+    {
+        memset(stats, 0, sizeof(i2c_dev_wait_stats_t));
+        // No transfer yet, unless the table was full
+        if (!find_wait_stats(s, dev->addr, true))
+            res = ESP_ERR_NO_MEM;
+    }
+    xSemaphoreGive(s->sched);
+
+    return res;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
 esp_err_t i2c_dev_create_mutex(i2c_dev_t *dev)
 {
 #if !CONFIG_I2CDEV_NOLOCK
@@ -173,11 +508,15 @@ esp_err_t i2c_dev_give_mutex(i2c_dev_t *dev)
     return ESP_OK;
 }
 
+#if HW_BACKEND
+
+/* ESP-IDF I2C master driver backend */
+
 inline static bool cfg_equal(const i2c_config_t *a, const i2c_config_t *b)
 {
     return a->scl_io_num == b->scl_io_num
         && a->sda_io_num == b->sda_io_num
-#if HELPER_TARGET_IS_ESP32
+#if HELPER_TARGET_IS_ESP32 || LEGACY_DRIVER_FAKE
         && a->master.clk_speed == b->master.clk_speed
 #elif HELPER_TARGET_IS_ESP8266
         && ((a->clk_stretch_tick && a->clk_stretch_tick == b->clk_stretch_tick) 
@@ -206,7 +545,7 @@ static esp_err_t i2c_setup_port(const i2c_dev_t *dev)
             i2c_driver_delete(dev->port);
             states[dev->port].installed = false;
         }
-#if HELPER_TARGET_IS_ESP32
+#if HELPER_TARGET_IS_ESP32 || LEGACY_DRIVER_FAKE
 #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
         // See https://github.com/espressif/esp-idf/issues/10163
         if ((res = i2c_driver_install(dev->port, temp.mode, 0, 0, 0)) != ESP_OK)
@@ -233,7 +572,7 @@ static esp_err_t i2c_setup_port(const i2c_dev_t *dev)
         memcpy(&states[dev->port].config, &temp, sizeof(i2c_config_t));
         ESP_LOGD(TAG, "I2C driver successfully reconfigured on port %d", dev->port);
     }
-#if HELPER_TARGET_IS_ESP32
+#if HELPER_TARGET_IS_ESP32 || LEGACY_DRIVER_FAKE
     int t;
     if ((res = i2c_get_timeout(dev->port, &t)) != ESP_OK)
         return res;
@@ -247,40 +586,58 @@ static esp_err_t i2c_setup_port(const i2c_dev_t *dev)
     return ESP_OK;
 }
 
-esp_err_t i2c_dev_probe(const i2c_dev_t *dev, i2c_dev_type_t operation_type)
+/*
+ * Creates the command link of a transfer with ops operations. Uses the buffer
+ * of the port when it is large enough, the port mutex protects it.
+ */
+static i2c_cmd_handle_t cmd_link_create(i2c_port_t port, size_t ops)
 {
-    if (!dev) return ESP_ERR_INVALID_ARG;
+#if STATIC_CMD_LINK
+    if (ops <= CONFIG_I2CDEV_CMD_LINK_OPS)
+    {
+        states[port].static_cmd = i2c_cmd_link_create_static(states[port].cmd_link, CMD_LINK_SIZE);
+        return states[port].static_cmd;
+    }
+#endif
+    return i2c_cmd_link_create();
+}
 
-    SEMAPHORE_TAKE(dev->port);
+static void cmd_link_delete(i2c_port_t port, i2c_cmd_handle_t cmd)
+{
+#if STATIC_CMD_LINK
+    if (cmd == states[port].static_cmd)
+    {
+        i2c_cmd_link_delete_static(cmd);
+        states[port].static_cmd = NULL;
+        return;
+    }
+#endif
+    i2c_cmd_link_delete(cmd);
+}
 
+static esp_err_t hw_probe(void *ctx, const i2c_dev_t *dev, i2c_dev_type_t operation_type)
+{
     esp_err_t res = i2c_setup_port(dev);
     if (res == ESP_OK)
     {
-        i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+        i2c_cmd_handle_t cmd = cmd_link_create(dev->port, 1);
         i2c_master_start(cmd);
         i2c_master_write_byte(cmd, dev->addr << 1 | (operation_type == I2C_DEV_READ ? 1 : 0), true);
         i2c_master_stop(cmd);
 
         res = i2c_master_cmd_begin(dev->port, cmd, pdMS_TO_TICKS(CONFIG_I2CDEV_TIMEOUT));
 
-        i2c_cmd_link_delete(cmd);
+        cmd_link_delete(dev->port, cmd);
     }
-
-    SEMAPHORE_GIVE(dev->port);
-
     return res;
 }
 
-esp_err_t i2c_dev_read(const i2c_dev_t *dev, const void *out_data, size_t out_size, void *in_data, size_t in_size)
+static esp_err_t hw_read(void *ctx, const i2c_dev_t *dev, const void *out_data, size_t out_size, void *in_data, size_t in_size)
 {
-    if (!dev || !in_data || !in_size) return ESP_ERR_INVALID_ARG;
-
-    SEMAPHORE_TAKE(dev->port);
-
     esp_err_t res = i2c_setup_port(dev);
     if (res == ESP_OK)
     {
-        i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+        i2c_cmd_handle_t cmd = cmd_link_create(dev->port, 1);
         if (out_data && out_size)
         {
             i2c_master_start(cmd);
@@ -293,26 +650,18 @@ esp_err_t i2c_dev_read(const i2c_dev_t *dev, const void *out_data, size_t out_si
         i2c_master_stop(cmd);
 
         res = i2c_master_cmd_begin(dev->port, cmd, pdMS_TO_TICKS(CONFIG_I2CDEV_TIMEOUT));
-        if (res != ESP_OK)
-            ESP_LOGE(TAG, "Could not read from device [0x%02x at %d]: %d (%s)", dev->addr, dev->port, res, esp_err_to_name(res));
 
-        i2c_cmd_link_delete(cmd);
+        cmd_link_delete(dev->port, cmd);
     }
-
-    SEMAPHORE_GIVE(dev->port);
     return res;
 }
 
-esp_err_t i2c_dev_write(const i2c_dev_t *dev, const void *out_reg, size_t out_reg_size, const void *out_data, size_t out_size)
+static esp_err_t hw_write(void *ctx, const i2c_dev_t *dev, const void *out_reg, size_t out_reg_size, const void *out_data, size_t out_size)
 {
-    if (!dev || !out_data || !out_size) return ESP_ERR_INVALID_ARG;
-
-    SEMAPHORE_TAKE(dev->port);
-
     esp_err_t res = i2c_setup_port(dev);
     if (res == ESP_OK)
     {
-        i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+        i2c_cmd_handle_t cmd = cmd_link_create(dev->port, 1);
         i2c_master_start(cmd);
         i2c_master_write_byte(cmd, dev->addr << 1, true);
         if (out_reg && out_reg_size)
@@ -320,10 +669,179 @@ esp_err_t i2c_dev_write(const i2c_dev_t *dev, const void *out_reg, size_t out_re
         i2c_master_write(cmd, (void *)out_data, out_size, true);
         i2c_master_stop(cmd);
         res = i2c_master_cmd_begin(dev->port, cmd, pdMS_TO_TICKS(CONFIG_I2CDEV_TIMEOUT));
-        if (res != ESP_OK)
-            ESP_LOGE(TAG, "Could not write to device [0x%02x at %d]: %d (%s)", dev->addr, dev->port, res, esp_err_to_name(res));
-        i2c_cmd_link_delete(cmd);
+        cmd_link_delete(dev->port, cmd);
+    }
+    return res;
+}
+
+static esp_err_t hw_batch(void *ctx, const i2c_dev_t *dev, const i2c_dev_op_t *ops, size_t count)
+{
+    esp_err_t res = i2c_setup_port(dev);
+    if (res == ESP_OK)
+    {
+        i2c_cmd_handle_t cmd = cmd_link_create(dev->port, count);
+        for (size_t i = 0; i < count; i++)
+        {
+            const i2c_dev_op_t *op = &ops[i];
+            bool has_reg = op->reg && op->reg_size;
+            if (op->type == I2C_DEV_WRITE || has_reg)
+            {
+                i2c_master_start(cmd);
+                i2c_master_write_byte(cmd, dev->addr << 1, true);
+                if (has_reg)
+                    i2c_master_write(cmd, (void *)op->reg, op->reg_size, true);
+            }
+            if (op->type == I2C_DEV_WRITE)
+            {
+                if (op->data && op->size)
+                    i2c_master_write(cmd, op->data, op->size, true);
+            }
+            else
+            {
+                i2c_master_start(cmd);
+                i2c_master_write_byte(cmd, (dev->addr << 1) | 1, true);
+                i2c_master_read(cmd, op->data, op->size, I2C_MASTER_LAST_NACK);
+            }
+        }
+        i2c_master_stop(cmd);
+
+        res = i2c_master_cmd_begin(dev->port, cmd, pdMS_TO_TICKS(CONFIG_I2CDEV_TIMEOUT));
+
+        cmd_link_delete(dev->port, cmd);
+    }
+    return res;
+}
+
+static esp_err_t hw_release(void *ctx, i2c_port_t port)
+{
+    if (states[port].installed)
+    {
+        i2c_driver_delete(port);
+        states[port].installed = false;
     }
+    return ESP_OK;
+}
+
+static const i2c_dev_backend_t hw_backend = {
+    .probe = hw_probe,
+    .read = hw_read,
+    .write = hw_write,
+    .batch = hw_batch,
+    .release = hw_release,
+};
+
+#endif /* HW_BACKEND */
+
+static const i2c_dev_backend_t *get_backend(i2c_port_t port)
+{
+#if HW_BACKEND
+    return states[port].backend ? states[port].backend : &hw_backend;
+#else
+    return states[port].backend;
+#endif
+}
+
+static esp_err_t release_backend(i2c_port_t port)
+{
+    const i2c_dev_backend_t *backend = get_backend(port);
+    if (!backend || !backend->release)
+        return ESP_OK;
+    return backend->release(states[port].backend_ctx, port);
+}
+
+esp_err_t i2c_dev_probe(const i2c_dev_t *dev, i2c_dev_type_t operation_type)
+{
+    if (!dev) return ESP_ERR_INVALID_ARG;
+    if (dev->port >= I2C_NUM_MAX) return ESP_ERR_INVALID_ARG;
+
+    SEMAPHORE_TAKE(dev->port, dev);
+
+    const i2c_dev_backend_t *backend = get_backend(dev->port);
+    esp_err_t res = backend
+        ? backend->probe(states[dev->port].backend_ctx, dev, operation_type)
+        : ESP_ERR_INVALID_STATE;
+
+    SEMAPHORE_GIVE(dev->port);
+
+    return res;
+}
+
+esp_err_t i2c_dev_read(const i2c_dev_t *dev, const void *out_data, size_t out_size, void *in_data, size_t in_size)
+{
+    if (!dev || !in_data || !in_size) return ESP_ERR_INVALID_ARG;
+    if (dev->port >= I2C_NUM_MAX) return ESP_ERR_INVALID_ARG;
+
+    SEMAPHORE_TAKE(dev->port, dev);
+
+    const i2c_dev_backend_t *backend = get_backend(dev->port);
+    esp_err_t res = backend
+        ? backend->read(states[dev->port].backend_ctx, dev, out_data, out_size, in_data, in_size)
+        : ESP_ERR_INVALID_STATE;
+    if (res != ESP_OK)
+        ESP_LOGE(TAG, "Could not read from device [0x%02x at %d]: %d (%s)", dev->addr, dev->port, res, esp_err_to_name(res));
+
+    SEMAPHORE_GIVE(dev->port);
+    return res;
+}
+
+esp_err_t i2c_dev_write(const i2c_dev_t *dev, const void *out_reg, size_t out_reg_size, const void *out_data, size_t out_size)
+{
+    if (!dev || !out_data || !out_size) return ESP_ERR_INVALID_ARG;
+    if (dev->port >= I2C_NUM_MAX) return ESP_ERR_INVALID_ARG;
+
+    SEMAPHORE_TAKE(dev->port, dev);
+
+    const i2c_dev_backend_t *backend = get_backend(dev->port);
+    esp_err_t res = backend
+        ? backend->write(states[dev->port].backend_ctx, dev, out_reg, out_reg_size, out_data, out_size)
+        : ESP_ERR_INVALID_STATE;
+    if (res != ESP_OK)
+        ESP_LOGE(TAG, "Could not write to device [0x%02x at %d]: %d (%s)", dev->addr, dev->port, res, esp_err_to_name(res));
+
+    SEMAPHORE_GIVE(dev->port);
+    return res;
+}
+
+/* Runs the operations one by one, for backends without batch support */
+static esp_err_t run_ops(const i2c_dev_backend_t *backend, void *ctx, const i2c_dev_t *dev, const i2c_dev_op_t *ops, size_t count)
+{
+    esp_err_t res = ESP_OK;
+    for (size_t i = 0; i < count && res == ESP_OK; i++)
+    {
+        const i2c_dev_op_t *op = &ops[i];
+        if (op->type == I2C_DEV_READ)
+            res = backend->read(ctx, dev, op->reg, op->reg_size, op->data, op->size);
+        else if (op->data && op->size)
+            res = backend->write(ctx, dev, op->reg, op->reg_size, op->data, op->size);
+        else
+            res = backend->write(ctx, dev, NULL, 0, op->reg, op->reg_size);
+    }
+    return res;
+}
+
+esp_err_t i2c_dev_batch(const i2c_dev_t *dev, const i2c_dev_op_t *ops, size_t count)
+{
+    if (!dev || !ops || !count) return ESP_ERR_INVALID_ARG;
+    if (dev->port >= I2C_NUM_MAX) return ESP_ERR_INVALID_ARG;
+    for (size_t i = 0; i < count; i++)
+    {
+        bool has_data = ops[i].data && ops[i].size;
+        bool has_reg = ops[i].reg && ops[i].reg_size;
+        if (!has_data && (ops[i].type == I2C_DEV_READ || !has_reg))
+            return ESP_ERR_INVALID_ARG;
+    }
+
+    SEMAPHORE_TAKE(dev->port, dev);
+
+    const i2c_dev_backend_t *backend = get_backend(dev->port);
+    void *ctx = states[dev->port].backend_ctx;
+    esp_err_t res = !backend
+        ? ESP_ERR_INVALID_STATE
+        : backend->batch
+            ? backend->batch(ctx, dev, ops, count)
+            : run_ops(backend, ctx, dev, ops, count);
+    if (res != ESP_OK)
+        ESP_LOGE(TAG, "Could not run batch of %u operations on device [0x%02x at %d]: %d (%s)", (unsigned)count, dev->addr, dev->port, res, esp_err_to_name(res));
 
     SEMAPHORE_GIVE(dev->port);
     return res;
@@ -35,12 +35,17 @@
 #ifndef __I2CDEV_H__
 #define __I2CDEV_H__
 
-#include <driver/i2c.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
 #include <esp_err.h>
 #include <esp_idf_lib_helpers.h>
 
+#if !HELPER_TARGET_IS_LINUX
+#include <driver/i2c.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -49,6 +54,41 @@ extern "C" {
 
 #define I2CDEV_MAX_STRETCH_TIME 0xffffffff
 
+#elif HELPER_TARGET_IS_LINUX
+
+#define I2CDEV_MAX_STRETCH_TIME 0x00ffffff
+
+/*
+ * There is no I2C driver on the linux target, only the types used by the
+ * device descriptors, so the drivers build against a simulated bus.
+ */
+typedef int gpio_num_t;
+typedef int i2c_port_t;
+
+#define I2C_NUM_0   0
+#define I2C_NUM_1   1
+#define I2C_NUM_MAX 2
+
+typedef enum {
+    I2C_MODE_SLAVE = 0,
+    I2C_MODE_MASTER,
+    I2C_MODE_MAX
+} i2c_mode_t;
+
+typedef struct
+{
+    i2c_mode_t mode;
+    int sda_io_num;
+    int scl_io_num;
+    bool sda_pullup_en;
+    bool scl_pullup_en;
+    struct
+    {
+        uint32_t clk_speed;
+    } master;
+    uint32_t clk_flags;
+} i2c_config_t;
+
 #else
 
 #include <soc/i2c_reg.h>
@@ -62,6 +102,31 @@ extern "C" {
 
 #endif /* HELPER_TARGET_IS_ESP8266 */
 
+/**
+ * Scheduling class of a device
+ *
+ * With CONFIG_I2CDEV_SCHEDULER the class gives the default deadline for
+ * getting a busy port and breaks ties between equal deadlines.
+ */
+typedef enum {
+    I2C_DEV_CLASS_NORMAL = 0, //!< Default, CONFIG_I2CDEV_SCHED_WAIT_NORMAL_US
+    I2C_DEV_CLASS_REALTIME,   //!< High-rate devices such as IMUs, CONFIG_I2CDEV_SCHED_WAIT_REALTIME_US
+    I2C_DEV_CLASS_BACKGROUND, //!< Slow devices such as CO2 sensors, CONFIG_I2CDEV_SCHED_WAIT_BACKGROUND_US
+    I2C_DEV_CLASS_MAX
+} i2c_dev_class_t;
+
+/**
+ * Time the transfers of a device waited for the port
+ */
+typedef struct
+{
+    uint32_t count;     //!< Transfers
+    uint32_t contended; //!< Transfers that found the port busy
+    uint32_t missed;    //!< Transfers that got the port after their deadline
+    uint32_t max_us;    //!< Longest wait, microseconds
+    uint64_t total_us;  //!< Sum of the waits, microseconds
+} i2c_dev_wait_stats_t;
+
 /**
  * I2C device descriptor
  */
@@ -74,6 +139,9 @@ typedef struct
     uint32_t timeout_ticks;  /*!< HW I2C bus timeout (stretch time), in ticks. 80MHz APB clock
                                   ticks for ESP-IDF, CPU ticks for ESP8266.
                                   When this value is 0, I2CDEV_MAX_STRETCH_TIME will be used */
+    i2c_dev_class_t sched_class;     //!< Scheduling class on the port
+    uint32_t max_wait_us;            /*!< Deadline for getting a busy port, microseconds.
+                                          When this value is 0, the default of the class will be used */
 } i2c_dev_t;
 
 /**
@@ -84,6 +152,68 @@ typedef enum {
     I2C_DEV_READ       /**< Read operation */
 } i2c_dev_type_t;
 
+/**
+ * Operation of a batch, see ::i2c_dev_batch()
+ */
+typedef struct
+{
+    i2c_dev_type_t type; //!< I2C_DEV_READ or I2C_DEV_WRITE
+    const void *reg;     //!< Register address to send first if non-null
+    size_t reg_size;     //!< Size of register address
+    void *data;          //!< Buffer to read into or data to write
+    size_t size;         //!< Size of data
+} i2c_dev_op_t;
+
+/**
+ * Batch operation reading \p len bytes into \p buf from the register with 8-bit address \p r
+ */
+#define I2C_DEV_OP_READ_REG(r, buf, len) \
+    { .type = I2C_DEV_READ, .reg = (const uint8_t[]){ (r) }, .reg_size = 1, .data = (buf), .size = (len) }
+
+/**
+ * Batch operation writing \p len bytes of \p buf to the register with 8-bit address \p r
+ */
+#define I2C_DEV_OP_WRITE_REG(r, buf, len) \
+    { .type = I2C_DEV_WRITE, .reg = (const uint8_t[]){ (r) }, .reg_size = 1, .data = (void *)(buf), .size = (len) }
+
+/**
+ * I2C bus backend
+ *
+ * Performs the transfers of ::i2c_dev_probe(), ::i2c_dev_read() and
+ * ::i2c_dev_write() on one port. The functions are called with the port
+ * taken and the arguments already checked. By default every port uses
+ * the ESP-IDF I2C master driver, see ::i2c_dev_set_backend().
+ */
+typedef struct
+{
+    /**
+     * Address \p dev with \p operation_type and stop
+     */
+    esp_err_t (*probe)(void *ctx, const i2c_dev_t *dev, i2c_dev_type_t operation_type);
+    /**
+     * Write \p out_size bytes of \p out_data if non-null, then read \p in_size bytes
+     * into \p in_data after a repeated start
+     */
+    esp_err_t (*read)(void *ctx, const i2c_dev_t *dev, const void *out_data, size_t out_size,
+            void *in_data, size_t in_size);
+    /**
+     * Write \p out_reg_size bytes of \p out_reg if non-null, followed by
+     * \p out_size bytes of \p out_data, in one transfer
+     */
+    esp_err_t (*write)(void *ctx, const i2c_dev_t *dev, const void *out_reg, size_t out_reg_size,
+            const void *out_data, size_t out_size);
+    /**
+     * Run \p count operations in one transfer, separated by repeated starts.
+     * Can be NULL, then the operations run one by one.
+     */
+    esp_err_t (*batch)(void *ctx, const i2c_dev_t *dev, const i2c_dev_op_t *ops, size_t count);
+    /**
+     * Release the port, when the backend is replaced or the library is
+     * finished. Can be NULL.
+     */
+    esp_err_t (*release)(void *ctx, i2c_port_t port);
+} i2c_dev_backend_t;
+
 /**
  * @brief Init library
  *
@@ -103,6 +233,35 @@ esp_err_t i2cdev_init();
  */
 esp_err_t i2cdev_done();
 
+/**
+ * @brief Set the bus backend of a port
+ *
+ * Releases the previous backend of the port and routes all further transfers
+ * on \p port to \p backend, e.g. the simulated bus of i2cdev_sim.h.
+ * Must be called after ::i2cdev_init().
+ *
+ * @param port I2C port number
+ * @param backend Bus backend, NULL for the ESP-IDF I2C master driver
+ * @param ctx Context passed to the backend functions
+ * @return ESP_OK on success
+ */
+esp_err_t i2c_dev_set_backend(i2c_port_t port, const i2c_dev_backend_t *backend, void *ctx);
+
+/**
+ * @brief Get the port wait statistics of a device
+ *
+ * The statistics are collected with option CONFIG_I2CDEV_SCHEDULER only,
+ * per port and device address, for up to CONFIG_I2CDEV_SCHED_STATS_DEVICES
+ * devices of a port.
+ *
+ * @param dev Device descriptor
+ * @param[out] stats Statistics
+ * @param reset Clear the statistics of the device
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the statistics of the port
+ *         are full, ESP_ERR_NOT_SUPPORTED without CONFIG_I2CDEV_SCHEDULER
+ */
+esp_err_t i2c_dev_get_wait_stats(const i2c_dev_t *dev, i2c_dev_wait_stats_t *stats, bool reset);
+
 /**
  * @brief Create mutex for device descriptor
  *
@@ -187,6 +346,32 @@ esp_err_t i2c_dev_read(const i2c_dev_t *dev, const void *out_data,
 esp_err_t i2c_dev_write(const i2c_dev_t *dev, const void *out_reg,
         size_t out_reg_size, const void *out_data, size_t out_size);
 
+/**
+ * @brief Run several reads and writes in one transfer
+ *
+ * Takes the port mutex and checks the port setup once, then sends all
+ * operations in a single command link: every operation starts with a
+ * (repeated) START condition, only the last one ends with STOP. Much cheaper
+ * than a sequence of ::i2c_dev_read() and ::i2c_dev_write() calls, but the
+ * device must accept a repeated START after a write. When an operation
+ * fails, the whole batch fails.
+ * Function is thread-safe.
+ *
+ * Example:
+ *
+ *     i2c_dev_op_t ops[] = {
+ *         I2C_DEV_OP_READ_REG(REG_STATUS, &status, 1),
+ *         I2C_DEV_OP_READ_REG(REG_DATA, data, sizeof(data)),
+ *     };
+ *     esp_err_t res = i2c_dev_batch(dev, ops, 2);
+ *
+ * @param dev Device descriptor
+ * @param ops Operations
+ * @param count Number of operations
+ * @return ESP_OK on success
+ */
+esp_err_t i2c_dev_batch(const i2c_dev_t *dev, const i2c_dev_op_t *ops, size_t count);
+
 /**
  * @brief Read from register with an 8-bit address
  *
@@ -0,0 +1,187 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ruslan V. Uss <unclerus@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file i2cdev_async.c
+ *
+ * Asynchronous I2C transfers
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <esp_log.h>
+#include "i2cdev_async.h"
+
+static const char *TAG = "i2cdev_async";
+
+typedef struct {
+    QueueHandle_t queues[I2C_DEV_PRIO_MAX];
+    SemaphoreHandle_t pending; // Counts the queued transfers and stop requests
+    SemaphoreHandle_t stopped;
+    TaskHandle_t task;
+    volatile bool stopping;
+} async_port_t;
+
+static async_port_t ports[I2C_NUM_MAX];
+
+static void delete_port(async_port_t *p)
+{
+    for (int i = 0; i < I2C_DEV_PRIO_MAX; i++)
+        if (p->queues[i])
+            vQueueDelete(p->queues[i]);
+    if (p->pending)
+        vSemaphoreDelete(p->pending);
+    if (p->stopped)
+        vSemaphoreDelete(p->stopped);
+    memset(p, 0, sizeof(async_port_t));
+}
+
+static i2c_dev_transfer_t *next_transfer(async_port_t *p)
+{
+    i2c_dev_transfer_t *transfer;
+    for (int i = I2C_DEV_PRIO_MAX - 1; i >= 0; i--)
+        if (xQueueReceive(p->queues[i], &transfer, 0) == pdTRUE)
+            return transfer;
+    return NULL;
+}
+
+static void worker(void *arg)
+{
+    async_port_t *p = arg;
+
+    while (true)
+    {
+        xSemaphoreTake(p->pending, portMAX_DELAY);
+
+        i2c_dev_transfer_t *transfer = next_transfer(p);
+        if (!transfer)
+        {
+            if (p->stopping)
+                break;
+            continue;
+        }
+
+        // The transfer may be reused as soon as the result is set, unless
+        // there is a callback: do not touch it after that
+        i2c_dev_transfer_cb_t callback = transfer->callback;
+        TaskHandle_t notify = transfer->notify;
+        transfer->result = i2c_dev_batch(transfer->dev, transfer->ops, transfer->count);
+        if (callback)
+            callback(transfer);
+        else if (notify)
+            xTaskNotifyGive(notify);
+    }
+
+    xSemaphoreGive(p->stopped);
+    vTaskDelete(NULL);
+}
+
+esp_err_t i2c_dev_async_init(i2c_port_t port, UBaseType_t task_priority)
+{
+    if (port >= I2C_NUM_MAX) return ESP_ERR_INVALID_ARG;
+
+    async_port_t *p = &ports[port];
+    if (p->task) return ESP_ERR_INVALID_STATE;
+
+    bool created = true;
+    for (int i = 0; i < I2C_DEV_PRIO_MAX; i++)
+    {
+        p->queues[i] = xQueueCreate(CONFIG_I2CDEV_ASYNC_QUEUE_LENGTH, sizeof(i2c_dev_transfer_t *));
+        created = created && p->queues[i];
+    }
+    p->pending = xSemaphoreCreateCounting(I2C_DEV_PRIO_MAX * CONFIG_I2CDEV_ASYNC_QUEUE_LENGTH + 1, 0);
+    p->stopped = xSemaphoreCreateBinary();
+    if (!created || !p->pending || !p->stopped
+        || xTaskCreate(worker, "i2c_async", CONFIG_I2CDEV_ASYNC_TASK_STACK_SIZE, p, task_priority, &p->task) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Could not start worker of port %d", port);
+        delete_port(p);
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t i2c_dev_async_done(i2c_port_t port)
+{
+    if (port >= I2C_NUM_MAX) return ESP_ERR_INVALID_ARG;
+
+    async_port_t *p = &ports[port];
+    if (!p->task) return ESP_ERR_INVALID_STATE;
+
+    p->stopping = true;
+    xSemaphoreGive(p->pending);
+    xSemaphoreTake(p->stopped, portMAX_DELAY);
+    delete_port(p);
+
+    return ESP_OK;
+}
+
+esp_err_t i2c_dev_submit(i2c_dev_transfer_t *transfer)
+{
+    if (!transfer || !transfer->dev || !transfer->ops || !transfer->count) return ESP_ERR_INVALID_ARG;
+    if (transfer->callback && transfer->notify) return ESP_ERR_INVALID_ARG;
+    if (transfer->dev->port >= I2C_NUM_MAX || transfer->priority >= I2C_DEV_PRIO_MAX) return ESP_ERR_INVALID_ARG;
+
+    async_port_t *p = &ports[transfer->dev->port];
+    if (!p->task || p->stopping) return ESP_ERR_INVALID_STATE;
+
+    transfer->result = ESP_ERR_NOT_FINISHED;
+    if (xQueueSend(p->queues[transfer->priority], &transfer, 0) != pdTRUE)
+    {
+        ESP_LOGW(TAG, "[0x%02x at %d] Transfer queue is full", transfer->dev->addr, transfer->dev->port);
+        return ESP_ERR_NO_MEM;
+    }
+    xSemaphoreGive(p->pending);
+
+    return ESP_OK;
+}
+
+esp_err_t i2c_dev_wait(i2c_dev_transfer_t *transfer, TickType_t timeout)
+{
+    if (!transfer || !transfer->notify) return ESP_ERR_INVALID_ARG;
+
+    // Every completion gives one notification, also if the transfer completed
+    // before this call. Give back the ones of other transfers taken meanwhile,
+    // so waiting for them later takes their own.
+    uint32_t taken = 0;
+    esp_err_t res = ESP_ERR_TIMEOUT;
+    while (ulTaskNotifyTake(pdFALSE, timeout))
+    {
+        taken++;
+        if (transfer->result != ESP_ERR_NOT_FINISHED)
+        {
+            res = transfer->result;
+            taken--;
+            break;
+        }
+    }
+    for (; taken; taken--)
+        xTaskNotifyGive(xTaskGetCurrentTaskHandle());
+
+    return res;
+}
@@ -0,0 +1,150 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ruslan V. Uss <unclerus@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file i2cdev_async.h
+ * @defgroup i2cdev_async i2cdev_async
+ * @{
+ *
+ * Asynchronous I2C transfers
+ *
+ * A worker task per port runs the submitted transfers with ::i2c_dev_batch()
+ * and reports their completion by callback and/or task notification, so the
+ * submitting task can do other work meanwhile. Pending transfers run in
+ * order of priority, transfers of the same priority in order of submission.
+ *
+ * The worker takes the port for every transfer like a blocking call, so
+ * blocking calls on the same port can be mixed with asynchronous transfers
+ * and the scheduling class of the device applies. It does not take the
+ * device mutex.
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+#ifndef __I2CDEV_ASYNC_H__
+#define __I2CDEV_ASYNC_H__
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "i2cdev.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Priority of an asynchronous transfer
+ */
+typedef enum {
+    I2C_DEV_PRIO_LOW = 0, //!< Background transfers
+    I2C_DEV_PRIO_NORMAL,  //!< Default
+    I2C_DEV_PRIO_HIGH,    //!< Runs before all other pending transfers
+    I2C_DEV_PRIO_MAX
+} i2c_dev_priority_t;
+
+typedef struct i2c_dev_transfer i2c_dev_transfer_t;
+
+/**
+ * Completion callback, called from the worker task
+ *
+ * The result is in `transfer->result`. The worker does not access the
+ * transfer after calling the callback, so the callback may reuse or submit
+ * it again.
+ */
+typedef void (*i2c_dev_transfer_cb_t)(i2c_dev_transfer_t *transfer);
+
+/**
+ * Asynchronous transfer
+ *
+ * The transfer, its operations and their buffers must stay valid until it
+ * is completed: until the callback is called if `callback` is set,
+ * otherwise until `result` is no longer ESP_ERR_NOT_FINISHED, e.g. when
+ * ::i2c_dev_wait() returned. Set at most one of `callback` and `notify`.
+ */
+struct i2c_dev_transfer
+{
+    const i2c_dev_t *dev;           //!< Device descriptor
+    const i2c_dev_op_t *ops;        //!< Operations, run as one batch
+    size_t count;                   //!< Number of operations
+    i2c_dev_priority_t priority;    //!< Priority
+    i2c_dev_transfer_cb_t callback; //!< Called on completion if non-null
+    TaskHandle_t notify;            //!< Task to notify (xTaskNotifyGive()) on completion if non-null and no callback is set
+    void *arg;                      //!< User data
+    volatile esp_err_t result;      //!< ESP_ERR_NOT_FINISHED while pending, then the result of the batch
+};
+
+/**
+ * @brief Start the worker task of a port
+ *
+ * Must be called after ::i2cdev_init().
+ *
+ * @param port I2C port number
+ * @param task_priority FreeRTOS priority of the worker task, usually above
+ *                      the priority of the submitting tasks
+ * @return ESP_OK on success
+ */
+esp_err_t i2c_dev_async_init(i2c_port_t port, UBaseType_t task_priority);
+
+/**
+ * @brief Stop the worker task of a port
+ *
+ * Runs the pending transfers first.
+ *
+ * @param port I2C port number
+ * @return ESP_OK on success
+ */
+esp_err_t i2c_dev_async_done(i2c_port_t port);
+
+/**
+ * @brief Submit a transfer to the worker of the device port
+ *
+ * Does not block.
+ *
+ * @param transfer Transfer
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the queue of the priority is
+ *         full, ESP_ERR_INVALID_STATE if the worker is not running,
+ *         ESP_ERR_INVALID_ARG if both `callback` and `notify` are set
+ */
+esp_err_t i2c_dev_submit(i2c_dev_transfer_t *transfer);
+
+/**
+ * @brief Wait for the completion of a transfer submitted with `notify` set to
+ *        the calling task
+ *
+ * Takes one task notification of the calling task, also if the transfer
+ * already completed, so every transfer submitted with `notify` must be
+ * waited for exactly once. Notifications of other transfers completing
+ * meanwhile are left for their own waits.
+ *
+ * @param transfer Transfer
+ * @param timeout Maximum time to wait for each notification, in ticks
+ * @return Result of the transfer, ESP_ERR_TIMEOUT if it did not complete
+ */
+esp_err_t i2c_dev_wait(i2c_dev_transfer_t *transfer, TickType_t timeout);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __I2CDEV_ASYNC_H__ */
@@ -0,0 +1,280 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ruslan V. Uss <unclerus@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file i2cdev_legacy_fake.c
+ *
+ * Fake of the ESP-IDF legacy I2C master driver for the linux target
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <freertos/FreeRTOS.h>
+#include <esp_log.h>
+#include "i2cdev.h"
+
+#if HELPER_TARGET_IS_LINUX && CONFIG_I2CDEV_LEGACY_DRIVER_FAKE
+
+#include "i2cdev_legacy_fake.h"
+
+static const char *TAG = "i2c_legacy_fake";
+
+typedef enum {
+    CMD_START = 0,
+    CMD_WRITE,
+    CMD_READ,
+    CMD_STOP,
+} cmd_type_t;
+
+// Command of a link, no larger than the one of the driver
+typedef struct cmd {
+    struct cmd *next;
+    uint8_t *data;      // Data of a read or write, NULL for a single byte
+    uint32_t len;
+    uint8_t type;
+    uint8_t byte;       // Data of i2c_master_write_byte()
+} cmd_t;
+
+// Link, at the start of the buffer of a preallocated link
+typedef struct {
+    cmd_t *head;
+    cmd_t *tail;
+    uint32_t used;      // Bytes used of the buffer
+    uint32_t size;      // Size of the buffer, 0 for a heap link
+} link_t;
+
+_Static_assert(sizeof(cmd_t) <= I2C_INTERNAL_STRUCT_SIZE, "Command larger than in the driver");
+_Static_assert(sizeof(link_t) <= I2C_INTERNAL_STRUCT_SIZE, "Link larger than in the driver");
+
+static bool installed[I2C_NUM_MAX];
+static int timeouts[I2C_NUM_MAX];
+static i2c_legacy_fake_stats_t stats;
+
+esp_err_t i2c_driver_install(i2c_port_t i2c_num, i2c_mode_t mode, size_t slv_rx_buf_len, size_t slv_tx_buf_len, int intr_alloc_flags)
+{
+    if (i2c_num >= I2C_NUM_MAX || mode != I2C_MODE_MASTER) return ESP_ERR_INVALID_ARG;
+    if (installed[i2c_num])
+    {
+        ESP_LOGE(TAG, "Driver of port %d already installed", i2c_num);
+        stats.errors++;
+        return ESP_FAIL;
+    }
+    installed[i2c_num] = true;
+    timeouts[i2c_num] = 0;
+    stats.installs++;
+    return ESP_OK;
+}
+
+esp_err_t i2c_driver_delete(i2c_port_t i2c_num)
+{
+    if (i2c_num >= I2C_NUM_MAX || !installed[i2c_num]) return ESP_ERR_INVALID_ARG;
+    installed[i2c_num] = false;
+    return ESP_OK;
+}
+
+esp_err_t i2c_param_config(i2c_port_t i2c_num, const i2c_config_t *i2c_conf)
+{
+    if (i2c_num >= I2C_NUM_MAX || !i2c_conf) return ESP_ERR_INVALID_ARG;
+    return ESP_OK;
+}
+
+esp_err_t i2c_set_timeout(i2c_port_t i2c_num, int timeout)
+{
+    if (i2c_num >= I2C_NUM_MAX || timeout <= 0 || timeout > I2CDEV_MAX_STRETCH_TIME) return ESP_ERR_INVALID_ARG;
+    timeouts[i2c_num] = timeout;
+    return ESP_OK;
+}
+
+esp_err_t i2c_get_timeout(i2c_port_t i2c_num, int *timeout)
+{
+    if (i2c_num >= I2C_NUM_MAX || !timeout) return ESP_ERR_INVALID_ARG;
+    *timeout = timeouts[i2c_num];
+    return ESP_OK;
+}
+
+i2c_cmd_handle_t i2c_cmd_link_create_static(uint8_t *buffer, uint32_t size)
+{
+    // The driver keeps pointers in the buffer
+    uint32_t pad = -(uintptr_t)buffer & (_Alignof(link_t) - 1);
+    if (!buffer || size <= pad + I2C_INTERNAL_STRUCT_SIZE)
+    {
+        ESP_LOGE(TAG, "Link buffer of %" PRIu32 " bytes too small", size);
+        stats.errors++;
+        return NULL;
+    }
+    link_t *link = (link_t *)(buffer + pad);
+    memset(link, 0, sizeof(link_t));
+    link->size = size - pad;
+    link->used = I2C_INTERNAL_STRUCT_SIZE;
+    stats.static_links++;
+    return link;
+}
+
+i2c_cmd_handle_t i2c_cmd_link_create(void)
+{
+    link_t *link = calloc(1, sizeof(link_t));
+    if (link)
+        stats.heap_links++;
+    return link;
+}
+
+void i2c_cmd_link_delete_static(i2c_cmd_handle_t cmd_handle)
+{
+    link_t *link = cmd_handle;
+    if (link && !link->size)
+    {
+        ESP_LOGE(TAG, "Heap link deleted as preallocated link");
+        stats.errors++;
+    }
+}
+
+void i2c_cmd_link_delete(i2c_cmd_handle_t cmd_handle)
+{
+    link_t *link = cmd_handle;
+    if (!link) return;
+    if (link->size)
+    {
+        ESP_LOGE(TAG, "Preallocated link deleted as heap link");
+        stats.errors++;
+        return;
+    }
+    while (link->head)
+    {
+        cmd_t *next = link->head->next;
+        free(link->head);
+        link->head = next;
+    }
+    free(link);
+}
+
+static esp_err_t add_cmd(i2c_cmd_handle_t cmd_handle, cmd_type_t type, uint8_t *data, size_t len, uint8_t byte)
+{
+    link_t *link = cmd_handle;
+    if (!link) return ESP_ERR_INVALID_ARG;
+
+    cmd_t *cmd;
+    if (link->size)
+    {
+        if (link->used + I2C_INTERNAL_STRUCT_SIZE > link->size)
+        {
+            ESP_LOGE(TAG, "Preallocated link of %" PRIu32 " bytes full", link->size);
+            stats.errors++;
+            return ESP_ERR_NO_MEM;
+        }
+        cmd = (cmd_t *)((uint8_t *)link + link->used);
+        link->used += I2C_INTERNAL_STRUCT_SIZE;
+        if (link->used > stats.max_static_used)
+            stats.max_static_used = link->used;
+    }
+    else if (!(cmd = malloc(sizeof(cmd_t))))
+        return ESP_ERR_NO_MEM;
+
+    memset(cmd, 0, sizeof(cmd_t));
+    cmd->type = type;
+    cmd->data = data;
+    cmd->len = len;
+    cmd->byte = byte;
+    if (link->tail)
+        link->tail->next = cmd;
+    else
+        link->head = cmd;
+    link->tail = cmd;
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_start(i2c_cmd_handle_t cmd_handle)
+{
+    return add_cmd(cmd_handle, CMD_START, NULL, 0, 0);
+}
+
+esp_err_t i2c_master_write_byte(i2c_cmd_handle_t cmd_handle, uint8_t data, bool ack_en)
+{
+    return add_cmd(cmd_handle, CMD_WRITE, NULL, 1, data);
+}
+
+esp_err_t i2c_master_write(i2c_cmd_handle_t cmd_handle, const uint8_t *data, size_t data_len, bool ack_en)
+{
+    if (!data) return ESP_ERR_INVALID_ARG;
+    return add_cmd(cmd_handle, CMD_WRITE, (uint8_t *)data, data_len, 0);
+}
+
+esp_err_t i2c_master_read(i2c_cmd_handle_t cmd_handle, uint8_t *data, size_t data_len, i2c_ack_type_t ack)
+{
+    if (!data || !data_len || ack >= I2C_MASTER_ACK_MAX) return ESP_ERR_INVALID_ARG;
+    // Like the driver: all bytes but the last with ACK, then the last one with NACK
+    if (ack == I2C_MASTER_LAST_NACK && data_len > 1)
+    {
+        esp_err_t res = add_cmd(cmd_handle, CMD_READ, data, data_len - 1, 0);
+        if (res != ESP_OK)
+            return res;
+        return add_cmd(cmd_handle, CMD_READ, data + data_len - 1, 1, 0);
+    }
+    return add_cmd(cmd_handle, CMD_READ, data, data_len, 0);
+}
+
+esp_err_t i2c_master_stop(i2c_cmd_handle_t cmd_handle)
+{
+    return add_cmd(cmd_handle, CMD_STOP, NULL, 0, 0);
+}
+
+esp_err_t i2c_master_cmd_begin(i2c_port_t i2c_num, i2c_cmd_handle_t cmd_handle, TickType_t ticks_to_wait)
+{
+    if (i2c_num >= I2C_NUM_MAX || !cmd_handle) return ESP_ERR_INVALID_ARG;
+    if (!installed[i2c_num])
+    {
+        ESP_LOGE(TAG, "Driver of port %d not installed", i2c_num);
+        stats.errors++;
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // A command that did not fit leaves a link without its stop
+    link_t *link = cmd_handle;
+    if (!link->head || link->head->type != CMD_START || link->tail->type != CMD_STOP)
+    {
+        ESP_LOGE(TAG, "Incomplete link on port %d", i2c_num);
+        stats.errors++;
+        return ESP_FAIL;
+    }
+    for (cmd_t *cmd = link->head; cmd; cmd = cmd->next)
+    {
+        if (cmd->type == CMD_READ)
+            memset(cmd->data, 0, cmd->len);
+    }
+    stats.transfers++;
+    return ESP_OK;
+}
+
+void i2c_legacy_fake_get_stats(i2c_legacy_fake_stats_t *s)
+{
+    if (s)
+        *s = stats;
+}
+
+void i2c_legacy_fake_reset(void)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+#endif /* HELPER_TARGET_IS_LINUX && CONFIG_I2CDEV_LEGACY_DRIVER_FAKE */
@@ -0,0 +1,133 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ruslan V. Uss <unclerus@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file i2cdev_legacy_fake.h
+ * @defgroup i2cdev_legacy_fake i2cdev_legacy_fake
+ * @{
+ *
+ * Fake of the ESP-IDF legacy I2C master driver for the linux target
+ *
+ * With option CONFIG_I2CDEV_LEGACY_DRIVER_FAKE, i2cdev builds its ESP-IDF
+ * driver backend on the linux target against the functions declared here,
+ * so the command link handling (preallocated links of
+ * CONFIG_I2CDEV_STATIC_CMD_LINK, heap links of larger batches) can run on
+ * the host. The fake keeps the commands of a link in the link like the
+ * driver does: a preallocated link takes I2C_INTERNAL_STRUCT_SIZE bytes of
+ * its buffer for the link and for every command, and a command that does not
+ * fit fails with ESP_ERR_NO_MEM. A heap link allocates every command.
+ *
+ * Every address acknowledges and reads return zeros, there is no bus timing.
+ * Use the simulated bus of i2cdev_sim.h to test device drivers.
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+#ifndef __I2CDEV_LEGACY_FAKE_H__
+#define __I2CDEV_LEGACY_FAKE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "i2cdev.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Size of the link and of every command in a preallocated link, as in driver/i2c.h
+ */
+#define I2C_INTERNAL_STRUCT_SIZE (24)
+
+/**
+ * Buffer size of a preallocated link for a number of transactions, as in driver/i2c.h
+ */
+#define I2C_LINK_RECOMMENDED_SIZE(TRANSACTIONS) (2 * I2C_INTERNAL_STRUCT_SIZE + I2C_INTERNAL_STRUCT_SIZE * (5 * (TRANSACTIONS)))
+
+typedef void *i2c_cmd_handle_t;
+
+typedef enum {
+    I2C_MASTER_ACK = 0,
+    I2C_MASTER_NACK,
+    I2C_MASTER_LAST_NACK,
+    I2C_MASTER_ACK_MAX
+} i2c_ack_type_t;
+
+/**
+ * Calls of the fake since ::i2c_legacy_fake_reset()
+ */
+typedef struct
+{
+    uint32_t installs;        //!< Driver installations
+    uint32_t static_links;    //!< Links created in a caller buffer
+    uint32_t heap_links;      //!< Links allocated on the heap
+    uint32_t max_static_used; //!< Most bytes used of the buffer of a preallocated link
+    uint32_t transfers;       //!< Links run by i2c_master_cmd_begin()
+    uint32_t errors;          //!< Calls that failed, e.g. a command that did not fit
+} i2c_legacy_fake_stats_t;
+
+esp_err_t i2c_driver_install(i2c_port_t i2c_num, i2c_mode_t mode, size_t slv_rx_buf_len, size_t slv_tx_buf_len, int intr_alloc_flags);
+esp_err_t i2c_driver_delete(i2c_port_t i2c_num);
+esp_err_t i2c_param_config(i2c_port_t i2c_num, const i2c_config_t *i2c_conf);
+esp_err_t i2c_set_timeout(i2c_port_t i2c_num, int timeout);
+esp_err_t i2c_get_timeout(i2c_port_t i2c_num, int *timeout);
+
+i2c_cmd_handle_t i2c_cmd_link_create_static(uint8_t *buffer, uint32_t size);
+i2c_cmd_handle_t i2c_cmd_link_create(void);
+void i2c_cmd_link_delete_static(i2c_cmd_handle_t cmd_handle);
+void i2c_cmd_link_delete(i2c_cmd_handle_t cmd_handle);
+
+esp_err_t i2c_master_start(i2c_cmd_handle_t cmd_handle);
+esp_err_t i2c_master_write_byte(i2c_cmd_handle_t cmd_handle, uint8_t data, bool ack_en);
+esp_err_t i2c_master_write(i2c_cmd_handle_t cmd_handle, const uint8_t *data, size_t data_len, bool ack_en);
+esp_err_t i2c_master_read(i2c_cmd_handle_t cmd_handle, uint8_t *data, size_t data_len, i2c_ack_type_t ack);
+esp_err_t i2c_master_stop(i2c_cmd_handle_t cmd_handle);
+
+/**
+ * Runs the commands of a link
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_STATE if the driver of the port is not
+ *         installed, ESP_FAIL if the link does not start with a start and
+ *         end with a stop, e.g. because a command did not fit
+ */
+esp_err_t i2c_master_cmd_begin(i2c_port_t i2c_num, i2c_cmd_handle_t cmd_handle, TickType_t ticks_to_wait);
+
+/**
+ * Get the call counters of the fake
+ *
+ * @param[out] stats Counters
+ */
+void i2c_legacy_fake_get_stats(i2c_legacy_fake_stats_t *stats);
+
+/**
+ * Clear the call counters of the fake
+ */
+void i2c_legacy_fake_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __I2CDEV_LEGACY_FAKE_H__ */
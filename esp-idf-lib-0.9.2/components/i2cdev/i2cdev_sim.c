@@ -0,0 +1,397 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ruslan V. Uss <unclerus@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file i2cdev_sim.c
+ *
+ * Simulated I2C bus backend for i2cdev
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+#include "i2cdev_sim.h"
+
+static const char *TAG = "i2cdev_sim";
+
+// Bits of a byte with its ACK
+#define BYTE_BITS 9
+
+// Stretch timeout counts 80 MHz APB clock ticks
+#define TIMEOUT_TICKS_PER_US 80
+
+static uint32_t clk_speed(const i2c_dev_t *dev)
+{
+#if HELPER_TARGET_IS_ESP8266
+    return I2C_SIM_DEFAULT_CLK_SPEED;
+#else
+    return dev->cfg.master.clk_speed ? dev->cfg.master.clk_speed : I2C_SIM_DEFAULT_CLK_SPEED;
+#endif
+}
+
+inline static size_t reg_width(const i2c_sim_device_t *sim_dev)
+{
+    return sim_dev->reg_size ? sim_dev->reg_size : 1;
+}
+
+static void wait_ns(i2c_sim_bus_t *bus, uint64_t ns)
+{
+    bus->now_ns += ns;
+    bus->stats.busy_ns += ns;
+}
+
+static void clock_bits(i2c_sim_bus_t *bus, const i2c_dev_t *dev, uint32_t bits)
+{
+    wait_ns(bus, (uint64_t)bits * 1000000000ULL / clk_speed(dev));
+}
+
+static i2c_sim_device_t *find_device(i2c_sim_bus_t *bus, uint8_t addr)
+{
+    for (i2c_sim_device_t *sim_dev = bus->devices; sim_dev; sim_dev = sim_dev->next)
+        if (sim_dev->addr == addr)
+            return sim_dev;
+    return NULL;
+}
+
+static esp_err_t nack(i2c_sim_bus_t *bus, const i2c_dev_t *dev, const char *reason)
+{
+    bus->stats.nacks++;
+    ESP_LOGD(TAG, "[0x%02x at %d] NACK: %s", dev->addr, dev->port, reason);
+    return ESP_FAIL;
+}
+
+static void begin(i2c_sim_bus_t *bus)
+{
+    bus->stats.calls++;
+    bus->stats.transfers++;
+    bus->start_ns = bus->now_ns;
+    wait_ns(bus, (uint64_t)bus->overhead_us * 1000);
+}
+
+static esp_err_t end(i2c_sim_bus_t *bus, const i2c_dev_t *dev, esp_err_t res)
+{
+    // STOP condition
+    clock_bits(bus, dev, 1);
+
+    if (bus->real_time)
+    {
+        // Carry the remainder below one tick over to the next transfer
+        const uint64_t tick_ns = (uint64_t)portTICK_PERIOD_MS * 1000000;
+        bus->delay_ns += bus->now_ns - bus->start_ns;
+        TickType_t ticks = bus->delay_ns / tick_ns;
+        if (ticks)
+        {
+            bus->delay_ns -= (uint64_t)ticks * tick_ns;
+            vTaskDelay(ticks);
+        }
+    }
+    return res;
+}
+
+/* START condition and address byte, finds the device if it acknowledges */
+static esp_err_t address(i2c_sim_bus_t *bus, const i2c_dev_t *dev, i2c_sim_device_t **sim_dev)
+{
+    clock_bits(bus, dev, 1 + BYTE_BITS);
+    bus->stats.bytes++;
+
+    i2c_sim_device_t *found = find_device(bus, dev->addr);
+    if (!found)
+        return nack(bus, dev, "no device");
+    if (found->nack_count)
+    {
+        found->nack_count--;
+        return nack(bus, dev, "injected");
+    }
+    if (bus->now_ns < found->busy_until_ns)
+        return nack(bus, dev, "busy");
+
+    *sim_dev = found;
+    return ESP_OK;
+}
+
+/* Data bytes sent by the master, already in the buffer of the bus */
+static esp_err_t write_data(i2c_sim_bus_t *bus, const i2c_dev_t *dev, i2c_sim_device_t *sim_dev, size_t size)
+{
+    clock_bits(bus, dev, BYTE_BITS * size);
+    bus->stats.bytes += size;
+
+    if (size < sim_dev->reg_addr_size)
+        return nack(bus, dev, "short register address");
+    for (size_t i = 0; i < sim_dev->reg_addr_size; i++)
+        sim_dev->reg = (i ? sim_dev->reg << 8 : 0) | bus->buf[i];
+    uint32_t reg = sim_dev->reg;
+
+    // Check and strip the CRC bytes in place
+    const uint8_t *in = bus->buf + sim_dev->reg_addr_size;
+    size_t in_size = size - sim_dev->reg_addr_size;
+    uint8_t *data = bus->buf;
+    size_t len = 0;
+    if (sim_dev->crc_word_size)
+    {
+        size_t word = sim_dev->crc_word_size;
+        if (in_size % (word + 1))
+            return nack(bus, dev, "incomplete CRC word");
+        for (size_t i = 0; i < in_size; i += word + 1)
+        {
+            if (sim_dev->crc(sim_dev, reg, false, in + i, word) != in[i + word])
+            {
+                bus->stats.crc_errors++;
+                return nack(bus, dev, "CRC error");
+            }
+            memmove(data + len, in + i, word);
+            len += word;
+        }
+    }
+    else
+    {
+        memmove(data, in, in_size);
+        len = in_size;
+    }
+
+    if (len && sim_dev->regs && (reg * reg_width(sim_dev) + len <= sim_dev->regs_size))
+    {
+        memcpy(sim_dev->regs + reg * reg_width(sim_dev), data, len);
+        sim_dev->reg = reg + len / reg_width(sim_dev);
+    }
+    else if (len && !sim_dev->on_write)
+        return nack(bus, dev, "register out of map");
+
+    if (sim_dev->on_write && sim_dev->on_write(sim_dev, reg, data, len) != ESP_OK)
+        return nack(bus, dev, "rejected by model");
+
+    return ESP_OK;
+}
+
+/* Data bytes sent by the device from its register map */
+static esp_err_t read_data(i2c_sim_bus_t *bus, const i2c_dev_t *dev, i2c_sim_device_t *sim_dev, uint8_t *data, size_t size)
+{
+    uint32_t ticks = dev->timeout_ticks ? dev->timeout_ticks : I2CDEV_MAX_STRETCH_TIME;
+    uint64_t timeout_ns = (uint64_t)ticks * 1000 / TIMEOUT_TICKS_PER_US;
+    uint64_t stretch_ns = (uint64_t)sim_dev->stretch_us * 1000;
+    if (stretch_ns > timeout_ns)
+    {
+        wait_ns(bus, timeout_ns);
+        bus->stats.timeouts++;
+        ESP_LOGD(TAG, "[0x%02x at %d] Clock stretching timeout", dev->addr, dev->port);
+        return ESP_ERR_TIMEOUT;
+    }
+    wait_ns(bus, stretch_ns);
+
+    if (sim_dev->on_read && sim_dev->on_read(sim_dev, sim_dev->reg, size) != ESP_OK)
+        return nack(bus, dev, "rejected by model");
+
+    clock_bits(bus, dev, BYTE_BITS * size);
+    bus->stats.bytes += size;
+
+    uint32_t reg = sim_dev->reg;
+    size_t offset = reg * reg_width(sim_dev);
+    size_t word = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        if (sim_dev->crc_word_size && word == sim_dev->crc_word_size)
+        {
+            data[i] = sim_dev->crc(sim_dev, reg, true, data + i - word, word);
+            word = 0;
+            continue;
+        }
+        // Released bus reads as 0xff
+        data[i] = sim_dev->regs && offset < sim_dev->regs_size ? sim_dev->regs[offset] : 0xff;
+        offset++;
+        word++;
+    }
+    if (sim_dev->regs)
+        sim_dev->reg = offset / reg_width(sim_dev);
+
+    return ESP_OK;
+}
+
+/* Write part of a transfer: START, address and the bytes of out_reg and out_data */
+static esp_err_t run_write(i2c_sim_bus_t *bus, const i2c_dev_t *dev, const void *out_reg, size_t out_reg_size,
+        const void *out_data, size_t out_size, i2c_sim_device_t **sim_dev)
+{
+    if (!out_reg) out_reg_size = 0;
+    if (!out_data) out_size = 0;
+    if (out_reg_size + out_size > I2C_SIM_MAX_WRITE_SIZE) return ESP_ERR_INVALID_SIZE;
+
+    if (out_reg_size)
+        memcpy(bus->buf, out_reg, out_reg_size);
+    if (out_size)
+        memcpy(bus->buf + out_reg_size, out_data, out_size);
+
+    esp_err_t res = address(bus, dev, sim_dev);
+    if (res != ESP_OK)
+        return res;
+    return write_data(bus, dev, *sim_dev, out_reg_size + out_size);
+}
+
+/* Read part of a transfer: (repeated) START, address and the bytes read */
+static esp_err_t run_read(i2c_sim_bus_t *bus, const i2c_dev_t *dev, void *in_data, size_t in_size)
+{
+    i2c_sim_device_t *sim_dev;
+
+    esp_err_t res = address(bus, dev, &sim_dev);
+    if (res != ESP_OK)
+        return res;
+    return read_data(bus, dev, sim_dev, in_data, in_size);
+}
+
+/* Starts the busy time of a device after the STOP of a write transfer */
+static void start_busy(i2c_sim_bus_t *bus, i2c_sim_device_t *sim_dev)
+{
+    if (sim_dev && sim_dev->busy_us)
+        sim_dev->busy_until_ns = bus->now_ns + (uint64_t)sim_dev->busy_us * 1000;
+}
+
+static esp_err_t sim_probe(void *ctx, const i2c_dev_t *dev, i2c_dev_type_t operation_type)
+{
+    i2c_sim_bus_t *bus = ctx;
+    i2c_sim_device_t *sim_dev;
+
+    begin(bus);
+    return end(bus, dev, address(bus, dev, &sim_dev));
+}
+
+static esp_err_t sim_read(void *ctx, const i2c_dev_t *dev, const void *out_data, size_t out_size, void *in_data, size_t in_size)
+{
+    i2c_sim_bus_t *bus = ctx;
+    i2c_sim_device_t *sim_dev;
+    esp_err_t res = ESP_OK;
+
+    begin(bus);
+    if (out_data && out_size)
+        res = run_write(bus, dev, NULL, 0, out_data, out_size, &sim_dev);
+    if (res == ESP_OK)
+        res = run_read(bus, dev, in_data, in_size);
+    return end(bus, dev, res);
+}
+
+static esp_err_t sim_write(void *ctx, const i2c_dev_t *dev, const void *out_reg, size_t out_reg_size, const void *out_data, size_t out_size)
+{
+    i2c_sim_bus_t *bus = ctx;
+    i2c_sim_device_t *sim_dev = NULL;
+
+    begin(bus);
+    esp_err_t res = end(bus, dev, run_write(bus, dev, out_reg, out_reg_size, out_data, out_size, &sim_dev));
+    if (res == ESP_OK)
+        start_busy(bus, sim_dev);
+    return res;
+}
+
+static esp_err_t sim_batch(void *ctx, const i2c_dev_t *dev, const i2c_dev_op_t *ops, size_t count)
+{
+    i2c_sim_bus_t *bus = ctx;
+    i2c_sim_device_t *sim_dev = NULL;
+    bool written = false;
+    esp_err_t res = ESP_OK;
+
+    begin(bus);
+    for (size_t i = 0; i < count && res == ESP_OK; i++)
+    {
+        const i2c_dev_op_t *op = &ops[i];
+        if (op->type == I2C_DEV_WRITE)
+        {
+            res = run_write(bus, dev, op->reg, op->reg_size, op->data, op->size, &sim_dev);
+            written = true;
+            continue;
+        }
+        if (op->reg && op->reg_size)
+            res = run_write(bus, dev, NULL, 0, op->reg, op->reg_size, &sim_dev);
+        if (res == ESP_OK)
+            res = run_read(bus, dev, op->data, op->size);
+    }
+    res = end(bus, dev, res);
+    if (res == ESP_OK && written)
+        start_busy(bus, sim_dev);
+    return res;
+}
+
+const i2c_dev_backend_t i2c_sim_backend = {
+    .probe = sim_probe,
+    .read = sim_read,
+    .write = sim_write,
+    .batch = sim_batch,
+    .release = NULL,
+};
+
+esp_err_t i2c_sim_bus_init(i2c_sim_bus_t *bus)
+{
+    if (!bus) return ESP_ERR_INVALID_ARG;
+
+    memset(bus, 0, sizeof(i2c_sim_bus_t));
+    return ESP_OK;
+}
+
+esp_err_t i2c_sim_add_device(i2c_sim_bus_t *bus, i2c_sim_device_t *sim_dev)
+{
+    if (!bus || !sim_dev || sim_dev->reg_addr_size > 2) return ESP_ERR_INVALID_ARG;
+    if (sim_dev->crc_word_size && !sim_dev->crc) return ESP_ERR_INVALID_ARG;
+    if (find_device(bus, sim_dev->addr))
+    {
+        ESP_LOGE(TAG, "Address 0x%02x is already taken", sim_dev->addr);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    sim_dev->busy_until_ns = 0;
+    sim_dev->next = bus->devices;
+    bus->devices = sim_dev;
+    return ESP_OK;
+}
+
+esp_err_t i2c_sim_attach(i2c_sim_bus_t *bus, i2c_port_t port)
+{
+    if (!bus) return ESP_ERR_INVALID_ARG;
+
+    return i2c_dev_set_backend(port, &i2c_sim_backend, bus);
+}
+
+void i2c_sim_advance(i2c_sim_bus_t *bus, uint32_t us)
+{
+    bus->now_ns += (uint64_t)us * 1000;
+}
+
+static uint8_t crc8(uint8_t crc, uint8_t polynomial, const uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 0x80) ? (crc << 1) ^ polynomial : (crc << 1);
+    }
+    return crc;
+}
+
+uint8_t i2c_sim_crc8_sensirion(const i2c_sim_device_t *sim_dev, uint32_t reg, bool read,
+        const uint8_t *data, size_t size)
+{
+    return crc8(0xff, 0x31, data, size);
+}
+
+uint8_t i2c_sim_crc8_smbus(const i2c_sim_device_t *sim_dev, uint32_t reg, bool read,
+        const uint8_t *data, size_t size)
+{
+    uint8_t header[3] = { sim_dev->addr << 1, reg, (sim_dev->addr << 1) | 1 };
+    uint8_t crc = crc8(0, 0x07, header, read ? 3 : 2);
+    return crc8(crc, 0x07, data, size);
+}
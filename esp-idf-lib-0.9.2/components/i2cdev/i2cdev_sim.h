@@ -0,0 +1,235 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ruslan V. Uss <unclerus@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file i2cdev_sim.h
+ * @defgroup i2cdev_sim i2cdev_sim
+ * @{
+ *
+ * Simulated I2C bus backend for i2cdev
+ *
+ * Runs the transfers of ::i2c_dev_read(), ::i2c_dev_write(),
+ * ::i2c_dev_batch() and ::i2c_dev_probe() against device models in memory
+ * instead of the I2C hardware, so the drivers can run on the linux target. A device model is a
+ * register map with optional behaviors: CRC words, clock stretching, NACKs
+ * while busy or on demand, and hooks for register side effects.
+ *
+ * The bus keeps a virtual time, advanced by the bit time of every transfer at
+ * the clock speed of the device descriptor, the programmable transfer
+ * overhead and the clock stretching of the devices. The results and the
+ * timing are deterministic. In real time mode the calling task also blocks
+ * for the bus time, rounded to whole ticks on average, so concurrent tasks
+ * see the bus as busy like on the hardware.
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+#ifndef __I2CDEV_SIM_H__
+#define __I2CDEV_SIM_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "i2cdev.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Maximum size of a write transfer, register address included
+ */
+#define I2C_SIM_MAX_WRITE_SIZE 256
+
+/**
+ * Clock speed used when the device descriptor does not set one, Hz
+ */
+#define I2C_SIM_DEFAULT_CLK_SPEED 100000
+
+typedef struct i2c_sim_device i2c_sim_device_t;
+
+/**
+ * Computes the CRC of a data word
+ *
+ * @param sim_dev Device model
+ * @param reg Register addressed by the transfer
+ * @param read true for words sent by the device, false for words received
+ * @param data Data word
+ * @param size Size of the data word
+ * @return CRC byte following the word
+ */
+typedef uint8_t (*i2c_sim_crc_t)(const i2c_sim_device_t *sim_dev, uint32_t reg, bool read,
+        const uint8_t *data, size_t size);
+
+/**
+ * Called after the device received a write transfer
+ *
+ * The data are already stored in the register map. Return an error to NACK
+ * the transfer.
+ *
+ * @param sim_dev Device model
+ * @param reg Register address sent by the master
+ * @param data Data following the register address, without CRC bytes
+ * @param size Size of data, can be 0
+ */
+typedef esp_err_t (*i2c_sim_write_cb_t)(i2c_sim_device_t *sim_dev, uint32_t reg,
+        const uint8_t *data, size_t size);
+
+/**
+ * Called before the device sends data from its register map
+ *
+ * Lets the model update the registers. Return an error to NACK the transfer.
+ *
+ * @param sim_dev Device model
+ * @param reg Current register address
+ * @param size Number of bytes the master reads, CRC bytes included
+ */
+typedef esp_err_t (*i2c_sim_read_cb_t)(i2c_sim_device_t *sim_dev, uint32_t reg, size_t size);
+
+/**
+ * Simulated device model
+ *
+ * Fill the configuration fields, zero the rest and add the model to a bus
+ * with ::i2c_sim_add_device().
+ */
+struct i2c_sim_device
+{
+    uint8_t addr;                 //!< Unshifted address
+    uint8_t reg_addr_size;        //!< Size of the register address sent first in every write, big endian: 0, 1 or 2 bytes
+    uint8_t reg_size;             //!< Size of one register in the register map, 0 for 1 byte
+    uint8_t *regs;                //!< Register map, NULL if the hooks provide the behavior
+    size_t regs_size;             //!< Size of the register map in bytes
+    uint8_t crc_word_size;        //!< A CRC byte follows every word of this size in both directions, 0 to disable
+    i2c_sim_crc_t crc;            //!< CRC function, required if crc_word_size is set
+    uint32_t stretch_us;          //!< Clock stretching before the first byte of every read, microseconds
+    uint32_t busy_us;             //!< Time after a write transfer when the device NACKs its address, microseconds
+    uint32_t nack_count;          //!< Number of the next transfers to NACK, counts down
+    i2c_sim_write_cb_t on_write;  //!< Write hook, can be NULL
+    i2c_sim_read_cb_t on_read;    //!< Read hook, can be NULL
+    void *ctx;                    //!< User data of the model
+
+    /* Run-time state of the model, maintained by the bus */
+    uint32_t reg;                 //!< Register address pointer
+    uint64_t busy_until_ns;       //!< End of the busy time, bus time
+    i2c_sim_device_t *next;       //!< Next device on the bus
+};
+
+/**
+ * Simulated bus statistics
+ */
+typedef struct
+{
+    uint32_t calls;               //!< Number of backend calls, each one takes the port mutex and checks the port setup once
+    uint32_t transfers;           //!< Number of transfers (start to stop)
+    uint32_t bytes;               //!< Number of bytes on the bus, addresses included
+    uint32_t nacks;               //!< Number of NACKed transfers
+    uint32_t crc_errors;          //!< Number of words received with a wrong CRC
+    uint32_t timeouts;            //!< Number of transfers with clock stretching over the timeout
+    uint64_t busy_ns;             //!< Time the bus was in use, nanoseconds
+} i2c_sim_stats_t;
+
+/**
+ * Simulated bus
+ */
+typedef struct
+{
+    i2c_sim_device_t *devices;    //!< Devices on the bus
+    uint32_t overhead_us;         //!< Programmable latency added to every transfer (driver and interrupt time), microseconds
+    bool real_time;               //!< Block the calling task for the bus time of every transfer, like the hardware
+    uint64_t now_ns;              //!< Virtual time of the bus, nanoseconds
+    i2c_sim_stats_t stats;        //!< Statistics
+
+    /* Run-time state of the bus */
+    uint64_t start_ns;            //!< Start of the current transfer, bus time
+    uint64_t delay_ns;            //!< Bus time not yet waited for in real time, below one tick
+    uint8_t buf[I2C_SIM_MAX_WRITE_SIZE]; //!< Write transfer buffer
+} i2c_sim_bus_t;
+
+/**
+ * Backend functions of the simulated bus, the context is a ::i2c_sim_bus_t
+ */
+extern const i2c_dev_backend_t i2c_sim_backend;
+
+/**
+ * @brief Initialize a simulated bus without devices
+ *
+ * @param bus Simulated bus
+ * @return ESP_OK on success
+ */
+esp_err_t i2c_sim_bus_init(i2c_sim_bus_t *bus);
+
+/**
+ * @brief Add a device model to the bus
+ *
+ * @param bus Simulated bus
+ * @param sim_dev Device model, must stay valid while the bus is in use
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if the address is taken
+ */
+esp_err_t i2c_sim_add_device(i2c_sim_bus_t *bus, i2c_sim_device_t *sim_dev);
+
+/**
+ * @brief Route the transfers of an I2C port to the simulated bus
+ *
+ * Shortcut to ::i2c_dev_set_backend().
+ *
+ * @param bus Simulated bus
+ * @param port I2C port number
+ * @return ESP_OK on success
+ */
+esp_err_t i2c_sim_attach(i2c_sim_bus_t *bus, i2c_port_t port);
+
+/**
+ * @brief Advance the virtual time of the bus
+ *
+ * Use instead of the delays of the real device, e.g. to let a measurement
+ * finish while a device is busy. Not thread-safe against running transfers.
+ *
+ * @param bus Simulated bus
+ * @param us Time in microseconds
+ */
+void i2c_sim_advance(i2c_sim_bus_t *bus, uint32_t us);
+
+/**
+ * @brief CRC-8 of the Sensirion sensors
+ *
+ * Polynomial 0x31, initialization 0xff, over the data word only.
+ */
+uint8_t i2c_sim_crc8_sensirion(const i2c_sim_device_t *sim_dev, uint32_t reg, bool read,
+        const uint8_t *data, size_t size);
+
+/**
+ * @brief SMBus packet error code
+ *
+ * CRC-8 with polynomial 0x07 over the address bytes, the register address
+ * and the data word, for devices with 1 byte register addresses and one word
+ * per transfer, like the LC709203F.
+ */
+uint8_t i2c_sim_crc8_smbus(const i2c_sim_device_t *sim_dev, uint32_t reg, bool read,
+        const uint8_t *data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif /* __I2CDEV_SIM_H__ */
@@ -18,6 +18,7 @@
  * this file is supposed to conform the code style.
  */
 
+#include <string.h>
 #include <freertos/FreeRTOS.h>
 #include <esp_idf_lib_helpers.h>
 #include <esp_err.h>
@@ -55,18 +56,16 @@ static uint8_t s_lc709203f_calc_crc(uint8_t *data, size_t data_len)
     return crc;
 }
 
-inline static esp_err_t s_i2c_dev_read_word(i2c_dev_t *dev, uint8_t reg, uint16_t *value)
+/* Checks the CRC of a word read from reg, received as LSB, MSB, CRC */
+static esp_err_t s_check_word(i2c_dev_t *dev, uint8_t reg, const uint8_t *data, uint16_t *value)
 {
     uint8_t read_data[6] = { 0 };
     uint8_t crc = 0;
 
-    I2C_DEV_TAKE_MUTEX(dev);
-    I2C_DEV_CHECK(dev, i2c_dev_read_reg(dev, reg, read_data + 3, 3));
-    I2C_DEV_GIVE_MUTEX(dev);
-
     read_data[0] = dev->addr << 1;
     read_data[1] = reg;
     read_data[2] = read_data[0] | 0x01;
+    memcpy(read_data + 3, data, 3);
 
     crc = s_lc709203f_calc_crc(read_data, 5);
 
@@ -83,6 +82,17 @@ inline static esp_err_t s_i2c_dev_read_word(i2c_dev_t *dev, uint8_t reg, uint16_
     return ESP_OK;
 }
 
+inline static esp_err_t s_i2c_dev_read_word(i2c_dev_t *dev, uint8_t reg, uint16_t *value)
+{
+    uint8_t data[3] = { 0 };
+
+    I2C_DEV_TAKE_MUTEX(dev);
+    I2C_DEV_CHECK(dev, i2c_dev_read_reg(dev, reg, data, 3));
+    I2C_DEV_GIVE_MUTEX(dev);
+
+    return s_check_word(dev, reg, data, value);
+}
+
 inline static esp_err_t s_i2c_dev_write_reg_word(i2c_dev_t *dev, uint8_t reg, uint16_t value)
 {
     uint8_t write_data[5];
@@ -210,6 +220,33 @@ esp_err_t lc709203f_get_cell_temperature_celsius(i2c_dev_t *dev, float *temperat
     return ret;
 }
 
+esp_err_t lc709203f_get_measurements(i2c_dev_t *dev, lc709203f_measurements_t *measurements)
+{
+    CHECK_ARG(dev && measurements);
+
+    uint8_t data[4][3] = { 0 };
+    uint16_t temp = 0;
+    i2c_dev_op_t ops[] = {
+        I2C_DEV_OP_READ_REG(LC709203F_REG_CELL_VOLTAGE, data[0], 3),
+        I2C_DEV_OP_READ_REG(LC709203F_REG_RSOC, data[1], 3),
+        I2C_DEV_OP_READ_REG(LC709203F_REG_CELL_ITE, data[2], 3),
+        I2C_DEV_OP_READ_REG(LC709203F_REG_CELL_TEMPERATURE, data[3], 3),
+    };
+
+    I2C_DEV_TAKE_MUTEX(dev);
+    I2C_DEV_CHECK(dev, i2c_dev_batch(dev, ops, 4));
+    I2C_DEV_GIVE_MUTEX(dev);
+
+    CHECK(s_check_word(dev, LC709203F_REG_CELL_VOLTAGE, data[0], &measurements->voltage));
+    CHECK(s_check_word(dev, LC709203F_REG_RSOC, data[1], &measurements->rsoc));
+    CHECK(s_check_word(dev, LC709203F_REG_CELL_ITE, data[2], &measurements->ite));
+    CHECK(s_check_word(dev, LC709203F_REG_CELL_TEMPERATURE, data[3], &temp));
+
+    measurements->temperature = temp / 10.0 - 273;
+
+    return ESP_OK;
+}
+
 esp_err_t lc709203f_get_cell_voltage(i2c_dev_t *dev, uint16_t *voltage)
 {
     CHECK_ARG(dev);
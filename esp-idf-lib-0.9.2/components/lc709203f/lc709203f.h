@@ -74,6 +74,14 @@ typedef enum {
     LC709203F_BATTERY_PROFILE_1 = 0x0001,
 } lc709203f_battery_profile_t;
 
+/*!  Measurements read by lc709203f_get_measurements() */
+typedef struct {
+    uint16_t voltage;   ///< Cell voltage (mV)
+    uint16_t rsoc;      ///< RSOC (%)
+    uint16_t ite;       ///< Indicator to empty (0.1%)
+    float temperature;  ///< Cell temperature (ºC)
+} lc709203f_measurements_t;
+
 /**
  * @brief Initialize device descriptor
  *
@@ -225,6 +233,21 @@ esp_err_t lc709203f_get_cell_temperature(i2c_dev_t *dev, float *temperature);
  */
 esp_err_t lc709203f_get_cell_temperature_celsius(i2c_dev_t *dev, float *temperature);
 
+/**
+ * @brief Get cell voltage, RSOC, ITE and temperature in one bus transaction
+ *
+ * Reads the four registers in one I2C transfer with ::i2c_dev_batch(),
+ * each word checked by its CRC.
+ *
+ * @param[in] dev Device descriptor
+ * @param[out] measurements Current measurements
+ * @return
+ *      `ESP_INVALID_ARG` null dev or measurements
+ *      `ESP_ERR_INVALID_CRC` a read failed its CRC
+ *      `ESP_OK` on success
+ */
+esp_err_t lc709203f_get_measurements(i2c_dev_t *dev, lc709203f_measurements_t *measurements);
+
 /**
  * @brief Get cell voltage
  *
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_heap_caps.h>
+#include <esp_heap_trace.h>
+#include <i2cdev.h>
+
+#define WARMUP_ROUNDS 10
+#define ROUNDS 1000
+#define TRANSFERS_PER_ROUND 3
+#define TRACE_RECORDS 64
+
+static heap_trace_record_t records[TRACE_RECORDS];
+
+static void round_trip(const i2c_dev_t *dev)
+{
+    uint8_t a[2], b[6];
+    i2c_dev_op_t ops[] = {
+        I2C_DEV_OP_READ_REG(0x00, a, sizeof(a)),
+        I2C_DEV_OP_READ_REG(0x01, b, sizeof(b)),
+    };
+
+    i2c_dev_probe(dev, I2C_DEV_WRITE);
+    i2c_dev_read_reg(dev, 0x00, a, 1);
+    i2c_dev_batch(dev, ops, 2);
+}
+
+void task(void *ignore)
+{
+    i2c_dev_t dev = { 0 };
+    dev.addr = CONFIG_EXAMPLE_I2C_ADDR;
+    dev.cfg.sda_io_num = CONFIG_EXAMPLE_I2C_MASTER_SDA;
+    dev.cfg.scl_io_num = CONFIG_EXAMPLE_I2C_MASTER_SCL;
+    dev.cfg.master.clk_speed = CONFIG_EXAMPLE_I2C_CLOCK_HZ;
+
+    // The first transfer installs the driver
+    for (int i = 0; i < WARMUP_ROUNDS; i++)
+        round_trip(&dev);
+
+    size_t free_before = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    ESP_ERROR_CHECK(heap_trace_start(HEAP_TRACE_ALL));
+    for (int i = 0; i < ROUNDS; i++)
+        round_trip(&dev);
+    ESP_ERROR_CHECK(heap_trace_stop());
+    size_t free_after = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+
+    size_t allocations = heap_trace_get_count();
+    printf("Transfers: %d\n", ROUNDS * TRANSFERS_PER_ROUND);
+    printf("Heap allocations: %s%u\n", allocations == TRACE_RECORDS ? ">= " : "", (unsigned)allocations);
+    printf("Free heap: %u -> %u bytes\n", (unsigned)free_before, (unsigned)free_after);
+    if (allocations || free_after != free_before)
+    {
+        heap_trace_dump();
+        printf("FAILED: transfers allocate heap in steady state\n");
+        abort();
+    }
+    printf("PASSED\n");
+
+    vTaskDelete(NULL);
+}
+
+void app_main()
+{
+    ESP_ERROR_CHECK(heap_trace_init_standalone(records, TRACE_RECORDS));
+    ESP_ERROR_CHECK(i2cdev_init());
+    xTaskCreate(task, "i2c_heap_stress", configMINIMAL_STACK_SIZE * 4, NULL, 5, NULL);
+}
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <freertos/FreeRTOS.h>
+#include <i2cdev.h>
+#include <i2cdev_sim.h>
+#include <i2cdev_legacy_fake.h>
+
+#define WARMUP_ROUNDS 10
+#define ROUNDS 1000
+#define TRANSFERS_PER_ROUND 4
+#define DEV_ADDR 0x68
+
+// Largest batch in the preallocated command link of the port
+#if CONFIG_I2CDEV_STATIC_CMD_LINK
+#define LINK_OPS CONFIG_I2CDEV_CMD_LINK_OPS
+#else
+#define LINK_OPS 4
+#endif
+
+// glibc allocator, wrapped below to count the allocations of the measured rounds
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static volatile bool counting;
+static volatile unsigned allocations;
+
+void *malloc(size_t size)
+{
+    if (counting)
+        allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    if (counting)
+        allocations++;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (counting)
+        allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+static uint8_t regs[0x10];
+static i2c_sim_device_t sim_dev = {
+    .addr = DEV_ADDR,
+    .reg_addr_size = 1,
+    .regs = regs,
+    .regs_size = sizeof(regs),
+};
+static i2c_sim_bus_t bus;
+
+static void full_batch(const i2c_dev_t *dev, size_t count)
+{
+    // Multi-byte register reads take the most commands
+    uint8_t regs[LINK_OPS + 1], data[LINK_OPS + 1][6];
+    i2c_dev_op_t ops[LINK_OPS + 1];
+    for (size_t i = 0; i < count; i++)
+    {
+        regs[i] = i;
+        ops[i] = (i2c_dev_op_t){ .type = I2C_DEV_READ, .reg = &regs[i], .reg_size = 1, .data = data[i], .size = sizeof(data[i]) };
+    }
+    ESP_ERROR_CHECK(i2c_dev_batch(dev, ops, count));
+}
+
+static void round_trip(const i2c_dev_t *dev)
+{
+    uint8_t a[2], b[6];
+    i2c_dev_op_t ops[] = {
+        I2C_DEV_OP_READ_REG(0x00, a, sizeof(a)),
+        I2C_DEV_OP_READ_REG(0x01, b, sizeof(b)),
+    };
+
+    ESP_ERROR_CHECK(i2c_dev_probe(dev, I2C_DEV_WRITE));
+    ESP_ERROR_CHECK(i2c_dev_read_reg(dev, 0x00, a, 1));
+    ESP_ERROR_CHECK(i2c_dev_batch(dev, ops, 2));
+    full_batch(dev, LINK_OPS);
+}
+
+void app_main()
+{
+    ESP_ERROR_CHECK(i2cdev_init());
+    ESP_ERROR_CHECK(i2c_sim_bus_init(&bus));
+    ESP_ERROR_CHECK(i2c_sim_add_device(&bus, &sim_dev));
+    ESP_ERROR_CHECK(i2c_sim_attach(&bus, I2C_NUM_0));
+
+    // Port 0 on the simulated bus, port 1 on the fake I2C master driver
+    i2c_dev_t sim = { 0 };
+    sim.port = I2C_NUM_0;
+    sim.addr = DEV_ADDR;
+    sim.cfg.master.clk_speed = 400000;
+    i2c_dev_t hw = sim;
+    hw.port = I2C_NUM_1;
+
+    for (int i = 0; i < WARMUP_ROUNDS; i++)
+    {
+        round_trip(&sim);
+        round_trip(&hw);
+    }
+
+    i2c_legacy_fake_reset();
+    counting = true;
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        round_trip(&sim);
+        round_trip(&hw);
+    }
+    counting = false;
+
+    i2c_legacy_fake_stats_t fake;
+    i2c_legacy_fake_get_stats(&fake);
+
+    // A larger batch does not fit and falls back to a heap link
+    i2c_legacy_fake_reset();
+    full_batch(&hw, LINK_OPS + 1);
+    i2c_legacy_fake_stats_t fallback;
+    i2c_legacy_fake_get_stats(&fallback);
+
+    printf("Transfers: %d\n", 2 * ROUNDS * TRANSFERS_PER_ROUND);
+    printf("Heap allocations: %u\n", allocations);
+    printf("Command links: %u preallocated, %u on the heap, %u errors\n", (unsigned)fake.static_links,
+           (unsigned)fake.heap_links, (unsigned)fake.errors);
+    printf("Largest preallocated link: %u bytes used\n", (unsigned)fake.max_static_used);
+    printf("Batch of %d operations: %u preallocated, %u on the heap\n", LINK_OPS + 1,
+           (unsigned)fallback.static_links, (unsigned)fallback.heap_links);
+    ESP_ERROR_CHECK(i2cdev_done());
+    if (allocations)
+    {
+        printf("FAILED: transfers allocate heap in steady state\n");
+        abort();
+    }
+    if (fake.static_links != ROUNDS * TRANSFERS_PER_ROUND || fake.heap_links || fake.errors
+        || fake.transfers != ROUNDS * TRANSFERS_PER_ROUND)
+    {
+        printf("FAILED: transfers do not use the preallocated command link\n");
+        abort();
+    }
+    if (fallback.static_links || fallback.heap_links != 1 || fallback.errors)
+    {
+        printf("FAILED: larger batches do not fall back to a heap command link\n");
+        abort();
+    }
+    printf("PASSED\n");
+}
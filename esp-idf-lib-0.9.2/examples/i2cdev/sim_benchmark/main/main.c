@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <i2cdev.h>
+#include <i2cdev_sim.h>
+#include <i2cdev_async.h>
+
+#define SAMPLES 1000
+
+// Samples of the blocking and asynchronous comparison, in real time
+#define RT_SAMPLES 200
+// Processing time of one sample
+#define CPU_WORK_MS 3
+#define ASYNC_TASK_PRIORITY 5
+
+// Simulated IMU with the register layout of a MPU6050
+#define IMU_ADDR            0x68
+#define IMU_REG_INT_STATUS  0x3a
+#define IMU_REG_ACCEL       0x3b
+#define IMU_REG_TEMP        0x41
+#define IMU_REG_GYRO        0x43
+#define IMU_REG_FIFO_COUNT  0x72
+
+// Driver and interrupt time of one transfer on the target
+#define TRANSFER_OVERHEAD_US 40
+
+static uint8_t imu_regs[0x80];
+static i2c_sim_device_t imu = {
+    .addr = IMU_ADDR,
+    .reg_addr_size = 1,
+    .regs = imu_regs,
+    .regs_size = sizeof(imu_regs),
+};
+static i2c_sim_bus_t bus;
+static i2c_dev_t dev = { 0 };
+
+typedef struct
+{
+    uint8_t status;
+    uint8_t accel[6];
+    uint8_t temp[2];
+    uint8_t gyro[6];
+    uint8_t fifo_count[2];
+} sample_t;
+
+typedef esp_err_t (*read_sample_t)(sample_t *sample);
+
+// One sample as read by most drivers: a transfer per register block
+static esp_err_t read_sample_single(sample_t *sample)
+{
+    esp_err_t res;
+    if ((res = i2c_dev_read_reg(&dev, IMU_REG_INT_STATUS, &sample->status, 1)) != ESP_OK)
+        return res;
+    if ((res = i2c_dev_read_reg(&dev, IMU_REG_ACCEL, sample->accel, 6)) != ESP_OK)
+        return res;
+    if ((res = i2c_dev_read_reg(&dev, IMU_REG_TEMP, sample->temp, 2)) != ESP_OK)
+        return res;
+    if ((res = i2c_dev_read_reg(&dev, IMU_REG_GYRO, sample->gyro, 6)) != ESP_OK)
+        return res;
+    return i2c_dev_read_reg(&dev, IMU_REG_FIFO_COUNT, sample->fifo_count, 2);
+}
+
+#define SAMPLE_OPS(sample) { \
+        I2C_DEV_OP_READ_REG(IMU_REG_INT_STATUS, &(sample)->status, 1), \
+        I2C_DEV_OP_READ_REG(IMU_REG_ACCEL, (sample)->accel, 6), \
+        I2C_DEV_OP_READ_REG(IMU_REG_TEMP, (sample)->temp, 2), \
+        I2C_DEV_OP_READ_REG(IMU_REG_GYRO, (sample)->gyro, 6), \
+        I2C_DEV_OP_READ_REG(IMU_REG_FIFO_COUNT, (sample)->fifo_count, 2), \
+    }
+#define SAMPLE_OP_COUNT 5
+
+// The same sample with one batch
+static esp_err_t read_sample_batch(sample_t *sample)
+{
+    i2c_dev_op_t ops[] = SAMPLE_OPS(sample);
+    return i2c_dev_batch(&dev, ops, SAMPLE_OP_COUNT);
+}
+
+// Processing of one sample, keeps the CPU busy
+static void cpu_work(const sample_t *sample)
+{
+    TickType_t end = xTaskGetTickCount() + pdMS_TO_TICKS(CPU_WORK_MS);
+    while (xTaskGetTickCount() < end)
+        ;
+}
+
+static void print_rate(const char *name, TickType_t ticks)
+{
+    double sec = (double)ticks * portTICK_PERIOD_MS / 1000;
+    printf("%-8s %10.1f %10.2f\n", name, RT_SAMPLES / sec, sec * 1000 / RT_SAMPLES);
+}
+
+// Reads a sample, then processes it
+static void run_blocking(void)
+{
+    sample_t sample;
+
+    TickType_t start = xTaskGetTickCount();
+    for (int i = 0; i < RT_SAMPLES; i++)
+    {
+        ESP_ERROR_CHECK(read_sample_batch(&sample));
+        cpu_work(&sample);
+    }
+    print_rate("blocking", xTaskGetTickCount() - start);
+}
+
+// Processes a sample while the worker reads the next one
+static void run_async(void)
+{
+    sample_t samples[2];
+    i2c_dev_op_t ops[2][SAMPLE_OP_COUNT] = { SAMPLE_OPS(&samples[0]), SAMPLE_OPS(&samples[1]) };
+    i2c_dev_transfer_t transfers[2];
+    for (int i = 0; i < 2; i++)
+    {
+        transfers[i] = (i2c_dev_transfer_t) {
+            .dev = &dev,
+            .ops = ops[i],
+            .count = SAMPLE_OP_COUNT,
+            .priority = I2C_DEV_PRIO_NORMAL,
+            .notify = xTaskGetCurrentTaskHandle(),
+        };
+    }
+
+    TickType_t start = xTaskGetTickCount();
+    ESP_ERROR_CHECK(i2c_dev_submit(&transfers[0]));
+    for (int i = 0; i < RT_SAMPLES; i++)
+    {
+        ESP_ERROR_CHECK(i2c_dev_wait(&transfers[i % 2], portMAX_DELAY));
+        if (i + 1 < RT_SAMPLES)
+            ESP_ERROR_CHECK(i2c_dev_submit(&transfers[(i + 1) % 2]));
+        cpu_work(&samples[i % 2]);
+    }
+    print_rate("async", xTaskGetTickCount() - start);
+}
+
+static void run(const char *name, read_sample_t read_sample)
+{
+    i2c_sim_stats_t before = bus.stats;
+    sample_t sample;
+
+    for (int i = 0; i < SAMPLES; i++)
+    {
+        // New measurement in the register map
+        imu_regs[IMU_REG_ACCEL] = i;
+        imu_regs[IMU_REG_GYRO + 5] = i;
+        if (read_sample(&sample) != ESP_OK || sample.accel[0] != imu_regs[IMU_REG_ACCEL]
+            || sample.gyro[5] != imu_regs[IMU_REG_GYRO + 5])
+        {
+            printf("%-8s sample %d is wrong\n", name, i);
+            return;
+        }
+    }
+
+    // Every backend call takes the port mutex and checks the port setup once
+    printf("%-8s %8.2f %8.2f %8.2f %10.1f\n", name,
+           (double)(bus.stats.calls - before.calls) / SAMPLES,
+           (double)(bus.stats.transfers - before.transfers) / SAMPLES,
+           (double)(bus.stats.bytes - before.bytes) / SAMPLES,
+           (double)(bus.stats.busy_ns - before.busy_ns) / SAMPLES / 1000);
+}
+
+void app_main()
+{
+    ESP_ERROR_CHECK(i2cdev_init());
+    ESP_ERROR_CHECK(i2c_sim_bus_init(&bus));
+    bus.overhead_us = TRANSFER_OVERHEAD_US;
+    ESP_ERROR_CHECK(i2c_sim_add_device(&bus, &imu));
+    ESP_ERROR_CHECK(i2c_sim_attach(&bus, I2C_NUM_0));
+
+    dev.port = I2C_NUM_0;
+    dev.addr = IMU_ADDR;
+    dev.cfg.master.clk_speed = 400000;
+
+    printf("Per sample, %d samples, 400 kHz, %d us overhead per transfer\n", SAMPLES, TRANSFER_OVERHEAD_US);
+    printf("%-8s %8s %8s %8s %10s\n", "", "locks", "xfers", "bytes", "bus us");
+    run("single", read_sample_single);
+    run("batch", read_sample_batch);
+
+    // Bus time in real time at 100 kHz, comparable to the processing time
+    bus.real_time = true;
+    dev.cfg.master.clk_speed = 100000;
+    ESP_ERROR_CHECK(i2c_dev_async_init(I2C_NUM_0, ASYNC_TASK_PRIORITY));
+    printf("\nBatch per sample in real time, %d samples, 100 kHz, %d ms processing per sample\n", RT_SAMPLES, CPU_WORK_MS);
+    printf("%-8s %10s %10s\n", "", "samples/s", "ms/sample");
+    run_blocking();
+    run_async();
+    ESP_ERROR_CHECK(i2c_dev_async_done(I2C_NUM_0));
+
+    ESP_ERROR_CHECK(i2cdev_done());
+}
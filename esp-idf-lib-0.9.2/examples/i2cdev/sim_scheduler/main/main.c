@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <i2cdev.h>
+#include <i2cdev_sim.h>
+
+#define RUN_MS 2000
+#define TASK_PRIORITY 5
+
+// IMU sampled every IMU_PERIOD_MS, with the register layout of a MPU6050
+#define IMU_ADDR       0x68
+#define IMU_REG_ACCEL  0x3b
+#define IMU_PERIOD_MS  5
+
+// SCD4x-like sensors read back to back: 2-byte command, 9 bytes
+#define SLOW_COUNT     3
+#define SLOW_ADDR      0x62
+#define SLOW_CMD       0xec05
+
+static uint8_t imu_regs[0x80];
+static i2c_sim_device_t imu = {
+    .addr = IMU_ADDR,
+    .reg_addr_size = 1,
+    .regs = imu_regs,
+    .regs_size = sizeof(imu_regs),
+};
+static i2c_sim_device_t slow[SLOW_COUNT];
+static i2c_sim_bus_t bus;
+
+static i2c_dev_t imu_dev = { 0 };
+static i2c_dev_t slow_dev[SLOW_COUNT] = { 0 };
+
+static volatile bool stop;
+static SemaphoreHandle_t done;
+
+static void imu_task(void *arg)
+{
+    uint8_t data[14];
+    TickType_t last = xTaskGetTickCount();
+    while (!stop)
+    {
+        ESP_ERROR_CHECK(i2c_dev_read_reg(&imu_dev, IMU_REG_ACCEL, data, sizeof(data)));
+        vTaskDelayUntil(&last, pdMS_TO_TICKS(IMU_PERIOD_MS));
+    }
+    xSemaphoreGive(done);
+    vTaskDelete(NULL);
+}
+
+static void slow_task(void *arg)
+{
+    i2c_dev_t *dev = arg;
+    uint8_t cmd[2] = { SLOW_CMD >> 8, SLOW_CMD & 0xff };
+    uint8_t data[9];
+    while (!stop)
+    {
+        ESP_ERROR_CHECK(i2c_dev_read(dev, cmd, sizeof(cmd), data, sizeof(data)));
+        vTaskDelay(1);
+    }
+    xSemaphoreGive(done);
+    vTaskDelete(NULL);
+}
+
+static void print_stats(const char *name, i2c_dev_t *dev)
+{
+    i2c_dev_wait_stats_t s;
+    ESP_ERROR_CHECK(i2c_dev_get_wait_stats(dev, &s, true));
+    printf("%-8s %8u %10u %10.1f %10u %8u\n", name, (unsigned)s.count, (unsigned)s.contended,
+           s.count ? (double)s.total_us / s.count : 0, (unsigned)s.max_us, (unsigned)s.missed);
+}
+
+static void run(const char *name, i2c_dev_class_t imu_class, i2c_dev_class_t slow_class)
+{
+    imu_dev.sched_class = imu_class;
+    for (int i = 0; i < SLOW_COUNT; i++)
+        slow_dev[i].sched_class = slow_class;
+
+    stop = false;
+    // All tasks at the same priority, so the port decides the order
+    xTaskCreate(imu_task, "imu", configMINIMAL_STACK_SIZE * 4, NULL, TASK_PRIORITY, NULL);
+    for (int i = 0; i < SLOW_COUNT; i++)
+        xTaskCreate(slow_task, "slow", configMINIMAL_STACK_SIZE * 4, &slow_dev[i], TASK_PRIORITY, NULL);
+    vTaskDelay(pdMS_TO_TICKS(RUN_MS));
+    stop = true;
+    for (int i = 0; i < SLOW_COUNT + 1; i++)
+        xSemaphoreTake(done, portMAX_DELAY);
+
+    printf("\n%s\n", name);
+    printf("%-8s %8s %10s %10s %10s %8s\n", "", "xfers", "contended", "avg us", "max us", "missed");
+    print_stats("imu", &imu_dev);
+    char slow_name[8];
+    for (int i = 0; i < SLOW_COUNT; i++)
+    {
+        snprintf(slow_name, sizeof(slow_name), "slow%d", i);
+        print_stats(slow_name, &slow_dev[i]);
+    }
+}
+
+void app_main()
+{
+    ESP_ERROR_CHECK(i2cdev_init());
+    ESP_ERROR_CHECK(i2c_sim_bus_init(&bus));
+    // Bus time in real time, so the tasks really wait for each other
+    bus.real_time = true;
+    ESP_ERROR_CHECK(i2c_sim_add_device(&bus, &imu));
+    for (int i = 0; i < SLOW_COUNT; i++)
+    {
+        slow[i].addr = SLOW_ADDR + i;
+        slow[i].reg_addr_size = 2;
+        ESP_ERROR_CHECK(i2c_sim_add_device(&bus, &slow[i]));
+    }
+    ESP_ERROR_CHECK(i2c_sim_attach(&bus, I2C_NUM_0));
+    done = xSemaphoreCreateCounting(SLOW_COUNT + 1, 0);
+
+    imu_dev.port = I2C_NUM_0;
+    imu_dev.addr = IMU_ADDR;
+    imu_dev.cfg.master.clk_speed = 100000;
+    for (int i = 0; i < SLOW_COUNT; i++)
+    {
+        slow_dev[i].port = I2C_NUM_0;
+        slow_dev[i].addr = SLOW_ADDR + i;
+        slow_dev[i].cfg.master.clk_speed = 100000;
+    }
+
+    printf("IMU every %d ms and %d sensors back to back at 100 kHz, %d ms per run\n", IMU_PERIOD_MS, SLOW_COUNT, RUN_MS);
+    run("Same class for all devices (order of arrival)", I2C_DEV_CLASS_NORMAL, I2C_DEV_CLASS_NORMAL);
+    run("Realtime IMU, background sensors", I2C_DEV_CLASS_REALTIME, I2C_DEV_CLASS_BACKGROUND);
+
+    vSemaphoreDelete(done);
+    ESP_ERROR_CHECK(i2cdev_done());
+}
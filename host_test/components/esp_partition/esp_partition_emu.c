@@ -0,0 +1,135 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_partition.h"
+#include "esp_partition_emu.h"
+
+// Largest partition the emulation holds.
+#define EMU_FLASH_SIZE (64 * ESP_PARTITION_EMU_SECTOR_SIZE)
+
+#define NO_CUT UINT32_MAX
+
+static uint8_t s_flash[EMU_FLASH_SIZE];
+static esp_partition_t s_partition;
+static esp_partition_emu_stats_t s_stats;
+
+static bool s_powered;                  // < Cleared by a cut, set by esp_partition_emu_power_on().
+static uint32_t s_write_budget;         // < Bytes programmed before the cut, or NO_CUT.
+static uint32_t s_erase_budget;         // < Erases completed before the cut, or NO_CUT.
+static uint32_t s_erased_bytes;         // < Bytes the interrupted erase sets to 0xFF.
+
+void esp_partition_emu_init(const char *label, uint32_t size)
+{
+    memset(s_flash, 0xFF, sizeof(s_flash));
+    memset(&s_partition, 0, sizeof(s_partition));
+    s_partition.type = ESP_PARTITION_TYPE_DATA;
+    s_partition.subtype = (esp_partition_subtype_t)0x40;
+    s_partition.size = size <= EMU_FLASH_SIZE ? size - size % ESP_PARTITION_EMU_SECTOR_SIZE : EMU_FLASH_SIZE;
+    s_partition.erase_size = ESP_PARTITION_EMU_SECTOR_SIZE;
+    strncpy(s_partition.label, label, sizeof(s_partition.label) - 1);
+
+    memset(&s_stats, 0, sizeof(s_stats));
+    esp_partition_emu_power_on();
+}
+
+void esp_partition_emu_cut_after_bytes(uint32_t bytes)
+{
+    s_write_budget = bytes;
+}
+
+void esp_partition_emu_cut_during_erase(uint32_t erases, uint32_t erased_bytes)
+{
+    s_erase_budget = erases;
+    s_erased_bytes = erased_bytes < ESP_PARTITION_EMU_SECTOR_SIZE ? erased_bytes : ESP_PARTITION_EMU_SECTOR_SIZE;
+}
+
+void esp_partition_emu_power_on(void)
+{
+    s_powered = true;
+    s_write_budget = NO_CUT;
+    s_erase_budget = NO_CUT;
+}
+
+esp_partition_emu_stats_t esp_partition_emu_stats(void)
+{
+    return s_stats;
+}
+
+static bool in_partition(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    return partition == &s_partition && offset <= partition->size && size <= partition->size - offset;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label)
+{
+    if (s_partition.size == 0 ||
+        (type != ESP_PARTITION_TYPE_ANY && type != s_partition.type) ||
+        (subtype != ESP_PARTITION_SUBTYPE_ANY && subtype != s_partition.subtype) ||
+        (label != NULL && strcmp(label, s_partition.label) != 0)) {
+        return NULL;
+    }
+    return &s_partition;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    if (!in_partition(partition, src_offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (!s_powered) {
+        return ESP_FAIL;
+    }
+    memcpy(dst, &s_flash[src_offset], size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+    if (!in_partition(partition, dst_offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    const uint8_t *data = src;
+    for (size_t i = 0; i < size; i++) {
+        if (!s_powered || s_write_budget == 0) {
+            s_powered = false;
+            return ESP_FAIL;
+        }
+        if (s_write_budget != NO_CUT) {
+            s_write_budget--;
+        }
+        uint8_t *byte = &s_flash[dst_offset + i];
+        s_stats.bit_errors += __builtin_popcount(data[i] & ~*byte & 0xFF);
+        *byte &= data[i];
+        s_stats.bytes_written++;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    if (!in_partition(partition, offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (offset % partition->erase_size != 0 || size % partition->erase_size != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (size_t sector = offset; sector < offset + size; sector += partition->erase_size) {
+        if (!s_powered) {
+            return ESP_FAIL;
+        }
+        s_stats.erases++;
+        if (s_erase_budget == 0) {
+            memset(&s_flash[sector], 0xFF, s_erased_bytes);
+            s_powered = false;
+            return ESP_FAIL;
+        }
+        if (s_erase_budget != NO_CUT) {
+            s_erase_budget--;
+        }
+        memset(&s_flash[sector], 0xFF, partition->erase_size);
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// The part of the esp_partition.h API of ESP-IDF the application uses, implemented on the
+// emulated flash of esp_partition_emu.h.
+
+/**
+ * @brief Partition type.
+ */
+typedef enum {
+    ESP_PARTITION_TYPE_APP = 0x00,      // < Application partition type.
+    ESP_PARTITION_TYPE_DATA = 0x01,     // < Data partition type.
+    ESP_PARTITION_TYPE_ANY = 0xff,      // < Used to search for partitions with any type.
+} esp_partition_type_t;
+
+/**
+ * @brief Partition subtype, only the wildcard is used by the application.
+ */
+typedef enum {
+    ESP_PARTITION_SUBTYPE_ANY = 0xff,   // < Used to search for partitions with any subtype.
+} esp_partition_subtype_t;
+
+/**
+ * @brief Partition information.
+ */
+typedef struct {
+    esp_partition_type_t type;          // < Partition type.
+    esp_partition_subtype_t subtype;    // < Partition subtype.
+    uint32_t address;                   // < Starting address of the partition in flash.
+    uint32_t size;                      // < Size of the partition in bytes.
+    uint32_t erase_size;                // < Size the partition is erased in.
+    char label[17];                     // < Partition label, NUL terminated.
+    bool encrypted;                     // < Always false.
+    bool readonly;                      // < Always false.
+} esp_partition_t;
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label);
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size);
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size);
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size);
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Emulated NOR flash holding a single data partition.
+//
+// An erase sets the bytes of whole sectors to 0xFF, a write can only clear bits: the written
+// byte is ANDed into the flash. A write that would have to set a cleared bit is counted in
+// bit_errors, a journal that expects it to work would not survive on a real chip.
+//
+// A power cut stops the write or erase in progress. Until esp_partition_emu_power_on(), every
+// read, write and erase fails.
+
+// Size of a flash sector, the erase size of the partition.
+#define ESP_PARTITION_EMU_SECTOR_SIZE 4096
+
+/**
+ * @brief Counters of the flash operations since esp_partition_emu_init().
+ */
+typedef struct {
+    uint32_t bytes_written;     // < Bytes programmed.
+    uint32_t erases;            // < Sectors erased, interrupted erases included.
+    uint32_t bit_errors;        // < Bits a write tried to set from 0 to 1.
+} esp_partition_emu_stats_t;
+
+/**
+ * @brief Creates an erased data partition of @p size bytes, clears the counters and any cut.
+ *
+ * @param label Label esp_partition_find_first() finds the partition by.
+ * @param size  Size in bytes, a multiple of ESP_PARTITION_EMU_SECTOR_SIZE.
+ */
+void esp_partition_emu_init(const char *label, uint32_t size);
+
+/**
+ * @brief Cuts the power once @p bytes more bytes were programmed.
+ *
+ * The write in progress programs its first bytes up to the cut and fails.
+ */
+void esp_partition_emu_cut_after_bytes(uint32_t bytes);
+
+/**
+ * @brief Cuts the power during the sector erase after the next @p erases ones.
+ *
+ * The interrupted erase only sets the first @p erased_bytes of the sector to 0xFF, the rest
+ * keeps its old content, and fails.
+ */
+void esp_partition_emu_cut_during_erase(uint32_t erases, uint32_t erased_bytes);
+
+/**
+ * @brief Powers the flash on again, the content left by a cut is kept.
+ */
+void esp_partition_emu_power_on(void);
+
+/**
+ * @brief Returns the counters of the flash operations.
+ */
+esp_partition_emu_stats_t esp_partition_emu_stats(void);
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// In-process stand-in for an MQTT 3.1.1 broker, for the connect-to-PUBACK latency of a wake.
+//
+// The broker handles CONNECT (with the clean session flag and the sessions of the client IDs
+// it has seen), PUBLISH with QoS 0 and 1, PINGREQ and DISCONNECT, like Mosquitto does for a
+// client that only publishes. The client talks to it through the functions below instead of
+// a socket.
+//
+// The network is emulated on a virtual clock, so the latencies do not depend on the machine
+// running the test: a packet arrives half a round trip plus a random jitter after it was
+// sent, in the order it was sent, and the TCP handshake takes a round trip. The broker
+// handles one packet after the other and needs auth_us to check the credentials of a CONNECT.
+
+/**
+ * @brief Emulated network and broker.
+ */
+typedef struct {
+    uint32_t rtt_us;            // < Round-trip time of the network.
+    uint32_t jitter_us;         // < Maximum random delay added to every packet.
+    uint32_t auth_us;           // < Time the broker needs to check the credentials of a CONNECT.
+    uint32_t seed;              // < Seed of the jitter.
+} mqtt_broker_stub_config_t;
+
+/**
+ * @brief Counters of the broker since mqtt_broker_stub_init().
+ */
+typedef struct {
+    uint32_t connects;          // < Accepted CONNECT packets.
+    uint32_t sessions_resumed;  // < CONNACKs with the session present flag.
+    uint32_t publishes;         // < Received PUBLISH packets.
+    uint32_t pubacks;           // < Sent PUBACK packets.
+    uint32_t protocol_errors;   // < Malformed or unexpected packets, the connection was closed.
+} mqtt_broker_stub_stats_t;
+
+/**
+ * @brief Starts the broker without any session, at virtual time 0.
+ */
+void mqtt_broker_stub_init(const mqtt_broker_stub_config_t *config);
+
+/**
+ * @brief Returns the virtual time in microseconds.
+ */
+uint64_t mqtt_broker_stub_now_us(void);
+
+/**
+ * @brief Advances the virtual time, e.g. for the deep sleep between two wakes.
+ */
+void mqtt_broker_stub_sleep(uint64_t us);
+
+/**
+ * @brief Opens a TCP connection to the broker, taking a round trip.
+ *
+ * @return false if a connection is already open.
+ */
+bool mqtt_broker_stub_connect(void);
+
+/**
+ * @brief Sends bytes to the broker, one or more complete MQTT packets.
+ *
+ * Packets sent together travel in one segment, e.g. a CONNECT followed by a PUBLISH.
+ */
+void mqtt_broker_stub_send(const uint8_t *data, size_t len);
+
+/**
+ * @brief Waits for the next packet from the broker.
+ *
+ * Advances the virtual time to the arrival of the packet.
+ *
+ * @param[out] buf  Received packet.
+ * @param size      Size of @p buf.
+ * @return Length of the packet, 0 if the broker has nothing more to send.
+ */
+size_t mqtt_broker_stub_recv(uint8_t *buf, size_t size);
+
+/**
+ * @brief Closes the connection, the broker keeps the session if it was not a clean one.
+ */
+void mqtt_broker_stub_close(void);
+
+/**
+ * @brief Returns the counters of the broker.
+ */
+mqtt_broker_stub_stats_t mqtt_broker_stub_stats(void);
@@ -0,0 +1,279 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "mqtt_broker_stub.h"
+
+// MQTT 3.1.1 control packet types (upper nibble of the fixed header).
+#define MQTT_CONNECT    1
+#define MQTT_CONNACK    2
+#define MQTT_PUBLISH    3
+#define MQTT_PUBACK     4
+#define MQTT_PINGREQ    12
+#define MQTT_PINGRESP   13
+#define MQTT_DISCONNECT 14
+
+#define CONNECT_FLAG_CLEAN_SESSION 0x02
+
+#define SESSIONS_MAX   16
+#define CLIENT_ID_SIZE 64
+#define QUEUE_SIZE     16
+
+/**
+ * @brief A packet on its way from the broker to the client.
+ */
+typedef struct {
+    uint64_t arrival_us;        // < Virtual time the packet arrives at the client.
+    uint8_t data[4];            // < The broker only sends CONNACK, PUBACK and PINGRESP.
+    size_t len;
+} downlink_packet_t;
+
+static mqtt_broker_stub_config_t s_config;
+static mqtt_broker_stub_stats_t s_stats;
+static uint64_t s_now_us;
+static uint32_t s_random;
+
+// Client IDs of the sessions the broker keeps.
+static char s_sessions[SESSIONS_MAX][CLIENT_ID_SIZE];
+static uint32_t s_session_count;
+
+static bool s_open;                     // < A TCP connection is open.
+static bool s_connected;                // < The CONNECT of the connection was accepted.
+static uint64_t s_broker_free_us;       // < Time the broker is done with the previous packet.
+static uint64_t s_uplink_arrival_us;    // < Arrival of the last packet at the broker.
+static uint64_t s_downlink_arrival_us;  // < Arrival of the last packet at the client.
+
+static downlink_packet_t s_queue[QUEUE_SIZE];
+static uint32_t s_queue_head;
+static uint32_t s_queue_count;
+
+static uint64_t max_u64(uint64_t a, uint64_t b)
+{
+    return a > b ? a : b;
+}
+
+/**
+ * @brief Returns the time a packet travels in one direction, half a round trip and the jitter.
+ */
+static uint64_t one_way_us(void)
+{
+    // xorshift32
+    s_random ^= s_random << 13;
+    s_random ^= s_random >> 17;
+    s_random ^= s_random << 5;
+    return s_config.rtt_us / 2 + (s_config.jitter_us > 0 ? s_random % (s_config.jitter_us + 1) : 0);
+}
+
+static int find_session(const char *client_id)
+{
+    for (uint32_t i = 0; i < s_session_count; i++) {
+        if (strcmp(s_sessions[i], client_id) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static void drop_connection(void)
+{
+    s_open = false;
+    s_connected = false;
+    s_queue_count = 0;
+}
+
+static void protocol_error(void)
+{
+    s_stats.protocol_errors++;
+    drop_connection();
+}
+
+/**
+ * @brief Sends a packet to the client once the broker is done with the packet it answers.
+ */
+static void respond(const uint8_t *data, size_t len, uint64_t done_us)
+{
+    if (s_queue_count == QUEUE_SIZE) {
+        protocol_error();
+        return;
+    }
+    s_broker_free_us = done_us;
+    // TCP keeps the order of the packets
+    s_downlink_arrival_us = max_u64(done_us + one_way_us(), s_downlink_arrival_us);
+
+    downlink_packet_t *packet = &s_queue[(s_queue_head + s_queue_count++) % QUEUE_SIZE];
+    packet->arrival_us = s_downlink_arrival_us;
+    memcpy(packet->data, data, len);
+    packet->len = len;
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static void handle_connect(const uint8_t *body, size_t len, uint64_t start_us)
+{
+    // Protocol name "MQTT", level 4, flags, keepalive, client ID
+    if (s_connected || len < 12 || get_u16(body) != 4 || memcmp(&body[2], "MQTT", 4) != 0 || body[6] != 4) {
+        protocol_error();
+        return;
+    }
+    bool clean = (body[7] & CONNECT_FLAG_CLEAN_SESSION) != 0;
+    uint16_t id_len = get_u16(&body[10]);
+    if (12 + (size_t)id_len > len || id_len >= CLIENT_ID_SIZE || (id_len == 0 && !clean)) {
+        protocol_error();
+        return;
+    }
+    char client_id[CLIENT_ID_SIZE];
+    memcpy(client_id, &body[12], id_len);
+    client_id[id_len] = '\0';
+
+    // A clean session discards the old one, otherwise the session is resumed or created
+    int session = find_session(client_id);
+    bool present = !clean && session >= 0;
+    if (clean && session >= 0) {
+        memmove(s_sessions[session], s_sessions[session + 1], (s_session_count - session - 1) * CLIENT_ID_SIZE);
+        s_session_count--;
+    } else if (!clean && session < 0 && s_session_count < SESSIONS_MAX) {
+        strcpy(s_sessions[s_session_count++], client_id);
+    }
+
+    s_connected = true;
+    s_stats.connects++;
+    s_stats.sessions_resumed += present;
+    const uint8_t connack[] = {MQTT_CONNACK << 4, 2, present, 0};
+    respond(connack, sizeof(connack), start_us + s_config.auth_us);
+}
+
+static void handle_publish(uint8_t flags, const uint8_t *body, size_t len, uint64_t start_us)
+{
+    uint8_t qos = (flags >> 1) & 3;
+    if (!s_connected || len < 2 || qos > 1 || 2 + (size_t)get_u16(body) + (qos ? 2 : 0) > len) {
+        protocol_error();
+        return;
+    }
+    s_stats.publishes++;
+    if (qos == 1) {
+        const uint8_t *id = &body[2 + get_u16(body)];
+        const uint8_t puback[] = {MQTT_PUBACK << 4, 2, id[0], id[1]};
+        s_stats.pubacks++;
+        respond(puback, sizeof(puback), start_us);
+    }
+}
+
+void mqtt_broker_stub_init(const mqtt_broker_stub_config_t *config)
+{
+    s_config = *config;
+    s_random = config->seed != 0 ? config->seed : 1;
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_now_us = 0;
+    s_session_count = 0;
+    s_broker_free_us = 0;
+    drop_connection();
+}
+
+uint64_t mqtt_broker_stub_now_us(void)
+{
+    return s_now_us;
+}
+
+void mqtt_broker_stub_sleep(uint64_t us)
+{
+    s_now_us += us;
+}
+
+bool mqtt_broker_stub_connect(void)
+{
+    if (s_open) {
+        return false;
+    }
+    // SYN and SYN-ACK, the ACK goes out with the first packet
+    s_now_us += one_way_us() + one_way_us();
+    s_open = true;
+    s_connected = false;
+    s_queue_head = 0;
+    s_queue_count = 0;
+    s_uplink_arrival_us = s_now_us;
+    s_downlink_arrival_us = s_now_us;
+    return true;
+}
+
+void mqtt_broker_stub_send(const uint8_t *data, size_t len)
+{
+    if (!s_open) {
+        return;
+    }
+    s_uplink_arrival_us = max_u64(s_now_us + one_way_us(), s_uplink_arrival_us);
+
+    size_t pos = 0;
+    while (s_open && pos < len) {
+        uint8_t header = data[pos++];
+        // Remaining length, a varint of up to 4 bytes
+        size_t remaining = 0;
+        uint32_t shift = 0;
+        uint8_t b;
+        do {
+            if (pos == len || shift > 21) {
+                protocol_error();
+                return;
+            }
+            b = data[pos++];
+            remaining |= (size_t)(b & 0x7F) << shift;
+            shift += 7;
+        } while (b & 0x80);
+        if (remaining > len - pos) {
+            protocol_error();
+            return;
+        }
+
+        const uint8_t *body = &data[pos];
+        pos += remaining;
+        uint64_t start_us = max_u64(s_uplink_arrival_us, s_broker_free_us);
+        switch (header >> 4) {
+        case MQTT_CONNECT:
+            handle_connect(body, remaining, start_us);
+            break;
+        case MQTT_PUBLISH:
+            handle_publish(header & 0x0F, body, remaining, start_us);
+            break;
+        case MQTT_PINGREQ: {
+            const uint8_t pingresp[] = {MQTT_PINGRESP << 4, 0};
+            respond(pingresp, sizeof(pingresp), start_us);
+            break;
+        }
+        case MQTT_DISCONNECT:
+            s_connected = false;
+            break;
+        default:
+            protocol_error();
+            break;
+        }
+    }
+}
+
+size_t mqtt_broker_stub_recv(uint8_t *buf, size_t size)
+{
+    if (s_queue_count == 0) {
+        return 0;
+    }
+    downlink_packet_t *packet = &s_queue[s_queue_head];
+    if (packet->len > size) {
+        return 0;
+    }
+    s_queue_head = (s_queue_head + 1) % QUEUE_SIZE;
+    s_queue_count--;
+    s_now_us = max_u64(s_now_us, packet->arrival_us);
+    memcpy(buf, packet->data, packet->len);
+    return packet->len;
+}
+
+void mqtt_broker_stub_close(void)
+{
+    drop_connection();
+}
+
+mqtt_broker_stub_stats_t mqtt_broker_stub_stats(void)
+{
+    return s_stats;
+}
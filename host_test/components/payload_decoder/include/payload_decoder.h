@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_attr.h"
+
+#include "rtc_wake_stub_buffer.h"
+#include "rtc_wake_stub_stats.h"
+
+// Decoder of the MQTT payloads, the consumer side of json_encoder.h and compact_encoder.h.
+//
+// Both formats decode into the same records, in the order they were added to the message,
+// so a payload can be checked against the records it was encoded from and the two formats
+// against each other. The JSON decoder only accepts the schema the encoder writes.
+
+// Maximum length of a room ID, the compact format stores it with a length byte.
+#define PAYLOAD_ROOM_ID_MAX 255
+
+/**
+ * @brief Kind of a decoded record.
+ */
+typedef enum {
+    PAYLOAD_RECORD_EVENT = 0,       // < Sensor event or activity span.
+    PAYLOAD_RECORD_BATTERY,         // < Battery reading.
+    PAYLOAD_RECORD_WAKE_STATS,      // < Wake cost statistics.
+} payload_record_kind_t;
+
+/**
+ * @brief A record decoded from a payload.
+ *
+ * Values are kept in the units of the compact format. The JSON format has the battery
+ * voltage and charge with one decimal only, so they are decoded with that precision.
+ */
+typedef struct {
+    payload_record_kind_t kind;                 // < Kind of the record.
+    uint64_t timestamp;                         // < The actual Unix timestamp in milliseconds.
+
+    // PAYLOAD_RECORD_EVENT
+    event_type_t type;                          // < Type of the event.
+    char room_id[PAYLOAD_ROOM_ID_MAX + 1];      // < Room ID reported with the event.
+    uint32_t duration;                          // < Span duration in milliseconds, 0 for a single trigger.
+    uint32_t count;                             // < Number of triggers, 1 for a single trigger.
+
+    // PAYLOAD_RECORD_BATTERY
+    uint32_t voltage_mv;                        // < Battery voltage in millivolts.
+    uint32_t soc_tenths;                        // < State of charge in tenths of a percent.
+
+    // PAYLOAD_RECORD_WAKE_STATS
+    uint32_t period_sec;                        // < Length of the period the statistics cover.
+    uint32_t stub_wakes;                        // < Wakes handled by the wake-up stub alone.
+    uint32_t boots;                             // < Wakes that booted the main application.
+    uint64_t stub_ms;                           // < Time spent in the stub on stub-only wakes.
+    uint64_t phase_ms[WAKE_PHASE_COUNT];        // < Time spent in every boot phase.
+    uint32_t histogram[WAKE_STATS_BUCKETS];     // < Awake time histogram of the boots.
+    uint64_t light_sleep_ms;                    // < Time spent in automatic light sleep.
+    uint32_t published;                         // < Sensor events acknowledged by the broker.
+    uint64_t latency_avg_ms;                    // < Average time from a trigger to its acknowledgment.
+    uint32_t latency_max_ms;                    // < Longest time from a trigger to its acknowledgment.
+    uint64_t connect_ack_avg_ms;                // < Average time from the MQTT connect to the first PUBACK of a boot.
+    uint32_t connect_ack_max_ms;                // < Longest time from the MQTT connect to the first PUBACK of a boot.
+} payload_record_t;
+
+/**
+ * @brief Decodes a compact payload (compact_encoder.h).
+ *
+ * @param data        The payload.
+ * @param len         Length of the payload in bytes.
+ * @param[out] records Decoded records.
+ * @param max         Size of @p records.
+ * @return Number of records, -1 if the payload is malformed or truncated or has more than
+ *         @p max records.
+ */
+int payload_decode_compact(const uint8_t *data, size_t len, payload_record_t *records, size_t max);
+
+/**
+ * @brief Decodes a JSON payload (json_encoder.h).
+ *
+ * @param json        The payload, NUL terminated.
+ * @param[out] records Decoded records.
+ * @param max         Size of @p records.
+ * @return Number of records, -1 if the payload is malformed or truncated or has more than
+ *         @p max records.
+ */
+int payload_decode_json(const char *json, payload_record_t *records, size_t max);
@@ -0,0 +1,370 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include "esp_attr.h"
+
+#include "compact_encoder.h"
+#include "payload_decoder.h"
+
+/**
+ * @brief Read position in a compact payload.
+ */
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+    bool error;         // < Set when a read went past the end of the payload.
+} compact_reader_t;
+
+static uint8_t get_byte(compact_reader_t *r)
+{
+    if (r->pos >= r->len) {
+        r->error = true;
+        return 0;
+    }
+    return r->data[r->pos++];
+}
+
+static uint64_t get_varint(compact_reader_t *r)
+{
+    uint64_t value = 0;
+    for (uint32_t shift = 0; shift < 64; shift += 7) {
+        uint8_t b = get_byte(r);
+        value |= (uint64_t)(b & 0x7F) << shift;
+        if ((b & 0x80) == 0) {
+            return value;
+        }
+    }
+    // More than 10 bytes
+    r->error = true;
+    return 0;
+}
+
+// Reads the zigzag encoded difference to the previous timestamp.
+static uint64_t get_timestamp(compact_reader_t *r, uint64_t previous)
+{
+    uint64_t zigzag = get_varint(r);
+    int64_t delta = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+    return previous + (uint64_t)delta;
+}
+
+int payload_decode_compact(const uint8_t *data, size_t len, payload_record_t *records, size_t max)
+{
+    compact_reader_t r = {.data = data, .len = len, .pos = 0, .error = false};
+    if (get_byte(&r) != COMPACT_MAGIC || get_byte(&r) != COMPACT_VERSION || r.error) {
+        return -1;
+    }
+
+    char rooms[COMPACT_MAX_ROOMS][PAYLOAD_ROOM_ID_MAX + 1];
+    uint32_t room_count = 0;
+    uint64_t timestamp = 0;
+    size_t count = 0;
+
+    while (r.pos < r.len) {
+        uint8_t tag = get_byte(&r);
+        uint8_t kind = tag & 0x07;
+        uint32_t room = tag >> 4;
+        bool span = (tag & COMPACT_TAG_SPAN) != 0;
+
+        if (tag == COMPACT_ROOM) {
+            if (room_count == COMPACT_MAX_ROOMS) {
+                return -1;
+            }
+            uint8_t room_len = get_byte(&r);
+            for (uint32_t i = 0; i < room_len; i++) {
+                rooms[room_count][i] = (char)get_byte(&r);
+            }
+            rooms[room_count][room_len] = '\0';
+            room_count++;
+        } else if (kind == COMPACT_PIR || kind == COMPACT_MAGNETIC) {
+            // The room has to be defined before the first record that refers to it
+            if (room >= room_count || count == max) {
+                return -1;
+            }
+            payload_record_t *record = &records[count++];
+            memset(record, 0, sizeof(*record));
+            record->kind = PAYLOAD_RECORD_EVENT;
+            record->type = kind == COMPACT_MAGNETIC ? EVENT_TYPE_MAGNETIC_SWITCH : EVENT_TYPE_PIR;
+            strcpy(record->room_id, rooms[room]);
+            record->timestamp = timestamp = get_timestamp(&r, timestamp);
+            record->duration = span ? (uint32_t)get_varint(&r) : 0;
+            record->count = span ? (uint32_t)get_varint(&r) : 1;
+        } else if (tag == COMPACT_BATTERY) {
+            if (count == max) {
+                return -1;
+            }
+            payload_record_t *record = &records[count++];
+            memset(record, 0, sizeof(*record));
+            record->kind = PAYLOAD_RECORD_BATTERY;
+            record->timestamp = timestamp = get_timestamp(&r, timestamp);
+            record->voltage_mv = (uint32_t)get_varint(&r);
+            record->soc_tenths = (uint32_t)get_varint(&r);
+        } else if (tag == COMPACT_WAKE_STATS) {
+            if (count == max) {
+                return -1;
+            }
+            payload_record_t *record = &records[count++];
+            memset(record, 0, sizeof(*record));
+            record->kind = PAYLOAD_RECORD_WAKE_STATS;
+            record->timestamp = timestamp = get_timestamp(&r, timestamp);
+            record->period_sec = (uint32_t)get_varint(&r);
+            record->stub_wakes = (uint32_t)get_varint(&r);
+            record->boots = (uint32_t)get_varint(&r);
+            record->stub_ms = get_varint(&r);
+            for (uint32_t i = 0; i < WAKE_PHASE_COUNT; i++) {
+                record->phase_ms[i] = get_varint(&r);
+            }
+            for (uint32_t i = 0; i < WAKE_STATS_BUCKETS; i++) {
+                record->histogram[i] = (uint32_t)get_varint(&r);
+            }
+            record->light_sleep_ms = get_varint(&r);
+            record->published = (uint32_t)get_varint(&r);
+            record->latency_avg_ms = get_varint(&r);
+            record->latency_max_ms = (uint32_t)get_varint(&r);
+            record->connect_ack_avg_ms = get_varint(&r);
+            record->connect_ack_max_ms = (uint32_t)get_varint(&r);
+        } else {
+            return -1;
+        }
+
+        if (r.error) {
+            return -1;
+        }
+    }
+    return (int)count;
+}
+
+/**
+ * @brief Numeric field of a JSON value object.
+ */
+typedef struct {
+    const char *key;
+    size_t offset;      // < Offset of the field in payload_record_t.
+    size_t size;        // < Size of the field, 4 or 8 bytes.
+    uint32_t scale;     // < Divisor of the value in thousandths.
+} json_field_t;
+
+#define FIELD(key, member, scale) {key, offsetof(payload_record_t, member), sizeof(((payload_record_t *)0)->member), scale}
+
+static const json_field_t json_fields[] = {
+    FIELD("timestamp", timestamp, 1000),
+    FIELD("duration", duration, 1000),
+    FIELD("count", count, 1000),
+    FIELD("voltage", voltage_mv, 1),
+    FIELD("soc", soc_tenths, 100),
+    FIELD("period", period_sec, 1000),
+    FIELD("stubWakes", stub_wakes, 1000),
+    FIELD("boots", boots, 1000),
+    FIELD("stubMs", stub_ms, 1000),
+    FIELD("bootStubMs", phase_ms[WAKE_PHASE_STUB], 1000),
+    FIELD("wifiMs", phase_ms[WAKE_PHASE_WIFI], 1000),
+    FIELD("clockMs", phase_ms[WAKE_PHASE_CLOCK], 1000),
+    FIELD("mqttMs", phase_ms[WAKE_PHASE_MQTT], 1000),
+    FIELD("gaugeMs", phase_ms[WAKE_PHASE_GAUGE], 1000),
+    FIELD("awakeMs", phase_ms[WAKE_PHASE_AWAKE], 1000),
+    FIELD("lightSleepMs", light_sleep_ms, 1000),
+    FIELD("published", published, 1000),
+    FIELD("latencyAvgMs", latency_avg_ms, 1000),
+    FIELD("latencyMaxMs", latency_max_ms, 1000),
+    FIELD("connectAckAvgMs", connect_ack_avg_ms, 1000),
+    FIELD("connectAckMaxMs", connect_ack_max_ms, 1000),
+};
+
+static void skip_space(const char **p)
+{
+    while (**p == ' ' || **p == '\n' || **p == '\r' || **p == '\t') {
+        (*p)++;
+    }
+}
+
+// Consumes the character c, after optional white space.
+static bool expect(const char **p, char c)
+{
+    skip_space(p);
+    if (**p != c) {
+        return false;
+    }
+    (*p)++;
+    return true;
+}
+
+// Returns true if the next character is c, without consuming it.
+static bool peek(const char **p, char c)
+{
+    skip_space(p);
+    return **p == c;
+}
+
+// Reads a string, with the escapes the encoder writes (quotes and backslashes).
+static bool read_string(const char **p, char *out, size_t size)
+{
+    if (!expect(p, '"')) {
+        return false;
+    }
+    size_t len = 0;
+    while (**p != '"') {
+        if (**p == '\0') {
+            return false;
+        }
+        if (**p == '\\') {
+            (*p)++;
+            if (**p != '"' && **p != '\\') {
+                return false;
+            }
+        }
+        if (len + 1 >= size) {
+            return false;
+        }
+        out[len++] = *(*p)++;
+    }
+    (*p)++;
+    out[len] = '\0';
+    return true;
+}
+
+// Reads an unsigned number with up to three decimals, in thousandths.
+static bool read_number(const char **p, uint64_t *thousandths)
+{
+    skip_space(p);
+    if (**p < '0' || **p > '9') {
+        return false;
+    }
+    uint64_t value = 0;
+    while (**p >= '0' && **p <= '9') {
+        value = value * 10 + (uint64_t)(*(*p)++ - '0');
+    }
+    uint32_t decimals = 0;
+    if (**p == '.') {
+        (*p)++;
+        while (**p >= '0' && **p <= '9') {
+            if (++decimals > 3) {
+                return false;
+            }
+            value = value * 10 + (uint64_t)(*(*p)++ - '0');
+        }
+        if (decimals == 0) {
+            return false;
+        }
+    }
+    for (; decimals < 3; decimals++) {
+        value *= 10;
+    }
+    *thousandths = value;
+    return true;
+}
+
+static bool read_field(const char **p, const char *key, payload_record_t *record)
+{
+    if (strcmp(key, "roomID") == 0) {
+        return record->kind == PAYLOAD_RECORD_EVENT && read_string(p, record->room_id, sizeof(record->room_id));
+    }
+    if (strcmp(key, "histogram") == 0) {
+        if (!expect(p, '[')) {
+            return false;
+        }
+        for (uint32_t i = 0; i < WAKE_STATS_BUCKETS; i++) {
+            uint64_t value;
+            if ((i > 0 && !expect(p, ',')) || !read_number(p, &value)) {
+                return false;
+            }
+            record->histogram[i] = (uint32_t)(value / 1000);
+        }
+        return expect(p, ']');
+    }
+
+    for (size_t i = 0; i < sizeof(json_fields) / sizeof(json_fields[0]); i++) {
+        const json_field_t *field = &json_fields[i];
+        if (strcmp(key, field->key) != 0) {
+            continue;
+        }
+        uint64_t value;
+        if (!read_number(p, &value)) {
+            return false;
+        }
+        value /= field->scale;
+        uint8_t *dst = (uint8_t *)record + field->offset;
+        if (field->size == sizeof(uint64_t)) {
+            memcpy(dst, &value, sizeof(uint64_t));
+        } else {
+            uint32_t value32 = (uint32_t)value;
+            memcpy(dst, &value32, sizeof(uint32_t));
+        }
+        return true;
+    }
+    return false;
+}
+
+// Reads one object of the "values" array of a sensor.
+static bool read_value(const char **p, payload_record_kind_t kind, event_type_t type, payload_record_t *record)
+{
+    memset(record, 0, sizeof(*record));
+    record->kind = kind;
+    record->type = type;
+    record->count = 1;
+
+    if (!expect(p, '{')) {
+        return false;
+    }
+    do {
+        char key[32];
+        if (!read_string(p, key, sizeof(key)) || !expect(p, ':') || !read_field(p, key, record)) {
+            return false;
+        }
+    } while (expect(p, ','));
+    return expect(p, '}');
+}
+
+int payload_decode_json(const char *json, payload_record_t *records, size_t max)
+{
+    const char **p = &json;
+    char key[32];
+    if (!expect(p, '{') || !read_string(p, key, sizeof(key)) || strcmp(key, "sensors") != 0 ||
+        !expect(p, ':') || !expect(p, '[')) {
+        return -1;
+    }
+
+    size_t count = 0;
+    if (!peek(p, ']')) {
+        do {
+            char name[32];
+            if (!expect(p, '{') || !read_string(p, key, sizeof(key)) || strcmp(key, "name") != 0 ||
+                !expect(p, ':') || !read_string(p, name, sizeof(name)) || !expect(p, ',') ||
+                !read_string(p, key, sizeof(key)) || strcmp(key, "values") != 0 ||
+                !expect(p, ':') || !expect(p, '[')) {
+                return -1;
+            }
+
+            // Sensor names of mqtt.c
+            payload_record_kind_t kind = PAYLOAD_RECORD_EVENT;
+            event_type_t type = EVENT_TYPE_PIR;
+            if (strcmp(name, "MagneticSwitch") == 0) {
+                type = EVENT_TYPE_MAGNETIC_SWITCH;
+            } else if (strcmp(name, "battery") == 0) {
+                kind = PAYLOAD_RECORD_BATTERY;
+            } else if (strcmp(name, "wakeStats") == 0) {
+                kind = PAYLOAD_RECORD_WAKE_STATS;
+            } else if (strcmp(name, "PIR") != 0) {
+                return -1;
+            }
+
+            if (!peek(p, ']')) {
+                do {
+                    if (count == max || !read_value(p, kind, type, &records[count])) {
+                        return -1;
+                    }
+                    count++;
+                } while (expect(p, ','));
+            }
+            if (!expect(p, ']') || !expect(p, '}')) {
+                return -1;
+            }
+        } while (expect(p, ','));
+    }
+
+    if (!expect(p, ']') || !expect(p, '}')) {
+        return -1;
+    }
+    skip_space(p);
+    return **p == '\0' ? (int)count : -1;
+}
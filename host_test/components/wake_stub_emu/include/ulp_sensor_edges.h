@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "rtc_wake_stub_channels.h"
+#include "rtc_wake_stub_ulp.h"
+
+// Host replacement of the header ulp_embed_binary() generates for ulp/sensor_edges.S.
+//
+// The variables of the ULP program are kept in one struct laid out like its .bss section,
+// so the indexing of the arrays in rtc_wake_stub_ulp.c, e.g. (&ulp_edge_time_lo)[slot],
+// stays within an array on the host.
+
+/**
+ * @brief RTC slow memory of the ULP program, see ulp/sensor_edges.S.
+ */
+typedef struct {
+    uint32_t channel_count;
+    uint32_t channel_io[SENSOR_CHANNELS_MAX];
+    uint32_t channel_wake[SENSOR_CHANNELS_MAX];
+    uint32_t channel_level[SENSOR_CHANNELS_MAX];
+    uint32_t wake_threshold;
+    uint32_t wake_pending;
+    uint32_t edge_head;
+    uint32_t edge_tail;
+    uint32_t edge_dropped;
+    uint32_t edge_channel[ULP_EDGE_SLOTS];
+    uint32_t edge_time_lo[ULP_EDGE_SLOTS];
+    uint32_t edge_time_mid[ULP_EDGE_SLOTS];
+    uint32_t edge_time_hi[ULP_EDGE_SLOTS];
+} ulp_sensor_edges_mem_t;
+
+// Emulated RTC slow memory of the ULP program (wake_stub_emu.c).
+extern ulp_sensor_edges_mem_t ulp_sensor_edges_mem;
+
+#define ulp_channel_count  (ulp_sensor_edges_mem.channel_count)
+#define ulp_channel_io     (ulp_sensor_edges_mem.channel_io[0])
+#define ulp_channel_wake   (ulp_sensor_edges_mem.channel_wake[0])
+#define ulp_channel_level  (ulp_sensor_edges_mem.channel_level[0])
+#define ulp_wake_threshold (ulp_sensor_edges_mem.wake_threshold)
+#define ulp_wake_pending   (ulp_sensor_edges_mem.wake_pending)
+#define ulp_edge_head      (ulp_sensor_edges_mem.edge_head)
+#define ulp_edge_tail      (ulp_sensor_edges_mem.edge_tail)
+#define ulp_edge_dropped   (ulp_sensor_edges_mem.edge_dropped)
+#define ulp_edge_channel   (ulp_sensor_edges_mem.edge_channel[0])
+#define ulp_edge_time_lo   (ulp_sensor_edges_mem.edge_time_lo[0])
+#define ulp_edge_time_mid  (ulp_sensor_edges_mem.edge_time_mid[0])
+#define ulp_edge_time_hi   (ulp_sensor_edges_mem.edge_time_hi[0])
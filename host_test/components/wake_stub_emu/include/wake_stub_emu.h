@@ -0,0 +1,122 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "rtc_wake_stub_buffer.h"
+
+// Emulation of the hardware used by the wake-up stub (rtc_wake_stub_hal.h) for the linux target.
+//
+// The emulation keeps the RTC time, the levels of the sensor pins, the EXT1 wake-up sources
+// and the sleep timer. wake_stub_emu_run() replays a trace of sensor level changes: it sleeps
+// until the next EXT1 or timer wake-up, runs wake_stub() and, whenever the stub boots the
+// main application, runs a model of it that delivers the pending events and goes to deep
+// sleep again like app_main() does. The RTC slow clock is emulated with one tick per
+// microsecond.
+//
+// wake_stub_emu_ulp_start() and wake_stub_emu_ulp_run() run a C model of the ULP program
+// ulp/sensor_edges.S (CONFIG_ULP_EDGE_COUNTER) on the same RTC IOs and RTC counter, with its
+// RTC slow memory in ulp_sensor_edges_mem (ulp_sensor_edges.h). The model is written by hand
+// and only covers the ring protocol between the ULP and the CPU side (rtc_wake_stub_ulp.c,
+// ulp_edges.c): the assembled program is not run, so a bug in sensor_edges.S that the model
+// does not repeat goes unnoticed.
+
+// Unix time (in milliseconds) of RTC time 0, the clock model starts synchronized to it.
+#define WAKE_STUB_EMU_EPOCH_MS 1700000000000ULL
+
+// Maximum number of delivered records kept in wake_stub_emu_result_t.
+#define WAKE_STUB_EMU_MAX_RECORDS 64
+
+/**
+ * @brief A level change of a sensor, at a time relative to the start of the trace.
+ */
+typedef struct {
+    uint64_t time_ms;   // < Time of the change in milliseconds.
+    uint32_t channel;   // < Sensor channel (index into sensor_channels).
+    bool level;         // < New level, the sensors are active high.
+} wake_stub_emu_edge_t;
+
+/**
+ * @brief Timing of the emulated wakes.
+ */
+typedef struct {
+    uint32_t stub_us;     // < Time from the CPU start until the stub sleeps or returns.
+    uint32_t app_us;      // < Time the main application stays awake on a boot.
+    uint32_t app_poll_ms; // < 0 to go to sleep with the active sensors masked, like app_main(). Otherwise
+                          //   the application polls the sensors at this interval until all are inactive,
+                          //   as it did before the masking.
+} wake_stub_emu_config_t;
+
+// Timing of a wake-up stub run and of a boot with Wi-Fi and MQTT.
+#define WAKE_STUB_EMU_CONFIG_DEFAULT() { .stub_us = 3000, .app_us = 3000000, .app_poll_ms = 0 }
+
+/**
+ * @brief Outcome of a replayed trace.
+ */
+typedef struct {
+    uint32_t ext1_wakes;        // < Wake-ups by a sensor pin.
+    uint32_t timer_wakes;       // < Wake-ups by the RTC timer.
+    uint32_t stub_wakes;        // < Wakes handled by the stub alone.
+    uint32_t app_boots;         // < Wakes that booted the main application.
+    uint64_t stub_us;           // < Time spent in the stub, on all wakes.
+    uint64_t app_us;            // < Time spent in the main application.
+    uint32_t delivered;         // < Records delivered by the main application.
+    event_record_t records[WAKE_STUB_EMU_MAX_RECORDS]; // < First delivered records.
+} wake_stub_emu_result_t;
+
+/**
+ * @brief Resets the emulated hardware and the RTC memory of the stub, like a power-on.
+ *
+ * The clock model is synchronized to WAKE_STUB_EMU_EPOCH_MS at RTC time 0, all sensors
+ * are inactive and enabled as EXT1 wake-up sources, and the configuration in RTC memory
+ * (MAX_PIR_EVENTS, FLUSH_MAX_EVENT_AGE_SEC, ...) is set back to its defaults.
+ *
+ * @param config Timing of the emulated wakes, NULL for WAKE_STUB_EMU_CONFIG_DEFAULT().
+ */
+void wake_stub_emu_reset(const wake_stub_emu_config_t *config);
+
+/**
+ * @brief Replays a trace, starting with the main application going to deep sleep at time 0.
+ *
+ * Call after wake_stub_emu_reset().
+ *
+ * @param trace       Level changes, sorted by time.
+ * @param count       Number of level changes.
+ * @param duration_ms Time to run for, in milliseconds.
+ * @param[out] result Outcome of the trace.
+ */
+void wake_stub_emu_run(const wake_stub_emu_edge_t *trace, size_t count, uint64_t duration_ms,
+                       wake_stub_emu_result_t *result);
+
+/**
+ * @brief Returns the emulated RTC time in microseconds.
+ */
+uint64_t wake_stub_emu_time_us(void);
+
+/**
+ * @brief Prints the log of the stub while a trace is replayed.
+ */
+void wake_stub_emu_set_verbose(bool verbose);
+
+/**
+ * @brief Sets up the ULP program like ulp_edges_start() does and starts its timer.
+ *
+ * Call after wake_stub_emu_reset(). The times of the traces passed to wake_stub_emu_ulp_run()
+ * are relative to this call.
+ */
+void wake_stub_emu_ulp_start(void);
+
+/**
+ * @brief Replays a trace in deep sleep, running the ULP program every CONFIG_ULP_EDGE_SAMPLE_PERIOD_MS.
+ *
+ * Returns when the program wakes the chip, call again with the same trace to continue after
+ * the wake-up was handled, e.g. with store_ulp_edges().
+ *
+ * @param trace    Level changes, sorted by time.
+ * @param count    Number of level changes.
+ * @param until_ms Time to run until, in milliseconds since wake_stub_emu_ulp_start().
+ * @return true if the ULP program woke the chip at the current RTC time, false if it
+ *         slept until @p until_ms.
+ */
+bool wake_stub_emu_ulp_run(const wake_stub_emu_edge_t *trace, size_t count, uint64_t until_ms);
@@ -0,0 +1,410 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <setjmp.h>
+#include "esp_attr.h"
+#include "sdkconfig.h"
+
+#include "rtc_wake_stub_hal.h"
+#include "main.h"
+#include "rtc_wake_stub.h"
+#include "rtc_wake_stub_buffer.h"
+#include "rtc_wake_stub_channels.h"
+#include "rtc_wake_stub_clock.h"
+#include "rtc_wake_stub_flush.h"
+#include "rtc_wake_stub_stats.h"
+#include "rtc_wake_stub_ulp.h"
+#include "gauge.h"
+#include "ulp_sensor_edges.h"
+#include "wake_stub_emu.h"
+
+// RTC variables defined by main.c and gauge.c, which do not build for the host.
+RTC_DATA_ATTR uint32_t MAX_PIR_EVENTS = CONFIG_MAX_PIR_EVENTS;
+RTC_DATA_ATTR uint32_t BATTERY_INFO_INTERVAL_SEC = CONFIG_BATTERY_INFO_INTERVAL_SEC;
+RTC_DATA_ATTR uint32_t AUTOMATIC_WAKEUP_INTERVAL_SEC = CONFIG_WAKEUP_INTERVAL_SEC;
+RTC_DATA_ATTR device_info_t this_device;
+RTC_DATA_ATTR uint64_t rtc_time_at_last_sync = 0;
+RTC_DATA_ATTR uint64_t actual_time_at_last_sync = 0;
+RTC_DATA_ATTR uint32_t battery_soc = 100;
+
+// Defined by rtc_wake_stub.c, only used by the stub itself.
+extern uint64_t last_battery_info_time_RTC;
+
+ulp_sensor_edges_mem_t ulp_sensor_edges_mem;
+
+// RTC IO number of the RTC capable GPIOs of the ESP32, -1 for the other GPIOs.
+static const int8_t gpio_rtc_io[40] = {
+    11, -1, 12, -1, 10, -1, -1, -1, -1, -1, -1, -1, 15, 14, 16, 13, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, 6, 7, 17, -1, -1, -1, -1, 9, 8, 4, 5, 0, 1, 2, 3,
+};
+
+// Value of an armed timer that never fires.
+#define TIMER_DISARMED UINT64_MAX
+
+// The ULP `st` instruction writes the value to the lower half-word and the program counter
+// to the upper one, which the CPU has to mask (ULP_WORD in rtc_wake_stub_ulp.c).
+#define ULP_ST_PC_BITS 0x00C80000
+
+static wake_stub_emu_config_t s_config;
+static bool s_verbose;
+
+static uint64_t s_rtc_us;                   // RTC time.
+static bool s_level[SENSOR_RTC_IO_COUNT];   // Levels of the RTC IOs.
+static uint32_t s_ext1_mask;                // RTC IOs enabled as EXT1 wake-up sources.
+static uint32_t s_ext1_status;              // RTC IOs that caused the EXT1 wake-up.
+static uint32_t s_cause;                    // Wake-up cause.
+static uint64_t s_timer_at_us;              // RTC time of the timer wake-up.
+static jmp_buf s_sleep;                     // Returns from wake_stub() into deep sleep.
+static uint64_t s_ulp_start_us;             // RTC time of wake_stub_emu_ulp_start().
+static size_t s_ulp_next;                   // Next level change of the trace replayed by the ULP.
+
+uint32_t wake_stub_hal_get_wakeup_cause(void)
+{
+    return s_cause;
+}
+
+uint32_t wake_stub_hal_get_ext1_status(void)
+{
+    return s_ext1_status;
+}
+
+bool wake_stub_hal_get_rtcio_level(int rtc_io_num)
+{
+    return s_level[rtc_io_num];
+}
+
+bool wake_stub_hal_ext1_enabled(int rtc_io_num)
+{
+    return (s_ext1_mask & (1 << rtc_io_num)) != 0;
+}
+
+void wake_stub_hal_ext1_enable(int rtc_io_num, bool enable)
+{
+    if (enable) {
+        s_ext1_mask |= 1 << rtc_io_num;
+    } else {
+        s_ext1_mask &= ~(1 << rtc_io_num);
+    }
+}
+
+void wake_stub_hal_set_wakeup_time_us(uint64_t time_us)
+{
+    s_timer_at_us = s_rtc_us + time_us;
+}
+
+void wake_stub_hal_sleep(void (*stub)(void))
+{
+    longjmp(s_sleep, 1);
+}
+
+void wake_stub_hal_boot_app(void)
+{
+    // The application boots once wake_stub() returns
+}
+
+void wake_stub_hal_feed_watchdog(void)
+{
+}
+
+uint32_t wake_stub_hal_get_cycle_time_us(void)
+{
+    return s_config.stub_us;
+}
+
+uint64_t wake_stub_hal_rtc_ticks_to_us(uint64_t ticks)
+{
+    return ticks;
+}
+
+uint64_t wake_stub_hal_get_rtc_time_us(void)
+{
+    return s_rtc_us;
+}
+
+void wake_stub_hal_log(const char *format, ...)
+{
+    if (!s_verbose) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+void wake_stub_emu_set_verbose(bool verbose)
+{
+    s_verbose = verbose;
+}
+
+uint64_t wake_stub_emu_time_us(void)
+{
+    return s_rtc_us;
+}
+
+void wake_stub_emu_reset(const wake_stub_emu_config_t *config)
+{
+    wake_stub_emu_config_t default_config = WAKE_STUB_EMU_CONFIG_DEFAULT();
+    s_config = config != NULL ? *config : default_config;
+
+    MAX_PIR_EVENTS = CONFIG_MAX_PIR_EVENTS;
+    BATTERY_INFO_INTERVAL_SEC = CONFIG_BATTERY_INFO_INTERVAL_SEC;
+    AUTOMATIC_WAKEUP_INTERVAL_SEC = CONFIG_WAKEUP_INTERVAL_SEC;
+    PIR_COALESCE_WINDOW_MS = CONFIG_PIR_COALESCE_WINDOW_MS;
+    EVENT_BUFFER_POLICY = CONFIG_EVENT_BUFFER_POLICY;
+    FLUSH_MAX_EVENT_AGE_SEC = CONFIG_FLUSH_MAX_EVENT_AGE_SEC;
+    FLUSH_FILL_PERCENT = CONFIG_FLUSH_FILL_PERCENT;
+    FLUSH_LOW_SOC_PERCENT = CONFIG_FLUSH_LOW_SOC_PERCENT;
+    flush_retry_at_ms = 0;
+    flush_backlog_pending = false;
+    battery_soc = 100;
+    last_battery_info_time_RTC = 0;
+    memset(&wake_stats, 0, sizeof(wake_stats));
+    memset(&ulp_sensor_edges_mem, 0, sizeof(ulp_sensor_edges_mem));
+    // Catch up with the cleared drop counter
+    ulp_edges_take_dropped();
+
+    // Clock synchronized at RTC time 0, without drift
+    rtc_time_at_last_sync = 0;
+    actual_time_at_last_sync = WAKE_STUB_EMU_EPOCH_MS;
+    rtc_drift_ppb = 0;
+    time_sync_count = 1;
+
+    // Empty buffer, no open span
+    close_pir_span();
+    event_buffer_clear();
+    dropped_event_count = 0;
+
+    s_rtc_us = 0;
+    s_ext1_mask = 0;
+    s_timer_at_us = TIMER_DISARMED;
+    memset(s_level, 0, sizeof(s_level));
+    for (uint32_t i = 0; i < sensor_channel_count; i++) {
+        sensor_channels[i].rtc_io_num = gpio_rtc_io[sensor_channels[i].pin];
+        s_ext1_mask |= 1 << sensor_channels[i].rtc_io_num;
+    }
+    sensor_channels_init();
+}
+
+/**
+ * @brief Returns true if any sensor is active.
+ */
+static bool any_sensor_active(void)
+{
+    for (uint32_t i = 0; i < sensor_channel_count; i++) {
+        if (s_level[sensor_channels[i].rtc_io_num]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Model of the main application: delivers the pending events and goes to deep sleep.
+ *
+ * Like app_main(), the pins of the sensors that are still active are left out of the EXT1
+ * wake-up sources and the timer checks them again, otherwise the timer is armed for
+ * AUTOMATIC_WAKEUP_INTERVAL_SEC or the retry time of the journal backlog. The delivery
+ * always succeeds, flush_retry_at_ms and flush_backlog_pending are left as the test set them.
+ */
+static void app_sleep(wake_stub_emu_result_t *result)
+{
+    close_pir_span();
+    event_record_t record;
+    while (event_buffer_pop(&record)) {
+        if (result->delivered < WAKE_STUB_EMU_MAX_RECORDS) {
+            result->records[result->delivered] = record;
+        }
+        result->delivered++;
+    }
+
+    bool sensor_active = false;
+    uint32_t recheck_sec = 0;
+    for (uint32_t i = 0; i < sensor_channel_count; i++) {
+        const sensor_channel_t *channel = &sensor_channels[i];
+        bool active = s_level[channel->rtc_io_num];
+        wake_stub_hal_ext1_enable(channel->rtc_io_num, !active);
+        if (active && (!sensor_active || channel->debounce_sec < recheck_sec)) {
+            sensor_active = true;
+            recheck_sec = channel->debounce_sec;
+        }
+    }
+    uint32_t timer_sec = sensor_active ? recheck_sec : AUTOMATIC_WAKEUP_INTERVAL_SEC;
+
+    // Resume an unfinished drain of the journal on time (backlog_drain_retry_in_sec())
+    if (flush_backlog_pending && flush_retry_at_ms != 0) {
+        uint64_t now_ms = clock_model_actual_time_ms(s_rtc_us / 1000);
+        uint32_t retry_sec = now_ms >= flush_retry_at_ms ? 1 : (uint32_t)((flush_retry_at_ms - now_ms + 999) / 1000);
+        if (retry_sec < timer_sec) {
+            timer_sec = retry_sec;
+        }
+    }
+    wake_stub_hal_set_wakeup_time_us((uint64_t)timer_sec * 1000000);
+}
+
+/**
+ * @brief Applies the level changes of the trace up to the current RTC time.
+ *
+ * @return Index of the first level change still to come.
+ */
+static size_t apply_edges(const wake_stub_emu_edge_t *trace, size_t count, size_t next, uint64_t start_us)
+{
+    while (next < count && start_us + trace[next].time_ms * 1000 <= s_rtc_us) {
+        s_level[sensor_channels[trace[next].channel].rtc_io_num] = trace[next].level;
+        next++;
+    }
+    return next;
+}
+
+void wake_stub_emu_run(const wake_stub_emu_edge_t *trace, size_t count, uint64_t duration_ms,
+                       wake_stub_emu_result_t *result)
+{
+    memset(result, 0, sizeof(*result));
+    uint64_t start_us = s_rtc_us;
+    uint64_t end_us = start_us + duration_ms * 1000;
+    size_t next = 0;
+
+    app_sleep(result);
+    while (true) {
+        // Deep sleep until a high EXT1 pin or the timer wakes the chip up
+        s_cause = 0;
+        while (s_cause == 0) {
+            next = apply_edges(trace, count, next, start_us);
+            uint32_t high = 0;
+            for (int io = 0; io < SENSOR_RTC_IO_COUNT; io++) {
+                high |= s_level[io] ? 1 << io : 0;
+            }
+            if ((high & s_ext1_mask) != 0) {
+                s_cause = WAKE_STUB_CAUSE_EXT1;
+                s_ext1_status = high & s_ext1_mask;
+                break;
+            }
+            uint64_t edge_at = next < count ? start_us + trace[next].time_ms * 1000 : UINT64_MAX;
+            if (s_timer_at_us <= edge_at && s_timer_at_us < end_us) {
+                s_rtc_us = s_timer_at_us;
+                s_cause = WAKE_STUB_CAUSE_TIMER;
+                s_ext1_status = 0;
+            } else if (edge_at < end_us) {
+                s_rtc_us = edge_at;
+            } else {
+                s_rtc_us = end_us;
+                return;
+            }
+        }
+
+        // Run the stub, it either goes to sleep again or returns to boot the application
+        if (s_cause == WAKE_STUB_CAUSE_EXT1) {
+            result->ext1_wakes++;
+        } else {
+            result->timer_wakes++;
+        }
+        s_timer_at_us = TIMER_DISARMED;
+        bool slept = setjmp(s_sleep) != 0;
+        if (!slept) {
+            wake_stub();
+        }
+        s_rtc_us += s_config.stub_us;
+        result->stub_us += s_config.stub_us;
+        if (slept) {
+            result->stub_wakes++;
+            continue;
+        }
+
+        result->app_boots++;
+        result->app_us += s_config.app_us;
+        s_rtc_us += s_config.app_us;
+        next = apply_edges(trace, count, next, start_us);
+        while (s_config.app_poll_ms > 0 && any_sensor_active()) {
+            result->app_us += (uint64_t)s_config.app_poll_ms * 1000;
+            s_rtc_us += (uint64_t)s_config.app_poll_ms * 1000;
+            next = apply_edges(trace, count, next, start_us);
+        }
+        app_sleep(result);
+    }
+}
+
+static void ulp_st(uint32_t *word, uint32_t value)
+{
+    *word = ULP_ST_PC_BITS | (value & 0xFFFF);
+}
+
+static uint32_t ulp_ld(const uint32_t *word)
+{
+    return *word & 0xFFFF;
+}
+
+/**
+ * @brief Runs a hand-written model of the ULP program ulp/sensor_edges.S once.
+ *
+ * It follows the program block by block, so the CPU side can be tested against the ring it
+ * writes, but it does not execute the assembled program. The registers of the ULP are 16 bit
+ * wide, so is the arithmetic here.
+ *
+ * @return true if the program executed `wake`, the chip is always in deep sleep here.
+ */
+static bool ulp_program_run(void)
+{
+    ulp_sensor_edges_mem_t *mem = &ulp_sensor_edges_mem;
+
+    for (uint32_t channel = 0; channel != ulp_ld(&mem->channel_count) && channel < SENSOR_CHANNELS_MAX; channel++) {
+        uint32_t io = ulp_ld(&mem->channel_io[channel]);
+        uint32_t level = io < SENSOR_RTC_IO_COUNT && s_level[io];
+        uint32_t previous = ulp_ld(&mem->channel_level[channel]);
+        ulp_st(&mem->channel_level[channel], level);
+        if (level < 1 || previous >= 1) {
+            continue;
+        }
+
+        // record_edge
+        uint32_t head = ulp_ld(&mem->edge_head);
+        uint32_t unread = (head - ulp_ld(&mem->edge_tail)) & (ULP_EDGE_SLOTS - 1);
+        if (unread >= ULP_EDGE_SLOTS - 1) {
+            ulp_st(&mem->edge_dropped, ulp_ld(&mem->edge_dropped) + 1);
+        } else {
+            ulp_st(&mem->edge_channel[head], channel);
+            ulp_st(&mem->edge_time_lo[head], (uint32_t)s_rtc_us);
+            ulp_st(&mem->edge_time_mid[head], (uint32_t)(s_rtc_us >> 16));
+            ulp_st(&mem->edge_time_hi[head], (uint32_t)(s_rtc_us >> 32));
+            ulp_st(&mem->edge_head, (head + 1) & (ULP_EDGE_SLOTS - 1));
+        }
+
+        if (ulp_ld(&mem->channel_wake[channel]) >= 1) {
+            ulp_st(&mem->wake_pending, 1);
+        }
+    }
+
+    if (ulp_ld(&mem->wake_pending) >= 1) {
+        return true;
+    }
+    uint32_t unread = (ulp_ld(&mem->edge_head) - ulp_ld(&mem->edge_tail)) & (ULP_EDGE_SLOTS - 1);
+    return ((unread - ulp_ld(&mem->wake_threshold)) & 0x8000) == 0;
+}
+
+void wake_stub_emu_ulp_start(void)
+{
+    // Start from the current levels, so a sensor that is already active is not counted
+    for (uint32_t i = 0; i < sensor_channel_count; i++) {
+        (&ulp_channel_io)[i] = sensor_channels[i].rtc_io_num;
+        (&ulp_channel_wake)[i] = sensor_channels[i].flush == SENSOR_FLUSH_IMMEDIATE;
+        (&ulp_channel_level)[i] = s_level[sensor_channels[i].rtc_io_num];
+    }
+    ulp_channel_count = sensor_channel_count;
+    ulp_edges_arm_wakeup(0);
+
+    s_ulp_start_us = s_rtc_us;
+    s_ulp_next = 0;
+}
+
+bool wake_stub_emu_ulp_run(const wake_stub_emu_edge_t *trace, size_t count, uint64_t until_ms)
+{
+    uint64_t period_us = (uint64_t)CONFIG_ULP_EDGE_SAMPLE_PERIOD_MS * 1000;
+    uint64_t end_us = s_ulp_start_us + until_ms * 1000;
+    while (s_rtc_us + period_us <= end_us) {
+        s_rtc_us += period_us;
+        s_ulp_next = apply_edges(trace, count, s_ulp_next, s_ulp_start_us);
+        if (ulp_program_run()) {
+            return true;
+        }
+    }
+    return false;
+}
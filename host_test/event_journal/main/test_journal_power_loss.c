@@ -0,0 +1,227 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "unity.h"
+
+#include "main.h"
+#include "event_journal.h"
+#include "rtc_wake_stub_buffer.h"
+#include "esp_partition_emu.h"
+
+// The journal partition: four sectors of eight full blocks each.
+#define SECTORS          4
+#define BLOCK_EVENTS     EVENT_JOURNAL_BLOCK_EVENTS
+#define BLOCKS_PER_SECTOR 8
+
+// Layout of a full block, see event_journal.h.
+#define HEADER_SIZE      20
+#define PAYLOAD_SIZE     (BLOCK_EVENTS * 15)
+#define BLOCK_SIZE       (HEADER_SIZE + PAYLOAD_SIZE + 4)
+
+#define PIR 0
+
+// Timestamp of the n-th event of a test.
+#define EVENT_TIME(n) (1700000000000ULL + (uint64_t)(n) * 1000)
+
+/**
+ * @brief Starts a test on an erased journal partition and an empty RTC event buffer.
+ */
+static void journal_reset(void)
+{
+    esp_log_level_set("journal", ESP_LOG_NONE);
+    esp_partition_emu_init(EVENT_JOURNAL_PARTITION, SECTORS * ESP_PARTITION_EMU_SECTOR_SIZE);
+    event_buffer_clear();
+    dropped_event_count = 0;
+    event_journal_unmount();
+}
+
+/**
+ * @brief Powers the node on after a power cut: the RTC memory is lost, the flash is kept.
+ */
+static void power_on(void)
+{
+    esp_partition_emu_power_on();
+    event_buffer_clear();
+    dropped_event_count = 0;
+    event_journal_unmount();
+}
+
+/**
+ * @brief Stores the events @p first to @p first + @p count - 1 in the RTC event buffer.
+ */
+static void add_events(uint32_t first, uint32_t count)
+{
+    for (uint32_t i = first; i < first + count; i++) {
+        TEST_ASSERT_TRUE(event_buffer_push(PIR, EVENT_TIME(i)));
+    }
+}
+
+/**
+ * @brief Appends a full block with the events starting at @p first.
+ */
+static void spill_block(uint32_t first)
+{
+    add_events(first, BLOCK_EVENTS);
+    TEST_ASSERT_EQUAL(BLOCK_EVENTS, event_journal_spill());
+}
+
+/**
+ * @brief Delivers all pending blocks, they have to hold the events @p first, @p first + 1, ...
+ *
+ * @return Number of delivered events.
+ */
+static uint32_t drain(uint32_t first)
+{
+    event_record_t events[BLOCK_EVENTS];
+    uint32_t count;
+    uint32_t delivered = 0;
+    while (event_journal_peek(events, &count)) {
+        for (uint32_t i = 0; i < count; i++) {
+            TEST_ASSERT_EQUAL(PIR, events[i].channel);
+            TEST_ASSERT_EQUAL(EVENT_TYPE_PIR, events[i].type);
+            TEST_ASSERT_EQUAL(EVENT_TIME(first + delivered), events[i].timestamp);
+            TEST_ASSERT_EQUAL(1, events[i].count);
+            delivered++;
+        }
+        event_journal_consume();
+    }
+    TEST_ASSERT_EQUAL(0, event_journal_pending_blocks());
+    return delivered;
+}
+
+/**
+ * @brief Cuts the power after @p from to @p to - 1 bytes of the third block were programmed.
+ *
+ * After the power-on, the two blocks before have to be intact, the third one is either
+ * complete (only if @p may_commit) or skipped, and new blocks are appended behind them.
+ */
+static void check_cut_while_appending(uint32_t from, uint32_t to, bool may_commit)
+{
+    for (uint32_t cut = from; cut < to; cut++) {
+        journal_reset();
+        spill_block(0);
+        spill_block(BLOCK_EVENTS);
+        add_events(2 * BLOCK_EVENTS, BLOCK_EVENTS);
+
+        esp_partition_emu_cut_after_bytes(cut);
+        TEST_ASSERT_EQUAL(0, event_journal_spill());
+        power_on();
+
+        uint32_t committed = event_journal_pending_blocks() * BLOCK_EVENTS;
+        if (!may_commit || committed != 3 * BLOCK_EVENTS) {
+            TEST_ASSERT_EQUAL(2 * BLOCK_EVENTS, committed);
+        }
+        spill_block(committed);
+        TEST_ASSERT_EQUAL(committed + BLOCK_EVENTS, drain(0));
+        TEST_ASSERT_EQUAL(0, esp_partition_emu_stats().bit_errors);
+    }
+}
+
+TEST_CASE("Journal delivers the spilled events in order", "[journal]")
+{
+    journal_reset();
+    add_events(0, 2 * BLOCK_EVENTS + 6);
+    TEST_ASSERT_EQUAL(2 * BLOCK_EVENTS + 6, event_journal_spill());
+    TEST_ASSERT_EQUAL(0, event_buffer_count());
+    TEST_ASSERT_EQUAL(3, event_journal_pending_blocks());
+
+    // The position is scanned from the partition after a power-on
+    power_on();
+    TEST_ASSERT_EQUAL(3, event_journal_pending_blocks());
+    TEST_ASSERT_EQUAL(2 * BLOCK_EVENTS + 6, drain(0));
+    TEST_ASSERT_EQUAL(0, esp_partition_emu_stats().bit_errors);
+}
+
+TEST_CASE("Power cut while writing a block header keeps the committed blocks", "[journal]")
+{
+    check_cut_while_appending(0, HEADER_SIZE, false);
+}
+
+TEST_CASE("Power cut while writing a block payload keeps the committed blocks", "[journal]")
+{
+    check_cut_while_appending(HEADER_SIZE, HEADER_SIZE + PAYLOAD_SIZE, false);
+}
+
+TEST_CASE("Power cut while committing a block leaves it complete or skipped", "[journal]")
+{
+    check_cut_while_appending(HEADER_SIZE + PAYLOAD_SIZE, BLOCK_SIZE, true);
+}
+
+TEST_CASE("Power cut while marking a block delivered delivers it again at most", "[journal]")
+{
+    for (uint32_t cut = 0; cut < 4; cut++) {
+        journal_reset();
+        spill_block(0);
+        spill_block(BLOCK_EVENTS);
+
+        event_record_t events[BLOCK_EVENTS];
+        uint32_t count;
+        TEST_ASSERT_TRUE(event_journal_peek(events, &count));
+        esp_partition_emu_cut_after_bytes(cut);
+        event_journal_consume();
+        power_on();
+
+        uint32_t pending = event_journal_pending_blocks();
+        TEST_ASSERT_TRUE(pending == 1 || pending == 2);
+        TEST_ASSERT_EQUAL(pending * BLOCK_EVENTS, drain((2 - pending) * BLOCK_EVENTS));
+        TEST_ASSERT_EQUAL(0, esp_partition_emu_stats().bit_errors);
+    }
+}
+
+/**
+ * @brief Cuts the power while the write position comes around to the first sector again.
+ *
+ * The first sector was delivered (@p delivered) or is dropped to make room. After the
+ * power-on, the other sectors have to be intact and the next block goes into the first one.
+ */
+static void check_cut_while_erasing(bool delivered)
+{
+    static const uint32_t erased_bytes[] = {0, 1, HEADER_SIZE, BLOCK_SIZE + 2, ESP_PARTITION_EMU_SECTOR_SIZE / 2,
+                                            ESP_PARTITION_EMU_SECTOR_SIZE - 1};
+    const uint32_t blocks = SECTORS * BLOCKS_PER_SECTOR;
+
+    for (uint32_t i = 0; i < sizeof(erased_bytes) / sizeof(erased_bytes[0]); i++) {
+        journal_reset();
+        for (uint32_t block = 0; block < blocks; block++) {
+            spill_block(block * BLOCK_EVENTS);
+        }
+        TEST_ASSERT_EQUAL(SECTORS, esp_partition_emu_stats().erases);
+        if (delivered) {
+            event_record_t events[BLOCK_EVENTS];
+            uint32_t count;
+            for (uint32_t block = 0; block < BLOCKS_PER_SECTOR; block++) {
+                TEST_ASSERT_TRUE(event_journal_peek(events, &count));
+                event_journal_consume();
+            }
+        }
+
+        add_events(blocks * BLOCK_EVENTS, BLOCK_EVENTS);
+        esp_partition_emu_cut_during_erase(0, erased_bytes[i]);
+        TEST_ASSERT_EQUAL(0, event_journal_spill());
+        power_on();
+
+        // An untouched first sector still holds its blocks until the next erase drops them
+        uint32_t pending = event_journal_pending_blocks();
+        if (delivered || erased_bytes[i] > 0) {
+            TEST_ASSERT_EQUAL(blocks - BLOCKS_PER_SECTOR, pending);
+        } else {
+            TEST_ASSERT_EQUAL(blocks, pending);
+        }
+
+        spill_block(blocks * BLOCK_EVENTS);
+        TEST_ASSERT_EQUAL(SECTORS + 2, esp_partition_emu_stats().erases);
+        TEST_ASSERT_EQUAL((blocks - BLOCKS_PER_SECTOR + 1) * BLOCK_EVENTS, drain(BLOCKS_PER_SECTOR * BLOCK_EVENTS));
+        TEST_ASSERT_EQUAL(0, esp_partition_emu_stats().bit_errors);
+    }
+}
+
+TEST_CASE("Power cut while erasing a delivered sector keeps the pending blocks", "[journal]")
+{
+    check_cut_while_erasing(true);
+}
+
+TEST_CASE("Power cut while erasing the oldest sector of a full journal keeps the other sectors", "[journal]")
+{
+    check_cut_while_erasing(false);
+}
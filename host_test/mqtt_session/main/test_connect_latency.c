@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "esp_attr.h"
+#include "unity.h"
+
+#include "main.h"
+#include "json_encoder.h"
+#include "mqtt_broker_stub.h"
+
+#define WAKES    100
+#define SLEEP_US (5 * 60 * 1000000ULL)
+#define MS       1000
+
+// Client ID of begin_mqtt() and a key of the length of the JWTs of the registry.
+#define CLIENT_ID "esp32-ec6260bce850"
+#define TOPIC     "1/4/data"
+#define JWT_LEN   300
+
+/**
+ * @brief How a wake connects and publishes.
+ */
+typedef enum {
+    WAKE_CLEAN_SESSION,         // < Clean session, PUBLISH after the CONNACK.
+    WAKE_PERSISTENT_SESSION,    // < Session kept by the broker (CONFIG_MQTT_PERSISTENT_SESSION), PUBLISH after the CONNACK.
+    WAKE_PREBUILT_CONNECT,      // < Persistent session, CONNECT built once and sent together with the PUBLISH.
+} wake_mode_t;
+
+static const char *const mode_names[] = {"clean session", "persistent session", "pre-built CONNECT"};
+
+/**
+ * @brief Connect-to-PUBACK latency of a series of wakes, in microseconds.
+ */
+typedef struct {
+    uint64_t avg_us;
+    uint64_t max_us;
+    uint32_t sessions_present;  // < Wakes whose CONNACK had the session present flag.
+} wake_series_t;
+
+static uint8_t s_connect[512];
+static size_t s_connect_len;
+static char s_payload[1024];
+static size_t s_payload_len;
+static uint8_t s_packet[sizeof(s_connect) + sizeof(s_payload) + 64];
+
+static size_t put_u16(uint8_t *p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value & 0xFF;
+    return 2;
+}
+
+static size_t put_str(uint8_t *p, const char *s, size_t len)
+{
+    put_u16(p, (uint16_t)len);
+    memcpy(&p[2], s, len);
+    return 2 + len;
+}
+
+/**
+ * @brief Writes the fixed header of a packet in front of its @p body_len bytes long body at p + 5.
+ *
+ * @return Length of the packet, which is moved to the start of @p p.
+ */
+static size_t finish_packet(uint8_t *p, uint8_t header, size_t body_len)
+{
+    uint8_t fixed[5];
+    size_t len = 0;
+    fixed[len++] = header;
+    size_t remaining = body_len;
+    do {
+        uint8_t b = remaining & 0x7F;
+        remaining >>= 7;
+        fixed[len++] = b | (remaining > 0 ? 0x80 : 0);
+    } while (remaining > 0);
+    memmove(&p[len], &p[5], body_len);
+    memcpy(p, fixed, len);
+    return len + body_len;
+}
+
+/**
+ * @brief Builds the CONNECT of begin_mqtt(): user name "JWT", the key as password.
+ */
+static size_t build_connect(uint8_t *p, bool clean)
+{
+    char jwt[JWT_LEN];
+    memset(jwt, 'k', sizeof(jwt));
+
+    uint8_t *body = &p[5];
+    size_t len = put_str(body, "MQTT", 4);
+    body[len++] = 4;                                // Protocol level 3.1.1
+    body[len++] = 0x80 | 0x40 | (clean ? 0x02 : 0); // User name, password, clean session
+    len += put_u16(&body[len], CONFIG_MQTT_KEEPALIVE_SEC);
+    len += put_str(&body[len], CLIENT_ID, strlen(CLIENT_ID));
+    len += put_str(&body[len], "JWT", 3);
+    len += put_str(&body[len], jwt, sizeof(jwt));
+    return finish_packet(p, 0x10, len);
+}
+
+static size_t build_publish(uint8_t *p, uint16_t packet_id)
+{
+    uint8_t *body = &p[5];
+    size_t len = put_str(body, TOPIC, strlen(TOPIC));
+    len += put_u16(&body[len], packet_id);
+    memcpy(&body[len], s_payload, s_payload_len);
+    return finish_packet(p, 0x32, len + s_payload_len); // PUBLISH, QoS 1
+}
+
+/**
+ * @brief Encodes the events of a wake like sendUplinkBatchToMQTT() does.
+ */
+static void build_payload(void)
+{
+    json_encoder_t enc;
+    json_encoder_init(&enc, s_payload, sizeof(s_payload));
+    TEST_ASSERT_TRUE(json_encoder_begin_sensor(&enc, "PIR"));
+    for (uint32_t i = 0; i < 5; i++) {
+        event_record_t event = {.type = EVENT_TYPE_PIR, .timestamp = 1700000000000ULL + i * 20000,
+                                .duration = i * 1000, .count = 1 + i};
+        TEST_ASSERT_TRUE(json_encoder_add_event(&enc, &event, "livingroom"));
+    }
+    s_payload_len = json_encoder_finish(&enc);
+}
+
+/**
+ * @brief Runs one wake: TCP connect, CONNECT, PUBLISH, PUBACK, DISCONNECT.
+ *
+ * @param[out] session_present Session present flag of the CONNACK.
+ * @return Time from the start of the TCP connection to the PUBACK, in microseconds.
+ */
+static uint64_t run_wake(wake_mode_t mode, uint16_t packet_id, bool *session_present)
+{
+    uint64_t start_us = mqtt_broker_stub_now_us();
+    TEST_ASSERT_TRUE(mqtt_broker_stub_connect());
+
+    // The pre-built CONNECT is kept across wakes, like in RTC memory
+    if (mode != WAKE_PREBUILT_CONNECT || s_connect_len == 0) {
+        s_connect_len = build_connect(s_connect, mode == WAKE_CLEAN_SESSION);
+    }
+    memcpy(s_packet, s_connect, s_connect_len);
+    size_t len = s_connect_len;
+    if (mode == WAKE_PREBUILT_CONNECT) {
+        // MQTT 3.1.1 lets the client send further packets without waiting for the CONNACK
+        len += build_publish(&s_packet[len], packet_id);
+    }
+    mqtt_broker_stub_send(s_packet, len);
+
+    uint8_t response[4];
+    TEST_ASSERT_EQUAL(4, mqtt_broker_stub_recv(response, sizeof(response)));
+    TEST_ASSERT_EQUAL(0x20, response[0]);
+    TEST_ASSERT_EQUAL(0, response[3]);
+    *session_present = response[2] != 0;
+
+    if (mode != WAKE_PREBUILT_CONNECT) {
+        mqtt_broker_stub_send(s_packet, build_publish(s_packet, packet_id));
+    }
+    TEST_ASSERT_EQUAL(4, mqtt_broker_stub_recv(response, sizeof(response)));
+    TEST_ASSERT_EQUAL(0x40, response[0]);
+    TEST_ASSERT_EQUAL(packet_id, response[2] << 8 | response[3]);
+    uint64_t latency_us = mqtt_broker_stub_now_us() - start_us;
+
+    const uint8_t disconnect[] = {0xE0, 0};
+    mqtt_broker_stub_send(disconnect, sizeof(disconnect));
+    mqtt_broker_stub_close();
+    return latency_us;
+}
+
+static wake_series_t run_wakes(wake_mode_t mode, const mqtt_broker_stub_config_t *config)
+{
+    mqtt_broker_stub_init(config);
+    build_payload();
+    s_connect_len = 0;
+
+    wake_series_t series = {0};
+    uint64_t total_us = 0;
+    for (uint32_t wake = 0; wake < WAKES; wake++) {
+        bool session_present;
+        uint64_t latency_us = run_wake(mode, (uint16_t)(wake + 1), &session_present);
+        total_us += latency_us;
+        series.max_us = latency_us > series.max_us ? latency_us : series.max_us;
+        series.sessions_present += session_present;
+        mqtt_broker_stub_sleep(SLEEP_US);
+    }
+    series.avg_us = total_us / WAKES;
+
+    mqtt_broker_stub_stats_t stats = mqtt_broker_stub_stats();
+    TEST_ASSERT_EQUAL(0, stats.protocol_errors);
+    TEST_ASSERT_EQUAL(WAKES, stats.connects);
+    TEST_ASSERT_EQUAL(WAKES, stats.pubacks);
+    return series;
+}
+
+TEST_CASE("broker resumes the persistent session on every wake after the first", "[mqtt]")
+{
+    const mqtt_broker_stub_config_t config = {.rtt_us = 40 * MS, .jitter_us = 10 * MS, .auth_us = 5 * MS, .seed = 1};
+    TEST_ASSERT_EQUAL(0, run_wakes(WAKE_CLEAN_SESSION, &config).sessions_present);
+    TEST_ASSERT_EQUAL(WAKES - 1, run_wakes(WAKE_PERSISTENT_SESSION, &config).sessions_present);
+    TEST_ASSERT_EQUAL(WAKES - 1, run_wakes(WAKE_PREBUILT_CONNECT, &config).sessions_present);
+}
+
+TEST_CASE("connect-to-PUBACK latency across 100 wakes", "[mqtt]")
+{
+    const mqtt_broker_stub_config_t config = {.rtt_us = 40 * MS, .jitter_us = 10 * MS, .auth_us = 5 * MS, .seed = 1};
+    wake_series_t series[3];
+    printf("%u wakes, RTT %u ms, jitter up to %u ms per packet, CONNECT auth %u ms:\n", WAKES,
+           (unsigned)(config.rtt_us / MS), (unsigned)(config.jitter_us / MS), (unsigned)(config.auth_us / MS));
+    for (wake_mode_t mode = WAKE_CLEAN_SESSION; mode <= WAKE_PREBUILT_CONNECT; mode++) {
+        series[mode] = run_wakes(mode, &config);
+        printf("  %-20s avg %6.1f ms, max %6.1f ms\n", mode_names[mode], series[mode].avg_us / 1000.0,
+               series[mode].max_us / 1000.0);
+    }
+
+    // TCP handshake, CONNECT/CONNACK and PUBLISH/PUBACK: three round trips
+    TEST_ASSERT_GREATER_OR_EQUAL(3 * config.rtt_us + config.auth_us, series[WAKE_CLEAN_SESSION].avg_us);
+    // A publish-only client does not save a round trip with the persistent session alone
+    TEST_ASSERT_LESS_OR_EQUAL(series[WAKE_CLEAN_SESSION].avg_us, series[WAKE_PERSISTENT_SESSION].avg_us);
+    TEST_ASSERT_GREATER_OR_EQUAL(series[WAKE_CLEAN_SESSION].avg_us - config.rtt_us / 10, series[WAKE_PERSISTENT_SESSION].avg_us);
+    // Sending the PUBLISH with the CONNECT saves the CONNACK round trip
+    TEST_ASSERT_LESS_OR_EQUAL(series[WAKE_PERSISTENT_SESSION].avg_us - 9 * config.rtt_us / 10, series[WAKE_PREBUILT_CONNECT].avg_us);
+}
+
+TEST_CASE("connect wait covers a slow network", "[mqtt]")
+{
+    // Congested access point: 200 ms round trips with up to 100 ms of jitter per packet
+    const mqtt_broker_stub_config_t config = {.rtt_us = 200 * MS, .jitter_us = 100 * MS, .auth_us = 20 * MS, .seed = 7};
+    wake_series_t series = run_wakes(CONFIG_MQTT_PERSISTENT_SESSION ? WAKE_PERSISTENT_SESSION : WAKE_CLEAN_SESSION, &config);
+    printf("Slow network: avg %.1f ms, max %.1f ms\n", series.avg_us / 1000.0, series.max_us / 1000.0);
+    TEST_ASSERT_LESS_THAN((uint64_t)CONFIG_MQTT_CONNECT_TIMEOUT_MS * MS, series.max_us);
+}
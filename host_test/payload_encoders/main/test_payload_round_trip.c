@@ -0,0 +1,463 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "esp_attr.h"
+#include "unity.h"
+
+#include "json_encoder.h"
+#include "compact_encoder.h"
+#include "payload_decoder.h"
+
+#define T0 1700000000000ULL
+
+#define RECORDS_MAX 128
+
+static payload_record_t s_decoded[RECORDS_MAX];
+static char s_json[8192];
+static uint8_t s_compact[2048];
+
+static payload_record_t event(event_type_t type, const char *room_id, uint64_t timestamp, uint32_t duration, uint32_t count)
+{
+    payload_record_t record = {.kind = PAYLOAD_RECORD_EVENT, .type = type, .timestamp = timestamp,
+                               .duration = duration, .count = count};
+    strcpy(record.room_id, room_id);
+    return record;
+}
+
+static payload_record_t battery(uint64_t timestamp, uint32_t voltage_mv, uint32_t soc_tenths)
+{
+    return (payload_record_t){.kind = PAYLOAD_RECORD_BATTERY, .timestamp = timestamp,
+                              .voltage_mv = voltage_mv, .soc_tenths = soc_tenths};
+}
+
+static payload_record_t wake_stats_record(uint64_t timestamp)
+{
+    payload_record_t record = {.kind = PAYLOAD_RECORD_WAKE_STATS, .timestamp = timestamp,
+                               .period_sec = 21600, .stub_wakes = 1234, .boots = 56, .stub_ms = 4321,
+                               .light_sleep_ms = 987654, .published = 300, .latency_avg_ms = 1500,
+                               .latency_max_ms = 70000, .connect_ack_avg_ms = 180, .connect_ack_max_ms = 2400};
+    for (uint32_t i = 0; i < WAKE_PHASE_COUNT; i++) {
+        record.phase_ms[i] = 1000 * (i + 1) + i;
+    }
+    for (uint32_t i = 0; i < WAKE_STATS_BUCKETS; i++) {
+        record.histogram[i] = 40 - 5 * i;
+    }
+    return record;
+}
+
+// Builds the wake statistics the encoders take from a decoded record.
+static wake_stats_t wake_stats_from(const payload_record_t *record)
+{
+    wake_stats_t stats = {.stub_wakes = record->stub_wakes, .app_boots = record->boots,
+                          .stub_us = record->stub_ms * 1000, .light_sleep_us = record->light_sleep_ms * 1000,
+                          .published_events = record->published,
+                          .publish_latency_ms = record->latency_avg_ms * record->published,
+                          .max_publish_latency_ms = record->latency_max_ms,
+                          .connect_acks = record->boots, .connect_ack_ms = record->connect_ack_avg_ms * record->boots,
+                          .max_connect_ack_ms = record->connect_ack_max_ms};
+    for (uint32_t i = 0; i < WAKE_PHASE_COUNT; i++) {
+        stats.phase_us[i] = record->phase_ms[i] * 1000;
+    }
+    for (uint32_t i = 0; i < WAKE_STATS_BUCKETS; i++) {
+        stats.awake_histogram[i] = (uint16_t)record->histogram[i];
+    }
+    return stats;
+}
+
+static event_record_t event_record_from(const payload_record_t *record)
+{
+    return (event_record_t){.type = record->type, .channel = 0, .timestamp = record->timestamp,
+                            .duration = record->duration, .count = (uint16_t)record->count};
+}
+
+// Sensor object names of mqtt.c
+static const char *sensor_name(const payload_record_t *record)
+{
+    if (record->kind == PAYLOAD_RECORD_BATTERY) {
+        return "battery";
+    }
+    if (record->kind == PAYLOAD_RECORD_WAKE_STATS) {
+        return "wakeStats";
+    }
+    return record->type == EVENT_TYPE_MAGNETIC_SWITCH ? "MagneticSwitch" : "PIR";
+}
+
+/**
+ * @brief Encodes the records like mqtt.c does, starting a sensor object whenever the sensor changes.
+ *
+ * @return Number of records added before the first one that did not fit.
+ */
+static size_t encode_json(const payload_record_t *records, size_t count, size_t size)
+{
+    json_encoder_t enc;
+    json_encoder_init(&enc, s_json, size);
+    const char *sensor = NULL;
+    size_t added = 0;
+    for (; added < count; added++) {
+        const payload_record_t *record = &records[added];
+        if (sensor != sensor_name(record)) {
+            if (!json_encoder_begin_sensor(&enc, sensor_name(record))) {
+                break;
+            }
+            sensor = sensor_name(record);
+        }
+        bool ok;
+        if (record->kind == PAYLOAD_RECORD_EVENT) {
+            event_record_t e = event_record_from(record);
+            ok = json_encoder_add_event(&enc, &e, record->room_id);
+        } else if (record->kind == PAYLOAD_RECORD_BATTERY) {
+            ok = json_encoder_add_battery(&enc, record->timestamp, record->voltage_mv / 1000.0f, record->soc_tenths / 10.0f);
+        } else {
+            wake_stats_t stats = wake_stats_from(record);
+            ok = json_encoder_add_wake_stats(&enc, record->timestamp, record->period_sec, &stats);
+        }
+        if (!ok) {
+            break;
+        }
+    }
+    json_encoder_finish(&enc);
+    return added;
+}
+
+/**
+ * @brief Encodes the records into a compact payload.
+ *
+ * @param[out] ends Length of the payload after every added record, may be NULL.
+ * @param[out] len  Length of the payload.
+ * @return Number of records added before the first one that did not fit.
+ */
+static size_t encode_compact(const payload_record_t *records, size_t count, size_t size, size_t *ends, size_t *len)
+{
+    compact_encoder_t enc;
+    compact_encoder_init(&enc, s_compact, size);
+    size_t added = 0;
+    for (; added < count; added++) {
+        const payload_record_t *record = &records[added];
+        bool ok;
+        if (record->kind == PAYLOAD_RECORD_EVENT) {
+            event_record_t e = event_record_from(record);
+            ok = compact_encoder_add_event(&enc, &e, record->room_id);
+        } else if (record->kind == PAYLOAD_RECORD_BATTERY) {
+            ok = compact_encoder_add_battery(&enc, record->timestamp, record->voltage_mv / 1000.0f, record->soc_tenths / 10.0f);
+        } else {
+            wake_stats_t stats = wake_stats_from(record);
+            ok = compact_encoder_add_wake_stats(&enc, record->timestamp, record->period_sec, &stats);
+        }
+        if (!ok) {
+            break;
+        }
+        if (ends) {
+            ends[added] = enc.len;
+        }
+    }
+    *len = compact_encoder_finish(&enc);
+    return added;
+}
+
+/**
+ * @brief Checks the decoded records against the records they were encoded from.
+ *
+ * @param json The records went through the JSON format, which has the battery voltage in
+ *             tenths of a volt only.
+ */
+static void assert_records(const payload_record_t *expected, const payload_record_t *actual, size_t count, bool json)
+{
+    for (size_t i = 0; i < count; i++) {
+        const payload_record_t *e = &expected[i];
+        const payload_record_t *a = &actual[i];
+        TEST_ASSERT_EQUAL(e->kind, a->kind);
+        TEST_ASSERT_EQUAL(e->timestamp, a->timestamp);
+        if (e->kind == PAYLOAD_RECORD_EVENT) {
+            TEST_ASSERT_EQUAL(e->type, a->type);
+            TEST_ASSERT_EQUAL_STRING(e->room_id, a->room_id);
+            TEST_ASSERT_EQUAL(e->duration, a->duration);
+            TEST_ASSERT_EQUAL(e->count, a->count);
+        } else if (e->kind == PAYLOAD_RECORD_BATTERY) {
+            TEST_ASSERT_EQUAL(json ? (e->voltage_mv + 50) / 100 * 100 : e->voltage_mv, a->voltage_mv);
+            TEST_ASSERT_EQUAL(e->soc_tenths, a->soc_tenths);
+        } else {
+            TEST_ASSERT_EQUAL(e->period_sec, a->period_sec);
+            TEST_ASSERT_EQUAL(e->stub_wakes, a->stub_wakes);
+            TEST_ASSERT_EQUAL(e->boots, a->boots);
+            TEST_ASSERT_EQUAL(e->stub_ms, a->stub_ms);
+            for (uint32_t j = 0; j < WAKE_PHASE_COUNT; j++) {
+                TEST_ASSERT_EQUAL(e->phase_ms[j], a->phase_ms[j]);
+            }
+            for (uint32_t j = 0; j < WAKE_STATS_BUCKETS; j++) {
+                TEST_ASSERT_EQUAL(e->histogram[j], a->histogram[j]);
+            }
+            TEST_ASSERT_EQUAL(e->light_sleep_ms, a->light_sleep_ms);
+            TEST_ASSERT_EQUAL(e->published, a->published);
+            TEST_ASSERT_EQUAL(e->latency_avg_ms, a->latency_avg_ms);
+            TEST_ASSERT_EQUAL(e->latency_max_ms, a->latency_max_ms);
+            TEST_ASSERT_EQUAL(e->connect_ack_avg_ms, a->connect_ack_avg_ms);
+            TEST_ASSERT_EQUAL(e->connect_ack_max_ms, a->connect_ack_max_ms);
+        }
+    }
+}
+
+TEST_CASE("JSON and compact payloads decode to the records they were encoded from", "[payload]")
+{
+    const payload_record_t records[] = {
+        event(EVENT_TYPE_PIR, "livingroom", T0 + 1000, 0, 1),
+        event(EVENT_TYPE_PIR, "livingroom", T0 + 61000, 25000, 3),
+        event(EVENT_TYPE_MAGNETIC_SWITCH, "livingroomdoor", T0 + 90000, 0, 1),
+        event(EVENT_TYPE_MAGNETIC_SWITCH, "livingroomdoor", T0 + 95000, 4000, 2),
+        event(EVENT_TYPE_PIR, "kitchen", T0 + 120000, 0, 1),
+        // Long span, its duration does not fit into 16 bit
+        event(EVENT_TYPE_PIR, "kitchen", T0 + 180000, 0x12345, 300),
+        battery(T0 + 200000, 3712, 853),
+        wake_stats_record(T0 + 200000),
+        // Backlog record older than the previous one, the timestamp delta is negative
+        event(EVENT_TYPE_PIR, "livingroom", T0 - 3600000, 30000, 7),
+        event(EVENT_TYPE_PIR, "hall \"north\"", T0 - 3500000, 0, 1),
+        battery(T0 + 210000, 3698, 1000),
+    };
+    size_t count = sizeof(records) / sizeof(records[0]);
+
+    TEST_ASSERT_EQUAL(count, encode_json(records, count, sizeof(s_json)));
+    TEST_ASSERT_EQUAL(count, payload_decode_json(s_json, s_decoded, RECORDS_MAX));
+    assert_records(records, s_decoded, count, true);
+
+    size_t len;
+    TEST_ASSERT_EQUAL(count, encode_compact(records, count, sizeof(s_compact), NULL, &len));
+    TEST_ASSERT_EQUAL(count, payload_decode_compact(s_compact, len, s_decoded, RECORDS_MAX));
+    assert_records(records, s_decoded, count, false);
+}
+
+TEST_CASE("compact payload defines every room once per message", "[payload]")
+{
+    static const char *rooms[] = {"livingroom", "kitchen", "hall"};
+    payload_record_t records[30];
+    for (uint32_t i = 0; i < 30; i++) {
+        records[i] = event(EVENT_TYPE_PIR, rooms[i % 3], T0 + i * 1000, 0, 1);
+    }
+
+    size_t len;
+    TEST_ASSERT_EQUAL(30, encode_compact(records, 30, sizeof(s_compact), NULL, &len));
+    // Header, three room definitions and 30 records of a tag and a 2 byte delta (the first one 6 bytes)
+    size_t rooms_len = 3 * 2 + strlen("livingroom") + strlen("kitchen") + strlen("hall");
+    TEST_ASSERT_EQUAL(2 + rooms_len + 30 * 3 + 4, len);
+    TEST_ASSERT_EQUAL(30, payload_decode_compact(s_compact, len, s_decoded, RECORDS_MAX));
+    assert_records(records, s_decoded, 30, false);
+}
+
+TEST_CASE("compact encoder rejects a room beyond COMPACT_MAX_ROOMS", "[payload]")
+{
+    payload_record_t records[COMPACT_MAX_ROOMS + 1];
+    for (uint32_t i = 0; i < COMPACT_MAX_ROOMS + 1; i++) {
+        char room_id[16];
+        snprintf(room_id, sizeof(room_id), "room%u", (unsigned)i);
+        records[i] = event(EVENT_TYPE_PIR, room_id, T0 + i * 1000, 0, 1);
+    }
+
+    size_t len;
+    TEST_ASSERT_EQUAL(COMPACT_MAX_ROOMS, encode_compact(records, COMPACT_MAX_ROOMS + 1, sizeof(s_compact), NULL, &len));
+    TEST_ASSERT_EQUAL(COMPACT_MAX_ROOMS, payload_decode_compact(s_compact, len, s_decoded, RECORDS_MAX));
+    assert_records(records, s_decoded, COMPACT_MAX_ROOMS, false);
+}
+
+TEST_CASE("record that does not fit is rolled back, the payload stays valid", "[payload]")
+{
+    payload_record_t records[40];
+    for (uint32_t i = 0; i < 40; i++) {
+        records[i] = event(i % 2 ? EVENT_TYPE_MAGNETIC_SWITCH : EVENT_TYPE_PIR, "livingroom", T0 + i * 70000, i * 100, 1 + i);
+    }
+    records[20] = battery(T0 + 20 * 70000, 3900, 500);
+    records[21] = wake_stats_record(T0 + 21 * 70000);
+
+    for (size_t size = 32; size <= 1024; size += 37) {
+        size_t added = encode_json(records, 40, size);
+        TEST_ASSERT_LESS_THAN(40, added);
+        TEST_ASSERT_EQUAL(added, payload_decode_json(s_json, s_decoded, RECORDS_MAX));
+        assert_records(records, s_decoded, added, true);
+    }
+    for (size_t size = 8; size <= 256; size += 11) {
+        size_t len;
+        size_t added = encode_compact(records, 40, size, NULL, &len);
+        TEST_ASSERT_LESS_THAN(40, added);
+        TEST_ASSERT_LESS_OR_EQUAL(size, len);
+        TEST_ASSERT_EQUAL(added, payload_decode_compact(s_compact, len, s_decoded, RECORDS_MAX));
+        assert_records(records, s_decoded, added, false);
+    }
+}
+
+TEST_CASE("decoders reject truncated payloads", "[payload]")
+{
+    const payload_record_t records[] = {
+        event(EVENT_TYPE_PIR, "livingroom", T0, 0, 1),
+        event(EVENT_TYPE_PIR, "livingroom", T0 + 100000, 0x12345, 300),
+        event(EVENT_TYPE_MAGNETIC_SWITCH, "livingroomdoor", T0 + 200000, 0, 1),
+        battery(T0 + 300000, 3712, 853),
+        wake_stats_record(T0 + 400000),
+    };
+    size_t count = sizeof(records) / sizeof(records[0]);
+
+    size_t ends[8];
+    size_t len;
+    TEST_ASSERT_EQUAL(count, encode_compact(records, count, sizeof(s_compact), ends, &len));
+    for (size_t cut = 0; cut < len; cut++) {
+        size_t whole = 0;
+        while (whole < count && ends[whole] <= cut) {
+            whole++;
+        }
+        int decoded = payload_decode_compact(s_compact, cut, s_decoded, RECORDS_MAX);
+        if (whole > 0 && cut == ends[whole - 1]) {
+            // The message ends after a record
+            TEST_ASSERT_EQUAL(whole, decoded);
+        } else if (decoded >= 0) {
+            // The message ends after the room definition of the next record
+            TEST_ASSERT_EQUAL(whole, decoded);
+        }
+    }
+
+    size_t json_len = encode_json(records, count, sizeof(s_json)) == count ? strlen(s_json) : 0;
+    TEST_ASSERT_NOT_EQUAL(0, json_len);
+    for (size_t cut = 0; cut < json_len; cut++) {
+        char truncated[sizeof(s_json)];
+        memcpy(truncated, s_json, cut);
+        truncated[cut] = '\0';
+        TEST_ASSERT_EQUAL(-1, payload_decode_json(truncated, s_decoded, RECORDS_MAX));
+    }
+}
+
+TEST_CASE("compact payload of coalesced PIR events is a fraction of the JSON payload", "[payload]")
+{
+    static payload_record_t records[101];
+    for (uint32_t i = 0; i < 100; i++) {
+        records[i] = event(EVENT_TYPE_PIR, "livingroom", T0 + i * 95000, 25000 + i * 10, 3 + i % 5);
+    }
+    records[100] = battery(T0 + 100 * 95000, 3712, 853);
+
+    TEST_ASSERT_EQUAL(101, encode_json(records, 101, sizeof(s_json)));
+    size_t json_len = strlen(s_json);
+    size_t compact_len;
+    TEST_ASSERT_EQUAL(101, encode_compact(records, 101, sizeof(s_compact), NULL, &compact_len));
+    printf("100 PIR spans and a battery reading: %u bytes JSON, %u bytes compact\n",
+           (unsigned)json_len, (unsigned)compact_len);
+    TEST_ASSERT_LESS_THAN(json_len / 5, compact_len);
+
+    TEST_ASSERT_EQUAL(101, payload_decode_json(s_json, s_decoded, RECORDS_MAX));
+    assert_records(records, s_decoded, 101, true);
+    TEST_ASSERT_EQUAL(101, payload_decode_compact(s_compact, compact_len, s_decoded, RECORDS_MAX));
+    assert_records(records, s_decoded, 101, false);
+}
+
+#define BENCH_EVENTS 10000
+#define BENCH_RUNS   5
+
+static event_record_t s_bench_events[BENCH_EVENTS];
+static payload_record_t s_bench_decoded[BENCH_EVENTS];
+static char s_bench_json[BENCH_EVENTS * 100];
+static char s_bench_sunk[BENCH_EVENTS * 100];
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief Output of the encoder in sink mode, collected in s_bench_sunk.
+ */
+typedef struct {
+    size_t len;
+    uint32_t chunks;
+} bench_sink_t;
+
+static void bench_sink(const char *data, size_t len, void *ctx)
+{
+    bench_sink_t *out = ctx;
+    TEST_ASSERT_LESS_OR_EQUAL(sizeof(s_bench_sunk), out->len + len);
+    memcpy(&s_bench_sunk[out->len], data, len);
+    out->len += len;
+    out->chunks++;
+}
+
+/**
+ * @brief Encodes the first @p count benchmark events like mqtt.c does.
+ *
+ * @return Number of events added before the first one that did not fit.
+ */
+static size_t bench_encode(json_encoder_t *enc, size_t count)
+{
+    event_type_t sensor = (event_type_t)-1;
+    for (size_t i = 0; i < count; i++) {
+        const event_record_t *e = &s_bench_events[i];
+        if (e->type != sensor) {
+            if (!json_encoder_begin_sensor(enc, e->type == EVENT_TYPE_MAGNETIC_SWITCH ? "MagneticSwitch" : "PIR")) {
+                return i;
+            }
+            sensor = e->type;
+        }
+        if (!json_encoder_add_event(enc, e, e->type == EVENT_TYPE_MAGNETIC_SWITCH ? "livingroomdoor" : "livingroom")) {
+            return i;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Returns the fastest of BENCH_RUNS encodings of @p count events into s_bench_json, in nanoseconds.
+ */
+static uint64_t bench_buffer_ns(size_t count)
+{
+    uint64_t best = UINT64_MAX;
+    for (uint32_t run = 0; run < BENCH_RUNS; run++) {
+        json_encoder_t enc;
+        uint64_t start = now_ns();
+        json_encoder_init(&enc, s_bench_json, sizeof(s_bench_json));
+        TEST_ASSERT_EQUAL(count, bench_encode(&enc, count));
+        json_encoder_finish(&enc);
+        uint64_t elapsed = now_ns() - start;
+        best = elapsed < best ? elapsed : best;
+    }
+    return best;
+}
+
+TEST_CASE("JSON encoder encodes 10,000 events in linear time, in buffer and sink mode", "[payload][benchmark]")
+{
+    // PIR triggers and spans, every 10th event a door contact, so the sensor object changes often
+    for (uint32_t i = 0; i < BENCH_EVENTS; i++) {
+        bool door = i % 10 == 9;
+        s_bench_events[i] = (event_record_t){
+            .type = door ? EVENT_TYPE_MAGNETIC_SWITCH : EVENT_TYPE_PIR, .channel = door ? 1 : 0,
+            .timestamp = T0 + (uint64_t)i * 30000, .duration = i % 3 ? 0 : 20000 + i, .count = i % 3 ? 1 : 2 + i % 7};
+    }
+
+    // Buffer mode: one pass, the cost per event does not grow with the message
+    uint64_t small_ns = bench_buffer_ns(BENCH_EVENTS / 10);
+    uint64_t full_ns = bench_buffer_ns(BENCH_EVENTS);
+    size_t json_len = strlen(s_bench_json);
+    printf("Buffer mode: %u events, %u bytes in %.2f ms (%.0f ns per event, %.0f ns per event for %u events)\n",
+           BENCH_EVENTS, (unsigned)json_len, full_ns / 1e6, (double)full_ns / BENCH_EVENTS,
+           (double)small_ns / (BENCH_EVENTS / 10), BENCH_EVENTS / 10);
+    TEST_ASSERT_LESS_THAN(3 * small_ns / (BENCH_EVENTS / 10), full_ns / BENCH_EVENTS);
+
+    // Sink mode: the same message, handed over in chunks of a small buffer
+    char chunk[256];
+    bench_sink_t out = {0};
+    json_encoder_t enc;
+    uint64_t start = now_ns();
+    json_encoder_init_sink(&enc, chunk, sizeof(chunk), bench_sink, &out);
+    TEST_ASSERT_EQUAL(BENCH_EVENTS, bench_encode(&enc, BENCH_EVENTS));
+    TEST_ASSERT_EQUAL(json_len, json_encoder_finish(&enc));
+    uint64_t sink_ns = now_ns() - start;
+    printf("Sink mode: %u events, %u bytes in %u chunks of %u bytes in %.2f ms (%.0f ns per event)\n",
+           BENCH_EVENTS, (unsigned)out.len, (unsigned)out.chunks, (unsigned)sizeof(chunk), sink_ns / 1e6,
+           (double)sink_ns / BENCH_EVENTS);
+    TEST_ASSERT_EQUAL(json_len, out.len);
+    TEST_ASSERT_EQUAL_MEMORY(s_bench_json, s_bench_sunk, json_len);
+
+    // Nothing was truncated
+    TEST_ASSERT_EQUAL(BENCH_EVENTS, payload_decode_json(s_bench_json, s_bench_decoded, BENCH_EVENTS));
+    for (uint32_t i = 0; i < BENCH_EVENTS; i++) {
+        TEST_ASSERT_EQUAL(s_bench_events[i].type, s_bench_decoded[i].type);
+        TEST_ASSERT_EQUAL(s_bench_events[i].timestamp, s_bench_decoded[i].timestamp);
+        TEST_ASSERT_EQUAL(s_bench_events[i].duration, s_bench_decoded[i].duration);
+        TEST_ASSERT_EQUAL(s_bench_events[i].count, s_bench_decoded[i].count);
+    }
+}
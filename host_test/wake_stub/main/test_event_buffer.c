@@ -0,0 +1,195 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_attr.h"
+#include "unity.h"
+
+#include "main.h"
+#include "rtc_wake_stub_buffer.h"
+#include "wake_stub_emu.h"
+
+#define T0 WAKE_STUB_EMU_EPOCH_MS
+
+// Sizes of the records (tag + timestamp payload), see rtc_wake_stub_buffer.c
+#define DELTA_16_SIZE 3
+#define DELTA_32_SIZE 5
+#define ABSOLUTE_SIZE 9
+
+/**
+ * @brief Fills the empty buffer with events @p step apart and returns how many were stored.
+ */
+static uint32_t fill(uint64_t start, uint64_t step)
+{
+    uint32_t stored = 0;
+    uint64_t timestamp = start;
+    while (event_buffer_push(0, timestamp)) {
+        stored++;
+        timestamp += step;
+    }
+    return stored;
+}
+
+TEST_CASE("event buffer picks the delta width of every record", "[event_buffer]")
+{
+    const uint64_t timestamps[] = {
+        T0,                         // First record, absolute
+        T0 + 0xFFFF,                // 16-bit delta
+        T0 + 0xFFFF + 0x10000,      // 32-bit delta
+        T0 + 0x2FFFF + 0xFFFFFFFF,  // 32-bit delta, largest
+        T0 + 0x2FFFF + 0x1FFFFFFFF, // Absolute, the delta does not fit 32 bits
+        T0,                         // Absolute, older than the previous record
+        T0 + 1,                     // 16-bit delta to the older record
+    };
+    const size_t count = sizeof(timestamps) / sizeof(timestamps[0]);
+    wake_stub_emu_reset(NULL);
+    for (size_t i = 0; i < count; i++) {
+        TEST_ASSERT_TRUE(event_buffer_push(i % 2, timestamps[i]));
+    }
+    TEST_ASSERT_EQUAL(count, event_buffer_count());
+    TEST_ASSERT_EQUAL(T0, event_buffer_oldest_timestamp());
+
+    event_buffer_iter_t iter;
+    event_record_t record;
+    event_buffer_iter_init(&iter);
+    for (size_t i = 0; i < count; i++) {
+        TEST_ASSERT_TRUE(event_buffer_iter_next(&iter, &record));
+        TEST_ASSERT_EQUAL_UINT64(timestamps[i], record.timestamp);
+        TEST_ASSERT_EQUAL(i % 2, record.channel);
+    }
+    TEST_ASSERT_FALSE(event_buffer_iter_next(&iter, &record));
+
+    for (size_t i = 0; i < count; i++) {
+        TEST_ASSERT_TRUE(event_buffer_pop(&record));
+        TEST_ASSERT_EQUAL_UINT64(timestamps[i], record.timestamp);
+        TEST_ASSERT_EQUAL(0, record.duration);
+        TEST_ASSERT_EQUAL(1, record.count);
+    }
+    TEST_ASSERT_FALSE(event_buffer_pop(&record));
+    TEST_ASSERT_EQUAL(0, event_buffer_oldest_timestamp());
+}
+
+TEST_CASE("event buffer record sizes follow the delta width", "[event_buffer]")
+{
+    // The first record of an empty buffer is always absolute
+    wake_stub_emu_reset(NULL);
+    EVENT_BUFFER_POLICY = EVENT_BUFFER_DROP_NEWEST;
+    TEST_ASSERT_EQUAL(1 + (CONFIG_EVENT_BUFFER_SIZE - ABSOLUTE_SIZE) / DELTA_16_SIZE, fill(T0, 1000));
+    TEST_ASSERT_TRUE(event_buffer_is_full());
+
+    event_buffer_clear();
+    TEST_ASSERT_EQUAL(1 + (CONFIG_EVENT_BUFFER_SIZE - ABSOLUTE_SIZE) / DELTA_32_SIZE, fill(T0, 0x10000));
+
+    // Absolute timestamp fallback of deltas beyond 32 bits
+    event_buffer_clear();
+    TEST_ASSERT_EQUAL(CONFIG_EVENT_BUFFER_SIZE / ABSOLUTE_SIZE, fill(T0, 0x100000000));
+}
+
+TEST_CASE("event buffer stores activity spans", "[event_buffer]")
+{
+    wake_stub_emu_reset(NULL);
+    TEST_ASSERT_TRUE(event_buffer_push_span(0, T0, 0xFFFF, 3));         // 16-bit duration
+    TEST_ASSERT_TRUE(event_buffer_push_span(0, T0 + 1000, 0x10000, 2)); // 32-bit duration
+    TEST_ASSERT_TRUE(event_buffer_push_span(1, T0 + 2000, 0, 1));       // Plain event
+    TEST_ASSERT_TRUE(event_buffer_push_span(0, T0 + 3000, 0, 0xFFFF));  // Triggers at the same time
+
+    event_record_t record;
+    TEST_ASSERT_TRUE(event_buffer_pop(&record));
+    TEST_ASSERT_EQUAL_UINT64(T0, record.timestamp);
+    TEST_ASSERT_EQUAL(0xFFFF, record.duration);
+    TEST_ASSERT_EQUAL(3, record.count);
+    TEST_ASSERT_TRUE(event_buffer_pop(&record));
+    TEST_ASSERT_EQUAL_UINT64(T0 + 1000, record.timestamp);
+    TEST_ASSERT_EQUAL(0x10000, record.duration);
+    TEST_ASSERT_EQUAL(2, record.count);
+    TEST_ASSERT_TRUE(event_buffer_pop(&record));
+    TEST_ASSERT_EQUAL_UINT64(T0 + 2000, record.timestamp);
+    TEST_ASSERT_EQUAL(1, record.channel);
+    TEST_ASSERT_EQUAL(EVENT_TYPE_MAGNETIC_SWITCH, record.type);
+    TEST_ASSERT_EQUAL(0, record.duration);
+    TEST_ASSERT_EQUAL(1, record.count);
+    TEST_ASSERT_TRUE(event_buffer_pop(&record));
+    TEST_ASSERT_EQUAL(0, record.duration);
+    TEST_ASSERT_EQUAL(0xFFFF, record.count);
+}
+
+TEST_CASE("event buffer keeps the order when the records wrap around the end", "[event_buffer]")
+{
+    // Reference FIFO of the stored timestamps, larger than the number of records that fit
+    static uint64_t expected[1024];
+    uint32_t head = 0;
+    uint32_t tail = 0;
+    uint32_t seed = 1;
+    uint64_t timestamp = T0;
+
+    wake_stub_emu_reset(NULL);
+    for (int i = 0; i < 20000; i++) {
+        // Deltas of all widths, mostly short ones
+        seed = seed * 1103515245 + 12345;
+        uint32_t r = seed >> 16;
+        timestamp += r % 8 == 0 ? 0x10000 + r : (r % 97 == 0 ? 0x100000000ULL : r % 0x10000);
+
+        TEST_ASSERT_TRUE(event_buffer_push(r % 2, timestamp));
+        expected[tail++ % 1024] = timestamp;
+        TEST_ASSERT_EQUAL(0, dropped_event_count);
+
+        // Keep the buffer between 50 and 100 records, so the records pass the end many times
+        if (tail - head > 100) {
+            while (tail - head > 50) {
+                event_record_t record;
+                TEST_ASSERT_TRUE(event_buffer_pop(&record));
+                TEST_ASSERT_EQUAL_UINT64(expected[head++ % 1024], record.timestamp);
+            }
+        }
+        TEST_ASSERT_EQUAL(tail - head, event_buffer_count());
+        TEST_ASSERT_EQUAL_UINT64(expected[head % 1024], event_buffer_oldest_timestamp());
+    }
+}
+
+TEST_CASE("event buffer overwrites the oldest records when full", "[event_buffer]")
+{
+    wake_stub_emu_reset(NULL);
+    EVENT_BUFFER_POLICY = EVENT_BUFFER_OVERWRITE_OLDEST;
+    uint32_t capacity = 1 + (CONFIG_EVENT_BUFFER_SIZE - ABSOLUTE_SIZE) / DELTA_16_SIZE;
+    for (uint32_t i = 0; i < capacity; i++) {
+        TEST_ASSERT_TRUE(event_buffer_push(0, T0 + i));
+    }
+    TEST_ASSERT_EQUAL(0, dropped_event_count);
+
+    // Room for the next record is made by dropping the oldest ones, the new oldest one
+    // is rebased on its own timestamp
+    for (uint32_t i = 0; i < 10; i++) {
+        TEST_ASSERT_TRUE(event_buffer_push(0, T0 + capacity + i));
+        TEST_ASSERT_EQUAL(capacity + i + 1, event_buffer_count() + dropped_event_count);
+        TEST_ASSERT_EQUAL_UINT64(T0 + dropped_event_count, event_buffer_oldest_timestamp());
+    }
+    TEST_ASSERT_GREATER_OR_EQUAL(1, dropped_event_count);
+
+    event_record_t record;
+    uint32_t count = event_buffer_count();
+    for (uint32_t i = 0; i < count; i++) {
+        TEST_ASSERT_TRUE(event_buffer_pop(&record));
+        TEST_ASSERT_EQUAL_UINT64(T0 + dropped_event_count + i, record.timestamp);
+    }
+    TEST_ASSERT_EQUAL_UINT64(T0 + capacity + 9, record.timestamp);
+}
+
+TEST_CASE("event buffer drops the newest record when full", "[event_buffer]")
+{
+    wake_stub_emu_reset(NULL);
+    EVENT_BUFFER_POLICY = EVENT_BUFFER_DROP_NEWEST;
+    uint32_t capacity = fill(T0, 1);
+    TEST_ASSERT_EQUAL(1, dropped_event_count);
+
+    TEST_ASSERT_FALSE(event_buffer_push_span(0, T0 + capacity + 1, 100, 2));
+    TEST_ASSERT_EQUAL(2, dropped_event_count);
+    TEST_ASSERT_EQUAL(capacity, event_buffer_count());
+    TEST_ASSERT_EQUAL_UINT64(T0, event_buffer_oldest_timestamp());
+
+    // A popped record makes room again
+    TEST_ASSERT_TRUE(event_buffer_pop(NULL));
+    TEST_ASSERT_TRUE(event_buffer_push(0, T0 + capacity));
+    event_buffer_discard(capacity - 1);
+    event_record_t record;
+    TEST_ASSERT_TRUE(event_buffer_pop(&record));
+    TEST_ASSERT_EQUAL_UINT64(T0 + capacity, record.timestamp);
+    TEST_ASSERT_EQUAL(0, event_buffer_count());
+}
@@ -0,0 +1,147 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_attr.h"
+#include "unity.h"
+
+#include "main.h"
+#include "gauge.h"
+#include "rtc_wake_stub_flush.h"
+#include "wake_stub_emu.h"
+
+// Sensor channel of the PIR sensor in CONFIG_SENSOR_CHANNELS
+#define PIR 0
+
+#define SEC(s) ((uint64_t)(s) * 1000)
+#define NOW (WAKE_STUB_EMU_EPOCH_MS + SEC(100000))
+#define MAX_AGE SEC(CONFIG_FLUSH_MAX_EVENT_AGE_SEC)
+
+typedef struct {
+    const char *name;
+    flush_input_t input;
+    bool flush;
+    uint32_t time_to_flush_sec;
+} flush_case_t;
+
+static const flush_case_t flush_cases[] = {
+    {"nothing pending", {.now = NOW, .battery_soc = 100}, false, UINT32_MAX},
+    {"fresh event", {.now = NOW, .event_count = 1, .has_pending = true, .oldest_timestamp = NOW - SEC(1), .battery_soc = 100},
+     false, (CONFIG_FLUSH_MAX_EVENT_AGE_SEC) - 1},
+    {"event at the maximum age", {.now = NOW, .event_count = 1, .has_pending = true, .oldest_timestamp = NOW - MAX_AGE, .battery_soc = 100},
+     true, 0},
+    {"open span only", {.now = NOW, .has_pending = true, .oldest_timestamp = NOW - MAX_AGE - 1, .battery_soc = 100},
+     true, 0},
+    {"deadline rounded up", {.now = NOW, .event_count = 1, .has_pending = true, .oldest_timestamp = NOW - MAX_AGE + 1500, .battery_soc = 100},
+     false, 2},
+    {"event count", {.now = NOW, .event_count = CONFIG_MAX_PIR_EVENTS, .has_pending = true, .oldest_timestamp = NOW, .battery_soc = 100},
+     true, CONFIG_FLUSH_MAX_EVENT_AGE_SEC},
+    {"fill ratio at low battery", {.now = NOW, .event_count = 1, .fill_percent = CONFIG_FLUSH_FILL_PERCENT, .has_pending = true, .oldest_timestamp = NOW, .battery_soc = 5},
+     true, 4 * (CONFIG_FLUSH_MAX_EVENT_AGE_SEC)},
+    {"age doubled below twice the low SOC", {.now = NOW, .event_count = 1, .has_pending = true, .oldest_timestamp = NOW - MAX_AGE, .battery_soc = 2 * CONFIG_FLUSH_LOW_SOC_PERCENT - 1},
+     false, CONFIG_FLUSH_MAX_EVENT_AGE_SEC},
+    {"age quadrupled below the low SOC", {.now = NOW, .event_count = 1, .has_pending = true, .oldest_timestamp = NOW - MAX_AGE, .battery_soc = CONFIG_FLUSH_LOW_SOC_PERCENT - 1},
+     false, 3 * (CONFIG_FLUSH_MAX_EVENT_AGE_SEC)},
+    {"age not stretched at twice the low SOC", {.now = NOW, .event_count = 1, .has_pending = true, .oldest_timestamp = NOW - MAX_AGE, .battery_soc = 2 * CONFIG_FLUSH_LOW_SOC_PERCENT},
+     true, 0},
+    {"old event waits for the retry", {.now = NOW, .event_count = 1, .has_pending = true, .oldest_timestamp = NOW - 2 * MAX_AGE, .battery_soc = 100, .retry_at = NOW + SEC(60)},
+     false, 60},
+    {"old event after the retry time", {.now = NOW, .event_count = 1, .has_pending = true, .oldest_timestamp = NOW - 2 * MAX_AGE, .battery_soc = 100, .retry_at = NOW - 1},
+     true, 0},
+    {"retry before the age deadline", {.now = NOW, .event_count = 1, .has_pending = true, .oldest_timestamp = NOW - SEC(1), .battery_soc = 100, .retry_at = NOW + SEC(10)},
+     false, (CONFIG_FLUSH_MAX_EVENT_AGE_SEC) - 1},
+    {"retry without pending events", {.now = NOW, .battery_soc = 100, .retry_at = NOW + SEC(10)},
+     false, UINT32_MAX},
+    {"backlog resumed at the retry time", {.now = NOW, .battery_soc = 100, .retry_at = NOW + SEC(60), .backlog_pending = true},
+     false, 60},
+    {"backlog due", {.now = NOW, .battery_soc = 100, .retry_at = NOW, .backlog_pending = true},
+     true, 0},
+    {"backlog retry before the age deadline", {.now = NOW, .event_count = 1, .has_pending = true, .oldest_timestamp = NOW, .battery_soc = 100, .retry_at = NOW + SEC(30), .backlog_pending = true},
+     false, 30},
+};
+
+TEST_CASE("flush policy decisions", "[flush_policy]")
+{
+    wake_stub_emu_reset(NULL);
+    for (size_t i = 0; i < sizeof(flush_cases) / sizeof(flush_cases[0]); i++) {
+        const flush_case_t *c = &flush_cases[i];
+        TEST_ASSERT_EQUAL_MESSAGE(c->flush, flush_policy_should_flush(&c->input), c->name);
+        TEST_ASSERT_EQUAL_UINT32_MESSAGE(c->time_to_flush_sec, flush_policy_time_to_flush_sec(&c->input), c->name);
+    }
+}
+
+TEST_CASE("stub flushes when MAX_PIR_EVENTS events are buffered", "[flush_policy]")
+{
+    const wake_stub_emu_edge_t trace[] = {
+        {SEC(10), PIR, true}, {SEC(11), PIR, false},
+        {SEC(20), PIR, true}, {SEC(21), PIR, false},
+        {SEC(30), PIR, true}, {SEC(31), PIR, false},
+        {SEC(40), PIR, true}, {SEC(41), PIR, false},
+    };
+    wake_stub_emu_result_t result;
+    wake_stub_emu_reset(NULL);
+    MAX_PIR_EVENTS = 4;
+    PIR_COALESCE_WINDOW_MS = 0;
+    wake_stub_emu_run(trace, sizeof(trace) / sizeof(trace[0]), SEC(60), &result);
+
+    TEST_ASSERT_EQUAL(4, result.ext1_wakes);
+    TEST_ASSERT_EQUAL(1, result.app_boots);
+    TEST_ASSERT_EQUAL(4, result.delivered);
+    TEST_ASSERT_EQUAL(WAKE_STUB_EMU_EPOCH_MS + SEC(40), result.records[3].timestamp);
+}
+
+TEST_CASE("stub stretches the age of an open span at low battery", "[flush_policy]")
+{
+    const wake_stub_emu_edge_t trace[] = {
+        {SEC(10), PIR, true}, {SEC(11), PIR, false},
+    };
+    const uint64_t deadline = SEC(10) + 4 * MAX_AGE;
+    wake_stub_emu_result_t result;
+
+    // Only the span is pending, it is flushed at four times the maximum age
+    wake_stub_emu_reset(NULL);
+    BATTERY_INFO_INTERVAL_SEC = UINT32_MAX;
+    battery_soc = CONFIG_FLUSH_LOW_SOC_PERCENT - 1;
+    wake_stub_emu_run(trace, 2, deadline - SEC(1), &result);
+    TEST_ASSERT_EQUAL(0, result.app_boots);
+
+    wake_stub_emu_reset(NULL);
+    BATTERY_INFO_INTERVAL_SEC = UINT32_MAX;
+    battery_soc = CONFIG_FLUSH_LOW_SOC_PERCENT - 1;
+    wake_stub_emu_run(trace, 2, deadline + SEC(1), &result);
+    TEST_ASSERT_EQUAL(1, result.app_boots);
+    TEST_ASSERT_EQUAL(1, result.delivered);
+}
+
+TEST_CASE("stub waits for the retry time of a failed delivery", "[flush_policy]")
+{
+    const wake_stub_emu_edge_t trace[] = {
+        {SEC(10), PIR, true}, {SEC(11), PIR, false},
+    };
+    const uint64_t retry_at = MAX_AGE + SEC(1000);
+    wake_stub_emu_result_t result;
+
+    wake_stub_emu_reset(NULL);
+    BATTERY_INFO_INTERVAL_SEC = UINT32_MAX;
+    flush_retry_at_ms = WAKE_STUB_EMU_EPOCH_MS + retry_at;
+    wake_stub_emu_run(trace, 2, retry_at - SEC(1), &result);
+    TEST_ASSERT_EQUAL(0, result.app_boots);
+
+    wake_stub_emu_reset(NULL);
+    BATTERY_INFO_INTERVAL_SEC = UINT32_MAX;
+    flush_retry_at_ms = WAKE_STUB_EMU_EPOCH_MS + retry_at;
+    wake_stub_emu_run(trace, 2, retry_at + SEC(1), &result);
+    TEST_ASSERT_EQUAL(1, result.app_boots);
+    TEST_ASSERT_EQUAL(1, result.delivered);
+}
+
+TEST_CASE("stub resumes the journal backlog at the retry time", "[flush_policy]")
+{
+    wake_stub_emu_result_t result;
+    wake_stub_emu_reset(NULL);
+    flush_backlog_pending = true;
+    flush_retry_at_ms = WAKE_STUB_EMU_EPOCH_MS + SEC(120);
+    wake_stub_emu_run(NULL, 0, SEC(121), &result);
+
+    TEST_ASSERT_EQUAL(1, result.timer_wakes);
+    TEST_ASSERT_EQUAL(1, result.app_boots);
+    TEST_ASSERT_EQUAL(0, result.delivered);
+}
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include "esp_attr.h"
+#include "unity.h"
+
+#include "main.h"
+#include "wake_stub_emu.h"
+
+// Sensor channels of CONFIG_SENSOR_CHANNELS
+#define PIR  0
+#define DOOR 1
+
+#define SEC(s) ((uint64_t)(s) * 1000)
+
+// Interval at which the application polled the sensors before it masked them (CONFIG_SENSOR_INACTIVE_DELAY_MS)
+#define OLD_POLL_MS 3000
+
+// One hour of a room: a door left open for five minutes and someone moving in front of
+// the PIR sensor for 40 s every two minutes.
+#define TRACE_DURATION_SEC (60 * 60)
+#define PIR_PERIOD_SEC     120
+#define PIR_ACTIVE_SEC     40
+#define TRACE_EDGES        (2 * (TRACE_DURATION_SEC / PIR_PERIOD_SEC) + 2)
+
+static size_t build_trace(wake_stub_emu_edge_t *trace)
+{
+    size_t count = 0;
+    bool door_open = false;
+    bool door_closed = false;
+    for (uint32_t start = 60; start < TRACE_DURATION_SEC; start += PIR_PERIOD_SEC) {
+        if (!door_open && start >= 300) {
+            trace[count++] = (wake_stub_emu_edge_t){SEC(290), DOOR, true};
+            door_open = true;
+        }
+        if (door_open && !door_closed && start >= 600) {
+            trace[count++] = (wake_stub_emu_edge_t){SEC(590), DOOR, false};
+            door_closed = true;
+        }
+        trace[count++] = (wake_stub_emu_edge_t){SEC(start), PIR, true};
+        trace[count++] = (wake_stub_emu_edge_t){SEC(start + PIR_ACTIVE_SEC), PIR, false};
+    }
+    return count;
+}
+
+TEST_CASE("masking active sensors saves the awake time of polling them", "[wake_stub]")
+{
+    wake_stub_emu_edge_t trace[TRACE_EDGES];
+    size_t count = build_trace(trace);
+
+    wake_stub_emu_config_t polling = WAKE_STUB_EMU_CONFIG_DEFAULT();
+    polling.app_poll_ms = OLD_POLL_MS;
+    wake_stub_emu_result_t old;
+    wake_stub_emu_reset(&polling);
+    wake_stub_emu_run(trace, count, SEC(TRACE_DURATION_SEC), &old);
+
+    wake_stub_emu_result_t new;
+    wake_stub_emu_reset(NULL);
+    wake_stub_emu_run(trace, count, SEC(TRACE_DURATION_SEC), &new);
+
+    uint64_t old_awake_us = old.stub_us + old.app_us;
+    uint64_t new_awake_us = new.stub_us + new.app_us;
+    printf("Polling: %" PRIu64 " ms awake, %u boots, %u stub wakes\n",
+           old_awake_us / 1000, old.app_boots, old.stub_wakes);
+    printf("Masking: %" PRIu64 " ms awake, %u boots, %u stub wakes\n",
+           new_awake_us / 1000, new.app_boots, new.stub_wakes);
+    printf("Saved: %" PRIu64 " ms awake per hour\n", (old_awake_us - new_awake_us) / 1000);
+
+    // The door boot polled until the door was closed, the stub re-checks it instead
+    TEST_ASSERT_EQUAL(old.app_boots, new.app_boots);
+    uint64_t polled_us = old.app_us - (uint64_t)old.app_boots * polling.app_us;
+    TEST_ASSERT_GREATER_OR_EQUAL(SEC(290) * 1000, polled_us);
+    TEST_ASSERT_LESS_THAN(old_awake_us / 10, new_awake_us);
+
+    // Both deliver the same events
+    TEST_ASSERT_EQUAL(old.delivered, new.delivered);
+}
@@ -0,0 +1,173 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_attr.h"
+#include "unity.h"
+
+#include "main.h"
+#include "rtc_wake_stub.h"
+#include "rtc_wake_stub_buffer.h"
+#include "rtc_wake_stub_ulp.h"
+#include "ulp_sensor_edges.h"
+#include "wake_stub_emu.h"
+
+// Sensor channels of CONFIG_SENSOR_CHANNELS
+#define PIR  0
+#define DOOR 1
+
+#define SEC(s) ((uint64_t)(s) * 1000)
+
+#define PULSES_MAX 100
+
+/**
+ * @brief Builds a trace of @p count pulses of 50 ms on @p channel, every @p every_ms.
+ *
+ * @return Number of level changes.
+ */
+static size_t pulses(wake_stub_emu_edge_t *trace, uint32_t channel, uint32_t count, uint64_t every_ms)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        trace[2 * i] = (wake_stub_emu_edge_t){(i + 1) * every_ms, channel, true};
+        trace[2 * i + 1] = (wake_stub_emu_edge_t){(i + 1) * every_ms + 50, channel, false};
+    }
+    return 2 * count;
+}
+
+TEST_CASE("ULP edge is time-stamped with the sample that saw it", "[ulp]")
+{
+    const wake_stub_emu_edge_t trace[] = {
+        {1005, PIR, true}, {1500, PIR, false},
+    };
+    wake_stub_emu_reset(NULL);
+    wake_stub_emu_ulp_start();
+    TEST_ASSERT_FALSE(wake_stub_emu_ulp_run(trace, 2, SEC(5)));
+
+    ulp_edge_t edge;
+    TEST_ASSERT_TRUE(ulp_edges_pop(&edge));
+    TEST_ASSERT_EQUAL(PIR, edge.channel);
+    TEST_ASSERT_EQUAL(1000000 + (CONFIG_ULP_EDGE_SAMPLE_PERIOD_MS) * 1000, edge.rtc_time_us);
+    TEST_ASSERT_FALSE(ulp_edges_pop(&edge));
+    TEST_ASSERT_EQUAL(0, ulp_edges_take_dropped());
+}
+
+TEST_CASE("ULP misses a pulse between two samples", "[ulp]")
+{
+    const wake_stub_emu_edge_t trace[] = {
+        {1005, PIR, true}, {1015, PIR, false},
+        {2005, PIR, true}, {2025, PIR, false},
+    };
+    wake_stub_emu_reset(NULL);
+    wake_stub_emu_ulp_start();
+    TEST_ASSERT_FALSE(wake_stub_emu_ulp_run(trace, 4, SEC(5)));
+
+    ulp_edge_t edge;
+    TEST_ASSERT_TRUE(ulp_edges_pop(&edge));
+    TEST_ASSERT_EQUAL(2020000, edge.rtc_time_us);
+    TEST_ASSERT_FALSE(ulp_edges_pop(&edge));
+}
+
+TEST_CASE("ULP wakes the chip right away on a door edge", "[ulp]")
+{
+    const wake_stub_emu_edge_t trace[] = {
+        {SEC(3), DOOR, true}, {SEC(4), DOOR, false},
+    };
+    wake_stub_emu_reset(NULL);
+    wake_stub_emu_ulp_start();
+    TEST_ASSERT_TRUE(wake_stub_emu_ulp_run(trace, 2, SEC(10)));
+    TEST_ASSERT_EQUAL(SEC(3) * 1000, wake_stub_emu_time_us());
+
+    // The stub boots the application, which delivers the door event
+    TEST_ASSERT_TRUE(store_ulp_edges());
+    event_record_t record;
+    TEST_ASSERT_TRUE(event_buffer_pop(&record));
+    TEST_ASSERT_EQUAL(DOOR, record.channel);
+    TEST_ASSERT_EQUAL(WAKE_STUB_EMU_EPOCH_MS + SEC(3), record.timestamp);
+
+    // The flag was cleared, the closing door does not wake the chip again
+    TEST_ASSERT_FALSE(wake_stub_emu_ulp_run(trace, 2, SEC(10)));
+}
+
+TEST_CASE("ULP wakes the chip once the events left until MAX_PIR_EVENTS are unread", "[ulp]")
+{
+    wake_stub_emu_edge_t trace[2 * PULSES_MAX];
+    size_t count = pulses(trace, PIR, 10, SEC(1));
+    wake_stub_emu_reset(NULL);
+    wake_stub_emu_ulp_start();
+    MAX_PIR_EVENTS = 5;
+    ulp_edges_arm_wakeup(2);
+
+    TEST_ASSERT_TRUE(wake_stub_emu_ulp_run(trace, count, SEC(20)));
+    TEST_ASSERT_EQUAL(SEC(3) * 1000, wake_stub_emu_time_us());
+
+    // The stub stores the edges as PIR triggers, merged into one activity span
+    TEST_ASSERT_FALSE(store_ulp_edges());
+    close_pir_span();
+    event_record_t record;
+    TEST_ASSERT_TRUE(event_buffer_pop(&record));
+    TEST_ASSERT_EQUAL(PIR, record.channel);
+    TEST_ASSERT_EQUAL(WAKE_STUB_EMU_EPOCH_MS + SEC(1), record.timestamp);
+    TEST_ASSERT_EQUAL(SEC(2), record.duration);
+    TEST_ASSERT_EQUAL(3, record.count);
+    TEST_ASSERT_FALSE(event_buffer_pop(&record));
+}
+
+TEST_CASE("ULP counts the edges lost while the ring is full", "[ulp]")
+{
+    wake_stub_emu_edge_t trace[2 * PULSES_MAX];
+    size_t count = pulses(trace, PIR, 40, 100);
+    wake_stub_emu_reset(NULL);
+    wake_stub_emu_ulp_start();
+
+    // Nobody reads the ring, the program keeps asking for a wake-up
+    while (wake_stub_emu_ulp_run(trace, count, SEC(10))) {
+    }
+
+    ulp_edge_t edge;
+    for (uint32_t i = 0; i < ULP_EDGE_SLOTS - 1; i++) {
+        TEST_ASSERT_TRUE(ulp_edges_pop(&edge));
+        TEST_ASSERT_EQUAL((uint64_t)(i + 1) * 100 * 1000, edge.rtc_time_us);
+    }
+    TEST_ASSERT_FALSE(ulp_edges_pop(&edge));
+    TEST_ASSERT_EQUAL(40 - (ULP_EDGE_SLOTS - 1), ulp_edges_take_dropped());
+    TEST_ASSERT_EQUAL(0, ulp_edges_take_dropped());
+}
+
+TEST_CASE("ULP drop counter wraps at 16 bit", "[ulp]")
+{
+    wake_stub_emu_edge_t trace[2 * PULSES_MAX];
+    size_t count = pulses(trace, PIR, ULP_EDGE_SLOTS - 1 + 3, 100);
+    wake_stub_emu_reset(NULL);
+    wake_stub_emu_ulp_start();
+    ulp_edge_dropped = 0xFFFE;
+    TEST_ASSERT_EQUAL(0xFFFE, ulp_edges_take_dropped());
+
+    while (wake_stub_emu_ulp_run(trace, count, SEC(10))) {
+    }
+    TEST_ASSERT_EQUAL(1, ulp_edge_dropped & 0xFFFF);
+    TEST_ASSERT_EQUAL(3, ulp_edges_take_dropped());
+}
+
+TEST_CASE("ULP ring wraps around while the stub reads it", "[ulp]")
+{
+    wake_stub_emu_edge_t trace[2 * PULSES_MAX];
+    size_t count = pulses(trace, PIR, PULSES_MAX, 100);
+    wake_stub_emu_reset(NULL);
+    wake_stub_emu_ulp_start();
+
+    uint32_t read = 0;
+    uint32_t wakes = 0;
+    bool woke;
+    do {
+        woke = wake_stub_emu_ulp_run(trace, count, SEC(20));
+        wakes += woke;
+        ulp_edge_t edge;
+        while (ulp_edges_pop(&edge)) {
+            read++;
+            TEST_ASSERT_EQUAL(PIR, edge.channel);
+            TEST_ASSERT_EQUAL((uint64_t)read * 100 * 1000, edge.rtc_time_us);
+        }
+    } while (woke);
+
+    TEST_ASSERT_EQUAL(PULSES_MAX, read);
+    TEST_ASSERT_EQUAL(PULSES_MAX / (ULP_EDGE_SLOTS - 1), wakes);
+    TEST_ASSERT_EQUAL(0, ulp_edges_take_dropped());
+}
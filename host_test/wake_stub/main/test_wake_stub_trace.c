@@ -0,0 +1,91 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_attr.h"
+#include "unity.h"
+
+#include "main.h"
+#include "rtc_wake_stub_buffer.h"
+#include "rtc_wake_stub_channels.h"
+#include "wake_stub_emu.h"
+
+// Sensor channels of CONFIG_SENSOR_CHANNELS
+#define PIR  0
+#define DOOR 1
+
+#define SEC(s) ((uint64_t)(s) * 1000)
+
+TEST_CASE("PIR triggers within the coalesce window are delivered as one span", "[wake_stub]")
+{
+    const wake_stub_emu_edge_t trace[] = {
+        {SEC(10), PIR, true}, {SEC(11), PIR, false},
+        {SEC(20), PIR, true}, {SEC(21), PIR, false},
+        {SEC(35), PIR, true}, {SEC(36), PIR, false},
+    };
+    wake_stub_emu_result_t result;
+    wake_stub_emu_reset(NULL);
+    wake_stub_emu_run(trace, sizeof(trace) / sizeof(trace[0]), SEC((CONFIG_FLUSH_MAX_EVENT_AGE_SEC) + 60), &result);
+
+    // Every trigger wakes the stub once, the span is only flushed when it reaches the maximum age
+    TEST_ASSERT_EQUAL(3, result.ext1_wakes);
+    TEST_ASSERT_EQUAL(1, result.app_boots);
+    TEST_ASSERT_EQUAL(1, result.delivered);
+    TEST_ASSERT_EQUAL(PIR, result.records[0].channel);
+    TEST_ASSERT_EQUAL(WAKE_STUB_EMU_EPOCH_MS + SEC(10), result.records[0].timestamp);
+    TEST_ASSERT_EQUAL(SEC(25), result.records[0].duration);
+    TEST_ASSERT_EQUAL(3, result.records[0].count);
+}
+
+TEST_CASE("door contact boots the application right away", "[wake_stub]")
+{
+    const wake_stub_emu_edge_t trace[] = {
+        {SEC(5), DOOR, true}, {SEC(6), DOOR, false},
+    };
+    wake_stub_emu_result_t result;
+    wake_stub_emu_reset(NULL);
+    wake_stub_emu_run(trace, sizeof(trace) / sizeof(trace[0]), SEC(60), &result);
+
+    TEST_ASSERT_EQUAL(1, result.ext1_wakes);
+    TEST_ASSERT_EQUAL(0, result.stub_wakes);
+    TEST_ASSERT_EQUAL(1, result.app_boots);
+    TEST_ASSERT_EQUAL(1, result.delivered);
+    TEST_ASSERT_EQUAL(DOOR, result.records[0].channel);
+    TEST_ASSERT_EQUAL(EVENT_TYPE_MAGNETIC_SWITCH, result.records[0].type);
+    TEST_ASSERT_EQUAL(WAKE_STUB_EMU_EPOCH_MS + SEC(5), result.records[0].timestamp);
+}
+
+TEST_CASE("active sensor is masked until the timer finds it inactive", "[wake_stub]")
+{
+    const wake_stub_emu_edge_t trace[] = {
+        {SEC(10), PIR, true}, {SEC(100), PIR, false},
+        {SEC(150), PIR, true}, {SEC(151), PIR, false},
+    };
+    wake_stub_emu_result_t result;
+    wake_stub_emu_reset(NULL);
+    wake_stub_emu_run(trace, sizeof(trace) / sizeof(trace[0]), SEC(200), &result);
+
+    // One EXT1 wake per activation, the re-checks run on the timer
+    TEST_ASSERT_EQUAL(2, result.ext1_wakes);
+    TEST_ASSERT_GREATER_OR_EQUAL(90 / CONFIG_SENSOR_INACTIVE_DELAY_IN_WAKE_UP_STUB_SEC, result.timer_wakes);
+    TEST_ASSERT_EQUAL(result.ext1_wakes + result.timer_wakes, result.stub_wakes);
+    TEST_ASSERT_EQUAL(0, result.app_boots);
+
+    // The re-checks extend the first span until the sensor became inactive, the second
+    // trigger is outside the coalesce window and closed the first span
+    TEST_ASSERT_EQUAL(1, event_buffer_count());
+    event_record_t record;
+    TEST_ASSERT_TRUE(event_buffer_pop(&record));
+    TEST_ASSERT_EQUAL(WAKE_STUB_EMU_EPOCH_MS + SEC(10), record.timestamp);
+    TEST_ASSERT_UINT64_WITHIN(SEC(CONFIG_SENSOR_INACTIVE_DELAY_IN_WAKE_UP_STUB_SEC), SEC(90), record.duration);
+}
+
+TEST_CASE("battery status boots the application after BATTERY_INFO_INTERVAL_SEC", "[wake_stub]")
+{
+    wake_stub_emu_result_t result;
+    wake_stub_emu_reset(NULL);
+    wake_stub_emu_run(NULL, 0, SEC((CONFIG_BATTERY_INFO_INTERVAL_SEC) + 60), &result);
+
+    TEST_ASSERT_EQUAL(0, result.ext1_wakes);
+    TEST_ASSERT_EQUAL((CONFIG_BATTERY_INFO_INTERVAL_SEC) / (CONFIG_WAKEUP_INTERVAL_SEC), result.timer_wakes);
+    TEST_ASSERT_EQUAL(1, result.app_boots);
+    TEST_ASSERT_EQUAL(0, result.delivered);
+}
@@ -0,0 +1,130 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+
+#include "main.h"
+#include "backlog_drain.h"
+#include "event_journal.h"
+#include "rtc_wake_stub_buffer.h"
+#include "rtc_wake_stub_flush.h"
+
+/**
+ * @brief Pacing state of the drain, kept across deep sleep.
+ */
+typedef struct {
+    uint32_t srtt_ms;         // < Smoothed PUBACK round-trip time, 0 before the first sample.
+    uint32_t rttvar_ms;       // < Smoothed variation of the round-trip time.
+    uint32_t page_events;     // < Maximum number of events per message, 0 before the first drain.
+    uint32_t retry_sec;       // < Delay of the next attempt after a failed delivery, 0 before the first failure.
+} drain_state_t;
+
+RTC_DATA_ATTR static drain_state_t s_drain;
+
+// Time of backlog_drain_begin() in the current wake.
+static int64_t s_start_us;
+
+static uint32_t clamp(uint32_t value, uint32_t min, uint32_t max)
+{
+    return value < min ? min : value > max ? max : value;
+}
+
+void backlog_drain_begin(void)
+{
+    s_start_us = esp_timer_get_time();
+}
+
+bool backlog_drain_has_budget(void)
+{
+    uint64_t elapsed_ms = (esp_timer_get_time() - s_start_us) / 1000;
+    return elapsed_ms + s_drain.srtt_ms < CONFIG_BACKLOG_DRAIN_BUDGET_MS;
+}
+
+uint32_t backlog_drain_page_events(void)
+{
+    if (s_drain.page_events == 0) {
+        s_drain.page_events = CONFIG_BACKLOG_MIN_PAGE_EVENTS;
+    }
+    return s_drain.page_events;
+}
+
+uint32_t backlog_drain_ack_timeout_ms(void)
+{
+    if (s_drain.srtt_ms == 0) {
+        return CONFIG_MQTT_ACK_TIMEOUT_MS;
+    }
+    return clamp(s_drain.srtt_ms + 4 * s_drain.rttvar_ms, BACKLOG_MIN_ACK_TIMEOUT_MS, CONFIG_MQTT_ACK_TIMEOUT_MS);
+}
+
+void backlog_drain_on_ack(uint32_t rtt_ms)
+{
+    // Smoothed round-trip time and variation with the gains of the TCP estimator (RFC 6298)
+    if (s_drain.srtt_ms == 0) {
+        s_drain.srtt_ms = rtt_ms > 0 ? rtt_ms : 1;
+        s_drain.rttvar_ms = rtt_ms / 2;
+    } else {
+        uint32_t error = rtt_ms > s_drain.srtt_ms ? rtt_ms - s_drain.srtt_ms : s_drain.srtt_ms - rtt_ms;
+        s_drain.rttvar_ms = (3 * s_drain.rttvar_ms + error) / 4;
+        s_drain.srtt_ms = (7 * s_drain.srtt_ms + rtt_ms + 7) / 8;
+    }
+
+    // Grow the messages while the broker keeps up, shrink them once the round trip slows down
+    uint32_t page = backlog_drain_page_events();
+    if (rtt_ms <= CONFIG_BACKLOG_TARGET_RTT_MS) {
+        page += page / 4 + 1;
+    } else {
+        page = page * 3 / 4;
+    }
+    s_drain.page_events = clamp(page, CONFIG_BACKLOG_MIN_PAGE_EVENTS, CONFIG_BACKLOG_MAX_PAGE_EVENTS);
+}
+
+void backlog_drain_on_timeout(void)
+{
+    s_drain.page_events = clamp(backlog_drain_page_events() / 2, CONFIG_BACKLOG_MIN_PAGE_EVENTS,
+                                CONFIG_BACKLOG_MAX_PAGE_EVENTS);
+    if (s_drain.srtt_ms != 0) {
+        s_drain.rttvar_ms = clamp(s_drain.rttvar_ms * 2, 1, CONFIG_MQTT_ACK_TIMEOUT_MS);
+    }
+}
+
+void backlog_drain_schedule(bool delivered)
+{
+    flush_backlog_pending = event_journal_pending_blocks() > 0;
+    if (!flush_backlog_pending && event_buffer_count() == 0) {
+        flush_retry_at_ms = 0;
+        s_drain.retry_sec = 0;
+        return;
+    }
+
+    uint32_t delay_sec;
+    if (delivered) {
+        // The drain budget ran out, continue soon
+        delay_sec = CONFIG_BACKLOG_RESUME_SEC;
+        s_drain.retry_sec = 0;
+    } else {
+        if (s_drain.retry_sec == 0) {
+            s_drain.retry_sec = CONFIG_BACKLOG_RETRY_MIN_SEC;
+        }
+        delay_sec = s_drain.retry_sec;
+        s_drain.retry_sec = clamp(s_drain.retry_sec * 2, CONFIG_BACKLOG_RETRY_MIN_SEC, CONFIG_BACKLOG_RETRY_MAX_SEC);
+    }
+    flush_retry_at_ms = get_current_time_in_ms() + (uint64_t)delay_sec * 1000;
+
+    ESP_LOGI("drain", "Next delivery attempt in %" PRIu32 " s (%s, page %" PRIu32 " events, RTT %" PRIu32 " ms)",
+             delay_sec, delivered ? "backlog left" : "delivery failed", backlog_drain_page_events(), s_drain.srtt_ms);
+}
+
+uint32_t backlog_drain_retry_in_sec(void)
+{
+    if (flush_retry_at_ms == 0) {
+        return UINT32_MAX;
+    }
+    uint64_t now_ms = get_current_time_in_ms();
+    if (now_ms >= flush_retry_at_ms) {
+        return 1;
+    }
+    return (uint32_t)((flush_retry_at_ms - now_ms + 999) / 1000);
+}
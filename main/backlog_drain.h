@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Lower bound (in milliseconds) of the adaptive acknowledgment timeout.
+#define BACKLOG_MIN_ACK_TIMEOUT_MS 1000
+
+/**
+ * @brief Starts the drain budget of the current wake.
+ *
+ * Call before the first publish of the pending records.
+ */
+void backlog_drain_begin(void);
+
+/**
+ * @brief Checks if there is time left to send another journal block in this wake.
+ *
+ * A block is only started if the elapsed time plus the smoothed PUBACK round-trip time
+ * stays within CONFIG_BACKLOG_DRAIN_BUDGET_MS.
+ */
+bool backlog_drain_has_budget(void);
+
+/**
+ * @brief Returns the maximum number of events to encode into the next message.
+ *
+ * Starts at CONFIG_BACKLOG_MIN_PAGE_EVENTS, grows while the PUBACK round-trip time stays
+ * below CONFIG_BACKLOG_TARGET_RTT_MS and shrinks when it rises or an acknowledgment is
+ * missing. Kept in RTC memory across deep sleep.
+ */
+uint32_t backlog_drain_page_events(void);
+
+/**
+ * @brief Returns the time to wait for the acknowledgment of a publish.
+ *
+ * Derived from the smoothed round-trip time and its variation like a TCP retransmission
+ * timeout, between BACKLOG_MIN_ACK_TIMEOUT_MS and CONFIG_MQTT_ACK_TIMEOUT_MS.
+ */
+uint32_t backlog_drain_ack_timeout_ms(void);
+
+/**
+ * @brief Records the round-trip time of an acknowledged publish.
+ *
+ * @param rtt_ms Time from the publish to the PUBACK in milliseconds.
+ */
+void backlog_drain_on_ack(uint32_t rtt_ms);
+
+/**
+ * @brief Records a publish that was not acknowledged in time.
+ */
+void backlog_drain_on_timeout(void);
+
+/**
+ * @brief Schedules the next delivery attempt for the wake-up stub.
+ *
+ * If records are left over although the broker acknowledged everything sent, the drain
+ * budget ran out and the next wake continues after CONFIG_BACKLOG_RESUME_SEC. After a failed
+ * delivery, the next attempt backs off exponentially from CONFIG_BACKLOG_RETRY_MIN_SEC to
+ * CONFIG_BACKLOG_RETRY_MAX_SEC. Call at the end of the delivery.
+ *
+ * @param delivered false if the broker was not reachable or did not acknowledge a publish.
+ */
+void backlog_drain_schedule(bool delivered);
+
+/**
+ * @brief Returns the time until the scheduled delivery attempt.
+ *
+ * @return Time in seconds (at least 1), UINT32_MAX if no attempt is scheduled.
+ */
+uint32_t backlog_drain_retry_in_sec(void);
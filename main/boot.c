@@ -0,0 +1,141 @@
+// Standard Libraries
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+// ESP-IDF Core Headers
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+
+// Project-Specific Headers
+#include "main.h"
+#include "wifi.h"
+#include "sntp.h"
+#include "mqtt.h"
+#include "gauge.h"
+#include "rtc_wake_stub.h"
+#include "rtc_wake_stub_clock.h"
+#include "boot.h"
+
+// Maximum time to wait for the fuel gauge task after the network is up
+#define GAUGE_TIMEOUT_MS 5000
+
+#define GAUGE_DONE_BIT BIT0
+
+static EventGroupHandle_t s_boot_event_group;
+
+// Result of the gauge read, valid once GAUGE_DONE_BIT is set.
+static bool s_gauge_read;
+
+/**
+ * @brief Reads the fuel gauge and signals the boot pipeline when done.
+ *
+ * @param arg Pointer to the boot report, receives the duration of the read.
+ */
+static void gauge_task(void *arg)
+{
+    boot_report_t *report = (boot_report_t *)arg;
+    int64_t start = esp_timer_get_time();
+
+    s_gauge_read = getRSOC();
+
+    report->gauge_us = esp_timer_get_time() - start;
+    xEventGroupSetBits(s_boot_event_group, GAUGE_DONE_BIT);
+    vTaskDelete(NULL);
+}
+
+void run_boot_pipeline(boot_report_t *report)
+{
+    memset(report, 0, sizeof(*report));
+    s_boot_event_group = xEventGroupCreate();
+    int64_t start = esp_timer_get_time();
+
+    ESP_LOGI("progress", "Starting Wifi");
+    begin_wifi();
+
+    // Read the gauge on the other core while the station associates
+    bool read_battery = this_device.battery_info_available && isBatteryStatusDue();
+    if (read_battery) {
+        ESP_LOGI("battery", "Reading the fuel gauge in parallel");
+        xTaskCreatePinnedToCore(gauge_task, "gauge", 4096, report, 5, NULL, portNUM_PROCESSORS - 1);
+    }
+
+    // Make the events merged by the wake-up stub ready to be sent
+    close_pir_span();
+
+    // Encode them into the MQTT payload while the station associates
+    int64_t prepare_start = esp_timer_get_time();
+    prepare_uplink_batch();
+    report->prepare_us = esp_timer_get_time() - prepare_start;
+
+    wait_for_wifi();
+    int64_t wifi_done = esp_timer_get_time();
+    report->wifi_us = wifi_done - start;
+
+    // SNTP and MQTT both only need the network, let their handshakes overlap.
+    // SNTP is skipped if the RTC drift model still keeps the time within the tolerance.
+    bool sync_clock = clock_model_needs_sync(get_time_since_boot_in_ms());
+    ESP_LOGI("progress", "Starting Clock and MQTT");
+    if (sync_clock) {
+        begin_clock();
+    }
+    begin_mqtt();
+
+    if (sync_clock) {
+        report->clock_synced = wait_for_clock();
+    } else {
+        restore_clock_from_rtc();
+    }
+    int64_t clock_done = esp_timer_get_time();
+    report->clock_us = clock_done - wifi_done;
+
+    wait_for_mqtt();
+    int64_t mqtt_done = esp_timer_get_time();
+    report->mqtt_us = mqtt_done - clock_done;
+
+    // Association also works with a reused lease whose address was given to another host
+    if (!mqtt_broker_connected || (sync_clock && !report->clock_synced)) {
+        wifi_drop_reused_lease();
+    }
+
+    bool gauge_done = false;
+    if (read_battery) {
+        EventBits_t bits = xEventGroupWaitBits(s_boot_event_group, GAUGE_DONE_BIT, pdFALSE, pdTRUE, pdMS_TO_TICKS(GAUGE_TIMEOUT_MS));
+        gauge_done = (bits & GAUGE_DONE_BIT) != 0;
+        if (!gauge_done) {
+            ESP_LOGW("battery", "Fuel gauge read did not finish in %d ms", GAUGE_TIMEOUT_MS);
+        }
+        // Only a successful read is sent, the battery interval restarts with it
+        report->battery_read = gauge_done && s_gauge_read;
+    }
+    report->total_us = esp_timer_get_time() - start;
+
+    // A serial boot waits for each phase in turn: the whole MQTT handshake after SNTP, the
+    // gauge and the encoding after the network. A skipped SNTP sync is not counted.
+    report->serial_us = report->wifi_us + report->clock_us + (mqtt_done - wifi_done) +
+                        report->gauge_us + report->prepare_us;
+
+    ESP_LOGI("progress", "Boot timing: wifi %lld ms, clock %lld ms, mqtt %lld ms, gauge %lld ms (parallel), "
+             "prepare %lld ms (parallel), total %lld ms, serial %lld ms",
+             report->wifi_us / 1000, report->clock_us / 1000, report->mqtt_us / 1000,
+             report->gauge_us / 1000, report->prepare_us / 1000, report->total_us / 1000,
+             report->serial_us / 1000);
+
+    // The gauge task may still reference the event group if it timed out
+    if (!read_battery || gauge_done) {
+        vEventGroupDelete(s_boot_event_group);
+    }
+}
+
+void log_awake_window(const boot_report_t *report, int64_t awake_us)
+{
+    int64_t serial_awake_us = awake_us - report->total_us + report->serial_us;
+    if (serial_awake_us <= 0) {
+        return;
+    }
+    ESP_LOGI("progress", "Awake window: %lld ms, serial boot %lld ms (%lld%%)", awake_us / 1000,
+             serial_awake_us / 1000, awake_us * 100 / serial_awake_us);
+}
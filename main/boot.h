@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Timing of the boot phases, all values in microseconds.
+ *
+ * The network phases run one after another on the main task, the fuel gauge
+ * is read in parallel on the other core and the MQTT payload is encoded while
+ * the station associates.
+ */
+typedef struct {
+    int64_t wifi_us;      // < From the start of the pipeline until Wi-Fi got an IP address.
+    int64_t clock_us;     // < Waiting for SNTP after Wi-Fi connected.
+    int64_t mqtt_us;      // < Waiting for the MQTT connection after SNTP.
+    int64_t gauge_us;     // < Duration of the fuel gauge read, 0 if it was not read.
+    int64_t prepare_us;   // < Encoding the buffered events into the MQTT payload.
+    int64_t total_us;     // < Total duration of the pipeline.
+    int64_t serial_us;    // < Duration of the same phases run one after another, as before the pipeline.
+    bool battery_read;    // < True if `voltage` and `rsoc` were updated and should be sent.
+    bool clock_synced;    // < True if the time was synchronized with SNTP, false if it was restored from the RTC.
+} boot_report_t;
+
+/**
+ * @brief Brings up the network and reads the fuel gauge in parallel.
+ *
+ * Starts Wi-Fi and, if the battery status is due, reads the LC709203F on the other
+ * core while the station associates. SNTP and MQTT are started together once
+ * Wi-Fi is connected, so the SNTP wait overlaps the MQTT handshake. SNTP is
+ * skipped when the RTC drift model keeps the time within the tolerance. Logs
+ * the timing of every phase.
+ *
+ * @param[out] report Timing of the boot phases and the result of the gauge read.
+ */
+void run_boot_pipeline(boot_report_t *report);
+
+/**
+ * @brief Logs the awake window of this boot against the one of a serial boot.
+ *
+ * The serial boot is estimated from the phase durations of the pipeline, the rest
+ * of the awake time is the same for both.
+ *
+ * @param report Timing of the boot phases.
+ * @param awake_us Time since the wake-up, just before entering deep sleep.
+ */
+void log_awake_window(const boot_report_t *report, int64_t awake_us);
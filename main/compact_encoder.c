@@ -0,0 +1,170 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include "esp_attr.h"
+
+#include "compact_encoder.h"
+
+static void put_byte(compact_encoder_t *enc, uint8_t b)
+{
+    if (enc->len >= enc->size) {
+        enc->overflow = true;
+        return;
+    }
+    enc->buf[enc->len++] = b;
+}
+
+static void put_varint(compact_encoder_t *enc, uint64_t value)
+{
+    while (value >= 0x80) {
+        put_byte(enc, (uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    put_byte(enc, (uint8_t)value);
+}
+
+// Writes the zigzag encoded difference to the previous timestamp.
+static void put_timestamp(compact_encoder_t *enc, uint64_t timestamp)
+{
+    int64_t delta = (int64_t)(timestamp - enc->timestamp);
+    put_varint(enc, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+}
+
+/**
+ * @brief Returns the index of the room, defining it in the message if needed.
+ *
+ * @return Room index, or -1 if the dictionary is full.
+ */
+static int room_index(compact_encoder_t *enc, const char *room_id)
+{
+    for (uint32_t i = 0; i < enc->room_count; i++) {
+        if (strcmp(enc->rooms[i], room_id) == 0) {
+            return i;
+        }
+    }
+    if (enc->room_count == COMPACT_MAX_ROOMS) {
+        return -1;
+    }
+
+    size_t len = strlen(room_id);
+    if (len > UINT8_MAX) {
+        len = UINT8_MAX;
+    }
+    put_byte(enc, COMPACT_ROOM);
+    put_byte(enc, (uint8_t)len);
+    for (size_t i = 0; i < len; i++) {
+        put_byte(enc, (uint8_t)room_id[i]);
+    }
+    if (enc->overflow) {
+        return -1;
+    }
+    enc->rooms[enc->room_count] = room_id;
+    return enc->room_count++;
+}
+
+/**
+ * @brief Undoes a partially written record.
+ *
+ * @return false if the record was rolled back.
+ */
+static bool commit(compact_encoder_t *enc, size_t mark, uint32_t room_count)
+{
+    if (enc->overflow) {
+        enc->len = mark;
+        enc->room_count = room_count;
+        enc->overflow = false;
+        return false;
+    }
+    return true;
+}
+
+void compact_encoder_init(compact_encoder_t *enc, uint8_t *buf, size_t size)
+{
+    enc->buf = buf;
+    enc->size = size;
+    enc->len = 0;
+    enc->overflow = false;
+    enc->timestamp = 0;
+    enc->room_count = 0;
+    put_byte(enc, COMPACT_MAGIC);
+    put_byte(enc, COMPACT_VERSION);
+}
+
+bool compact_encoder_add_event(compact_encoder_t *enc, const event_record_t *event, const char *room_id)
+{
+    size_t mark = enc->len;
+    uint32_t room_count = enc->room_count;
+
+    int room = room_index(enc, room_id);
+    if (room < 0) {
+        enc->overflow = true;
+        return commit(enc, mark, room_count);
+    }
+
+    bool span = event->count > 1 || event->duration > 0;
+    uint8_t kind = event->type == EVENT_TYPE_MAGNETIC_SWITCH ? COMPACT_MAGNETIC : COMPACT_PIR;
+    put_byte(enc, (uint8_t)((room << 4) | (span ? COMPACT_TAG_SPAN : 0) | kind));
+    put_timestamp(enc, event->timestamp);
+    if (span) {
+        put_varint(enc, event->duration);
+        put_varint(enc, event->count);
+    }
+    if (!commit(enc, mark, room_count)) {
+        return false;
+    }
+
+    enc->timestamp = event->timestamp;
+    return true;
+}
+
+bool compact_encoder_add_battery(compact_encoder_t *enc, uint64_t timestamp, float voltage, float soc)
+{
+    size_t mark = enc->len;
+
+    put_byte(enc, COMPACT_BATTERY);
+    put_timestamp(enc, timestamp);
+    put_varint(enc, voltage > 0 ? (uint64_t)(voltage * 1000.0f + 0.5f) : 0);
+    put_varint(enc, soc > 0 ? (uint64_t)(soc * 10.0f + 0.5f) : 0);
+    if (!commit(enc, mark, enc->room_count)) {
+        return false;
+    }
+
+    enc->timestamp = timestamp;
+    return true;
+}
+
+bool compact_encoder_add_wake_stats(compact_encoder_t *enc, uint64_t timestamp, uint32_t period_sec, const wake_stats_t *stats)
+{
+    size_t mark = enc->len;
+
+    put_byte(enc, COMPACT_WAKE_STATS);
+    put_timestamp(enc, timestamp);
+    put_varint(enc, period_sec);
+    put_varint(enc, stats->stub_wakes);
+    put_varint(enc, stats->app_boots);
+    put_varint(enc, stats->stub_us / 1000);
+    for (uint32_t i = 0; i < WAKE_PHASE_COUNT; i++) {
+        put_varint(enc, stats->phase_us[i] / 1000);
+    }
+    for (uint32_t i = 0; i < WAKE_STATS_BUCKETS; i++) {
+        put_varint(enc, stats->awake_histogram[i]);
+    }
+    put_varint(enc, stats->light_sleep_us / 1000);
+    put_varint(enc, stats->published_events);
+    put_varint(enc, stats->published_events > 0 ? stats->publish_latency_ms / stats->published_events : 0);
+    put_varint(enc, stats->max_publish_latency_ms);
+    put_varint(enc, stats->connect_acks > 0 ? stats->connect_ack_ms / stats->connect_acks : 0);
+    put_varint(enc, stats->max_connect_ack_ms);
+    if (!commit(enc, mark, enc->room_count)) {
+        return false;
+    }
+
+    enc->timestamp = timestamp;
+    return true;
+}
+
+size_t compact_encoder_finish(compact_encoder_t *enc)
+{
+    return enc->len;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "rtc_wake_stub_buffer.h"
+#include "rtc_wake_stub_stats.h"
+
+/**
+ * @brief Encoding of the MQTT payloads.
+ */
+typedef enum {
+    PAYLOAD_FORMAT_JSON = 0,    // < {"sensors":[...]} JSON, see json_encoder.h.
+    PAYLOAD_FORMAT_COMPACT = 1, // < Binary records with delta timestamps, see below.
+} payload_format_t;
+
+/*
+ * Compact payload format (version 3), the binary counterpart of the JSON schema:
+ *
+ *   message := 0xC5 version(u8) record*
+ *   record  := tag(u8) body
+ *
+ * The tag holds the record kind in bits 0-2, the span flag in bit 3 and the room index
+ * in bits 4-7. All integers are unsigned LEB128 varints, timestamps are zigzag encoded
+ * deltas (in milliseconds) to the timestamp of the previous record, starting from 0.
+ *
+ *   COMPACT_ROOM     body := len(u8) bytes            defines the next room index
+ *   COMPACT_PIR      body := delta [duration count]   room index of the event
+ *   COMPACT_MAGNETIC body := delta [duration count]   room index of the event
+ *   COMPACT_BATTERY  body := delta voltage_mv soc_tenths
+ *   COMPACT_WAKE_STATS body := delta period_sec stub_wakes boots stub_ms
+ *                              phase_ms[WAKE_PHASE_COUNT] histogram[WAKE_STATS_BUCKETS]
+ *                              light_sleep_ms published latency_avg_ms latency_max_ms
+ *                              connect_ack_avg_ms connect_ack_max_ms
+ *
+ * A room is defined once per message, before the first record that refers to it.
+ * Duration and count are only present if the span flag is set.
+ */
+#define COMPACT_MAGIC    0xC5
+#define COMPACT_VERSION  3
+
+#define COMPACT_ROOM     0
+#define COMPACT_PIR      1
+#define COMPACT_MAGNETIC 2
+#define COMPACT_BATTERY  3
+#define COMPACT_WAKE_STATS 4
+
+#define COMPACT_TAG_SPAN 0x08
+
+// Maximum number of distinct rooms in one message.
+#define COMPACT_MAX_ROOMS 16
+
+/**
+ * @brief Single-pass encoder for the compact payload format.
+ *
+ * Like json_encoder_t, a record that does not fit is rolled back and reported, so the
+ * message written so far stays valid.
+ */
+typedef struct {
+    uint8_t *buf;                           // < Output buffer.
+    size_t size;                            // < Size of the output buffer.
+    size_t len;                             // < Number of bytes written.
+    bool overflow;                          // < Set when a write did not fit into the buffer.
+    uint64_t timestamp;                     // < Timestamp of the previous record.
+    uint32_t room_count;                    // < Number of rooms defined in the message.
+    const char *rooms[COMPACT_MAX_ROOMS];   // < Room IDs by index.
+} compact_encoder_t;
+
+/**
+ * @brief Starts a message in the given buffer.
+ *
+ * @param enc  Encoder to initialize.
+ * @param buf  Output buffer.
+ * @param size Size of the output buffer.
+ */
+void compact_encoder_init(compact_encoder_t *enc, uint8_t *buf, size_t size);
+
+/**
+ * @brief Adds a buffered sensor event.
+ *
+ * The room ID string must stay valid until the message is finished.
+ *
+ * @param enc     Encoder.
+ * @param event   Event to encode.
+ * @param room_id Room ID reported with the event.
+ * @return false if the record does not fit into the buffer.
+ */
+bool compact_encoder_add_event(compact_encoder_t *enc, const event_record_t *event, const char *room_id);
+
+/**
+ * @brief Adds a battery reading.
+ *
+ * @param enc       Encoder.
+ * @param timestamp The actual Unix timestamp in milliseconds.
+ * @param voltage   Battery voltage in volts, encoded in millivolts.
+ * @param soc       State of charge in percent, encoded in tenths of a percent.
+ * @return false if the record does not fit into the buffer.
+ */
+bool compact_encoder_add_battery(compact_encoder_t *enc, uint64_t timestamp, float voltage, float soc);
+
+/**
+ * @brief Adds the wake cost statistics.
+ *
+ * @param enc        Encoder.
+ * @param timestamp  The actual Unix timestamp in milliseconds.
+ * @param period_sec Length of the period the statistics cover, in seconds.
+ * @param stats      Statistics to encode.
+ * @return false if the record does not fit into the buffer.
+ */
+bool compact_encoder_add_wake_stats(compact_encoder_t *enc, uint64_t timestamp, uint32_t period_sec, const wake_stats_t *stats);
+
+/**
+ * @brief Returns the length of the message in bytes.
+ */
+size_t compact_encoder_finish(compact_encoder_t *enc);
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "esp_log.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+
+#include "main.h"
+#include "device_registry.h"
+
+// MQTT key of this_device, loaded on the first use.
+static char *s_key = NULL;
+
+// Set once the registry partition is initialized.
+static bool s_initialized = false;
+
+/**
+ * @brief Formats the NVS namespace of a device from its MAC address.
+ */
+static void device_namespace(const uint8_t *mac_address, char *name, size_t size)
+{
+    snprintf(name, size, "%02x%02x%02x%02x%02x%02x", mac_address[0], mac_address[1], mac_address[2],
+             mac_address[3], mac_address[4], mac_address[5]);
+}
+
+/**
+ * @brief Opens the namespace of a device in the registry partition, initializing it on the first use.
+ *
+ * The partition is never erased here: a registry that can not be initialized stays
+ * unreadable until it is provisioned again.
+ */
+static esp_err_t registry_open(const uint8_t *mac_address, nvs_handle_t *handle)
+{
+    if (!s_initialized) {
+        esp_err_t err = nvs_flash_init_partition(DEVICE_REGISTRY_PARTITION);
+        if (err != ESP_OK) {
+            ESP_LOGE("*", "Device registry: partition not initialized (%s)", esp_err_to_name(err));
+            return err;
+        }
+        s_initialized = true;
+    }
+
+    char name[NVS_KEY_NAME_MAX_SIZE];
+    device_namespace(mac_address, name, sizeof(name));
+    return nvs_open_from_partition(DEVICE_REGISTRY_PARTITION, name, NVS_READONLY, handle);
+}
+
+/**
+ * @brief Reads a string into a fixed size field, leaving it empty if the key is missing.
+ */
+static void read_string(nvs_handle_t handle, const char *key, char *value, size_t size)
+{
+    size_t length = size;
+    esp_err_t err = nvs_get_str(handle, key, value, &length);
+    if (err != ESP_OK) {
+        ESP_LOGW("*", "Device registry: %s not read (%s)", key, esp_err_to_name(err));
+        value[0] = '\0';
+    }
+}
+
+bool device_registry_load(const uint8_t *mac_address, device_info_t *device)
+{
+    nvs_handle_t handle;
+    if (registry_open(mac_address, &handle) != ESP_OK) {
+        return false;
+    }
+
+    int32_t device_id = 0;
+    uint8_t battery = 0;
+    esp_err_t err = nvs_get_i32(handle, DEVICE_REGISTRY_KEY_ID, &device_id);
+    if (err == ESP_OK) {
+        for (int i = 0; i < sizeof(device->mac_address); i++) {
+            device->mac_address[i] = mac_address[i];
+        }
+        device->device_id = device_id;
+        nvs_get_u8(handle, DEVICE_REGISTRY_KEY_BATTERY, &battery);
+        device->battery_info_available = battery != 0;
+        read_string(handle, DEVICE_REGISTRY_KEY_NAME, device->device_name, sizeof(device->device_name));
+        read_string(handle, DEVICE_REGISTRY_KEY_TOPIC, device->device_topic, sizeof(device->device_topic));
+        read_string(handle, DEVICE_REGISTRY_KEY_ROOM, device->room_id, sizeof(device->room_id));
+    }
+    nvs_close(handle);
+    return err == ESP_OK;
+}
+
+const char *device_registry_get_key(void)
+{
+    if (s_key != NULL) {
+        return s_key;
+    }
+
+    nvs_handle_t handle;
+    size_t length = 0;
+    if (registry_open(this_device.mac_address, &handle) == ESP_OK) {
+        if (nvs_get_str(handle, DEVICE_REGISTRY_KEY_MQTT_KEY, NULL, &length) == ESP_OK) {
+            s_key = malloc(length);
+            if (s_key != NULL && nvs_get_str(handle, DEVICE_REGISTRY_KEY_MQTT_KEY, s_key, &length) != ESP_OK) {
+                free(s_key);
+                s_key = NULL;
+            }
+        }
+        nvs_close(handle);
+    }
+
+    if (s_key == NULL) {
+        ESP_LOGW("mqtt", "No MQTT key provisioned for this device");
+        return "";
+    }
+    return s_key;
+}
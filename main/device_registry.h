@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "main.h"
+
+// NVS partition of the registry (see partitions.csv). It is separate from the default
+// "nvs" partition, which app_main erases when it can not be initialized.
+#define DEVICE_REGISTRY_PARTITION "registry"
+
+// NVS keys of a device entry. Every device has its own namespace, named by its Wi-Fi
+// station MAC address as 12 lower case hex digits (e.g. "ec6260bce850").
+#define DEVICE_REGISTRY_KEY_ID       "id"       // < i32, device ID.
+#define DEVICE_REGISTRY_KEY_NAME     "name"     // < string, name of the device.
+#define DEVICE_REGISTRY_KEY_TOPIC    "topic"    // < string, MQTT topic of the device.
+#define DEVICE_REGISTRY_KEY_ROOM     "room"     // < string, room ID of the device.
+#define DEVICE_REGISTRY_KEY_BATTERY  "battery"  // < u8, 1 if the device has a fuel gauge.
+#define DEVICE_REGISTRY_KEY_MQTT_KEY "key"      // < string, key (JWT) to authenticate with the MQTT broker.
+
+/**
+ * @brief Loads the registry entry of a device from NVS.
+ *
+ * The entry is looked up by the namespace of the MAC address, so the cost does not
+ * depend on the number of provisioned devices. The MQTT key is not loaded, see
+ * device_registry_get_key(). The registry partition is initialized on the first call.
+ *
+ * @param mac_address   MAC address of the device.
+ * @param[out] device   Device information.
+ * @return true if the device is provisioned.
+ */
+bool device_registry_load(const uint8_t *mac_address, device_info_t *device);
+
+/**
+ * @brief Returns the MQTT key of this_device, loading it from NVS on the first call.
+ *
+ * The key is kept in the heap until the next deep sleep, wakes that do not connect to
+ * MQTT never read it.
+ *
+ * @return The key, or an empty string if it is not provisioned.
+ */
+const char *device_registry_get_key(void);
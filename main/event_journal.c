@@ -0,0 +1,391 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+
+#include "main.h"
+#include "event_journal.h"
+#include "rtc_wake_stub_channels.h"
+
+#define JOURNAL_MAGIC           0x314C4E4A  // < "JNL1"
+#define JOURNAL_ERASED          0xFFFFFFFF  // < Word of erased flash.
+#define JOURNAL_STATE_COMMITTED 0xFFFF0000  // < Block written completely, not yet delivered.
+#define JOURNAL_STATE_CONSUMED  0x00000000  // < Block delivered to the broker.
+
+// Size (in bytes) of an encoded event in the block payload.
+#define JOURNAL_RECORD_SIZE  15
+#define JOURNAL_PAYLOAD_SIZE (EVENT_JOURNAL_BLOCK_EVENTS * JOURNAL_RECORD_SIZE)
+
+/**
+ * @brief Header in front of every journal block, see event_journal.h.
+ */
+typedef struct {
+    uint32_t magic;           // < JOURNAL_MAGIC.
+    uint32_t state;           // < JOURNAL_ERASED, JOURNAL_STATE_COMMITTED or JOURNAL_STATE_CONSUMED.
+    uint32_t seq;             // < Sequence number, increasing with every appended block.
+    uint16_t count;           // < Number of events in the block.
+    uint16_t length;          // < Size of the payload in bytes.
+    uint32_t crc;             // < CRC32 of the payload.
+} journal_header_t;
+
+/**
+ * @brief What read_slot() found at an offset.
+ */
+typedef enum {
+    SLOT_BLOCK,               // < A structurally valid block.
+    SLOT_FREE,                // < Erased flash, or no room for a block before the end of the sector.
+    SLOT_INVALID,             // < Garbage, e.g. left by an interrupted write or erase.
+} journal_slot_t;
+
+/**
+ * @brief Position of the journal, kept across deep sleep.
+ *
+ * Lost on a power loss or reset, the partition is then scanned again.
+ */
+typedef struct {
+    bool mounted;             // < The fields below were restored from the partition.
+    uint32_t read_offset;     // < Offset of the oldest pending block.
+    uint32_t write_offset;    // < Offset of the next block.
+    uint32_t next_seq;        // < Sequence number of the next block.
+    uint32_t pending_blocks;  // < Number of committed blocks not yet delivered.
+} journal_state_t;
+
+RTC_DATA_ATTR static journal_state_t s_journal;
+
+static const esp_partition_t *s_partition = NULL;
+static uint32_t s_sector_size;
+static uint32_t s_sector_count;
+
+// Payload of the block being written or read.
+static uint8_t s_payload[JOURNAL_PAYLOAD_SIZE];
+
+static uint32_t block_size(const journal_header_t *header)
+{
+    return (sizeof(journal_header_t) + header->length + 3) & ~3u;
+}
+
+/**
+ * @brief Returns the start of the sector following the one holding @p offset, wrapping around.
+ */
+static uint32_t next_sector(uint32_t offset)
+{
+    uint32_t next = offset - offset % s_sector_size + s_sector_size;
+    return next >= s_sector_count * s_sector_size ? 0 : next;
+}
+
+/**
+ * @brief Returns the offset right behind the block at @p offset, wrapping around.
+ */
+static uint32_t next_block(uint32_t offset, const journal_header_t *header)
+{
+    offset += block_size(header);
+    return offset >= s_sector_count * s_sector_size ? 0 : offset;
+}
+
+static journal_slot_t read_slot(uint32_t offset, journal_header_t *header)
+{
+    uint32_t room = s_sector_size - offset % s_sector_size;
+    if (room < sizeof(*header)) {
+        return SLOT_FREE;
+    }
+    if (esp_partition_read(s_partition, offset, header, sizeof(*header)) != ESP_OK) {
+        return SLOT_INVALID;
+    }
+    if (header->magic == JOURNAL_ERASED) {
+        return SLOT_FREE;
+    }
+    if (header->magic != JOURNAL_MAGIC || header->count > EVENT_JOURNAL_BLOCK_EVENTS ||
+        header->length != header->count * JOURNAL_RECORD_SIZE || block_size(header) > room) {
+        return SLOT_INVALID;
+    }
+    return SLOT_BLOCK;
+}
+
+/**
+ * @brief Returns the first committed block at or after @p offset, or the write offset if there is none.
+ */
+static uint32_t find_pending(uint32_t offset)
+{
+    journal_header_t header;
+    uint32_t sectors = 0;
+    while (offset != s_journal.write_offset && sectors <= s_sector_count) {
+        if (read_slot(offset, &header) != SLOT_BLOCK) {
+            offset = next_sector(offset);
+            sectors++;
+            continue;
+        }
+        if (header.state == JOURNAL_STATE_COMMITTED) {
+            return offset;
+        }
+        offset = next_block(offset, &header);
+        if (offset % s_sector_size == 0) {
+            sectors++;
+        }
+    }
+    return s_journal.write_offset;
+}
+
+/**
+ * @brief Restores the journal position, scanning the partition if it was lost.
+ */
+static bool journal_mount(void)
+{
+    if (!CONFIG_EVENT_JOURNAL_ENABLED) {
+        return false;
+    }
+    if (s_partition == NULL) {
+        s_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+                                               EVENT_JOURNAL_PARTITION);
+        if (s_partition == NULL) {
+            ESP_LOGW("journal", "No \"%s\" partition, events can not be spilled to flash", EVENT_JOURNAL_PARTITION);
+            return false;
+        }
+        s_sector_size = s_partition->erase_size;
+        s_sector_count = s_partition->size / s_partition->erase_size;
+    }
+    if (s_sector_count < 2) {
+        return false;
+    }
+    if (s_journal.mounted) {
+        return true;
+    }
+
+    // Find the oldest pending block and the newest block written completely
+    journal_header_t header;
+    bool found = false;
+    uint32_t first_seq = UINT32_MAX;
+    uint32_t last_seq = 0;
+    uint32_t last_end = 0;
+    s_journal.pending_blocks = 0;
+    for (uint32_t sector = 0; sector < s_sector_count; sector++) {
+        uint32_t offset = sector * s_sector_size;
+        uint32_t end = offset + s_sector_size;
+        while (offset < end && read_slot(offset, &header) == SLOT_BLOCK) {
+            if (header.state == JOURNAL_STATE_COMMITTED) {
+                s_journal.pending_blocks++;
+                if (header.seq < first_seq) {
+                    first_seq = header.seq;
+                    s_journal.read_offset = offset;
+                }
+            }
+            if (header.state != JOURNAL_ERASED && (!found || header.seq > last_seq)) {
+                found = true;
+                last_seq = header.seq;
+                last_end = offset + block_size(&header);
+            }
+            offset += block_size(&header);
+        }
+    }
+
+    // Continue behind the newest block, or in the next sector if an interrupted write follows it
+    s_journal.write_offset = 0;
+    s_journal.next_seq = 0;
+    if (found) {
+        s_journal.next_seq = last_seq + 1;
+        s_journal.write_offset = last_end % (s_sector_count * s_sector_size);
+        if (s_journal.write_offset % s_sector_size != 0 && read_slot(s_journal.write_offset, &header) != SLOT_FREE) {
+            s_journal.write_offset = next_sector(s_journal.write_offset);
+        }
+    }
+    if (s_journal.pending_blocks == 0) {
+        s_journal.read_offset = s_journal.write_offset;
+    }
+    s_journal.mounted = true;
+
+    ESP_LOGI("journal", "Mounted, %" PRIu32 " pending blocks, next block %" PRIu32 " at 0x%" PRIx32,
+             s_journal.pending_blocks, s_journal.next_seq, s_journal.write_offset);
+    return true;
+}
+
+/**
+ * @brief Forgets the pending blocks of a sector that is about to be erased.
+ */
+static void drop_sector(uint32_t sector_offset)
+{
+    journal_header_t header;
+    uint32_t dropped = 0;
+    uint32_t offset = sector_offset;
+    uint32_t end = sector_offset + s_sector_size;
+    while (s_journal.pending_blocks > 0 && offset < end && read_slot(offset, &header) == SLOT_BLOCK) {
+        if (header.state == JOURNAL_STATE_COMMITTED) {
+            s_journal.pending_blocks--;
+            dropped += header.count;
+        }
+        offset += block_size(&header);
+    }
+    if (dropped == 0) {
+        return;
+    }
+
+    dropped_event_count += dropped;
+    ESP_LOGW("journal", "Journal full, dropped %" PRIu32 " events", dropped);
+    if (s_journal.read_offset - s_journal.read_offset % s_sector_size == sector_offset) {
+        s_journal.read_offset = s_journal.pending_blocks > 0 ? find_pending(next_sector(sector_offset))
+                                                              : s_journal.write_offset;
+    }
+}
+
+/**
+ * @brief Appends the first @p count events of s_payload as a new block.
+ */
+static bool append_block(uint32_t count)
+{
+    journal_header_t header = {
+        .magic = JOURNAL_MAGIC,
+        .state = JOURNAL_ERASED,
+        .seq = s_journal.next_seq,
+        .count = count,
+        .length = count * JOURNAL_RECORD_SIZE,
+    };
+    header.crc = esp_rom_crc32_le(0, s_payload, header.length);
+
+    // Blocks do not cross sectors, a sector is erased when the write position enters it
+    uint32_t offset = s_journal.write_offset;
+    if (offset % s_sector_size + block_size(&header) > s_sector_size) {
+        offset = next_sector(offset);
+    }
+    if (offset % s_sector_size == 0) {
+        drop_sector(offset);
+        if (esp_partition_erase_range(s_partition, offset, s_sector_size) != ESP_OK) {
+            ESP_LOGE("journal", "Erasing the sector at 0x%" PRIx32 " failed", offset);
+            s_journal.mounted = false;
+            return false;
+        }
+    }
+
+    // The state is programmed last, an interrupted write leaves an uncommitted block
+    uint32_t state = JOURNAL_STATE_COMMITTED;
+    if (esp_partition_write(s_partition, offset, &header, sizeof(header)) != ESP_OK ||
+        esp_partition_write(s_partition, offset + sizeof(header), s_payload, header.length) != ESP_OK ||
+        esp_partition_write(s_partition, offset + offsetof(journal_header_t, state), &state, sizeof(state)) != ESP_OK) {
+        ESP_LOGE("journal", "Writing the block at 0x%" PRIx32 " failed", offset);
+        // Scan again before the next write, the space behind the last block is no longer erased
+        s_journal.mounted = false;
+        return false;
+    }
+
+    if (s_journal.pending_blocks++ == 0) {
+        s_journal.read_offset = offset;
+    }
+    s_journal.write_offset = next_block(offset, &header);
+    s_journal.next_seq++;
+    return true;
+}
+
+static void put_le(uint8_t *p, uint64_t value, uint32_t size)
+{
+    for (uint32_t i = 0; i < size; i++) {
+        p[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static uint64_t get_le(const uint8_t *p, uint32_t size)
+{
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < size; i++) {
+        value |= (uint64_t)p[i] << (8 * i);
+    }
+    return value;
+}
+
+static void encode_event(uint8_t *p, const event_record_t *event)
+{
+    p[0] = event->channel;
+    put_le(p + 1, event->timestamp, 8);
+    put_le(p + 9, event->duration, 4);
+    put_le(p + 13, event->count, 2);
+}
+
+static void decode_event(const uint8_t *p, event_record_t *event)
+{
+    event->channel = p[0];
+    event->type = sensor_channel_type(p[0]);
+    event->timestamp = get_le(p + 1, 8);
+    event->duration = (uint32_t)get_le(p + 9, 4);
+    event->count = (uint16_t)get_le(p + 13, 2);
+}
+
+uint32_t event_journal_pending_blocks(void)
+{
+    return journal_mount() ? s_journal.pending_blocks : 0;
+}
+
+uint32_t event_journal_spill(void)
+{
+    if (!journal_mount()) {
+        return 0;
+    }
+
+    uint32_t spilled = 0;
+    while (event_buffer_count() > 0) {
+        uint32_t count = 0;
+        event_buffer_iter_t iter;
+        event_record_t event;
+        event_buffer_iter_init(&iter);
+        while (count < EVENT_JOURNAL_BLOCK_EVENTS && event_buffer_iter_next(&iter, &event)) {
+            encode_event(&s_payload[count * JOURNAL_RECORD_SIZE], &event);
+            count++;
+        }
+        // Remove the events from RTC memory only once they are committed to flash
+        if (!append_block(count)) {
+            break;
+        }
+        event_buffer_discard(count);
+        spilled += count;
+    }
+
+    ESP_LOGI("journal", "Spilled %" PRIu32 " events, %" PRIu32 " blocks pending", spilled, s_journal.pending_blocks);
+    return spilled;
+}
+
+bool event_journal_peek(event_record_t *events, uint32_t *count)
+{
+    if (!journal_mount()) {
+        return false;
+    }
+
+    journal_header_t header;
+    while (s_journal.pending_blocks > 0) {
+        uint32_t offset = s_journal.read_offset;
+        if (read_slot(offset, &header) == SLOT_BLOCK && header.state == JOURNAL_STATE_COMMITTED &&
+            esp_partition_read(s_partition, offset + sizeof(header), s_payload, header.length) == ESP_OK &&
+            esp_rom_crc32_le(0, s_payload, header.length) == header.crc) {
+            for (uint32_t i = 0; i < header.count; i++) {
+                decode_event(&s_payload[i * JOURNAL_RECORD_SIZE], &events[i]);
+            }
+            *count = header.count;
+            return true;
+        }
+        ESP_LOGW("journal", "Skipping the corrupted block at 0x%" PRIx32, offset);
+        event_journal_consume();
+    }
+    return false;
+}
+
+void event_journal_consume(void)
+{
+    if (!journal_mount() || s_journal.pending_blocks == 0) {
+        return;
+    }
+
+    journal_header_t header;
+    uint32_t offset = s_journal.read_offset;
+    uint32_t next = next_sector(offset);
+    if (read_slot(offset, &header) == SLOT_BLOCK) {
+        uint32_t state = JOURNAL_STATE_CONSUMED;
+        esp_partition_write(s_partition, offset + offsetof(journal_header_t, state), &state, sizeof(state));
+        next = next_block(offset, &header);
+    }
+    s_journal.pending_blocks--;
+    s_journal.read_offset = s_journal.pending_blocks > 0 ? find_pending(next) : s_journal.write_offset;
+}
+
+void event_journal_unmount(void)
+{
+    s_journal.mounted = false;
+}
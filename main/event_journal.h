@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "main.h"
+#include "rtc_wake_stub_buffer.h"
+
+// Label of the data partition holding the journal (see partitions.csv).
+#define EVENT_JOURNAL_PARTITION "journal"
+
+// Maximum number of events in one journal block.
+#define EVENT_JOURNAL_BLOCK_EVENTS CONFIG_EVENT_JOURNAL_BLOCK_EVENTS
+
+/*
+ * Journal layout: the partition is used as a ring of flash sectors. Blocks are appended
+ * one after another and never cross a sector boundary; a sector is erased only when the
+ * write position enters it again, so all sectors are erased equally often.
+ *
+ *   block  := header payload
+ *   header := magic(u32) state(u32) seq(u32) count(u16) length(u16) crc(u32)
+ *   payload:= count * (channel(u8) timestamp(u64) duration(u32) count(u16))
+ *
+ * The header and payload are written with the state left erased, the state is then
+ * programmed to COMMITTED. Once the events were delivered, it is programmed to CONSUMED.
+ * Each step only clears bits, so no erase is needed. A block cut off by a power loss stays
+ * in the erased state (or fails its CRC) and is skipped when the journal is scanned.
+ */
+
+/**
+ * @brief Returns the number of committed blocks not yet delivered.
+ *
+ * Scans the partition on the first call after a power-on, the position is kept in RTC
+ * memory across deep sleep.
+ */
+uint32_t event_journal_pending_blocks(void);
+
+/**
+ * @brief Moves all events of the RTC event buffer into the journal.
+ *
+ * The events are written in blocks of up to EVENT_JOURNAL_BLOCK_EVENTS and removed from the
+ * RTC buffer only after their block was committed. If the journal is full, the oldest sector
+ * is erased and its events are counted in dropped_event_count.
+ *
+ * @return Number of events moved into the journal.
+ */
+uint32_t event_journal_spill(void);
+
+/**
+ * @brief Reads the oldest block not yet delivered.
+ *
+ * Blocks failing their CRC are marked consumed and skipped.
+ *
+ * @param[out] events Decoded events, room for EVENT_JOURNAL_BLOCK_EVENTS records.
+ * @param[out] count  Number of events in the block.
+ * @return false if the journal holds no pending block.
+ */
+bool event_journal_peek(event_record_t *events, uint32_t *count);
+
+/**
+ * @brief Marks the block returned by event_journal_peek() as delivered.
+ */
+void event_journal_consume(void);
+
+/**
+ * @brief Forgets the journal position kept in RTC memory, as a power-on does.
+ *
+ * The next call scans the partition again. Used by the host tests to emulate a power loss.
+ */
+void event_journal_unmount(void);
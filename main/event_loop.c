@@ -0,0 +1,133 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "driver/rtc_io.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include "main.h"
+#include "event_loop.h"
+#include "event_journal.h"
+#include "gauge.h"
+#include "wifi.h"
+#include "rtc_wake_stub_buffer.h"
+#include "rtc_wake_stub_channels.h"
+#include "rtc_wake_stub_stats.h"
+
+/**
+ * @brief Rising edge of a sensor, queued by the GPIO interrupt.
+ */
+typedef struct {
+    uint32_t channel;         // < Sensor channel of the pin.
+    int64_t time_us;          // < esp_timer time of the interrupt.
+} sensor_edge_t;
+
+static QueueHandle_t s_edge_queue;
+
+/**
+ * @brief GPIO interrupt of a sensor pin.
+ *
+ * The pins use level interrupts, as only those wake the chip from light sleep. After every
+ * interrupt the pin waits for the opposite level, so an active sensor raises one interrupt.
+ */
+static void sensor_isr(void *arg)
+{
+    uint32_t channel = (uint32_t)arg;
+    gpio_num_t pin = sensor_channels[channel].pin;
+    int level = gpio_get_level(pin);
+    gpio_set_intr_type(pin, level ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+    if (level) {
+        sensor_edge_t edge = {.channel = channel, .time_us = esp_timer_get_time()};
+        BaseType_t task_woken = pdFALSE;
+        xQueueSendFromISR(s_edge_queue, &edge, &task_woken);
+        if (task_woken) {
+            portYIELD_FROM_ISR();
+        }
+    }
+}
+
+#if CONFIG_PM_LIGHT_SLEEP_CALLBACKS
+/**
+ * @brief Accounts the time spent in automatic light sleep, called with interrupts disabled.
+ */
+static esp_err_t IRAM_ATTR on_light_sleep_exit(int64_t slept_us, void *arg)
+{
+    wake_stats.light_sleep_us += slept_us;
+    return ESP_OK;
+}
+#endif
+
+/**
+ * @brief Switches the sensor pins from the RTC IOs used in deep sleep to GPIO interrupts.
+ */
+static void configure_sensor_interrupts(void)
+{
+    s_edge_queue = xQueueCreate(EVENT_LOOP_QUEUE_LENGTH, sizeof(sensor_edge_t));
+    ESP_ERROR_CHECK(gpio_install_isr_service(0));
+    for (uint32_t i = 0; i < sensor_channel_count; i++) {
+        gpio_num_t pin = sensor_channels[i].pin;
+        rtc_gpio_deinit(pin);
+        gpio_config_t config = {
+            .pin_bit_mask = 1ULL << pin,
+            .mode = GPIO_MODE_INPUT,
+            .pull_up_en = GPIO_PULLUP_DISABLE,
+            .pull_down_en = GPIO_PULLDOWN_ENABLE,
+            .intr_type = GPIO_INTR_DISABLE,
+        };
+        ESP_ERROR_CHECK(gpio_config(&config));
+        // Sets the level interrupt and enables it as light sleep wake-up source
+        ESP_ERROR_CHECK(gpio_wakeup_enable(pin, gpio_get_level(pin) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL));
+        ESP_ERROR_CHECK(gpio_isr_handler_add(pin, sensor_isr, (void *)i));
+    }
+    ESP_ERROR_CHECK(esp_sleep_enable_gpio_wakeup());
+}
+
+/**
+ * @brief Stores a queued edge in the event buffer, with the time of the interrupt.
+ */
+static void store_edge(const sensor_edge_t *edge)
+{
+    uint64_t age_ms = (esp_timer_get_time() - edge->time_us) / 1000;
+    if (event_buffer_is_full()) {
+        event_journal_spill();
+    }
+    event_buffer_push(edge->channel, get_current_time_in_ms() - age_ms);
+    ESP_LOGI("loop", "Sensor channel %" PRIu32 " triggered", edge->channel);
+}
+
+void event_loop_run(void)
+{
+    ESP_LOGI("loop", "Running the light sleep event loop");
+    wifi_enable_modem_sleep();
+#if CONFIG_PM_LIGHT_SLEEP_CALLBACKS
+    esp_pm_sleep_cbs_register_config_t callbacks = {
+        .exit_cb = on_light_sleep_exit,
+    };
+    ESP_ERROR_CHECK(esp_pm_light_sleep_register_cbs(&callbacks));
+#endif
+    configure_sensor_interrupts();
+
+    while (true) {
+        sensor_edge_t edge;
+        if (xQueueReceive(s_edge_queue, &edge, pdMS_TO_TICKS(CONFIG_EVENT_LOOP_TICK_SEC * 1000)) == pdTRUE) {
+            // Send the edges queued meanwhile in the same message
+            do {
+                store_edge(&edge);
+            } while (xQueueReceive(s_edge_queue, &edge, 0) == pdTRUE);
+        }
+
+        bool read_battery = this_device.battery_info_available && isBatteryStatusDue();
+        if (read_battery) {
+            // A failed read is retried on the next tick instead of sending the old values
+            read_battery = getRSOC();
+        }
+        handlePendingRecords(read_battery);
+    }
+}
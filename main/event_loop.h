@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief How the application runs after the boot.
+ */
+typedef enum {
+    RUNTIME_MODE_DEEP_SLEEP = 0,  // < Deep sleep between the flushes, the wake-up stub buffers the events.
+    RUNTIME_MODE_LIGHT_SLEEP = 1, // < Stay connected in automatic light sleep and publish every event right away.
+} runtime_mode_t;
+
+// Number of sensor edges the GPIO interrupt can queue for the event loop.
+#define EVENT_LOOP_QUEUE_LENGTH 32
+
+/**
+ * @brief Runs the light sleep event loop, for mains powered nodes. Does not return.
+ *
+ * Keeps Wi-Fi (in DTIM based modem sleep) and MQTT connected and lets the power management
+ * enter automatic light sleep while idle. The sensor pins are level interrupts that also
+ * wake the chip from light sleep; the interrupt queues the rising edges, and the loop
+ * stores them in the event buffer and sends them with sendUplinkBatchToMQTT(), like the
+ * events buffered by the wake-up stub. Every CONFIG_EVENT_LOOP_TICK_SEC the loop also sends
+ * the battery status and the statistics when due, and retries undelivered events.
+ */
+void event_loop_run(void);
@@ -13,15 +13,35 @@
 
 i2c_dev_t lc = {};
 float voltage = 0, rsoc = 0;
+float cell_ite = 0, cell_temperature = 0;
+RTC_DATA_ATTR uint32_t battery_soc = 100;
 
-static esp_err_t initialize_lc709203f() {
-  ESP_ERROR_CHECK(lc709203f_init_desc(&lc, 0, 21, 22));
+// Set once the LC709203F was configured. The gauge keeps its configuration while the ESP32
+// is in deep sleep, and is only reset by a power loss, which also clears the RTC memory.
+RTC_DATA_ATTR static bool gauge_configured = false;
+
+// Set once the I2C bus and the device descriptor were set up in this boot.
+static bool s_session_open = false;
 
-  int count = 0;
-  while (count < 10 && lc709203f_set_power_mode(&lc, LC709203F_POWER_MODE_OPERATIONAL) != ESP_OK) {
+/**
+ * @brief Sets the operating mode, retrying while the gauge wakes up from its sleep mode.
+ */
+static esp_err_t wake_lc709203f() {
+  esp_err_t err = ESP_FAIL;
+  for (int count = 0; count < 10; count++) {
+    err = lc709203f_set_power_mode(&lc, LC709203F_POWER_MODE_OPERATIONAL);
+    if (err == ESP_OK) {
+      break;
+    }
     vTaskDelay(pdMS_TO_TICKS(100));
-    count++;
   }
+  return err;
+}
+
+/**
+ * @brief Writes the battery configuration to the gauge, needed after a power loss only.
+ */
+static esp_err_t initialize_lc709203f() {
   // Using 2500mAh LiPo battery. Check Datasheet graph for APA values by battery type & mAh
   ESP_ERROR_CHECK(lc709203f_set_apa(&lc, 0x2A));
   ESP_ERROR_CHECK(lc709203f_set_battery_profile(&lc, LC709203F_BATTERY_PROFILE_1));
@@ -39,23 +59,46 @@ static esp_err_t initialize_lc709203f() {
   ESP_ERROR_CHECK(lc709203f_get_temp_mode(&lc, (lc709203f_temp_mode_t *)&value));
   ESP_LOGI("gauge", "Temp Mode: 0x%X", value);
 
+  gauge_configured = true;
   return ESP_OK;
 }
 
-void getRSOC() {
-  uint16_t voltage_u = 0, rsoc_u = 0;
-  ESP_ERROR_CHECK(i2cdev_init());
-  initialize_lc709203f();
+bool getRSOC() {
+  if (!s_session_open) {
+    ESP_ERROR_CHECK(i2cdev_init());
+    ESP_ERROR_CHECK(lc709203f_init_desc(&lc, 0, 21, 22));
+    s_session_open = true;
+  }
+
+  esp_err_t err = wake_lc709203f();
+  if (err == ESP_OK && !gauge_configured) {
+    ESP_LOGI("gauge", "Configuring the fuel gauge after a power loss");
+    initialize_lc709203f();
+  }
 
-  int count = 0;
-  while (count < 10 && lc709203f_get_cell_voltage(&lc, &voltage_u) != ESP_OK) {
-    vTaskDelay(pdMS_TO_TICKS(100));
-    count++;
+  // The configured gauge only needs a single batched read
+  lc709203f_measurements_t measurements;
+  err = lc709203f_get_measurements(&lc, &measurements);
+  if (err != ESP_OK && gauge_configured) {
+    // The gauge may have lost its supply on its own, configure it again
+    ESP_LOGW("gauge", "Reading the fuel gauge failed (%s), configuring it again", esp_err_to_name(err));
+    gauge_configured = false;
+    if (wake_lc709203f() == ESP_OK) {
+      initialize_lc709203f();
+      err = lc709203f_get_measurements(&lc, &measurements);
+    }
   }
-  ESP_ERROR_CHECK(lc709203f_get_rsoc(&lc, &rsoc_u));
-  voltage =  voltage_u / 1000.0;
-  rsoc = (float) rsoc_u;
-  ESP_LOGI("gauge", "Voltage: %.2f\tRSOC: %.1f%%", voltage, rsoc);
-  // ESP_LOGI("gauge", "Voltage: %.2f\tRSOC: %.u%%", voltage, rsoc_u);
+  if (err != ESP_OK) {
+    ESP_LOGE("gauge", "Reading the fuel gauge failed: %s", esp_err_to_name(err));
+    return false;
+  }
+
+  voltage = measurements.voltage / 1000.0;
+  rsoc = (float) measurements.rsoc;
+  cell_ite = measurements.ite / 10.0;
+  cell_temperature = measurements.temperature;
+  battery_soc = measurements.rsoc;
+  ESP_LOGI("gauge", "Voltage: %.2f\tRSOC: %.1f%%\tITE: %.1f%%\tTemperature: %.1f C", voltage, rsoc, cell_ite, cell_temperature);
   ESP_ERROR_CHECK(lc709203f_set_power_mode(&lc, LC709203F_POWER_MODE_SLEEP));
-}
\ No newline at end of file
+  return true;
+}
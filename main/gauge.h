@@ -1,4 +1,21 @@
 #pragma once
 
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_attr.h"
+
 extern float voltage, rsoc;
-void getRSOC();
\ No newline at end of file
+
+// Indicator to empty (in percent) and cell temperature (in degrees Celsius) as last read by getRSOC().
+extern float cell_ite, cell_temperature;
+
+// Battery state of charge in percent as last read by getRSOC(), kept in RTC memory for the wake-up stub.
+extern RTC_DATA_ATTR uint32_t battery_soc;
+
+/**
+ * @brief Reads the battery voltage, state of charge, ITE and temperature from the LC709203F.
+ *
+ * @return true if the values were updated, false if the gauge could not be read and the
+ *         values of the previous read are kept.
+ */
+bool getRSOC();
\ No newline at end of file
@@ -0,0 +1,261 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_attr.h"
+
+#include "json_encoder.h"
+
+// Space kept free in buffer mode for closing the message: "]}]}" and the terminator.
+#define CLOSING_RESERVE 5
+
+static void put_char(json_encoder_t *enc, char c)
+{
+    if (enc->sink) {
+        if (enc->len == enc->size) {
+            enc->sink(enc->buf, enc->len, enc->sink_ctx);
+            enc->flushed += enc->len;
+            enc->len = 0;
+        }
+    } else if (enc->len + CLOSING_RESERVE >= enc->size) {
+        enc->overflow = true;
+        return;
+    }
+    enc->buf[enc->len++] = c;
+}
+
+static void put_str(json_encoder_t *enc, const char *s)
+{
+    while (*s) {
+        put_char(enc, *s++);
+    }
+}
+
+// Writes the closing characters, which always fit into the reserved space in buffer mode.
+static void put_closing(json_encoder_t *enc, const char *s)
+{
+    while (*s) {
+        if (enc->sink) {
+            put_char(enc, *s++);
+        } else {
+            enc->buf[enc->len++] = *s++;
+        }
+    }
+}
+
+static void put_u64(json_encoder_t *enc, uint64_t value)
+{
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (n > 0) {
+        put_char(enc, digits[--n]);
+    }
+}
+
+// Writes the value with one decimal, like printf("%.1f").
+static void put_fixed1(json_encoder_t *enc, float value)
+{
+    if (value < 0) {
+        put_char(enc, '-');
+        value = -value;
+    }
+    uint64_t tenths = (uint64_t)(value * 10.0f + 0.5f);
+    put_u64(enc, tenths / 10);
+    put_char(enc, '.');
+    put_char(enc, (char)('0' + tenths % 10));
+}
+
+// Writes a JSON string, escaping quotes and backslashes.
+static void put_string(json_encoder_t *enc, const char *s)
+{
+    put_char(enc, '"');
+    while (*s) {
+        if (*s == '"' || *s == '\\') {
+            put_char(enc, '\\');
+        }
+        put_char(enc, *s++);
+    }
+    put_char(enc, '"');
+}
+
+// Writes ,"name":value
+static void put_field(json_encoder_t *enc, const char *name, uint64_t value)
+{
+    put_char(enc, ',');
+    put_string(enc, name);
+    put_char(enc, ':');
+    put_u64(enc, value);
+}
+
+/**
+ * @brief Undoes a partially written value in buffer mode.
+ *
+ * @return false if the value was rolled back.
+ */
+static bool commit(json_encoder_t *enc, size_t mark)
+{
+    if (enc->overflow) {
+        enc->len = mark;
+        enc->overflow = false;
+        return false;
+    }
+    return true;
+}
+
+static void init(json_encoder_t *enc, char *buf, size_t size)
+{
+    enc->buf = buf;
+    enc->size = size;
+    enc->len = 0;
+    enc->flushed = 0;
+    enc->overflow = false;
+    enc->in_sensor = false;
+    enc->sensor_count = 0;
+    enc->value_count = 0;
+    put_str(enc, "{\"sensors\":[");
+}
+
+void json_encoder_init(json_encoder_t *enc, char *buf, size_t size)
+{
+    enc->sink = NULL;
+    enc->sink_ctx = NULL;
+    init(enc, buf, size);
+}
+
+void json_encoder_init_sink(json_encoder_t *enc, char *buf, size_t size, json_sink_t sink, void *ctx)
+{
+    enc->sink = sink;
+    enc->sink_ctx = ctx;
+    init(enc, buf, size);
+}
+
+bool json_encoder_begin_sensor(json_encoder_t *enc, const char *name)
+{
+    size_t mark = enc->len;
+    if (enc->in_sensor) {
+        put_str(enc, "]},");
+    } else if (enc->sensor_count > 0) {
+        put_char(enc, ',');
+    }
+    put_str(enc, "{\"name\":");
+    put_string(enc, name);
+    put_str(enc, ",\"values\":[");
+    if (!commit(enc, mark)) {
+        return false;
+    }
+
+    enc->in_sensor = true;
+    enc->sensor_count++;
+    enc->value_count = 0;
+    return true;
+}
+
+bool json_encoder_add_event(json_encoder_t *enc, const event_record_t *event, const char *room_id)
+{
+    size_t mark = enc->len;
+    if (enc->value_count > 0) {
+        put_char(enc, ',');
+    }
+    put_str(enc, "{\"timestamp\":");
+    put_u64(enc, event->timestamp);
+    put_str(enc, ",\"roomID\":");
+    put_string(enc, room_id);
+    if (event->count > 1 || event->duration > 0) {
+        // Activity span merged by the wake-up stub
+        put_str(enc, ",\"duration\":");
+        put_u64(enc, event->duration);
+        put_str(enc, ",\"count\":");
+        put_u64(enc, event->count);
+    }
+    put_char(enc, '}');
+    if (!commit(enc, mark)) {
+        return false;
+    }
+
+    enc->value_count++;
+    return true;
+}
+
+bool json_encoder_add_battery(json_encoder_t *enc, uint64_t timestamp, float voltage, float soc)
+{
+    size_t mark = enc->len;
+    if (enc->value_count > 0) {
+        put_char(enc, ',');
+    }
+    put_str(enc, "{\"timestamp\":");
+    put_u64(enc, timestamp);
+    put_str(enc, ",\"voltage\":");
+    put_fixed1(enc, voltage);
+    put_str(enc, ",\"soc\":");
+    put_fixed1(enc, soc);
+    put_char(enc, '}');
+    if (!commit(enc, mark)) {
+        return false;
+    }
+
+    enc->value_count++;
+    return true;
+}
+
+bool json_encoder_add_wake_stats(json_encoder_t *enc, uint64_t timestamp, uint32_t period_sec, const wake_stats_t *stats)
+{
+    size_t mark = enc->len;
+    if (enc->value_count > 0) {
+        put_char(enc, ',');
+    }
+    put_str(enc, "{\"timestamp\":");
+    put_u64(enc, timestamp);
+    put_field(enc, "period", period_sec);
+    put_field(enc, "stubWakes", stats->stub_wakes);
+    put_field(enc, "boots", stats->app_boots);
+    put_field(enc, "stubMs", stats->stub_us / 1000);
+    put_field(enc, "bootStubMs", stats->phase_us[WAKE_PHASE_STUB] / 1000);
+    put_field(enc, "wifiMs", stats->phase_us[WAKE_PHASE_WIFI] / 1000);
+    put_field(enc, "clockMs", stats->phase_us[WAKE_PHASE_CLOCK] / 1000);
+    put_field(enc, "mqttMs", stats->phase_us[WAKE_PHASE_MQTT] / 1000);
+    put_field(enc, "gaugeMs", stats->phase_us[WAKE_PHASE_GAUGE] / 1000);
+    put_field(enc, "awakeMs", stats->phase_us[WAKE_PHASE_AWAKE] / 1000);
+    put_field(enc, "lightSleepMs", stats->light_sleep_us / 1000);
+    put_field(enc, "published", stats->published_events);
+    put_field(enc, "latencyAvgMs", stats->published_events > 0 ? stats->publish_latency_ms / stats->published_events : 0);
+    put_field(enc, "latencyMaxMs", stats->max_publish_latency_ms);
+    put_field(enc, "connectAckAvgMs", stats->connect_acks > 0 ? stats->connect_ack_ms / stats->connect_acks : 0);
+    put_field(enc, "connectAckMaxMs", stats->max_connect_ack_ms);
+    put_str(enc, ",\"histogram\":[");
+    for (uint32_t i = 0; i < WAKE_STATS_BUCKETS; i++) {
+        if (i > 0) {
+            put_char(enc, ',');
+        }
+        put_u64(enc, stats->awake_histogram[i]);
+    }
+    put_str(enc, "]}");
+    if (!commit(enc, mark)) {
+        return false;
+    }
+
+    enc->value_count++;
+    return true;
+}
+
+size_t json_encoder_finish(json_encoder_t *enc)
+{
+    if (enc->in_sensor) {
+        put_closing(enc, "]}");
+        enc->in_sensor = false;
+    }
+    put_closing(enc, "]}");
+
+    if (enc->sink) {
+        if (enc->len > 0) {
+            enc->sink(enc->buf, enc->len, enc->sink_ctx);
+            enc->flushed += enc->len;
+            enc->len = 0;
+        }
+        return enc->flushed;
+    }
+    enc->buf[enc->len] = '\0';
+    return enc->len;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "rtc_wake_stub_buffer.h"
+#include "rtc_wake_stub_stats.h"
+
+/**
+ * @brief Receives the encoded output in chunks, see json_encoder_init_sink().
+ *
+ * @param data Encoded bytes, not NUL terminated.
+ * @param len  Number of bytes.
+ * @param ctx  User context passed to json_encoder_init_sink().
+ */
+typedef void (*json_sink_t)(const char *data, size_t len, void *ctx);
+
+/**
+ * @brief Streaming encoder for the `{"sensors":[{"name":...,"values":[...]}]}` payload.
+ *
+ * Writes the message in a single pass into a caller provided buffer, without heap
+ * allocations or string functions. Values are grouped under the sensor started last
+ * with json_encoder_begin_sensor().
+ */
+typedef struct {
+    char *buf;                // < Output buffer (or chunk buffer in sink mode).
+    size_t size;              // < Size of the output buffer.
+    size_t len;               // < Number of bytes written to the buffer.
+    size_t flushed;           // < Number of bytes already handed to the sink.
+    json_sink_t sink;         // < Chunk sink, NULL in buffer mode.
+    void *sink_ctx;           // < User context of the sink.
+    bool overflow;            // < Set when a write did not fit into the buffer.
+    bool in_sensor;           // < A sensor object is open.
+    uint32_t sensor_count;    // < Number of sensor objects started.
+    uint32_t value_count;     // < Number of values in the open sensor object.
+} json_encoder_t;
+
+/**
+ * @brief Starts a message in the given buffer.
+ *
+ * The buffer holds the whole message. A value that does not fit is rolled back and
+ * reported by the add function, so the message stays valid and can be sent as is.
+ *
+ * @param enc  Encoder to initialize.
+ * @param buf  Output buffer.
+ * @param size Size of the output buffer, at least 32 bytes.
+ */
+void json_encoder_init(json_encoder_t *enc, char *buf, size_t size);
+
+/**
+ * @brief Starts a message that is streamed to a sink.
+ *
+ * The buffer is only used as a chunk buffer: whenever it is full it is handed to the
+ * sink, so messages of any length can be encoded. Values are never rejected.
+ *
+ * @param enc  Encoder to initialize.
+ * @param buf  Chunk buffer.
+ * @param size Size of the chunk buffer.
+ * @param sink Function receiving the chunks.
+ * @param ctx  User context passed to the sink.
+ */
+void json_encoder_init_sink(json_encoder_t *enc, char *buf, size_t size, json_sink_t sink, void *ctx);
+
+/**
+ * @brief Closes the open sensor object, if any, and starts a new one.
+ *
+ * @param enc  Encoder.
+ * @param name Sensor name, e.g. "PIR".
+ * @return false if the sensor object does not fit into the buffer.
+ */
+bool json_encoder_begin_sensor(json_encoder_t *enc, const char *name);
+
+/**
+ * @brief Adds a buffered sensor event to the open sensor object.
+ *
+ * Activity spans get the "duration" and "count" fields in addition to the timestamp
+ * and the room ID.
+ *
+ * @param enc     Encoder.
+ * @param event   Event to encode.
+ * @param room_id Room ID reported with the event.
+ * @return false if the value does not fit into the buffer.
+ */
+bool json_encoder_add_event(json_encoder_t *enc, const event_record_t *event, const char *room_id);
+
+/**
+ * @brief Adds a battery reading to the open sensor object.
+ *
+ * @param enc       Encoder.
+ * @param timestamp The actual Unix timestamp in milliseconds.
+ * @param voltage   Battery voltage in volts.
+ * @param soc       State of charge in percent.
+ * @return false if the value does not fit into the buffer.
+ */
+bool json_encoder_add_battery(json_encoder_t *enc, uint64_t timestamp, float voltage, float soc);
+
+/**
+ * @brief Adds the wake cost statistics to the open sensor object.
+ *
+ * Phase times are reported in milliseconds, summed over the period, together with
+ * the awake time histogram of the application boots.
+ *
+ * @param enc        Encoder.
+ * @param timestamp  The actual Unix timestamp in milliseconds.
+ * @param period_sec Length of the period the statistics cover, in seconds.
+ * @param stats      Statistics to encode.
+ * @return false if the value does not fit into the buffer.
+ */
+bool json_encoder_add_wake_stats(json_encoder_t *enc, uint64_t timestamp, uint32_t period_sec, const wake_stats_t *stats);
+
+/**
+ * @brief Closes the message.
+ *
+ * In buffer mode the message is NUL terminated. In sink mode the rest of the message
+ * is handed to the sink.
+ *
+ * @param enc Encoder.
+ * @return Total length of the message in bytes, without the terminator.
+ */
+size_t json_encoder_finish(json_encoder_t *enc);
@@ -1,6 +1,7 @@
 // Standard Libraries
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <string.h>
 #include <time.h>
 #include <sys/time.h>
@@ -27,31 +28,37 @@
 #include "main.h"
 #include "gauge.h"
 #include "rtc_wake_stub.h"
+#include "rtc_wake_stub_buffer.h"
+#include "rtc_wake_stub_channels.h"
+#include "boot.h"
+#include "rtc_wake_stub_clock.h"
+#include "wake_stats.h"
+#include "ulp_edges.h"
+#include "device_registry.h"
+#include "event_journal.h"
+#include "backlog_drain.h"
+#include "rtc_wake_stub_flush.h"
+#include "event_loop.h"
+#include "esp_timer.h"
 
 // RTC slow memory config variables
 RTC_DATA_ATTR uint32_t MAX_PIR_EVENTS = CONFIG_MAX_PIR_EVENTS;
 RTC_DATA_ATTR uint32_t BATTERY_INFO_INTERVAL_SEC = CONFIG_BATTERY_INFO_INTERVAL_SEC;
 RTC_DATA_ATTR uint32_t AUTOMATIC_WAKEUP_INTERVAL_SEC = CONFIG_WAKEUP_INTERVAL_SEC;
-RTC_DATA_ATTR int PIR_PIN = CONFIG_PIR_PIN;
-RTC_DATA_ATTR int MAGNETIC_SWITCH_PIN = CONFIG_MAGNETIC_SWITCH_PIN;
-RTC_DATA_ATTR uint32_t SENSOR_INACTIVE_DELAY_MS = CONFIG_SENSOR_INACTIVE_DELAY_MS;
-RTC_DATA_ATTR PIR_Event_t pir_events[CONFIG_MAX_PIR_EVENTS];
 
 // Keeps track of the last time battery information was sent
 RTC_DATA_ATTR uint64_t last_battery_info_time = 0;
 
-// Counter of the already stored PIR events, stored in RTC memory
-RTC_DATA_ATTR int pir_event_count = 0;
-
 // Define this_device variable
 RTC_DATA_ATTR device_info_t this_device;
 
+// Set once this_device was loaded from the device registry.
+RTC_DATA_ATTR static bool device_identified = false;
+
 // Extern declarations for time synchronization variables during wake up stub
 RTC_DATA_ATTR uint64_t rtc_time_at_last_sync = 0;
 RTC_DATA_ATTR uint64_t actual_time_at_last_sync = 0;
 
-// List of ESPs
-const device_info_t ESPs[] = {ESP_DEVICE_1, ESP_DEVICE_2, ESP_DEVICE_3};
 
 // Sleep_enter_time stored in RTC memory
 static RTC_DATA_ATTR struct timeval sleep_enter_time;
@@ -74,12 +81,8 @@ void app_main(void)
     // Initalize the logging information
     initialize_logging();
 
-    // Read the MAC address and identify the device
-    uint8_t mac_address[6];
-    esp_read_mac(mac_address, ESP_MAC_WIFI_STA);
-    identify_device(mac_address);
-
-    // Initialize NVS, erase and reinitialize if storage is full or version mismatch occurs
+    // Initialize NVS, erase and reinitialize if storage is full or version mismatch occurs.
+    // The device registry has its own partition, which is never erased here.
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
         ESP_ERROR_CHECK(nvs_flash_erase());
@@ -87,52 +90,80 @@ void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
 
-    ESP_LOGI("progress", "Starting Wifi");
-    start_wifi();
-
-    ESP_LOGI("progress", "Starting Clock");
-    start_clock();
+    // Read the MAC address and identify the device
+    uint8_t mac_address[6];
+    esp_read_mac(mac_address, ESP_MAC_WIFI_STA);
+    identify_device(mac_address);
 
-    ESP_LOGI("progress", "Starting MQTT");
-    start_mqtt();
+    // Connect Wi-Fi, SNTP and MQTT while the fuel gauge is read on the other core
+    boot_report_t boot_report;
+    run_boot_pipeline(&boot_report);
     ESP_LOGI("progress", "MQTT broker connected status: %d", mqtt_broker_connected);
 
-    // Synchronize RTC time and actual time
-    actual_time_at_last_sync = get_current_time_in_ms();
-    rtc_time_at_last_sync = get_time_since_boot_in_ms();
-    ESP_LOGI("progress", "updating RTC time at last sync: %llu ms", rtc_time_at_last_sync);
-    ESP_LOGI("progress", "updating actual time at last sync: %llu ms", actual_time_at_last_sync);
-    // Check if it is time to send the battery status and if so, do so.
-    updateBatteryStatus();
+    // Synchronize RTC time and actual time, and update the RTC drift estimate
+    if (boot_report.clock_synced) {
+        clock_model_sync(get_time_since_boot_in_ms(), get_current_time_in_ms());
+        ESP_LOGI("progress", "updating RTC time at last sync: %llu ms", rtc_time_at_last_sync);
+        ESP_LOGI("progress", "updating actual time at last sync: %llu ms", actual_time_at_last_sync);
+        ESP_LOGI("progress", "RTC drift: %" PRId32 " ppb (uncertainty %" PRIu32 " ppb)", rtc_drift_ppb, rtc_drift_uncertainty_ppb);
+    }
+    // Log the wakeup reason, the events of the waking channels were stored by the wake-up stub
+    ESP_LOGI("progress", "Determining the wakeup reason.");
+    handle_wakeup_reason();
 
-    // Check if there are any PIR events in pir events array and send them to MQTT
-    handlePIReventsArray();
+    // Send the stored events and the battery status (if it was read during boot) in one batch
+    handlePendingRecords(boot_report.battery_read);
 
-    // Configure RTC GPIOs for PIR and Magnetic Switch
+    if (CONFIG_RUNTIME_MODE == RUNTIME_MODE_LIGHT_SLEEP) {
+        // Mains powered nodes stay connected and publish every event right away
+        wake_stats_record_boot(&boot_report, esp_timer_get_time());
+        event_loop_run();
+    }
+
+    // Configure RTC GPIOs of the sensor channels
     ESP_LOGI("progress", "Configuring RTC GPIOs");
     configure_rtc_gpio();
 
-    // Determine the wakeup reason
-    ESP_LOGI("progress", "Determining the wakeup reason.");
-    handle_wakeup_reason();
-
-    ESP_LOGI("progress", "Waiting for sensors to become inactive");
-    while (gpio_get_level(PIR_PIN) == 1 || gpio_get_level(MAGNETIC_SWITCH_PIN) == 1) {
-        // Wait until both sensors are inactive (logic low)
-        vTaskDelay(pdMS_TO_TICKS(SENSOR_INACTIVE_DELAY_MS));
+    bool sensor_active = false;
+    uint32_t recheck_sec = 0;
+#if CONFIG_ULP_EDGE_COUNTER
+    // The ULP program counts the sensor edges during deep sleep and wakes the chip
+    ulp_edges_start();
+    ulp_edges_prepare_sleep(event_buffer_count());
+#else
+    // Sleep right away, even if a sensor is still active: its pin is left out of the EXT1
+    // wake-up sources and the wake-up stub re-enables it once the sensor became inactive.
+    uint64_t wakeup_pins_mask = 0;
+    for (uint32_t i = 0; i < sensor_channel_count; i++) {
+        const sensor_channel_t* channel = &sensor_channels[i];
+        if (gpio_get_level(channel->pin) == 0) {
+            wakeup_pins_mask |= 1ULL << channel->pin;
+        } else if (!sensor_active || channel->debounce_sec < recheck_sec) {
+            sensor_active = true;
+            recheck_sec = channel->debounce_sec;
+        }
     }
 
-    // Create a bitmask for the GPIO pins
-    uint64_t wakeup_pins_mask = (1ULL << PIR_PIN) | (1ULL << MAGNETIC_SWITCH_PIN);
-
-    // Enable EXT1 wakeup on the selected pins with any high logic level
-    ESP_ERROR_CHECK(esp_sleep_enable_ext1_wakeup(wakeup_pins_mask, ESP_EXT1_WAKEUP_ANY_HIGH));
+    // Enable EXT1 wakeup on the inactive pins with any high logic level
+    esp_err_t ext1_err = esp_sleep_enable_ext1_wakeup(wakeup_pins_mask, ESP_EXT1_WAKEUP_ANY_HIGH);
+    if (ext1_err != ESP_OK) {
+        ESP_LOGW("progress", "Could not enable EXT1 wakeup: %s", esp_err_to_name(ext1_err));
+    }
+#endif
 
-    ESP_LOGI("progress", "Disconnecting from WIFI.");
+    ESP_LOGI("progress", "Disconnecting from MQTT and WIFI.");
+    finish_mqtt();
     finish_wifi();
 
-    ESP_LOGI("progress", "Enabling timer wakeup, %ds\n", AUTOMATIC_WAKEUP_INTERVAL_SEC);
-    esp_sleep_enable_timer_wakeup(AUTOMATIC_WAKEUP_INTERVAL_SEC * 1000000);
+    // An active sensor is checked again by the wake-up stub after a short delay
+    uint32_t timer_wakeup_sec = sensor_active ? recheck_sec : AUTOMATIC_WAKEUP_INTERVAL_SEC;
+    // Resume an unfinished drain of the journal on time, the stub boots the application then
+    uint32_t retry_sec = backlog_drain_retry_in_sec();
+    if (flush_backlog_pending && retry_sec < timer_wakeup_sec) {
+        timer_wakeup_sec = retry_sec;
+    }
+    ESP_LOGI("progress", "Enabling timer wakeup, %lus%s\n", timer_wakeup_sec, sensor_active ? " (sensor still active)" : "");
+    esp_sleep_enable_timer_wakeup((uint64_t)timer_wakeup_sec * 1000000);
 
 #if CONFIG_IDF_TARGET_ESP32
     // Isolate GPIO12 pin from external circuits. This is needed for modules
@@ -141,9 +172,13 @@ void app_main(void)
     rtc_gpio_isolate(GPIO_NUM_12);
 #endif
 
-    ESP_LOGI("progress", "Enabling timer wakeup in wake up stub every %ds\n", AUTOMATIC_WAKEUP_INTERVAL_SEC);
     esp_set_deep_sleep_wake_stub(&wake_stub);
 
+    // Account the cost of this boot
+    int64_t awake_us = esp_timer_get_time();
+    log_awake_window(&boot_report, awake_us);
+    wake_stats_record_boot(&boot_report, awake_us);
+
     gettimeofday(&sleep_enter_time, NULL);
     printf("progress", "Entering deep sleep\n");
     esp_deep_sleep_start();
@@ -162,7 +197,7 @@ void configPM(){
     esp_pm_config_esp32_t pm_config = {
     .max_freq_mhz = CONFIG_MAX_FREQ,
     .min_freq_mhz = CONFIG_MIN_FREQ, //DFS, enable in menucofig in Power Management
-    .light_sleep_enable = CONFIG_LIGHT_SLEEP_ENABLE,
+    .light_sleep_enable = CONFIG_LIGHT_SLEEP_ENABLE || CONFIG_RUNTIME_MODE == RUNTIME_MODE_LIGHT_SLEEP,
     };
     ESP_ERROR_CHECK(esp_pm_configure(&pm_config));
   }
@@ -185,22 +220,22 @@ void print_cpu_frequency() {
 /**
  * @brief Identifies the current device based on its MAC address.
  *
- * Matches the MAC address of the device with the pre-configured device list in `main.h`.
- * Sets the device's ID, MQTT topic, security key, and battery information availability.
+ * Loads the entry of the MAC address from the device registry in NVS into `this_device`.
+ * The entry is kept in RTC memory, so NVS is only read on the first boot after a reset.
  *
  * @param mac_address Pointer to the MAC address array of the device.
  */
 void identify_device(const uint8_t* mac_address) {
-    for (int i = 0; i < sizeof(ESPs) / sizeof(ESPs[0]); ++i) {
-        if (memcmp(mac_address, ESPs[i].mac_address, sizeof(ESPs[i].mac_address)) == 0) {
-            // Copy the device info into this_device
-            memcpy(&this_device, &ESPs[i], sizeof(device_info_t));
-            // Logging
-            ESP_LOGI("*", "*********** Device identified as %s", this_device.device_name);
-            return;
-        }
+    if (device_identified && memcmp(mac_address, this_device.mac_address, sizeof(this_device.mac_address)) == 0) {
+        ESP_LOGI("*", "Device %s (ID %d) restored from RTC memory", this_device.device_name, this_device.device_id);
+        return;
+    }
+    if (device_registry_load(mac_address, &this_device)) {
+        device_identified = true;
+        ESP_LOGI("*", "*********** Device identified as %s", this_device.device_name);
+        return;
     }
-    ESP_LOGI("*", "Device not recognized.");
+    ESP_LOGI("*", "Device not recognized, provision it in the NVS device registry.");
 }
 
 /**
@@ -224,21 +259,20 @@ void initialize_logging(void)
 /**
  * @brief Configures the RTC GPIOs for sensors.
  *
- * Initializes the GPIO pins connected to the PIR sensor and the magnetic switch sensor.
- * Configures the pins as inputs with appropriate pull-up or pull-down resistors.
+ * Initializes the GPIO pins of all sensor channels (CONFIG_SENSOR_CHANNELS).
+ * Configures the pins as inputs with pull-down resistors, the sensors are active high.
  */
 void configure_rtc_gpio() {
-    // PIR Sensor Configuration (Assuming it uses pull-down and is active high)
-    ESP_ERROR_CHECK(rtc_gpio_init(PIR_PIN));
-    ESP_ERROR_CHECK(rtc_gpio_set_direction(PIR_PIN, RTC_GPIO_MODE_INPUT_ONLY));
-    ESP_ERROR_CHECK(rtc_gpio_pulldown_en(PIR_PIN));
-    ESP_ERROR_CHECK(rtc_gpio_pullup_dis(PIR_PIN));
-
-    // Magnetic Switch Sensor Configuration
-    ESP_ERROR_CHECK(rtc_gpio_init(MAGNETIC_SWITCH_PIN));
-    ESP_ERROR_CHECK(rtc_gpio_set_direction(MAGNETIC_SWITCH_PIN, RTC_GPIO_MODE_INPUT_ONLY));
-    ESP_ERROR_CHECK(rtc_gpio_pulldown_en(MAGNETIC_SWITCH_PIN));
-    ESP_ERROR_CHECK(rtc_gpio_pullup_dis(MAGNETIC_SWITCH_PIN));
+    for (uint32_t i = 0; i < sensor_channel_count; i++) {
+        sensor_channel_t* channel = &sensor_channels[i];
+        ESP_ERROR_CHECK(rtc_gpio_init(channel->pin));
+        ESP_ERROR_CHECK(rtc_gpio_set_direction(channel->pin, RTC_GPIO_MODE_INPUT_ONLY));
+        ESP_ERROR_CHECK(rtc_gpio_pulldown_en(channel->pin));
+        ESP_ERROR_CHECK(rtc_gpio_pullup_dis(channel->pin));
+        // The wake-up stub can not use the GPIO to RTC IO mapping table in flash
+        channel->rtc_io_num = rtc_io_number_get(channel->pin);
+    }
+    sensor_channels_init();
 }
 
 /**
@@ -255,15 +289,16 @@ void handle_wakeup_reason(){
     printf("Time spent in deep sleep: %dms. RTC time: %llus\n", sleep_time_ms, esp_rtc_get_time_us()/1000000);
 
     if (wakeup_reason == ESP_SLEEP_WAKEUP_EXT1) {
-        // Wakeup caused by external GPIO (EXT1)
+        // Wakeup caused by external GPIO (EXT1), the event was stored by the wake-up stub
         uint64_t wakeup_pin_mask = esp_sleep_get_ext1_wakeup_status();
-        if (wakeup_pin_mask & (1ULL << PIR_PIN)) {
-            ESP_LOGI("*", "Wakeup caused by PIR sensor");
-        }
-        if (wakeup_pin_mask & (1ULL << MAGNETIC_SWITCH_PIN)) {
-            ESP_LOGI("*", "Wakeup caused by Magnetic Switch");
-            sendMagneticSwitchEventToMQTT();
+        for (uint32_t i = 0; i < sensor_channel_count; i++) {
+            if (wakeup_pin_mask & (1ULL << sensor_channels[i].pin)) {
+                ESP_LOGI("*", "Wakeup caused by sensor channel %lu (GPIO %d)", i, sensor_channels[i].pin);
+            }
         }
+    } else if (wakeup_reason == ESP_SLEEP_WAKEUP_ULP) {
+        // Events counted by the ULP program are already stored by the wake-up stub
+        ESP_LOGI("*", "Wakeup caused by the ULP edge counter");
     } else if (wakeup_reason == ESP_SLEEP_WAKEUP_TIMER) {
         // Wakeup caused by timer
         ESP_LOGI("*", "Wakeup caused by automatic timer.");
@@ -277,48 +312,78 @@ void handle_wakeup_reason(){
 }
 
 /**
- * @brief Updates the battery status and sends it to the MQTT broker.
+ * @brief Checks if the interval for sending battery information has elapsed.
+ *
+ * The battery status is always due if it has not been sent since power-on.
  *
- * Checks if the interval for sending battery information has elapsed. If so, retrieves
- * the battery voltage and state of charge (SOC) and publishes the data to the configured
- * MQTT topic.
+ * @return true if the battery status should be sent.
  */
-void updateBatteryStatus() {
-    struct timeval now;
-    gettimeofday(&now, NULL);
-
-    // Convert `struct timeval` to milliseconds
-    uint64_t now_ms = (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_usec / 1000;
+bool isBatteryStatusDue() {
+    uint64_t now_ms = get_current_time_in_ms();
     uint64_t last_update_ms = last_battery_info_time;
 
-    if ((now_ms - last_update_ms) >= BATTERY_INFO_INTERVAL_SEC * 1000) {
+    if (last_update_ms == 0 || (now_ms - last_update_ms) >= BATTERY_INFO_INTERVAL_SEC * 1000) {
         ESP_LOGI("battery", "Time to send battery information");
-        if (this_device.battery_info_available) {
-            getRSOC();
-            ESP_LOGI("battery", "Sending battery status to MQTT");
-            sendBatteryStatusToMQTT();
-            last_battery_info_time = now_ms; // Update the timestamp
-        }
-    } else {
-        uint64_t time_left_ms = BATTERY_INFO_INTERVAL_SEC * 1000 - (now_ms - last_update_ms);
-        uint64_t time_left_sec = time_left_ms / 1000; // Convert milliseconds to seconds
-        ESP_LOGI("battery", "Not time to send battery status yet. Time left: %llu seconds.", time_left_sec);
+        return true;
     }
+
+    uint64_t time_left_ms = BATTERY_INFO_INTERVAL_SEC * 1000 - (now_ms - last_update_ms);
+    uint64_t time_left_sec = time_left_ms / 1000; // Convert milliseconds to seconds
+    ESP_LOGI("battery", "Not time to send battery status yet. Time left: %llu seconds.", time_left_sec);
+    return false;
 }
 
 /**
- * @brief Handles the array of PIR events stored in RTC memory.
+ * @brief Sends all pending records to the MQTT broker in one batch.
+ *
+ * Sends the events stored in the RTC event buffer and, if requested, the battery status
+ * in as few messages as possible. Events are removed from the buffer only after the
+ * broker acknowledged them.
  *
- * If PIR events are stored in memory, this function flushes them to the MQTT broker
- * as a batch. Resets the event count after successful transmission.
+ * The fresh records go first, the backlog spilled into the flash journal gets the rest of
+ * the drain budget of the wake, so a long backlog does not delay the fresh events. If the
+ * broker can not be reached and the RTC buffer is filling up, its events are spilled into
+ * the journal so the wake-up stub does not overwrite them. Whatever is left over is
+ * scheduled for a later wake with backlog_drain_schedule().
+ *
+ * @param include_battery Whether to send the battery status read during boot.
  */
-void handlePIReventsArray() {
-    if (pir_event_count > 0) {
-        ESP_LOGI("PIR", "Found %d stored PIR events. Flushing to MQTT.", pir_event_count);
-        sendPIReventsToMQTT();    
-        // Reset the PIR event count in sendPIREventsFunction
-    } else {
-        ESP_LOGI("PIR", "No stored PIR events to send.");
+void handlePendingRecords(bool include_battery) {
+    // Store the edges the ULP program counted since the wake-up stub ran
+#if CONFIG_ULP_EDGE_COUNTER
+    store_ulp_edges();
+#endif
+    // Store the activity span merged by the wake-up stub so it is sent as well
+    close_pir_span();
+    backlog_drain_begin();
+    uplink_extras_t extras = {.battery = include_battery, .wake_stats = wake_stats_due()};
+    uint32_t count = event_buffer_count();
+    uint32_t backlog = event_journal_pending_blocks();
+    if (count == 0 && backlog == 0 && !extras.battery && !extras.wake_stats) {
+        ESP_LOGI("PIR", "No stored events to send.");
+        backlog_drain_schedule(true);
+        return;
+    }
+
+    ESP_LOGI("PIR", "Found %u stored events (%u dropped), %u journal blocks. Flushing to MQTT.", count, dropped_event_count, backlog);
+    bool stats_requested = extras.wake_stats;
+    bool delivered = sendUplinkBatchToMQTT(&extras);
+    if (!delivered) {
+        ESP_LOGW("PIR", "%u events not confirmed by the broker, keeping them for the next wake", event_buffer_count());
+        if (event_buffer_fill_percent() >= CONFIG_EVENT_JOURNAL_SPILL_PERCENT) {
+            event_journal_spill();
+        }
+    } else if (backlog > 0) {
+        delivered = sendJournalToMQTT();
+        ESP_LOGI("PIR", "%u journal blocks left", event_journal_pending_blocks());
+    }
+    backlog_drain_schedule(delivered);
+    if (include_battery && !extras.battery) {
+        // Restart the battery interval only once the broker has the reading
+        last_battery_info_time = get_current_time_in_ms();
+    }
+    if (stats_requested && !extras.wake_stats) {
+        wake_stats_reset();
     }
 }
 
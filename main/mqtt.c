@@ -3,13 +3,16 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <string.h>
+#include <inttypes.h>
 
 // ESP-IDF Core Components
 #include "esp_system.h"
+#include "esp_mac.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_netif.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 
 // FreeRTOS Headers
@@ -28,6 +31,15 @@
 #include "mqtt_client.h"
 #include "main.h"
 #include "gauge.h"
+#include "rtc_wake_stub_buffer.h"
+#include "rtc_wake_stub_channels.h"
+#include "json_encoder.h"
+#include "compact_encoder.h"
+#include "rtc_wake_stub_stats.h"
+#include "wake_stats.h"
+#include "device_registry.h"
+#include "event_journal.h"
+#include "backlog_drain.h"
 
 
 
@@ -36,6 +48,246 @@ EventGroupHandle_t mqtt_event_group;
 static int qos_test = 1;
 
 const static int CONNECTED_BIT = BIT0;
+const static int PUBLISHED_BIT = BIT1;
+
+// Time of begin_mqtt(), to measure the connect latency.
+static int64_t connect_start_us;
+
+// Session present flag of the last CONNACK.
+static bool session_present = false;
+
+// Set once the connect-to-PUBACK latency of this boot was recorded.
+static bool connect_ack_recorded = false;
+
+// Message ID of the last publish acknowledged by the broker.
+static volatile int acked_msg_id = -1;
+
+// Payload buffer shared by the senders, they all run in the main task.
+static uint8_t payload[CONFIG_MQTT_PAYLOAD_SIZE];
+
+// Sensor object of a JSON payload holding the battery readings.
+#define SENSOR_WAKE_STATS -3
+#define SENSOR_BATTERY -2
+#define SENSOR_NONE    -1
+
+/**
+ * @brief Encoder of the payload format selected by CONFIG_MQTT_PAYLOAD_FORMAT.
+ */
+typedef struct {
+  json_encoder_t json;
+  compact_encoder_t compact;
+  int sensor;   // < Sensor object open in the JSON payload (event type, SENSOR_BATTERY or SENSOR_NONE).
+} payload_encoder_t;
+
+/**
+ * @brief Buffered events encoded into a payload, oldest first.
+ */
+typedef struct {
+  uint32_t sent;            // < Number of events.
+  uint64_t timestamp_sum;   // < Sum of the event timestamps in milliseconds.
+  uint64_t oldest;          // < Timestamp of the oldest event in milliseconds.
+  uint32_t hash;            // < Hash of the events, to check that the buffer still starts with them.
+} batch_events_t;
+
+/**
+ * @brief Payload with the buffered events, encoded by prepare_uplink_batch() while Wi-Fi associates.
+ *
+ * Only valid as long as nothing else was encoded into the payload buffer.
+ */
+static struct {
+  bool valid;
+  payload_encoder_t enc;
+  batch_events_t events;
+} prepared;
+
+/**
+ * @brief Returns the sensor name used in the payload for an event type.
+ */
+static const char* sensor_name(event_type_t type) {
+  return type == EVENT_TYPE_MAGNETIC_SWITCH ? "MagneticSwitch" : "PIR";
+}
+
+/**
+ * @brief Returns the room ID reported with the events of a sensor channel.
+ */
+static const char* sensor_room_id(uint32_t channel) {
+  const char* room_id = channel < sensor_channel_count ? sensor_channels[channel].room_id : NULL;
+  return room_id != NULL ? room_id : this_device.room_id;
+}
+
+static void payload_init(payload_encoder_t* enc) {
+  prepared.valid = false;
+  if (CONFIG_MQTT_PAYLOAD_FORMAT == PAYLOAD_FORMAT_COMPACT) {
+    compact_encoder_init(&enc->compact, payload, sizeof(payload));
+  } else {
+    json_encoder_init(&enc->json, (char*)payload, sizeof(payload));
+  }
+  enc->sensor = SENSOR_NONE;
+}
+
+/**
+ * @brief Starts a new JSON sensor object if the open one is for another sensor.
+ */
+static bool payload_select_sensor(payload_encoder_t* enc, int sensor, const char* name) {
+  if (enc->sensor == sensor) {
+    return true;
+  }
+  if (!json_encoder_begin_sensor(&enc->json, name)) {
+    return false;
+  }
+  enc->sensor = sensor;
+  return true;
+}
+
+/**
+ * @brief Adds an event to the payload.
+ *
+ * @return false if the event does not fit, it should be sent in the next message.
+ */
+static bool payload_add_event(payload_encoder_t* enc, const event_record_t* event) {
+  if (CONFIG_MQTT_PAYLOAD_FORMAT == PAYLOAD_FORMAT_COMPACT) {
+    return compact_encoder_add_event(&enc->compact, event, sensor_room_id(event->channel));
+  }
+  return payload_select_sensor(enc, event->type, sensor_name(event->type)) &&
+         json_encoder_add_event(&enc->json, event, sensor_room_id(event->channel));
+}
+
+/**
+ * @brief Mixes an event into the FNV-1a hash of a batch.
+ */
+static uint32_t hash_event(uint32_t hash, const event_record_t* event) {
+  const uint64_t fields[] = {event->type, event->channel, event->timestamp, event->duration, event->count};
+  const uint8_t* bytes = (const uint8_t*)fields;
+  for (size_t i = 0; i < sizeof(fields); i++) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+/**
+ * @brief Adds as many buffered events as fit into the payload, oldest first, at most one drain page.
+ */
+static void payload_add_events(payload_encoder_t* enc, batch_events_t* batch) {
+  uint32_t page = backlog_drain_page_events();
+  event_buffer_iter_t iter;
+  event_record_t event;
+  *batch = (batch_events_t){.oldest = UINT64_MAX, .hash = 2166136261u};
+  event_buffer_iter_init(&iter);
+  while (batch->sent < page && event_buffer_iter_next(&iter, &event)) {
+    // Keep the remaining events for the next message
+    if (!payload_add_event(enc, &event)) {
+      break;
+    }
+    batch->sent++;
+    batch->timestamp_sum += event.timestamp;
+    if (event.timestamp < batch->oldest) {
+      batch->oldest = event.timestamp;
+    }
+    batch->hash = hash_event(batch->hash, &event);
+  }
+}
+
+/**
+ * @brief Takes the payload of prepare_uplink_batch() if the buffer still starts with its events.
+ *
+ * The wake-up stub, the ULP edges and the activity spans only append to the buffer, but
+ * an overflow may have dropped the oldest events or a span record may have grown.
+ *
+ * @return false if the payload has to be encoded again.
+ */
+static bool take_prepared_batch(payload_encoder_t* enc, batch_events_t* batch) {
+  if (!prepared.valid) {
+    return false;
+  }
+  prepared.valid = false;
+
+  uint32_t hash = 2166136261u;
+  uint32_t count = 0;
+  event_buffer_iter_t iter;
+  event_record_t event;
+  event_buffer_iter_init(&iter);
+  while (count < prepared.events.sent && event_buffer_iter_next(&iter, &event)) {
+    hash = hash_event(hash, &event);
+    count++;
+  }
+  if (count != prepared.events.sent || hash != prepared.events.hash) {
+    ESP_LOGI("mqtt", "Event buffer changed since the batch was prepared, encoding it again");
+    return false;
+  }
+  *enc = prepared.enc;
+  *batch = prepared.events;
+  return true;
+}
+
+/**
+ * @brief Adds a battery reading to the payload.
+ *
+ * @return false if the reading does not fit.
+ */
+static bool payload_add_battery(payload_encoder_t* enc, uint64_t timestamp, float voltage, float soc) {
+  if (CONFIG_MQTT_PAYLOAD_FORMAT == PAYLOAD_FORMAT_COMPACT) {
+    return compact_encoder_add_battery(&enc->compact, timestamp, voltage, soc);
+  }
+  return payload_select_sensor(enc, SENSOR_BATTERY, "battery") &&
+         json_encoder_add_battery(&enc->json, timestamp, voltage, soc);
+}
+
+/**
+ * @brief Adds the wake cost statistics of the current period to the payload.
+ *
+ * @return false if the statistics do not fit.
+ */
+static bool payload_add_wake_stats(payload_encoder_t* enc, uint64_t timestamp) {
+  uint32_t period_sec = (get_time_since_boot_in_ms() - wake_stats.period_start_ms) / 1000;
+  if (CONFIG_MQTT_PAYLOAD_FORMAT == PAYLOAD_FORMAT_COMPACT) {
+    return compact_encoder_add_wake_stats(&enc->compact, timestamp, period_sec, &wake_stats);
+  }
+  return payload_select_sensor(enc, SENSOR_WAKE_STATS, "wakeStats") &&
+         json_encoder_add_wake_stats(&enc->json, timestamp, period_sec, &wake_stats);
+}
+
+/**
+ * @brief Closes the payload.
+ *
+ * @return Length of the payload in bytes.
+ */
+static size_t payload_finish(payload_encoder_t* enc) {
+  if (CONFIG_MQTT_PAYLOAD_FORMAT == PAYLOAD_FORMAT_COMPACT) {
+    return compact_encoder_finish(&enc->compact);
+  }
+  return json_encoder_finish(&enc->json);
+}
+
+/**
+ * @brief Returns the topic the payloads are published to.
+ *
+ * Compact payloads go to a sub-topic of the device topic, so consumers expecting JSON
+ * never see them.
+ */
+static const char* payload_topic(void) {
+  static char compact_topic[128];
+  if (CONFIG_MQTT_PAYLOAD_FORMAT != PAYLOAD_FORMAT_COMPACT) {
+    return this_device.device_topic;
+  }
+  if (compact_topic[0] == '\0') {
+    snprintf(compact_topic, sizeof(compact_topic), "%s%s", this_device.device_topic, MQTT_COMPACT_TOPIC_SUFFIX);
+  }
+  return compact_topic;
+}
+
+/**
+ * @brief Publishes the encoded payload with QoS level 1.
+ *
+ * @return Message ID of the publish, -1 on error.
+ */
+static int publish_payload(size_t size) {
+  if (CONFIG_MQTT_PAYLOAD_FORMAT == PAYLOAD_FORMAT_COMPACT) {
+    ESP_LOGI("mqtt", "Sent %u byte compact payload to topic %s", (unsigned)size, payload_topic());
+  } else {
+    ESP_LOGI("mqtt", "Sent <%s> to topic %s", (const char*)payload, payload_topic());
+  }
+  return esp_mqtt_client_publish(mqtt_client, payload_topic(), (const char*)payload, size, 1, 0);
+}
 
 /**
  * @brief MQTT event handler callback function.
@@ -53,7 +305,9 @@ void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event
   esp_mqtt_event_t *data = (esp_mqtt_event_t *)event_data;
   switch (event_id) {
     case MQTT_EVENT_CONNECTED:
-      ESP_LOGI("mqtt", "MQTT_EVENT_CONNECTED\n");
+      ESP_LOGI("mqtt", "MQTT_EVENT_CONNECTED in %lld ms, session present: %d\n",
+               (esp_timer_get_time() - connect_start_us) / 1000, data->session_present);
+      session_present = data->session_present;
       xEventGroupSetBits(mqtt_event_group, CONNECTED_BIT);
       mqtt_broker_connected = true;
       break;
@@ -75,7 +329,8 @@ void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event
 
     case MQTT_EVENT_PUBLISHED:
       ESP_LOGI("mqtt", "MQTT_EVENT_PUBLISHED, msg_id=%d\n", data->msg_id);
-      mqtt_broker_connected = false;
+      acked_msg_id = data->msg_id;
+      xEventGroupSetBits(mqtt_event_group, PUBLISHED_BIT);
       break;
 
     case MQTT_EVENT_DATA:
@@ -114,27 +369,62 @@ void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event
  * - Starts the MQTT client and waits for a successful connection.
  */
 void start_mqtt(void) {
+  begin_mqtt();
+  wait_for_mqtt();
+}
+
+/**
+ * @brief Initializes and starts the MQTT client without waiting for the connection.
+ *
+ * The client connects in the background once the network is up. With
+ * CONFIG_MQTT_PERSISTENT_SESSION the client ID stays the same across wakes and the
+ * session is not cleaned, so the broker keeps the session state between the short
+ * connections instead of setting it up on every wake. The client ID is derived from
+ * the MAC address, so nodes missing from the device registry do not share one ID and
+ * take over each other's session.
+ */
+void begin_mqtt(void) {
+  static char client_id[32];
+  uint8_t mac[6];
+  esp_read_mac(mac, ESP_MAC_WIFI_STA);
+  snprintf(client_id, sizeof(client_id), "esp32-%02x%02x%02x%02x%02x%02x",
+           mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
   esp_mqtt_client_config_t mqtt_cfg = {};
   mqtt_cfg.broker.address.hostname = MQTT_BROKER;
   mqtt_cfg.broker.address.port = 1883;
   mqtt_cfg.broker.address.transport = MQTT_TRANSPORT_OVER_TCP;
   mqtt_cfg.session.protocol_ver = MQTT_PROTOCOL_V_3_1_1;
+  mqtt_cfg.session.disable_clean_session = CONFIG_MQTT_PERSISTENT_SESSION;
+  mqtt_cfg.session.keepalive = CONFIG_MQTT_KEEPALIVE_SEC;
+  mqtt_cfg.credentials.client_id = client_id;
   mqtt_cfg.credentials.username = "JWT";
-  mqtt_cfg.network.timeout_ms = 30000;
-  mqtt_cfg.credentials.authentication.password = this_device.device_key;
-  ESP_LOGI("mqtt", "Device Key: %s", this_device.device_key);
+  mqtt_cfg.network.timeout_ms = CONFIG_MQTT_NETWORK_TIMEOUT_MS;
+  mqtt_cfg.network.reconnect_timeout_ms = CONFIG_MQTT_NETWORK_TIMEOUT_MS;
+  // The key is only read from NVS on wakes that connect to the broker
+  mqtt_cfg.credentials.authentication.password = device_registry_get_key();
 
   ESP_LOGI("mqtt", "[APP] Free memory: %d bytes", esp_get_free_heap_size());
+  connect_start_us = esp_timer_get_time();
+  connect_ack_recorded = false;
   mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
   esp_mqtt_client_register_event(mqtt_client, MQTT_EVENT_ANY, mqtt_event_handler, NULL);
 
   mqtt_event_group = xEventGroupCreate();
   esp_mqtt_client_start(mqtt_client);
   ESP_LOGI("mqtt", "Note free memory: %d bytes", esp_get_free_heap_size());
+}
+
+/**
+ * @brief Waits up to CONFIG_MQTT_CONNECT_TIMEOUT_MS for the client started by begin_mqtt() to connect.
+ *
+ * Sets `mqtt_broker_connected` to false if the connection was not established.
+ */
+void wait_for_mqtt(void) {
   ESP_LOGI("mqtt", "Waiting for connection to MQTT\n");
 
-  // Wait for connection with a timeout of 10 seconds
-  EventBits_t bits = xEventGroupWaitBits(mqtt_event_group, CONNECTED_BIT, false, true, pdMS_TO_TICKS(10000));
+  // Wait for connection with a timeout
+  EventBits_t bits = xEventGroupWaitBits(mqtt_event_group, CONNECTED_BIT, false, true, pdMS_TO_TICKS(CONFIG_MQTT_CONNECT_TIMEOUT_MS));
   if (bits & CONNECTED_BIT) {
     ESP_LOGI("mqtt", "Connected to MQTT\n");
   } else {
@@ -144,177 +434,218 @@ void start_mqtt(void) {
 }
 
 /**
- * @brief Sends a single PIR (Passive Infrared) event to the MQTT broker.
+ * @brief Disconnects from the MQTT broker and stops the client before going to sleep.
  *
- * This function constructs a JSON message containing the current timestamp
- * and room ID associated with the device. It then publishes this message
- * to the MQTT broker under the device's specific topic.
- *
- * - Retrieves the current time to timestamp the event.
- * - Formats the message as a JSON string.
- * - Publishes the message to the MQTT broker with QoS level 1.
- *
- * @note This function should be called when a PIR event is detected and needs
- *       to be reported immediately.
+ * Sends a DISCONNECT, so the broker closes the connection right away instead of waiting
+ * for the keepalive to expire. A persistent session is kept by the broker.
  */
-void sendPIReventToMQTT(void) {
-  time_t now = 0;
-  char msg[150];
-  time(&now);
-  const char* room_id = this_device.room_id;
-
-  if (mqtt_broker_connected) {
-    // Format the message with the correct room ID
-    int size = snprintf(msg, sizeof(msg), "{\"sensors\":[{\"name\":\"PIR\",\"values\":[{\"timestamp\":%llu, \"roomID\":\"%s\"}]}]}",
-                        (unsigned long long)(now * 1000), room_id);
-
-    ESP_LOGI("mqtt", "Sent <%s> to topic %s", msg, this_device.device_topic);
-    int err = esp_mqtt_client_publish(mqtt_client, this_device.device_topic, msg, size, 1, 0);
-    if (err == -1) {
-      ESP_LOGE("mqtt", "Error while publishing to mqtt");
-      ESP_LOGI("functions", "SendToMqttFunction terminated");
-    }
-  } else {
-    // Store the event in pir_events[]
-    if (pir_event_count < MAX_PIR_EVENTS) {
-      pir_events[pir_event_count].timestamp = (unsigned long long)(now * 1000);
-      // Copy device info
-      pir_events[pir_event_count].device = this_device;
-      pir_event_count++;
-      ESP_LOGI("PIR", "Stored PIR event locally, total stored events: %d", pir_event_count);
-    } else {
-      ESP_LOGW("PIR", "PIR event buffer is full, cannot store more events");
-    }
+void finish_mqtt(void) {
+  if (mqtt_client == NULL) {
+    return;
   }
+  esp_mqtt_client_disconnect(mqtt_client);
+  esp_mqtt_client_stop(mqtt_client);
+  mqtt_broker_connected = false;
 }
 
-
 /**
- * @brief Sends a magnetic switch event to the MQTT broker.
- *
- * This function constructs a JSON message containing the current timestamp
- * and a predefined room ID ("livingroomdoor"), indicating that a magnetic
- * switch event (e.g., door open/close) has occurred. It then publishes this
- * message to the MQTT broker under the device's topic.
+ * @brief Waits until the broker acknowledged the publish with the given message ID.
  *
- * - Retrieves the current time to timestamp the event.
- * - Formats the message as a JSON string.
- * - Publishes the message to the MQTT broker with QoS level 1.
- *
- * @note This function is specific to devices equipped with a magnetic switch sensor.
+ * @param msg_id     Message ID returned by esp_mqtt_client_publish().
+ * @param timeout_ms Maximum time to wait in milliseconds.
+ * @return true if the matching MQTT_EVENT_PUBLISHED was received in time.
  */
-void sendMagneticSwitchEventToMQTT(void) {
-    if (!mqtt_broker_connected) {
-      ESP_LOGI("PIR", "Cannot send stored PIR events, MQTT is not connected");
-      return;
-    }
-    
-    time_t now = 0;
-    char msg[150];
-    time(&now);
-
-    int size = snprintf(msg, sizeof(msg), 
-        "{\"sensors\":[{\"name\":\"MagneticSwitch\",\"values\":[{\"timestamp\":%llu, \"roomID\":\"livingroomdoor\"}]}]}",
-        (unsigned long long)(now * 1000));
-    ESP_LOGI("mqtt", "Sent <%s> to topic %s", msg, this_device.device_topic);
-
-    int msg_id = esp_mqtt_client_publish(mqtt_client, this_device.device_topic, msg, size, 1, 0);
-    if (msg_id == -1) {
-        ESP_LOGE("mqtt", "Error publishing magnetic switch event");
+static bool wait_for_publish_ack(int msg_id, uint32_t timeout_ms) {
+  TickType_t start = xTaskGetTickCount();
+  TickType_t timeout = pdMS_TO_TICKS(timeout_ms);
+  while (acked_msg_id != msg_id) {
+    TickType_t elapsed = xTaskGetTickCount() - start;
+    if (elapsed >= timeout) {
+      return false;
     }
+    xEventGroupWaitBits(mqtt_event_group, PUBLISHED_BIT, pdTRUE, pdTRUE, timeout - elapsed);
+  }
+  return true;
 }
 
 /**
- * @brief Sends the battery status information to the MQTT broker.
- *
- * This function constructs a JSON message containing the current timestamp,
- * battery voltage, and state of charge (SoC) of the device. It then publishes
- * this message to the MQTT broker under the device's topic.
+ * @brief Publishes the encoded payload and waits for the broker to acknowledge it.
  *
- * - Retrieves the current time to timestamp the status.
- * - Formats the message as a JSON string with battery metrics.
- * - Publishes the message to the MQTT broker with QoS level 1.
+ * The acknowledgment timeout and the measured round-trip time feed the pacing of the
+ * drain (see backlog_drain.h).
  *
- * @note The variables `voltage` and `rsoc` should be updated with the latest
- *       battery measurements before calling this function.
+ * @return true if the broker acknowledged the message.
  */
-void sendBatteryStatusToMQTT(void) {
-  if (!mqtt_broker_connected) {
-      ESP_LOGI("PIR", "Cannot send stored PIR events, MQTT is not connected");
-      return;
+static bool publish_payload_acked(size_t size) {
+  xEventGroupClearBits(mqtt_event_group, PUBLISHED_BIT);
+  int64_t start_us = esp_timer_get_time();
+  int msg_id = publish_payload(size);
+  // -1 on an error, -2 if the outbox is full
+  if (msg_id < 0) {
+    ESP_LOGE("mqtt", "Error publishing pending records to MQTT (%d)", msg_id);
+    return false;
   }
-
-  time_t now = 0;
-
-  char msg[150];
-  time(&now);
-
-  int size = snprintf(msg, sizeof(msg), "{\"sensors\":[{\"name\":\"battery\",\"values\":[{\"timestamp\":%llu, \"voltage\":%.1f, \"soc\":%.1f}]}]}", now * 1000, voltage, rsoc);
-  ESP_LOGI("mqtt", "Sent <%s> to topic %s", msg, this_device.device_topic);
-  auto err = esp_mqtt_client_publish(mqtt_client, this_device.device_topic, msg, size, 1, 0);
-  if (err == -1) {
-    printf("Error while publishing to mqtt\n");
-    ESP_LOGI("functions", "SendToMqttFunction terminated");
-    return ESP_FAIL;
+  if (!wait_for_publish_ack(msg_id, backlog_drain_ack_timeout_ms())) {
+    ESP_LOGW("mqtt", "No acknowledgment for msg_id=%d", msg_id);
+    backlog_drain_on_timeout();
+    return false;
+  }
+  backlog_drain_on_ack((uint32_t)((esp_timer_get_time() - start_us) / 1000));
+
+  // Time to the first acknowledged message, what a persistent session can shorten
+  if (!connect_ack_recorded) {
+    connect_ack_recorded = true;
+    uint32_t latency_ms = (uint32_t)((esp_timer_get_time() - connect_start_us) / 1000);
+    ESP_LOGI("mqtt", "Connect to PUBACK in %" PRIu32 " ms, session present: %d", latency_ms, session_present);
+    wake_stats_record_connect_ack(latency_ms);
   }
+  return true;
 }
 
 /**
- * @brief Sends stored PIR events to the MQTT broker in batch.
+ * @brief Adds the trigger-to-acknowledgment latency of a message to the wake statistics.
  *
- * This function iterates over the array of stored PIR events (`pir_events`),
- * constructs a JSON message containing the timestamps and room IDs of all events,
- * and publishes it to the MQTT broker under the device's topic. After successful
- * publication, it resets the event count to prevent re-sending the same events.
+ * @param count         Number of events in the message.
+ * @param timestamp_sum Sum of the event timestamps in milliseconds.
+ * @param oldest        Timestamp of the oldest event in milliseconds.
+ */
+static void record_publish_latency(uint32_t count, uint64_t timestamp_sum, uint64_t oldest) {
+  uint64_t now_ms = get_current_time_in_ms();
+  uint64_t total_ms = (uint64_t)count * now_ms;
+  wake_stats_record_publish(count, total_ms > timestamp_sum ? total_ms - timestamp_sum : 0,
+                            now_ms > oldest ? (uint32_t)(now_ms - oldest) : 0);
+}
+
+/**
+ * @brief Sends all pending records to the MQTT broker, batched into as few messages as possible.
+ *
+ * The requested extra records (battery reading, wake cost statistics), the magnetic switch
+ * events and the PIR events stored in the RTC event buffer are encoded into one message.
+ * Only if they do not fit into CONFIG_MQTT_PAYLOAD_SIZE, the rest follows in further messages.
  *
- * - Builds a JSON array of PIR event values.
- * - Formats the message as a JSON string with all stored events.
- * - Publishes the message to the MQTT broker with QoS level 1.
+ * A message holds at most backlog_drain_page_events() events, so a buffer filled during
+ * an outage goes up in pages paced by the PUBACK round-trip time.
  *
- * @note This function is useful for sending multiple events that were stored during
- *       periods when the device was in deep sleep or had no network connectivity.
+ * Every message is published with QoS level 1. The sent events are removed from the
+ * buffer only after the broker acknowledged the message (MQTT_EVENT_PUBLISHED with the
+ * matching msg_id). If no acknowledgment arrives within backlog_drain_ack_timeout_ms(),
+ * the events are kept and sent again on the next wake.
+ *
+ * @param[in,out] extras Extra records to send, each flag is cleared once the record was acknowledged.
+ * @return true if all pending records were acknowledged.
  */
-void sendPIReventsToMQTT()
+bool sendUplinkBatchToMQTT(uplink_extras_t* extras)
 {
     if (!mqtt_broker_connected) {
-      ESP_LOGI("PIR", "Cannot send stored PIR events, MQTT is not connected");
-      return;
+      ESP_LOGI("mqtt", "Cannot send pending records, MQTT is not connected");
+      return false;
     }
 
-    // Build the JSON message
-    char msg[1024]; // Adjust size as needed
-    char values[512] = ""; // Buffer for "values" array
-    char temp[128];
-
-    for (int i = 0; i < pir_event_count; i++)
-    {
-        // Get room ID from the stored device information
-        const char* room_id = pir_events[i].device.room_id;
-
-        // Append comma if not the first element
-        if (i > 0)
-            strcat(values, ",");
+    while (extras->battery || extras->wake_stats || event_buffer_count() > 0) {
+        // The first message may have been encoded while Wi-Fi associated
+        payload_encoder_t enc;
+        batch_events_t events;
+        bool reuse = take_prepared_batch(&enc, &events);
+        if (!reuse) {
+            payload_init(&enc);
+        }
+
+        // The extra records go first, unless they are appended to a prepared message
+        time_t now = 0;
+        time(&now);
+        bool battery = extras->battery && payload_add_battery(&enc, (uint64_t)now * 1000, voltage, rsoc);
+        bool stats = extras->wake_stats && payload_add_wake_stats(&enc, (uint64_t)now * 1000);
+        if (!reuse) {
+            payload_add_events(&enc, &events);
+        }
+        uint32_t sent = events.sent;
+        if (sent == 0 && !battery && !stats) {
+            ESP_LOGE("mqtt", "Pending record does not fit into the payload buffer");
+            return false;
+        }
+        size_t size = payload_finish(&enc);
+
+        ESP_LOGI("mqtt", "Sending %" PRIu32 " stored events%s%s", sent,
+                 battery ? ", the battery status" : "", stats ? ", the wake statistics" : "");
+
+        // Keep the events until the broker confirmed them
+        if (!publish_payload_acked(size)) {
+            ESP_LOGW("mqtt", "Keeping %" PRIu32 " events for the next wake", sent);
+            return false;
+        }
+        event_buffer_discard(sent);
+        if (sent > 0) {
+            record_publish_latency(sent, events.timestamp_sum, events.oldest);
+        }
+        if (battery) {
+            extras->battery = false;
+        }
+        if (stats) {
+            extras->wake_stats = false;
+        }
+    }
+    return true;
+}
 
-        // Format the timestamp in milliseconds
-        uint64_t timestamp_ms = pir_events[i].timestamp;
+void prepare_uplink_batch(void)
+{
+    prepared.valid = false;
+    if (event_buffer_count() == 0) {
+        return;
+    }
+    int64_t start_us = esp_timer_get_time();
+    payload_init(&prepared.enc);
+    payload_add_events(&prepared.enc, &prepared.events);
+    prepared.valid = prepared.events.sent > 0;
+    ESP_LOGI("mqtt", "Prepared %" PRIu32 " of %" PRIu32 " events in %lld us", prepared.events.sent,
+             event_buffer_count(), esp_timer_get_time() - start_us);
+}
 
-        snprintf(temp, sizeof(temp), "{\"timestamp\":%llu,\"roomID\":\"%s\"}", timestamp_ms, room_id);
-        strcat(values, temp);
+/**
+ * @brief Sends the events spilled into the flash journal to the MQTT broker.
+ *
+ * The journal is drained oldest block first, with stop-and-wait flow control: the next
+ * message is only published after the broker acknowledged the previous one, and a block
+ * is marked delivered only once all its events were acknowledged. The blocks are split into
+ * messages of backlog_drain_page_events() events. Draining stops at the first missing
+ * acknowledgment, or when the drain budget of the wake is used up; the journal position is
+ * kept, so the next wake continues with the first block not yet delivered.
+ *
+ * @return false if the broker was not reachable or did not acknowledge a message.
+ */
+bool sendJournalToMQTT(void)
+{
+    if (!mqtt_broker_connected) {
+      ESP_LOGI("mqtt", "Cannot drain the event journal, MQTT is not connected");
+      return false;
     }
 
-    // Build the final JSON message
-    snprintf(msg, sizeof(msg), "{\"sensors\":[{\"name\":\"PIR\",\"values\":[%s]}]}", values);
-
-    // Send the message via MQTT
-    ESP_LOGI("mqtt", "Sending PIR events: %s", msg);
-    int msg_id = esp_mqtt_client_publish(mqtt_client, this_device.device_topic, msg, 0, 1, 0);
-    if (msg_id == -1)
-    {
-        ESP_LOGE("mqtt", "Error publishing PIR events to MQTT");
-        ESP_LOGI("functions", "SendToMqttFunction terminated");
-        return ESP_FAIL;
-    } else {
-        // Reset the PIR event count if success
-        pir_event_count = 0;
+    static event_record_t events[EVENT_JOURNAL_BLOCK_EVENTS];
+    uint32_t count = 0;
+    while (backlog_drain_has_budget() && event_journal_peek(events, &count)) {
+        // The block is kept until all its messages are acknowledged
+        uint32_t sent = 0;
+        while (sent < count) {
+            payload_encoder_t enc;
+            payload_init(&enc);
+            uint32_t first = sent;
+            uint32_t page = backlog_drain_page_events();
+            while (sent < count && sent - first < page && payload_add_event(&enc, &events[sent])) {
+                sent++;
+            }
+            if (sent == first) {
+                ESP_LOGE("mqtt", "Journal event does not fit into the payload buffer");
+                return false;
+            }
+            size_t size = payload_finish(&enc);
+
+            ESP_LOGI("mqtt", "Sending %" PRIu32 " journal events", sent - first);
+            if (!publish_payload_acked(size)) {
+                ESP_LOGW("mqtt", "Keeping the journal block for the next wake");
+                return false;
+            }
+        }
+        event_journal_consume();
     }
+    return true;
 }
@@ -1,10 +1,29 @@
 #pragma once
+#include <stdbool.h>
+#include <stdint.h>
 #include "freertos/event_groups.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
 
 void start_mqtt(void);
-void sendPIReventToMQTT(void);
-void sendBatteryStatusToMQTT(void);
-void sendMagneticSwitchEventToMQTT(void);
-void sendPIReventsToMQTT(void);
+void begin_mqtt(void);
+void wait_for_mqtt(void);
+void finish_mqtt(void);
+
+/**
+ * @brief Records sent together with the buffered events by sendUplinkBatchToMQTT().
+ */
+typedef struct {
+  bool battery;      // < The last battery reading (`voltage` and `rsoc`).
+  bool wake_stats;   // < The wake cost statistics of the current period.
+} uplink_extras_t;
+
+/**
+ * @brief Encodes the buffered events into the payload buffer ahead of sendUplinkBatchToMQTT().
+ *
+ * Called while Wi-Fi associates. sendUplinkBatchToMQTT() sends the prepared message if
+ * the buffer still starts with its events and nothing else was encoded in between.
+ */
+void prepare_uplink_batch(void);
+bool sendUplinkBatchToMQTT(uplink_extras_t* extras);
+bool sendJournalToMQTT(void);
@@ -1,23 +1,21 @@
 #include <inttypes.h>
-#include "esp_sleep.h"
-#include "esp_cpu.h"
-#include "esp_rom_sys.h"
-#include "esp_wake_stub.h"
+#include "esp_attr.h"
+#include "esp_log.h"
 #include "sdkconfig.h"
 
-#include "esp_rom_sys.h"
-#include "hal/rtc_io_ll.h"
-#include "rom/rtc.h"
-#include "soc/rtc.h"
-#include "soc/rtc_periph.h"
-#include "soc/sens_periph.h"
-#include "soc/timer_group_reg.h"
-#include "soc/uart_reg.h"
-#include "esp_private/esp_clk.h"
+#include "rtc_wake_stub_hal.h"
 #include "main.h"
-
-// Waiting time in seconds for inactive sensors in wake-up stub.
-RTC_DATA_ATTR uint32_t SENSOR_INACTIVE_DELAY_IN_WAKE_UP_STUB_SEC = CONFIG_SENSOR_INACTIVE_DELAY_IN_WAKE_UP_STUB_SEC;
+#include "rtc_wake_stub.h"
+#include "rtc_wake_stub_buffer.h"
+#include "rtc_wake_stub_channels.h"
+#include "rtc_wake_stub_flush.h"
+#include "rtc_wake_stub_clock.h"
+#include "rtc_wake_stub_stats.h"
+#include "rtc_wake_stub_ulp.h"
+#include "gauge.h"
+
+// Triggers closer than this window (in milliseconds) are merged into one activity span.
+RTC_DATA_ATTR uint32_t PIR_COALESCE_WINDOW_MS = CONFIG_PIR_COALESCE_WINDOW_MS;
 
 // Wake-up cause stored in RTC memory.
 static uint32_t wakeup_cause;
@@ -25,12 +23,141 @@ static uint32_t wakeup_cause;
 // Wake-up time from CPU start to wake stub.
 static uint32_t wakeup_time;
 
-// Variable to prevent multiple wake-ups caused by PIR sensors.
-RTC_DATA_ATTR static uint64_t last_wakeup_RTC = 0;
+// Activity span that is still open, merged triggers are not yet stored in the event buffer.
+RTC_DATA_ATTR static bool pir_span_open = false;
+RTC_DATA_ATTR static uint32_t pir_span_channel = 0;
+RTC_DATA_ATTR static uint64_t pir_span_start = 0;
+RTC_DATA_ATTR static uint64_t pir_span_end = 0;
+RTC_DATA_ATTR static uint16_t pir_span_count = 0;
 
 // Information about the last battery update.
 RTC_DATA_ATTR uint64_t last_battery_info_time_RTC = 0;
 
+/**
+ * @brief Re-enables the EXT1 wake-up of a masked sensor pin once the sensor is inactive.
+ *
+ * With ESP_EXT1_WAKEUP_ANY_HIGH an active sensor would wake the chip again immediately,
+ * so its pin is removed from the wake-up sources and checked again on a timer wake-up.
+ * The main application masks the pins of sensors that are still active when it goes to
+ * sleep, the stub masks the pin of a buffered channel after a trigger.
+ *
+ * @param channel The sensor channel.
+ * @return true if the pin is masked and the sensor is still active.
+ */
+static bool sensor_still_active(const sensor_channel_t *channel)
+{
+    if (wake_stub_hal_ext1_enabled(channel->rtc_io_num)) {
+        return false;
+    }
+    if (wake_stub_hal_get_rtcio_level(channel->rtc_io_num)) {
+        return true;
+    }
+    wake_stub_hal_ext1_enable(channel->rtc_io_num, true);
+    return false;
+}
+
+/**
+ * @brief Checks all masked sensor pins, see sensor_still_active().
+ *
+ * A still active PIR sensor extends its open activity span.
+ *
+ * @param[out] recheck_sec Shortest re-check interval of the active sensors.
+ * @return true if any sensor is still active.
+ */
+static bool recheck_active_sensors(uint32_t *recheck_sec)
+{
+    bool active = false;
+    for (uint32_t i = 0; i < sensor_channel_count; i++) {
+        const sensor_channel_t *channel = &sensor_channels[i];
+        if (!sensor_still_active(channel)) {
+            continue;
+        }
+        ESP_RTC_LOGI("wake stub: sensor channel %d still active, checking again later", i);
+        if (!active || channel->debounce_sec < *recheck_sec) {
+            *recheck_sec = channel->debounce_sec;
+        }
+        active = true;
+        if (pir_span_open && pir_span_channel == i) {
+            pir_span_end = get_actual_time_ms();
+        }
+    }
+    return active;
+}
+
+/**
+ * @brief Records the cost of this wake and enters deep sleep again. Does not return.
+ */
+static void sleep_again(void)
+{
+    wake_stats_record_stub_wake(wake_stub_hal_get_cycle_time_us());
+    wake_stub_hal_sleep(&wake_stub);
+}
+
+/**
+ * @brief Records the stub time and prepares booting the main application.
+ *
+ * The caller has to return from the wake-up stub afterwards.
+ */
+static void boot_app(void)
+{
+    wake_stats_record_stub_boot(wake_stub_hal_get_cycle_time_us());
+    wake_stub_hal_boot_app();
+    ESP_RTC_LOGI("wake stub: Booting the firmware and the main app.");
+}
+
+/**
+ * @brief Collects the state of the pending events for the flush policy.
+ *
+ * @param[out] input State of the pending events.
+ */
+static void get_flush_input(flush_input_t *input)
+{
+    input->now = get_actual_time_ms();
+    input->event_count = event_buffer_count();
+    input->fill_percent = event_buffer_fill_percent();
+    input->has_pending = input->event_count > 0 || pir_span_open;
+    input->oldest_timestamp = input->event_count > 0 ? event_buffer_oldest_timestamp() : pir_span_start;
+    input->battery_soc = battery_soc;
+    input->retry_at = flush_retry_at_ms;
+    input->backlog_pending = flush_backlog_pending;
+}
+
+/**
+ * @brief Prepares booting the main application to flush the pending events.
+ *
+ * The caller has to return from the wake-up stub afterwards.
+ *
+ * @param input State of the pending events.
+ */
+static void boot_app_to_flush(const flush_input_t *input)
+{
+    ESP_RTC_LOGI("wake stub: Flushing %d events (%d%% full, oldest %llu), waking up the application.",
+                 input->event_count, input->fill_percent, input->oldest_timestamp);
+    boot_app();
+}
+
+/**
+ * @brief Returns the time in seconds until the stub has to check the events or the battery again.
+ *
+ * @param input State of the pending events.
+ */
+static uint32_t get_next_wakeup_sec(const flush_input_t *input)
+{
+    uint32_t next = AUTOMATIC_WAKEUP_INTERVAL_SEC;
+
+    uint32_t time_to_flush = flush_policy_time_to_flush_sec(input);
+    if (time_to_flush < next) {
+        next = time_to_flush;
+    }
+
+    uint64_t since_battery_info = my_rtc_time_get_us() / 1000000 - last_battery_info_time_RTC;
+    if (since_battery_info < BATTERY_INFO_INTERVAL_SEC && BATTERY_INFO_INTERVAL_SEC - since_battery_info < next) {
+        next = BATTERY_INFO_INTERVAL_SEC - since_battery_info;
+    }
+
+    return next > 0 ? next : 1;
+}
+
 /**
  * @brief Wake-up stub function executed during wake-up from deep sleep.
  *
@@ -45,143 +172,230 @@ void wake_stub(void)
     ESP_RTC_LOGI("wake stub: start of the wake-up stub");
 
     // Feed the watchdog to prevent a reset
-    REG_WRITE(TIMG_WDTFEED_REG(0), 1);
+    wake_stub_hal_feed_watchdog();
 
     // Get wake-up time.
-    wakeup_time = esp_cpu_get_cycle_count() / esp_rom_get_cpu_ticks_per_us();
+    wakeup_time = wake_stub_hal_get_cycle_time_us();
 
     // Get wake-up cause.
-    wakeup_cause = esp_wake_stub_get_wakeup_cause(); // 8: Timer, 2: Sensor (EXT1)
+    wakeup_cause = wake_stub_hal_get_wakeup_cause();
 
     ESP_RTC_LOGI("wake stub: wake-up cause is %d, wake-up cost %ld us, RTC clock: %llu, last battery update: %llu",
                  wakeup_cause, wakeup_time, my_rtc_time_get_us() / 1000000, last_battery_info_time_RTC);
 
-    // Ensure the wake-up event was caused by a new trigger, not by still active sensors
-    // and the triggered events are SENSOR_INACTIVE_DELAY_IN_WAKE_UP_STUB_SEC from each other.
-    ESP_RTC_LOGI("wake stub: RTC clock: %llu, last wake-up RTC: %llu",
-                 my_rtc_time_get_us() / 1000000, last_wakeup_RTC);
+    flush_input_t flush_input;
 
-    if (my_rtc_time_get_us() / 1000000 - last_wakeup_RTC <= SENSOR_INACTIVE_DELAY_IN_WAKE_UP_STUB_SEC) {
-        last_wakeup_RTC = my_rtc_time_get_us() / 1000000;
-        ESP_RTC_LOGI("wake stub: wake-up stub is caused by still active sensor, waiting for the sensors to become inactive");
-        ets_delay_us(1000000); // Delay in microseconds.
-        esp_wake_stub_set_wakeup_time(AUTOMATIC_WAKEUP_INTERVAL_SEC * 1000000);
-        ESP_RTC_LOGI("wake stub: going to deep sleep");
-        // Set stub entry, then go to deep sleep again.
-        esp_wake_stub_sleep(&wake_stub);
+#if CONFIG_ULP_EDGE_COUNTER
+    // The ULP program counted the sensor edges while the chip was sleeping.
+    if (wakeup_cause == WAKE_STUB_CAUSE_ULP) {
+        ESP_RTC_LOGI("wake stub: wake-up caused by the ULP edge counter.");
+    }
+    if (store_ulp_edges()) {
+        ESP_RTC_LOGI("wake stub: sensor channel with immediate flush triggered wake-up.");
+        boot_app();
+        return;
+    }
+#else
+    // Timer wake-up armed while a sensor was still active: check it again without a busy wait.
+    uint32_t recheck_sec = 0;
+    if (wakeup_cause != WAKE_STUB_CAUSE_EXT1 && recheck_active_sensors(&recheck_sec)) {
+        get_flush_input(&flush_input);
+        if (flush_policy_should_flush(&flush_input)) {
+            boot_app_to_flush(&flush_input);
+            return;
+        }
+        wake_stub_hal_set_wakeup_time_us((uint64_t)recheck_sec * 1000000);
+        sleep_again();
     }
-    last_wakeup_RTC = my_rtc_time_get_us() / 1000000;
-    ESP_RTC_LOGI("wake stub: Waiting time for inactive sensors is finished.");
 
     // Wake-up was caused by a sensor.
-    if (wakeup_cause == 2) { // ESP_SLEEP_WAKEUP_EXT1
+    if (wakeup_cause == WAKE_STUB_CAUSE_EXT1) {
         ESP_RTC_LOGI("wake stub: wake-up caused by sensor trigger.");
         ESP_RTC_LOGI("wake stub: DEVICE_ID = %d", this_device.device_id);
-        
-        // Read the EXT1 wake-up status register to identify the sensor.
-        uint32_t ext1_status = REG_READ(RTC_CNTL_EXT_WAKEUP1_STATUS_REG);
 
+        // Read the EXT1 wake-up status register, every set bit is the RTC IO of a triggered sensor.
+        uint32_t ext1_status = wake_stub_hal_get_ext1_status();
         ESP_RTC_LOGI("wake stub: ext1_status = 0x%X", ext1_status);
 
-        // Identify which sensor triggered the wake-up.
-        if (ext1_status == 0x20000) {
-            ESP_RTC_LOGI("wake stub: PIR sensor triggered wake-up");
-            if (pir_event_count < MAX_PIR_EVENTS){
-                store_pir_event();
-            } else {
-                ESP_RTC_LOGI("wake stub: Can not store the PIR event, the pir_event array is full!");
+        uint64_t actual_timestamp = get_actual_time_ms();
+        bool boot_now = false;
+        bool masked = false;
+        while (ext1_status != 0) {
+            int rtc_io_num = __builtin_ctz(ext1_status);
+            ext1_status &= ext1_status - 1;
+
+            int index = sensor_channel_from_rtc_io(rtc_io_num);
+            if (index < 0) {
+                ESP_RTC_LOGI("wake stub: RTC IO %d is not a sensor channel", rtc_io_num);
+                continue;
             }
+            const sensor_channel_t *channel = &sensor_channels[index];
+            ESP_RTC_LOGI("wake stub: sensor channel %d triggered wake-up", index);
+            store_sensor_event(index, actual_timestamp);
 
-            if (pir_event_count >= MAX_PIR_EVENTS) {
-                // Do not reset pir_event_count here.
-                ESP_RTC_LOGI("wake stub: The PIR events array is full (%d/%d events stored), waking up the application.",
-                             pir_event_count, MAX_PIR_EVENTS);
-                esp_default_wake_deep_sleep();
-                ESP_RTC_LOGI("wake stub: Booting the firmware and the main app.");
-                return;
+            if (channel->flush == SENSOR_FLUSH_IMMEDIATE) {
+                boot_now = true;
+            } else {
+                // Ignore the pin until the sensor becomes inactive, the timer wakes us up to check it.
+                wake_stub_hal_ext1_enable(channel->rtc_io_num, false);
+                if (!masked || channel->debounce_sec < recheck_sec) {
+                    recheck_sec = channel->debounce_sec;
+                }
+                masked = true;
             }
-        } else {
-            ESP_RTC_LOGI("wake stub: Magnetic Switch triggered wake-up.");
-            esp_default_wake_deep_sleep();
-            ESP_RTC_LOGI("wake stub: Booting the firmware and the main app.");
-            return;
         }
 
-        // Perform required minimal actions for the sensors here.
-        // Do not proceed to the main application; return to deep sleep.
-        ESP_RTC_LOGI("wake stub: returning to deep sleep after handling sensor trigger");
+        if (boot_now) {
+            boot_app();
+            return;
+        }
 
-        // Set the wake-up time for the next cycle if needed.
-        esp_wake_stub_set_wakeup_time(AUTOMATIC_WAKEUP_INTERVAL_SEC * 1000000);
+        get_flush_input(&flush_input);
+        if (flush_policy_should_flush(&flush_input)) {
+            boot_app_to_flush(&flush_input);
+            return;
+        }
 
-        // Return to deep sleep.
-        esp_wake_stub_sleep(&wake_stub);
+        if (masked) {
+            ESP_RTC_LOGI("wake stub: returning to deep sleep after handling sensor trigger");
+            wake_stub_hal_set_wakeup_time_us((uint64_t)recheck_sec * 1000000);
+            sleep_again();
+        }
     } else {
         ESP_RTC_LOGI("wake stub: wake-up caused by automatic refresh.");
     }
+#endif
+
+    // Check if the pending events have to be flushed.
+    get_flush_input(&flush_input);
+    if (flush_policy_should_flush(&flush_input)) {
+        boot_app_to_flush(&flush_input);
+        return;
+    }
 
     // Check if it's time to send the battery status to MQTT.
     if (my_rtc_time_get_us() / 1000000 - last_battery_info_time_RTC >= BATTERY_INFO_INTERVAL_SEC) {
         ESP_RTC_LOGI("wake stub: time to send the battery status.");
         last_battery_info_time_RTC = my_rtc_time_get_us() / 1000000;
-        esp_default_wake_deep_sleep();
-        ESP_RTC_LOGI("wake stub: Booting the firmware and the main app.");
+        boot_app();
         return;
     }
 
-    // Set wake-up time in stub if needed to check GPIOs or read some sensor periodically in the stub.
-    esp_wake_stub_set_wakeup_time(AUTOMATIC_WAKEUP_INTERVAL_SEC * 1000000);
+    // Sleep until the oldest event has to be flushed or the battery status is due.
+    uint32_t next_wakeup_sec = get_next_wakeup_sec(&flush_input);
+    wake_stub_hal_set_wakeup_time_us((uint64_t)next_wakeup_sec * 1000000);
+#if CONFIG_ULP_EDGE_COUNTER
+    ulp_edges_arm_wakeup(flush_input.event_count);
+#endif
 
     // Print status.
-    ESP_RTC_LOGI("wake stub: going to deep sleep");
+    ESP_RTC_LOGI("wake stub: going to deep sleep for %d s", next_wakeup_sec);
 
     // Set stub entry, then go to deep sleep again.
-    esp_wake_stub_sleep(&wake_stub);
+    sleep_again();
 }
 
 /**
- * @brief Stores a PIR event with the current timestamp and device information.
+ * @brief Converts the current RTC time into the actual Unix time in milliseconds.
  *
- * Calculates the actual timestamp based on RTC time and synchronization data,
- * then stores the event in the PIR events array.
+ * Uses the RTC time, the actual time stored at the last synchronization and the
+ * estimated drift of the RTC slow clock.
+ *
+ * @return The actual Unix timestamp in milliseconds.
  */
-void store_pir_event(void)
+uint64_t get_actual_time_ms(void)
 {
     // Get the current RTC time in milliseconds.
     uint64_t rtc_time_now = my_rtc_time_get_us() / 1000;
 
-    // Calculate the time difference since the last synchronization.
-    uint64_t rtc_time_diff = rtc_time_now - rtc_time_at_last_sync;
-
-    // Calculate the actual timestamp using the time difference and the last actual time.
-    uint64_t actual_timestamp = actual_time_at_last_sync + rtc_time_diff;
+    // Calculate the actual timestamp from the last synchronization, corrected by the RTC drift.
+    uint64_t actual_timestamp = clock_model_actual_time_ms(rtc_time_now);
 
     ESP_RTC_LOGI("wake stub: rtc_time_now: %llu, rtc_time_at_last_sync: %llu, actual_time_at_last_sync: %llu, actual_timestamp: %llu",
                  rtc_time_now, rtc_time_at_last_sync, actual_time_at_last_sync, actual_timestamp);
 
-    // Store the new event with the calculated actual timestamp.
-    pir_events[pir_event_count].timestamp = actual_timestamp;
+    return actual_timestamp;
+}
 
-    // Since we cannot use memcpy in the wake-up stub, we manually copy each field.
-    pir_events[pir_event_count].device.device_id = this_device.device_id;
-    pir_events[pir_event_count].device.battery_info_available = this_device.battery_info_available;
+/**
+ * @brief Stores a PIR event in the RTC event buffer.
+ *
+ * If coalescing is enabled (PIR_COALESCE_WINDOW_MS > 0), a trigger within the window
+ * of the previous one extends the open activity span instead of writing a new record.
+ * The span is written to the event buffer once a trigger falls outside the window.
+ *
+ * Triggers of different channels are never merged.
+ *
+ * @param channel          Sensor channel of the PIR sensor.
+ * @param actual_timestamp The actual Unix timestamp of the trigger in milliseconds.
+ */
+void store_pir_event(uint32_t channel, uint64_t actual_timestamp)
+{
+    if (PIR_COALESCE_WINDOW_MS > 0) {
+        if (pir_span_open && pir_span_channel == channel && actual_timestamp - pir_span_end <= PIR_COALESCE_WINDOW_MS) {
+            pir_span_end = actual_timestamp;
+            if (pir_span_count < 0xFFFF) {
+                pir_span_count++;
+            }
+            ESP_RTC_LOGI("wake stub: Merged PIR event into the activity span: Start = %llu, Count = %d",
+                         pir_span_start, pir_span_count);
+            return;
+        }
+        close_pir_span();
+        pir_span_open = true;
+        pir_span_channel = channel;
+        pir_span_start = actual_timestamp;
+        pir_span_end = actual_timestamp;
+        pir_span_count = 1;
+        ESP_RTC_LOGI("wake stub: Opened PIR activity span: Start = %llu", actual_timestamp);
+        return;
+    }
 
-    // Note: Assigning pointers directly as below is acceptable in the wake-up stub environment.
-    pir_events[pir_event_count].device.device_name = this_device.device_name;
-    pir_events[pir_event_count].device.device_topic = this_device.device_topic;
-    pir_events[pir_event_count].device.device_key = this_device.device_key;
-    pir_events[pir_event_count].device.room_id = this_device.room_id;
+    if (event_buffer_push(channel, actual_timestamp)) {
+        ESP_RTC_LOGI("wake stub: Stored PIR event: Timestamp = %llu, Events stored = %d",
+                     actual_timestamp, event_buffer_count());
+    } else {
+        ESP_RTC_LOGI("wake stub: Can not store the PIR event, the event buffer is full! Dropped events: %d",
+                     dropped_event_count);
+    }
+}
 
-    // Copy MAC address manually.
-    for (int i = 0; i < 6; i++) {
-        pir_events[pir_event_count].device.mac_address[i] = this_device.mac_address[i];
+/**
+ * @brief Stores a trigger of a sensor channel in the RTC event buffer.
+ *
+ * PIR triggers go through store_pir_event(), other sensors are stored as single events.
+ *
+ * @param channel          Index of the sensor channel.
+ * @param actual_timestamp The actual Unix timestamp of the trigger in milliseconds.
+ */
+void store_sensor_event(uint32_t channel, uint64_t actual_timestamp)
+{
+    if (sensor_channel_type(channel) == EVENT_TYPE_PIR) {
+        store_pir_event(channel, actual_timestamp);
+    } else if (event_buffer_push(channel, actual_timestamp)) {
+        ESP_RTC_LOGI("wake stub: Stored event of sensor channel %d: Timestamp = %llu", channel, actual_timestamp);
+    } else {
+        ESP_RTC_LOGI("wake stub: Can not store the event of sensor channel %d, the event buffer is full!", channel);
     }
+}
 
-    ESP_RTC_LOGI("wake stub: Stored PIR event: Timestamp = %llu, Device ID = %d, Event Index = %d",
-                 actual_timestamp, this_device.device_id, pir_event_count);
+/**
+ * @brief Writes the open PIR activity span, if any, to the RTC event buffer.
+ */
+void close_pir_span(void)
+{
+    if (!pir_span_open) {
+        return;
+    }
+    pir_span_open = false;
 
-    // Increment the event count.
-    pir_event_count++;
+    if (event_buffer_push_span(pir_span_channel, pir_span_start, (uint32_t)(pir_span_end - pir_span_start), pir_span_count)) {
+        ESP_RTC_LOGI("wake stub: Stored PIR activity span: Start = %llu, End = %llu, Count = %d, Events stored = %d",
+                     pir_span_start, pir_span_end, pir_span_count, event_buffer_count());
+    } else {
+        ESP_RTC_LOGI("wake stub: Can not store the PIR activity span, the event buffer is full! Dropped events: %d",
+                     dropped_event_count);
+    }
 }
 
 /**
@@ -194,18 +408,5 @@ void store_pir_event(void)
  */
 RTC_IRAM_ATTR uint64_t my_rtc_time_get_us(void)
 {
-    SET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_UPDATE);
-    while (GET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_VALID) == 0) {
-        ets_delay_us(1); // Wait for RTC time to be valid.
-    }
-    SET_PERI_REG_MASK(RTC_CNTL_INT_CLR_REG, RTC_CNTL_TIME_VALID_INT_CLR);
-    uint64_t t = READ_PERI_REG(RTC_CNTL_TIME0_REG);
-    t |= ((uint64_t)READ_PERI_REG(RTC_CNTL_TIME1_REG)) << 32;
-
-    uint32_t period = REG_READ(RTC_SLOW_CLK_CAL_REG);
-
-    // Convert RTC clock cycles to microseconds.
-    uint64_t now_us = ((t * period) >> RTC_CLK_CAL_FRACT);
-
-    return now_us;
+    return wake_stub_hal_get_rtc_time_us();
 }
@@ -1,3 +1,9 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_attr.h"
+
 /**
  * @brief Wake-up stub function executed during wake-up from deep sleep.
  *
@@ -10,12 +16,44 @@
 void wake_stub(void);
 
 /**
- * @brief Stores a PIR event with the current timestamp and device information.
+ * @brief Stores a PIR event in the RTC event buffer.
+ *
+ * If coalescing is enabled (PIR_COALESCE_WINDOW_MS > 0), a trigger within the window
+ * of the previous one extends the open activity span instead of writing a new record.
+ * The span is written to the event buffer once a trigger falls outside the window.
+ * Triggers of different channels are never merged.
+ *
+ * @param channel          Sensor channel of the PIR sensor.
+ * @param actual_timestamp The actual Unix timestamp of the trigger in milliseconds.
+ */
+void store_pir_event(uint32_t channel, uint64_t actual_timestamp);
+
+/**
+ * @brief Stores a trigger of a sensor channel in the RTC event buffer.
+ *
+ * PIR triggers go through store_pir_event(), other sensors are stored as single events.
+ *
+ * @param channel          Index of the sensor channel.
+ * @param actual_timestamp The actual Unix timestamp of the trigger in milliseconds.
+ */
+void store_sensor_event(uint32_t channel, uint64_t actual_timestamp);
+
+/**
+ * @brief Writes the open PIR activity span, if any, to the RTC event buffer.
+ *
+ * Called by the main application before flushing the buffer.
+ */
+void close_pir_span(void);
+
+/**
+ * @brief Converts the current RTC time into the actual Unix time in milliseconds.
+ *
+ * Uses the RTC time, the actual time stored at the last synchronization and the
+ * estimated drift of the RTC slow clock.
  *
- * Calculates the actual timestamp based on RTC time and synchronization data,
- * then stores the event in the PIR events array.
+ * @return The actual Unix timestamp in milliseconds.
  */
-void store_pir_event(void);
+uint64_t get_actual_time_ms(void);
 
 /**
  * @brief Retrieves the current RTC time in microseconds.
@@ -0,0 +1,260 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_attr.h"
+#include "sdkconfig.h"
+
+#include "main.h"
+#include "rtc_wake_stub_buffer.h"
+#include "rtc_wake_stub_channels.h"
+
+// Record layout: one tag byte followed by the timestamp payload and, for activity spans,
+// the span duration and the 16-bit trigger count.
+// The tag holds the sensor channel in bits 0-3, the timestamp width in bits 4-5, the span flag
+// in bit 6 and the duration width (0: 16-bit, 1: 32-bit) in bit 7.
+#define TAG_CHANNEL_MASK    0x0F
+#define TAG_WIDTH_SHIFT     4
+#define TAG_WIDTH_MASK      0x03
+#define TAG_SPAN            0x40
+#define TAG_SPAN_LONG       0x80
+#define WIDTH_DELTA_16      0   // < 16-bit delta to the previous event.
+#define WIDTH_DELTA_32      1   // < 32-bit delta to the previous event.
+#define WIDTH_ABSOLUTE_64   2   // < Full 64-bit timestamp.
+
+// Size of the largest record (tag + 64-bit timestamp + 32-bit duration + 16-bit count).
+#define EVENT_RECORD_MAX_SIZE 15
+
+// Policy applied when the buffer is full.
+RTC_DATA_ATTR uint32_t EVENT_BUFFER_POLICY = CONFIG_EVENT_BUFFER_POLICY;
+
+// Number of events lost because the buffer was full.
+RTC_DATA_ATTR uint32_t dropped_event_count = 0;
+
+// Byte ring holding the encoded records.
+RTC_DATA_ATTR static uint8_t buffer_data[CONFIG_EVENT_BUFFER_SIZE];
+
+RTC_DATA_ATTR static uint32_t buffer_head = 0;        // Offset of the oldest record.
+RTC_DATA_ATTR static uint32_t buffer_used = 0;        // Number of used bytes.
+RTC_DATA_ATTR static uint32_t buffer_count = 0;       // Number of stored records.
+RTC_DATA_ATTR static uint64_t buffer_base_time = 0;   // Timestamp of the oldest record.
+RTC_DATA_ATTR static uint64_t buffer_last_time = 0;   // Timestamp of the newest record.
+
+// Note: this file is placed in RTC memory by the linker (rtc_wake_stub* pattern) so that
+// the wake-up stub can use it. Standard library functions such as memcpy are not available.
+
+static inline uint32_t wrap(uint32_t pos)
+{
+    return pos >= CONFIG_EVENT_BUFFER_SIZE ? pos - CONFIG_EVENT_BUFFER_SIZE : pos;
+}
+
+static inline uint32_t payload_size(uint8_t width)
+{
+    return width == WIDTH_DELTA_16 ? 2 : (width == WIDTH_DELTA_32 ? 4 : 8);
+}
+
+/**
+ * @brief Decodes the record at @p pos.
+ *
+ * @param pos        Byte offset of the record.
+ * @param previous   Timestamp of the preceding record, used for delta records.
+ * @param[out] record Decoded event.
+ * @return Size of the record in bytes.
+ */
+static uint32_t decode_record(uint32_t pos, uint64_t previous, event_record_t *record)
+{
+    uint8_t tag = buffer_data[pos];
+    uint8_t width = (tag >> TAG_WIDTH_SHIFT) & TAG_WIDTH_MASK;
+    uint32_t size = payload_size(width);
+
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < size; i++) {
+        pos = wrap(pos + 1);
+        value |= (uint64_t)buffer_data[pos] << (8 * i);
+    }
+
+    record->channel = tag & TAG_CHANNEL_MASK;
+    record->type = sensor_channel_type(record->channel);
+    record->timestamp = width == WIDTH_ABSOLUTE_64 ? value : previous + value;
+    record->duration = 0;
+    record->count = 1;
+
+    if (tag & TAG_SPAN) {
+        uint32_t duration_size = (tag & TAG_SPAN_LONG) ? 4 : 2;
+        uint32_t duration = 0;
+        for (uint32_t i = 0; i < duration_size; i++) {
+            pos = wrap(pos + 1);
+            duration |= (uint32_t)buffer_data[pos] << (8 * i);
+        }
+        pos = wrap(pos + 1);
+        uint16_t count = buffer_data[pos];
+        pos = wrap(pos + 1);
+        count |= (uint16_t)buffer_data[pos] << 8;
+
+        record->duration = duration;
+        record->count = count;
+        size += duration_size + 2;
+    }
+    return 1 + size;
+}
+
+bool event_buffer_push(uint32_t channel, uint64_t timestamp)
+{
+    return event_buffer_push_span(channel, timestamp, 0, 1);
+}
+
+bool event_buffer_push_span(uint32_t channel, uint64_t timestamp, uint32_t duration, uint16_t count)
+{
+    uint8_t span = (count > 1 || duration > 0) ? TAG_SPAN : 0;
+    if (span && duration > 0xFFFF) {
+        span |= TAG_SPAN_LONG;
+    }
+    uint32_t span_size = span ? ((span & TAG_SPAN_LONG) ? 4 : 2) + 2 : 0;
+
+    uint8_t width = WIDTH_ABSOLUTE_64;
+    uint64_t value = timestamp;
+    if (buffer_count > 0 && timestamp >= buffer_last_time) {
+        uint64_t delta = timestamp - buffer_last_time;
+        if (delta <= 0xFFFF) {
+            width = WIDTH_DELTA_16;
+            value = delta;
+        } else if (delta <= 0xFFFFFFFF) {
+            width = WIDTH_DELTA_32;
+            value = delta;
+        }
+    }
+    uint32_t size = 1 + payload_size(width) + span_size;
+
+    if (CONFIG_EVENT_BUFFER_SIZE - buffer_used < size) {
+        if (EVENT_BUFFER_POLICY == EVENT_BUFFER_DROP_NEWEST) {
+            dropped_event_count++;
+            return false;
+        }
+        while (CONFIG_EVENT_BUFFER_SIZE - buffer_used < size && buffer_count > 0) {
+            event_buffer_pop(NULL);
+            dropped_event_count++;
+        }
+        if (buffer_count == 0) {
+            // The delta was computed against an event that is gone now.
+            width = WIDTH_ABSOLUTE_64;
+            value = timestamp;
+            size = 1 + payload_size(width) + span_size;
+        }
+    }
+
+    uint32_t pos = wrap(buffer_head + buffer_used);
+    buffer_data[pos] = (uint8_t)(span | (width << TAG_WIDTH_SHIFT) | (channel & TAG_CHANNEL_MASK));
+    for (uint32_t i = 0; i < payload_size(width); i++) {
+        pos = wrap(pos + 1);
+        buffer_data[pos] = (uint8_t)(value >> (8 * i));
+    }
+    if (span) {
+        for (uint32_t i = 0; i < span_size - 2; i++) {
+            pos = wrap(pos + 1);
+            buffer_data[pos] = (uint8_t)(duration >> (8 * i));
+        }
+        pos = wrap(pos + 1);
+        buffer_data[pos] = (uint8_t)count;
+        pos = wrap(pos + 1);
+        buffer_data[pos] = (uint8_t)(count >> 8);
+    }
+
+    if (buffer_count == 0) {
+        buffer_base_time = timestamp;
+    }
+    buffer_last_time = timestamp;
+    buffer_used += size;
+    buffer_count++;
+    return true;
+}
+
+bool event_buffer_pop(event_record_t *record)
+{
+    if (buffer_count == 0) {
+        return false;
+    }
+
+    event_record_t oldest;
+    uint32_t size = decode_record(buffer_head, buffer_base_time, &oldest);
+    // The oldest record is always reported with the base time, its own delta is stale.
+    oldest.timestamp = buffer_base_time;
+    if (record) {
+        // Copy field by field, a struct assignment may be compiled into a memcpy call.
+        record->type = oldest.type;
+        record->channel = oldest.channel;
+        record->timestamp = oldest.timestamp;
+        record->duration = oldest.duration;
+        record->count = oldest.count;
+    }
+
+    buffer_head = wrap(buffer_head + size);
+    buffer_used -= size;
+    buffer_count--;
+
+    if (buffer_count == 0) {
+        buffer_head = 0;
+        buffer_used = 0;
+    } else {
+        // The next record becomes the oldest one, rebase on its timestamp.
+        event_record_t next;
+        decode_record(buffer_head, buffer_base_time, &next);
+        buffer_base_time = next.timestamp;
+    }
+    return true;
+}
+
+void event_buffer_discard(uint32_t count)
+{
+    while (count-- > 0 && event_buffer_pop(NULL)) {
+    }
+}
+
+void event_buffer_clear(void)
+{
+    buffer_head = 0;
+    buffer_used = 0;
+    buffer_count = 0;
+}
+
+uint32_t event_buffer_count(void)
+{
+    return buffer_count;
+}
+
+bool event_buffer_is_full(void)
+{
+    return CONFIG_EVENT_BUFFER_SIZE - buffer_used < EVENT_RECORD_MAX_SIZE;
+}
+
+uint32_t event_buffer_fill_percent(void)
+{
+    return buffer_used * 100 / CONFIG_EVENT_BUFFER_SIZE;
+}
+
+uint64_t event_buffer_oldest_timestamp(void)
+{
+    return buffer_count > 0 ? buffer_base_time : 0;
+}
+
+void event_buffer_iter_init(event_buffer_iter_t *iter)
+{
+    iter->pos = buffer_head;
+    iter->remaining = buffer_count;
+    iter->timestamp = buffer_base_time;
+}
+
+bool event_buffer_iter_next(event_buffer_iter_t *iter, event_record_t *record)
+{
+    if (iter->remaining == 0) {
+        return false;
+    }
+
+    bool first = iter->remaining == buffer_count;
+    uint32_t size = decode_record(iter->pos, iter->timestamp, record);
+    if (first) {
+        record->timestamp = buffer_base_time;
+    }
+
+    iter->pos = wrap(iter->pos + size);
+    iter->timestamp = record->timestamp;
+    iter->remaining--;
+    return true;
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Type tag stored with every buffered sensor event.
+ */
+typedef enum {
+    EVENT_TYPE_PIR = 0,             // < Motion detected by the PIR sensor.
+    EVENT_TYPE_MAGNETIC_SWITCH = 1, // < Magnetic switch (door) triggered.
+} event_type_t;
+
+/**
+ * @brief Behavior of the event buffer when a new event does not fit.
+ */
+typedef enum {
+    EVENT_BUFFER_OVERWRITE_OLDEST = 0, // < Discard the oldest events to make room for the new one.
+    EVENT_BUFFER_DROP_NEWEST = 1,      // < Keep the stored events and discard the new one.
+} event_buffer_policy_t;
+
+/**
+ * @brief A decoded event as returned by the event buffer.
+ *
+ * A single trigger has a duration of 0 and a count of 1. An activity span merges
+ * several triggers: it starts at the timestamp and lasts for the duration.
+ */
+typedef struct {
+    event_type_t type;        // < Type of the event, given by the sensor channel.
+    uint8_t channel;          // < Sensor channel that reported the event (see rtc_wake_stub_channels.h).
+    uint64_t timestamp;       // < The actual Unix timestamp in milliseconds (start of the span).
+    uint32_t duration;        // < Time in milliseconds from the first to the last trigger.
+    uint16_t count;           // < Number of triggers merged into this record.
+} event_record_t;
+
+/**
+ * @brief Read cursor over the events stored in the buffer, oldest first.
+ *
+ * Iterating does not remove events; use event_buffer_discard() once the events
+ * have been delivered.
+ */
+typedef struct {
+    uint32_t pos;             // < Byte offset of the next record.
+    uint32_t remaining;       // < Number of records not yet returned.
+    uint64_t timestamp;       // < Timestamp of the previously returned record.
+} event_buffer_iter_t;
+
+// Policy applied when the buffer is full, stored in RTC memory.
+extern RTC_DATA_ATTR uint32_t EVENT_BUFFER_POLICY;
+
+// Number of events lost because the buffer was full.
+extern RTC_DATA_ATTR uint32_t dropped_event_count;
+
+/**
+ * @brief Appends an event to the RTC memory event buffer.
+ *
+ * Events are stored as a one byte tag holding the sensor channel, followed by the time
+ * elapsed since the previous event (16 or 32 bits), or by the full timestamp if the delta
+ * does not fit. Safe to call from the wake-up stub.
+ *
+ * @param channel   Sensor channel that reported the event.
+ * @param timestamp The actual Unix timestamp in milliseconds.
+ * @return true if the event was stored, false if it was dropped.
+ */
+bool event_buffer_push(uint32_t channel, uint64_t timestamp);
+
+/**
+ * @brief Appends an activity span to the RTC memory event buffer.
+ *
+ * A span with a count of 1 and no duration is stored as a plain event.
+ * Safe to call from the wake-up stub.
+ *
+ * @param channel   Sensor channel of the triggers merged into the span.
+ * @param timestamp The actual Unix timestamp of the first trigger in milliseconds.
+ * @param duration  Time from the first to the last trigger in milliseconds.
+ * @param count     Number of triggers in the span.
+ * @return true if the span was stored, false if it was dropped.
+ */
+bool event_buffer_push_span(uint32_t channel, uint64_t timestamp, uint32_t duration, uint16_t count);
+
+/**
+ * @brief Removes the oldest event from the buffer.
+ *
+ * @param[out] record Decoded event, may be NULL.
+ * @return true if an event was removed, false if the buffer is empty.
+ */
+bool event_buffer_pop(event_record_t *record);
+
+/**
+ * @brief Removes up to @p count oldest events from the buffer.
+ *
+ * @param count Number of events to remove.
+ */
+void event_buffer_discard(uint32_t count);
+
+/**
+ * @brief Removes all events from the buffer.
+ */
+void event_buffer_clear(void);
+
+/**
+ * @brief Returns the number of events stored in the buffer.
+ */
+uint32_t event_buffer_count(void);
+
+/**
+ * @brief Returns true if the buffer can not take another event without dropping one.
+ */
+bool event_buffer_is_full(void);
+
+/**
+ * @brief Returns the used part of the buffer in percent.
+ */
+uint32_t event_buffer_fill_percent(void);
+
+/**
+ * @brief Returns the timestamp of the oldest stored event, 0 if the buffer is empty.
+ */
+uint64_t event_buffer_oldest_timestamp(void);
+
+/**
+ * @brief Positions the iterator at the oldest stored event.
+ *
+ * @param[out] iter Iterator to initialize.
+ */
+void event_buffer_iter_init(event_buffer_iter_t *iter);
+
+/**
+ * @brief Returns the next event of the iterator.
+ *
+ * The buffer must not be modified while iterating.
+ *
+ * @param iter        Iterator initialized by event_buffer_iter_init().
+ * @param[out] record Decoded event.
+ * @return true if an event was returned, false if there are no more events.
+ */
+bool event_buffer_iter_next(event_buffer_iter_t *iter, event_record_t *record);
@@ -0,0 +1,56 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_attr.h"
+#include "sdkconfig.h"
+
+#include "main.h"
+#include "rtc_wake_stub_channels.h"
+
+// Number of channels in CONFIG_SENSOR_CHANNELS.
+#define SENSOR_CHANNELS_CONFIGURED (sizeof((sensor_channel_t[])CONFIG_SENSOR_CHANNELS) / sizeof(sensor_channel_t))
+
+_Static_assert(SENSOR_CHANNELS_CONFIGURED <= SENSOR_CHANNELS_MAX, "Too many sensor channels in CONFIG_SENSOR_CHANNELS");
+
+// Sensor channels, stored in RTC memory for the wake-up stub.
+RTC_DATA_ATTR sensor_channel_t sensor_channels[SENSOR_CHANNELS_MAX] = CONFIG_SENSOR_CHANNELS;
+RTC_DATA_ATTR uint32_t sensor_channel_count = SENSOR_CHANNELS_CONFIGURED;
+
+// Channel index + 1 of every RTC IO, 0 if the RTC IO is not used by a channel.
+RTC_DATA_ATTR static uint8_t rtc_io_channel[SENSOR_RTC_IO_COUNT];
+
+void sensor_channels_init(void)
+{
+    for (uint32_t io = 0; io < SENSOR_RTC_IO_COUNT; io++) {
+        rtc_io_channel[io] = 0;
+    }
+    for (uint32_t i = 0; i < sensor_channel_count; i++) {
+        int io = sensor_channels[i].rtc_io_num;
+        if (io >= 0 && io < SENSOR_RTC_IO_COUNT) {
+            rtc_io_channel[io] = (uint8_t)(i + 1);
+        }
+    }
+}
+
+int sensor_channel_from_rtc_io(int rtc_io_num)
+{
+    if (rtc_io_num < 0 || rtc_io_num >= SENSOR_RTC_IO_COUNT) {
+        return -1;
+    }
+    return (int)rtc_io_channel[rtc_io_num] - 1;
+}
+
+int sensor_channel_find(event_type_t type)
+{
+    for (uint32_t i = 0; i < sensor_channel_count; i++) {
+        if (sensor_channels[i].type == type) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+event_type_t sensor_channel_type(uint32_t channel)
+{
+    return channel < sensor_channel_count ? sensor_channels[channel].type : EVENT_TYPE_PIR;
+}
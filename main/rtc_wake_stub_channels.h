@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "rtc_wake_stub_buffer.h"
+
+// Maximum number of sensor channels. The channel index is stored in the 4 bit type field
+// of the event buffer records and as the record type of the ULP edge counter.
+#define SENSOR_CHANNELS_MAX 8
+
+// Number of RTC IOs that can be EXT1 wake-up sources.
+#define SENSOR_RTC_IO_COUNT 18
+
+/**
+ * @brief What the wake-up stub does with a trigger of a sensor channel.
+ */
+typedef enum {
+    SENSOR_FLUSH_BUFFERED = 0,  // < Store the event, the flush policy decides when it is sent (PIR).
+    SENSOR_FLUSH_IMMEDIATE = 1, // < Store the event and boot the main application right away (door contact).
+} sensor_flush_t;
+
+/**
+ * @brief A sensor connected to an RTC capable GPIO.
+ */
+typedef struct {
+    int pin;                  // < GPIO of the sensor, active high.
+    event_type_t type;        // < Type of the events of the sensor.
+    const char *room_id;      // < Room ID reported with the events, NULL for the room of the device.
+    uint32_t debounce_sec;    // < Interval in seconds to re-check the sensor while it stays active.
+    sensor_flush_t flush;     // < Handling of a trigger.
+    int rtc_io_num;           // < RTC IO number of the pin, set by sensor_channels_init().
+} sensor_channel_t;
+
+// Sensor channels (CONFIG_SENSOR_CHANNELS), stored in RTC memory for the wake-up stub.
+extern RTC_DATA_ATTR sensor_channel_t sensor_channels[SENSOR_CHANNELS_MAX];
+
+// Number of used entries of sensor_channels.
+extern RTC_DATA_ATTR uint32_t sensor_channel_count;
+
+/**
+ * @brief Builds the lookup from RTC IO numbers to channels.
+ *
+ * Call after the rtc_io_num of every channel was set.
+ */
+void sensor_channels_init(void);
+
+/**
+ * @brief Returns the channel of an RTC IO in O(1).
+ *
+ * Safe to call from the wake-up stub.
+ *
+ * @param rtc_io_num RTC IO number, e.g. a bit of the EXT1 wake-up status.
+ * @return Channel index, or -1 if no channel uses the RTC IO.
+ */
+int sensor_channel_from_rtc_io(int rtc_io_num);
+
+/**
+ * @brief Returns the first channel of the given type.
+ *
+ * @return Channel index, or -1 if there is no such channel.
+ */
+int sensor_channel_find(event_type_t type);
+
+/**
+ * @brief Returns the type of the events of a channel.
+ *
+ * Safe to call from the wake-up stub.
+ */
+event_type_t sensor_channel_type(uint32_t channel);
@@ -0,0 +1,74 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_attr.h"
+#include "sdkconfig.h"
+
+#include "main.h"
+#include "rtc_wake_stub_clock.h"
+
+// Measurements over a shorter interval are dominated by the SNTP error and are ignored.
+#define MIN_DRIFT_MEASUREMENT_MS (10 * 60 * 1000)
+
+RTC_DATA_ATTR int32_t rtc_drift_ppb = 0;
+RTC_DATA_ATTR uint32_t rtc_drift_uncertainty_ppb = CONFIG_RTC_DRIFT_UNCERTAINTY_PPM * 1000;
+RTC_DATA_ATTR uint32_t time_sync_count = 0;
+RTC_DATA_ATTR uint32_t TIME_SYNC_TOLERANCE_MS = CONFIG_TIME_SYNC_TOLERANCE_MS;
+
+// Note: this file is placed in RTC memory by the linker (rtc_wake_stub* pattern) so that
+// the wake-up stub can convert RTC time to the actual time.
+
+uint64_t clock_model_actual_time_ms(uint64_t rtc_time_ms)
+{
+    int64_t elapsed = (int64_t)(rtc_time_ms - rtc_time_at_last_sync);
+    int64_t correction = elapsed * rtc_drift_ppb / 1000000000;
+    return actual_time_at_last_sync + elapsed + correction;
+}
+
+uint32_t clock_model_error_ms(uint64_t rtc_time_ms)
+{
+    if (time_sync_count == 0) {
+        return UINT32_MAX;
+    }
+    uint64_t elapsed = rtc_time_ms - rtc_time_at_last_sync;
+    uint64_t error = CONFIG_TIME_SYNC_ERROR_MS + elapsed * rtc_drift_uncertainty_ppb / 1000000000;
+    return error > UINT32_MAX ? UINT32_MAX : (uint32_t)error;
+}
+
+bool clock_model_needs_sync(uint64_t rtc_time_ms)
+{
+    if (time_sync_count == 0) {
+        return true;
+    }
+    if (rtc_time_ms - rtc_time_at_last_sync >= (uint64_t)CONFIG_TIME_SYNC_MAX_INTERVAL_SEC * 1000) {
+        return true;
+    }
+    return clock_model_error_ms(rtc_time_ms) > TIME_SYNC_TOLERANCE_MS;
+}
+
+void clock_model_sync(uint64_t rtc_time_ms, uint64_t actual_time_ms)
+{
+    int64_t elapsed = (int64_t)(rtc_time_ms - rtc_time_at_last_sync);
+    if (time_sync_count > 0 && elapsed >= MIN_DRIFT_MEASUREMENT_MS) {
+        // Drift of the uncorrected RTC time over the interval since the last synchronization.
+        int64_t offset = (int64_t)(actual_time_ms - actual_time_at_last_sync) - elapsed;
+        int32_t measured_ppb = (int32_t)(offset * 1000000000 / elapsed);
+        int32_t residual = measured_ppb - rtc_drift_ppb;
+        uint32_t abs_residual = residual < 0 ? -residual : residual;
+
+        if (time_sync_count == 1) {
+            // First measurement, no estimate to smooth yet. Its uncertainty is the SNTP error of both ends.
+            rtc_drift_ppb = measured_ppb;
+            rtc_drift_uncertainty_ppb = (uint32_t)(2LL * CONFIG_TIME_SYNC_ERROR_MS * 1000000000 / elapsed);
+        } else {
+            rtc_drift_ppb += residual / 4;
+            rtc_drift_uncertainty_ppb = (rtc_drift_uncertainty_ppb * 3 + abs_residual) / 4;
+        }
+        if (rtc_drift_uncertainty_ppb < CONFIG_RTC_DRIFT_MIN_UNCERTAINTY_PPM * 1000) {
+            rtc_drift_uncertainty_ppb = CONFIG_RTC_DRIFT_MIN_UNCERTAINTY_PPM * 1000;
+        }
+    }
+
+    rtc_time_at_last_sync = rtc_time_ms;
+    actual_time_at_last_sync = actual_time_ms;
+    time_sync_count++;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Estimated drift of the RTC slow clock in parts per billion (positive: the RTC runs slow).
+extern RTC_DATA_ATTR int32_t rtc_drift_ppb;
+
+// Uncertainty of the drift estimate in parts per billion.
+extern RTC_DATA_ATTR uint32_t rtc_drift_uncertainty_ppb;
+
+// Number of SNTP synchronizations the drift model has seen since power-on.
+extern RTC_DATA_ATTR uint32_t time_sync_count;
+
+// The estimated error (in milliseconds) above which the time is synchronized with SNTP again.
+extern RTC_DATA_ATTR uint32_t TIME_SYNC_TOLERANCE_MS;
+
+/**
+ * @brief Converts an RTC time into the actual Unix time using the drift model.
+ *
+ * Starts from the last SNTP synchronization and corrects the elapsed RTC time by the
+ * estimated drift. Safe to call from the wake-up stub.
+ *
+ * @param rtc_time_ms RTC time in milliseconds.
+ * @return The actual Unix timestamp in milliseconds.
+ */
+uint64_t clock_model_actual_time_ms(uint64_t rtc_time_ms);
+
+/**
+ * @brief Returns the error bound of clock_model_actual_time_ms() at the given RTC time.
+ *
+ * The bound is the SNTP error at the last synchronization plus the elapsed time multiplied
+ * by the drift uncertainty.
+ *
+ * @param rtc_time_ms RTC time in milliseconds.
+ * @return Estimated maximum error in milliseconds, UINT32_MAX if the time was never synchronized.
+ */
+uint32_t clock_model_error_ms(uint64_t rtc_time_ms);
+
+/**
+ * @brief Returns true if the time should be synchronized with SNTP.
+ *
+ * That is the case before the first synchronization, when the error bound exceeds
+ * TIME_SYNC_TOLERANCE_MS or when CONFIG_TIME_SYNC_MAX_INTERVAL_SEC elapsed.
+ *
+ * @param rtc_time_ms RTC time in milliseconds.
+ */
+bool clock_model_needs_sync(uint64_t rtc_time_ms);
+
+/**
+ * @brief Records an SNTP synchronization and updates the drift estimate.
+ *
+ * Updates `rtc_time_at_last_sync` and `actual_time_at_last_sync`.
+ *
+ * @param rtc_time_ms    RTC time in milliseconds at the synchronization.
+ * @param actual_time_ms The synchronized Unix time in milliseconds.
+ */
+void clock_model_sync(uint64_t rtc_time_ms, uint64_t actual_time_ms);
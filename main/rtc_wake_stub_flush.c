@@ -0,0 +1,60 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_attr.h"
+#include "sdkconfig.h"
+
+#include "main.h"
+#include "rtc_wake_stub_flush.h"
+
+// Flush policy configuration, stored in RTC memory so the wake-up stub can use it.
+RTC_DATA_ATTR uint32_t FLUSH_MAX_EVENT_AGE_SEC = CONFIG_FLUSH_MAX_EVENT_AGE_SEC;
+RTC_DATA_ATTR uint32_t FLUSH_FILL_PERCENT = CONFIG_FLUSH_FILL_PERCENT;
+RTC_DATA_ATTR uint32_t FLUSH_LOW_SOC_PERCENT = CONFIG_FLUSH_LOW_SOC_PERCENT;
+
+// Retry state of the delivery, set by the main application.
+RTC_DATA_ATTR uint64_t flush_retry_at_ms = 0;
+RTC_DATA_ATTR bool flush_backlog_pending = false;
+
+uint32_t flush_policy_max_event_age_sec(uint32_t battery_soc)
+{
+    if (battery_soc < FLUSH_LOW_SOC_PERCENT) {
+        return FLUSH_MAX_EVENT_AGE_SEC * 4;
+    }
+    if (battery_soc < FLUSH_LOW_SOC_PERCENT * 2) {
+        return FLUSH_MAX_EVENT_AGE_SEC * 2;
+    }
+    return FLUSH_MAX_EVENT_AGE_SEC;
+}
+
+bool flush_policy_should_flush(const flush_input_t *input)
+{
+    if (input->event_count >= MAX_PIR_EVENTS || input->fill_percent >= FLUSH_FILL_PERCENT) {
+        return true;
+    }
+    return flush_policy_time_to_flush_sec(input) == 0;
+}
+
+uint32_t flush_policy_time_to_flush_sec(const flush_input_t *input)
+{
+    uint64_t deadline = UINT64_MAX;
+    if (input->has_pending) {
+        deadline = input->oldest_timestamp + (uint64_t)flush_policy_max_event_age_sec(input->battery_soc) * 1000;
+    }
+    if (input->retry_at != 0) {
+        // Do not retry a failed delivery before the retry time, resume the journal backlog then
+        if (input->backlog_pending) {
+            deadline = input->retry_at;
+        } else if (deadline != UINT64_MAX && deadline < input->retry_at) {
+            deadline = input->retry_at;
+        }
+    }
+
+    if (deadline == UINT64_MAX) {
+        return UINT32_MAX;
+    }
+    if (input->now >= deadline) {
+        return 0;
+    }
+    // Round up so the check does not fire a moment before the deadline.
+    return (uint32_t)((deadline - input->now + 999) / 1000);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief State of the pending events the flush policy decides on.
+ */
+typedef struct {
+    uint64_t now;              // < The actual Unix time in milliseconds.
+    uint32_t event_count;      // < Number of events stored in the event buffer.
+    uint32_t fill_percent;     // < Used part of the event buffer in percent.
+    bool has_pending;          // < True if there is any event not yet sent (buffered or in an open span).
+    uint64_t oldest_timestamp; // < Timestamp of the oldest pending event in milliseconds.
+    uint32_t battery_soc;      // < Battery state of charge in percent, as last read from the gauge.
+    uint64_t retry_at;         // < Earliest time of the next delivery attempt in milliseconds, 0 if none is scheduled.
+    bool backlog_pending;      // < True if the flash journal holds events not yet delivered.
+} flush_input_t;
+
+// Maximum age (in seconds) of a pending event at full battery.
+extern RTC_DATA_ATTR uint32_t FLUSH_MAX_EVENT_AGE_SEC;
+
+// Fill ratio (in percent) of the event buffer that triggers a flush.
+extern RTC_DATA_ATTR uint32_t FLUSH_FILL_PERCENT;
+
+// Battery state of charge (in percent) below which flushes are postponed.
+extern RTC_DATA_ATTR uint32_t FLUSH_LOW_SOC_PERCENT;
+
+// Earliest time (Unix time in milliseconds) of the next delivery attempt after a failed or
+// unfinished drain, 0 if none is scheduled. Set by the main application (see backlog_drain.h).
+extern RTC_DATA_ATTR uint64_t flush_retry_at_ms;
+
+// True while the flash journal holds events not yet delivered.
+extern RTC_DATA_ATTR bool flush_backlog_pending;
+
+/**
+ * @brief Returns the maximum age of a pending event for the given battery charge.
+ *
+ * Below FLUSH_LOW_SOC_PERCENT * 2 the age is doubled, below FLUSH_LOW_SOC_PERCENT it is
+ * quadrupled, so a node running out of battery boots the main application less often.
+ *
+ * @param battery_soc Battery state of charge in percent.
+ * @return Maximum event age in seconds.
+ */
+uint32_t flush_policy_max_event_age_sec(uint32_t battery_soc);
+
+/**
+ * @brief Decides whether the main application should be booted to flush the events.
+ *
+ * The events are flushed when the count reaches MAX_PIR_EVENTS, when the buffer is filled
+ * to FLUSH_FILL_PERCENT (regardless of the battery, to avoid losing events) or when the
+ * oldest pending event is older than flush_policy_max_event_age_sec(). After a failed or
+ * unfinished delivery, the age based flush waits for the retry time, and a backlog left in
+ * the flash journal is resumed at the retry time.
+ * Safe to call from the wake-up stub.
+ *
+ * @param input State of the pending events.
+ * @return true if the main application should be booted.
+ */
+bool flush_policy_should_flush(const flush_input_t *input);
+
+/**
+ * @brief Returns the time until the oldest pending event reaches its maximum age, or until
+ * the retry time of a failed or unfinished delivery.
+ *
+ * Safe to call from the wake-up stub.
+ *
+ * @param input State of the pending events.
+ * @return Time in seconds, UINT32_MAX if there is nothing to deliver.
+ */
+uint32_t flush_policy_time_to_flush_sec(const flush_input_t *input);
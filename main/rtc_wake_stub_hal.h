@@ -0,0 +1,162 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+
+// Hardware access used by the wake-up stub logic (rtc_wake_stub.c).
+//
+// On the ESP32 every function is a thin inline wrapper around the RTC registers and the
+// esp_wake_stub API, so it ends up in RTC fast memory together with the stub. Building
+// for the ESP-IDF linux target turns them into plain functions, implemented by the
+// emulation of the RTC slow memory, the EXT1 wake-up registers and the sleep timer in
+// host_test/components/wake_stub_emu. This lets the stub logic run off-target, driven by
+// a scripted sensor trace.
+
+// Raw wake-up causes as reported by the RTC controller.
+#define WAKE_STUB_CAUSE_EXT1   2   // < Sensor pin (EXT1).
+#define WAKE_STUB_CAUSE_TIMER  8   // < RTC timer.
+#define WAKE_STUB_CAUSE_ULP    0x200 // < ULP program (see rtc_wake_stub_ulp.h).
+
+#if CONFIG_IDF_TARGET_LINUX
+
+// The log of the stub goes to the emulation, which only prints it when asked to.
+#undef ESP_RTC_LOGI
+#define ESP_RTC_LOGI(format, ...) wake_stub_hal_log(format "\n", ##__VA_ARGS__)
+
+void wake_stub_hal_log(const char *format, ...);
+uint32_t wake_stub_hal_get_wakeup_cause(void);
+uint32_t wake_stub_hal_get_ext1_status(void);
+bool wake_stub_hal_get_rtcio_level(int rtc_io_num);
+bool wake_stub_hal_ext1_enabled(int rtc_io_num);
+void wake_stub_hal_ext1_enable(int rtc_io_num, bool enable);
+void wake_stub_hal_set_wakeup_time_us(uint64_t time_us);
+void wake_stub_hal_sleep(void (*stub)(void));
+void wake_stub_hal_boot_app(void);
+void wake_stub_hal_feed_watchdog(void);
+uint32_t wake_stub_hal_get_cycle_time_us(void);
+uint64_t wake_stub_hal_rtc_ticks_to_us(uint64_t ticks);
+uint64_t wake_stub_hal_get_rtc_time_us(void);
+
+#else
+
+#include "esp_sleep.h"
+#include "esp_cpu.h"
+#include "esp_rom_sys.h"
+#include "esp_wake_stub.h"
+#include "hal/rtc_io_ll.h"
+#include "rom/rtc.h"
+#include "soc/rtc.h"
+#include "soc/rtc_periph.h"
+#include "soc/timer_group_reg.h"
+
+/**
+ * @brief Returns the raw wake-up cause (WAKE_STUB_CAUSE_*).
+ */
+static inline uint32_t wake_stub_hal_get_wakeup_cause(void)
+{
+    return esp_wake_stub_get_wakeup_cause();
+}
+
+/**
+ * @brief Returns the bitmask of the RTC IOs that caused the EXT1 wake-up.
+ */
+static inline uint32_t wake_stub_hal_get_ext1_status(void)
+{
+    return REG_READ(RTC_CNTL_EXT_WAKEUP1_STATUS_REG);
+}
+
+/**
+ * @brief Returns the level of an RTC IO.
+ */
+static inline bool wake_stub_hal_get_rtcio_level(int rtc_io_num)
+{
+    return rtcio_ll_get_level(rtc_io_num);
+}
+
+/**
+ * @brief Returns true if the RTC IO is selected as an EXT1 wake-up source.
+ */
+static inline bool wake_stub_hal_ext1_enabled(int rtc_io_num)
+{
+    return (REG_READ(RTC_CNTL_EXT_WAKEUP1_REG) & (1 << rtc_io_num)) != 0;
+}
+
+/**
+ * @brief Adds or removes the RTC IO from the EXT1 wake-up sources.
+ */
+static inline void wake_stub_hal_ext1_enable(int rtc_io_num, bool enable)
+{
+    if (enable) {
+        REG_SET_BIT(RTC_CNTL_EXT_WAKEUP1_REG, 1 << rtc_io_num);
+    } else {
+        REG_CLR_BIT(RTC_CNTL_EXT_WAKEUP1_REG, 1 << rtc_io_num);
+    }
+}
+
+/**
+ * @brief Arms the RTC timer wake-up for the next deep sleep.
+ */
+static inline void wake_stub_hal_set_wakeup_time_us(uint64_t time_us)
+{
+    esp_wake_stub_set_wakeup_time(time_us);
+}
+
+/**
+ * @brief Enters deep sleep again, the stub runs on the next wake-up. Does not return.
+ */
+static inline void wake_stub_hal_sleep(void (*stub)(void))
+{
+    esp_wake_stub_sleep(stub);
+}
+
+/**
+ * @brief Continues with the default wake-up, booting the main application once the stub returns.
+ */
+static inline void wake_stub_hal_boot_app(void)
+{
+    esp_default_wake_deep_sleep();
+}
+
+/**
+ * @brief Feeds the watchdog to prevent a reset while the stub runs.
+ */
+static inline void wake_stub_hal_feed_watchdog(void)
+{
+    REG_WRITE(TIMG_WDTFEED_REG(0), 1);
+}
+
+/**
+ * @brief Returns the time from the CPU start to now in microseconds.
+ */
+static inline uint32_t wake_stub_hal_get_cycle_time_us(void)
+{
+    return esp_cpu_get_cycle_count() / esp_rom_get_cpu_ticks_per_us();
+}
+
+/**
+ * @brief Converts RTC slow clock cycles to microseconds, using the last slow clock calibration.
+ */
+static inline uint64_t wake_stub_hal_rtc_ticks_to_us(uint64_t ticks)
+{
+    uint32_t period = REG_READ(RTC_SLOW_CLK_CAL_REG);
+    return (ticks * period) >> RTC_CLK_CAL_FRACT;
+}
+
+/**
+ * @brief Reads the RTC time registers and returns the RTC time in microseconds.
+ */
+static inline uint64_t wake_stub_hal_get_rtc_time_us(void)
+{
+    SET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_UPDATE);
+    while (GET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_VALID) == 0) {
+        ets_delay_us(1); // Wait for RTC time to be valid.
+    }
+    SET_PERI_REG_MASK(RTC_CNTL_INT_CLR_REG, RTC_CNTL_TIME_VALID_INT_CLR);
+    uint64_t t = READ_PERI_REG(RTC_CNTL_TIME0_REG);
+    t |= ((uint64_t)READ_PERI_REG(RTC_CNTL_TIME1_REG)) << 32;
+
+    return wake_stub_hal_rtc_ticks_to_us(t);
+}
+
+#endif
@@ -0,0 +1,22 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_attr.h"
+
+#include "rtc_wake_stub_stats.h"
+
+// Wake cost statistics, kept across deep sleep.
+RTC_DATA_ATTR wake_stats_t wake_stats;
+
+// Time (in microseconds) the wake-up stub ran before booting the current application.
+RTC_DATA_ATTR uint32_t wake_stats_boot_stub_us = 0;
+
+void wake_stats_record_stub_wake(uint32_t stub_us)
+{
+    wake_stats.stub_wakes++;
+    wake_stats.stub_us += stub_us;
+}
+
+void wake_stats_record_stub_boot(uint32_t stub_us)
+{
+    wake_stats_boot_stub_us = stub_us;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Number of buckets of the awake time histogram. Bucket i counts the boots of the main
+// application that stayed awake for less than 250 ms * 2^i, the last one all longer boots.
+#define WAKE_STATS_BUCKETS 8
+
+/**
+ * @brief Phases of a boot of the main application, as measured by run_boot_pipeline().
+ */
+typedef enum {
+    WAKE_PHASE_STUB = 0,    // < Wake-up stub before booting the application.
+    WAKE_PHASE_WIFI,        // < Wi-Fi association and IP address.
+    WAKE_PHASE_CLOCK,       // < SNTP synchronization (or restoring the time from the RTC).
+    WAKE_PHASE_MQTT,        // < MQTT connection.
+    WAKE_PHASE_GAUGE,       // < Fuel gauge read, in parallel to the network phases.
+    WAKE_PHASE_AWAKE,       // < Whole application, from the start until deep sleep.
+    WAKE_PHASE_COUNT,
+} wake_phase_t;
+
+/**
+ * @brief Wake cost statistics collected in RTC memory since the last report.
+ */
+typedef struct {
+    uint32_t stub_wakes;                        // < Wakes handled by the wake-up stub alone.
+    uint32_t app_boots;                         // < Wakes that booted the main application.
+    uint64_t stub_us;                           // < Time spent in the wake-up stub on stub-only wakes.
+    uint64_t phase_us[WAKE_PHASE_COUNT];        // < Time spent in every boot phase, summed over all boots.
+    uint16_t awake_histogram[WAKE_STATS_BUCKETS]; // < Awake time of the application boots.
+    uint64_t light_sleep_us;                    // < Time spent in automatic light sleep by the event loop.
+    uint32_t published_events;                  // < Sensor events acknowledged by the broker.
+    uint64_t publish_latency_ms;                // < Time from the trigger to the acknowledgment, summed over the published events.
+    uint32_t max_publish_latency_ms;            // < Longest time from a trigger to its acknowledgment.
+    uint32_t connect_acks;                      // < Boots that got a PUBACK.
+    uint64_t connect_ack_ms;                    // < Time from the MQTT connect to the first PUBACK, summed over these boots.
+    uint32_t max_connect_ack_ms;                // < Longest time from the MQTT connect to the first PUBACK.
+    uint64_t period_start_ms;                   // < RTC time (in milliseconds) when the statistics were reset.
+} wake_stats_t;
+
+// Wake cost statistics, kept across deep sleep.
+extern RTC_DATA_ATTR wake_stats_t wake_stats;
+
+// Time (in microseconds) the wake-up stub ran before booting the current application.
+extern RTC_DATA_ATTR uint32_t wake_stats_boot_stub_us;
+
+/**
+ * @brief Records a wake handled by the stub alone. Safe to call from the wake-up stub.
+ *
+ * @param stub_us Time from the CPU start until the stub goes back to sleep, in microseconds.
+ */
+void wake_stats_record_stub_wake(uint32_t stub_us);
+
+/**
+ * @brief Records the stub time of a wake that boots the application. Safe to call from the wake-up stub.
+ *
+ * @param stub_us Time from the CPU start until the stub returns, in microseconds.
+ */
+void wake_stats_record_stub_boot(uint32_t stub_us);
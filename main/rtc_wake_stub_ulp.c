@@ -0,0 +1,83 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_attr.h"
+#include "esp_log.h"
+
+#include "rtc_wake_stub_hal.h"
+#include "rtc_wake_stub_ulp.h"
+#include "main.h"
+#include "rtc_wake_stub.h"
+#include "rtc_wake_stub_channels.h"
+#include "rtc_wake_stub_clock.h"
+#include "ulp_sensor_edges.h"
+
+// Variables of the ULP program are 16 bit values in the lower half of a 32 bit word.
+#define ULP_WORD(var) ((var) & 0xFFFF)
+
+// Value of the drop counter of the ULP program at the last ulp_edges_take_dropped().
+RTC_DATA_ATTR static uint32_t ulp_dropped_seen = 0;
+
+bool ulp_edges_pop(ulp_edge_t *edge)
+{
+    uint32_t tail = ULP_WORD(ulp_edge_tail);
+    if (tail == ULP_WORD(ulp_edge_head)) {
+        return false;
+    }
+
+    uint64_t ticks = ULP_WORD((&ulp_edge_time_lo)[tail]);
+    ticks |= (uint64_t)ULP_WORD((&ulp_edge_time_mid)[tail]) << 16;
+    ticks |= (uint64_t)ULP_WORD((&ulp_edge_time_hi)[tail]) << 32;
+    edge->channel = ULP_WORD((&ulp_edge_channel)[tail]);
+    edge->rtc_time_us = wake_stub_hal_rtc_ticks_to_us(ticks);
+
+    // Hand the slot back to the ULP program only after it was read
+    ulp_edge_tail = (tail + 1) % ULP_EDGE_SLOTS;
+    return true;
+}
+
+void ulp_edges_clear_wake_pending(void)
+{
+    ulp_wake_pending = 0;
+}
+
+uint32_t ulp_edges_take_dropped(void)
+{
+    // The counter is only written by the ULP program, resetting it here could lose an increment
+    uint32_t counter = ULP_WORD(ulp_edge_dropped);
+    uint32_t dropped = (counter - ulp_dropped_seen) & 0xFFFF;
+    ulp_dropped_seen = counter;
+    return dropped;
+}
+
+void ulp_edges_arm_wakeup(uint32_t event_count)
+{
+    uint32_t threshold = MAX_PIR_EVENTS > event_count ? MAX_PIR_EVENTS - event_count : 1;
+    if (threshold > ULP_EDGE_SLOTS - 1) {
+        threshold = ULP_EDGE_SLOTS - 1;
+    }
+    ulp_wake_threshold = threshold;
+}
+
+bool store_ulp_edges(void)
+{
+    // Clear the flag first, an edge recorded while reading the ring wakes the chip again
+    ulp_edges_clear_wake_pending();
+
+    bool boot_now = false;
+    ulp_edge_t edge;
+    while (ulp_edges_pop(&edge)) {
+        if (edge.channel >= sensor_channel_count) {
+            continue;
+        }
+        store_sensor_event(edge.channel, clock_model_actual_time_ms(edge.rtc_time_us / 1000));
+        if (sensor_channels[edge.channel].flush == SENSOR_FLUSH_IMMEDIATE) {
+            boot_now = true;
+        }
+    }
+
+    uint32_t dropped = ulp_edges_take_dropped();
+    if (dropped > 0) {
+        ESP_RTC_LOGI("wake stub: ULP edge ring was full, %d edges lost", dropped);
+    }
+    return boot_now;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Number of records in the edge ring of the ULP program, must match EDGE_SLOTS in
+// ulp/sensor_edges.S. One slot stays empty to tell a full ring from an empty one.
+#define ULP_EDGE_SLOTS 32
+
+/**
+ * @brief Sensor edge counted by the ULP program during deep sleep.
+ */
+typedef struct {
+    uint32_t channel;       // < Sensor channel of the edge (see rtc_wake_stub_channels.h).
+    uint64_t rtc_time_us;   // < RTC time of the edge in microseconds.
+} ulp_edge_t;
+
+/**
+ * @brief Takes the oldest unread edge from the ring of the ULP program.
+ *
+ * Safe to call from the wake-up stub.
+ *
+ * @param[out] edge The edge.
+ * @return false if there is no unread edge.
+ */
+bool ulp_edges_pop(ulp_edge_t *edge);
+
+/**
+ * @brief Clears the flag the ULP program sets on an edge of a SENSOR_FLUSH_IMMEDIATE channel.
+ *
+ * Call before reading the ring, so an edge recorded meanwhile wakes the chip again.
+ */
+void ulp_edges_clear_wake_pending(void);
+
+/**
+ * @brief Returns the number of edges lost since the last call because the ring was full.
+ */
+uint32_t ulp_edges_take_dropped(void);
+
+/**
+ * @brief Sets the number of unread edges that wakes the chip from deep sleep.
+ *
+ * The threshold is the number of events left until MAX_PIR_EVENTS is reached, limited by
+ * the size of the ring. The age and fill based flushes are left to the timer wake-up.
+ *
+ * @param event_count Number of events stored in the event buffer.
+ */
+void ulp_edges_arm_wakeup(uint32_t event_count);
+
+/**
+ * @brief Moves the edges counted by the ULP program into the RTC event buffer.
+ *
+ * The edges are time-stamped with the RTC time at which the ULP program saw them. Called by
+ * the wake-up stub and by the main application before flushing the buffer.
+ *
+ * @return true if a channel with SENSOR_FLUSH_IMMEDIATE was triggered.
+ */
+bool store_ulp_edges(void);
@@ -1,3 +1,5 @@
+#include <inttypes.h>
+#include <sys/time.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_system.h"
@@ -7,6 +9,9 @@
 
 #include "main.h"
 #include "sntp.h"
+#include "rtc_wake_stub_clock.h"
+
+static void log_current_time(void);
 
 
 
@@ -19,7 +24,12 @@ void time_sync_notification_cb(struct timeval *tv)
 
 void start_clock(void)
 {
-    	char strftime_buf[64];
+    begin_clock();
+    wait_for_clock();
+}
+
+void begin_clock(void)
+{
     sntp_setoperatingmode(SNTP_OPMODE_POLL);
     //sntp_setservername(0, "pool.ntp.org");
     sntp_setservername(0, SNTP_SERVER_NAME);
@@ -28,22 +38,51 @@ void start_clock(void)
     sntp_set_sync_mode(SNTP_SYNC_MODE_SMOOTH);
 #endif
     sntp_init();
+}
 
-        // wait for time to be set
-    time_t now = 0;
-    struct tm timeinfo = { 0 };
+bool wait_for_clock(void)
+{
+    // wait for time to be set
     int retry = 0;
     const int retry_count = 20;
-    while (sntp_get_sync_status() == SNTP_SYNC_STATUS_RESET && ++retry < retry_count) {
+    // Reading a completed status resets it, so keep the result of the last read
+    sntp_sync_status_t status;
+    while ((status = sntp_get_sync_status()) == SNTP_SYNC_STATUS_RESET && ++retry < retry_count) {
         ESP_LOGI("sntp", "Waiting for system time to be set... (%d/%d)", retry, retry_count);
         vTaskDelay(2000 / portTICK_PERIOD_MS);
     }
+    bool synced = status != SNTP_SYNC_STATUS_RESET;
+
+    log_current_time();
+    return synced;
+}
+
+void restore_clock_from_rtc(void)
+{
+    uint64_t rtc_time_ms = get_time_since_boot_in_ms();
+    uint64_t actual_time_ms = clock_model_actual_time_ms(rtc_time_ms);
+
+    struct timeval tv = {
+        .tv_sec = actual_time_ms / 1000,
+        .tv_usec = (actual_time_ms % 1000) * 1000,
+    };
+    settimeofday(&tv, NULL);
+    ESP_LOGI("sntp", "Skipping SNTP, time restored from RTC (drift %" PRId32 " ppb, error bound %" PRIu32 " ms)",
+             rtc_drift_ppb, clock_model_error_ms(rtc_time_ms));
+
+    log_current_time();
+}
+
+static void log_current_time(void)
+{
+    char strftime_buf[64];
+    time_t now = 0;
+    struct tm timeinfo = { 0 };
     time(&now);
-	
-	setenv("TZ", "CET-1CEST,M3.5.0/2,M10.5.0/3", 1);
+
+    setenv("TZ", "CET-1CEST,M3.5.0/2,M10.5.0/3", 1);
     tzset();
     localtime_r(&now, &timeinfo);
     strftime(strftime_buf, sizeof(strftime_buf), "%c", &timeinfo);
     ESP_LOGI("progress", "The current date/time in Germany is: %s", strftime_buf);
-
 }
@@ -4,4 +4,26 @@
 #include "esp_event.h"
 
 
-void start_clock(void);
\ No newline at end of file
+/**
+ * @brief Synchronizes the system time with SNTP, blocking until it is set.
+ *
+ * Same as begin_clock() followed by wait_for_clock().
+ */
+void start_clock(void);
+
+/**
+ * @brief Starts the SNTP client without waiting for the time to be set.
+ */
+void begin_clock(void);
+
+/**
+ * @brief Waits (up to 20 x 2 s) until the SNTP client started by begin_clock() has set the time.
+ *
+ * @return true if the time was synchronized.
+ */
+bool wait_for_clock(void);
+
+/**
+ * @brief Sets the system time from the RTC drift model instead of running SNTP.
+ */
+void restore_clock_from_rtc(void);
\ No newline at end of file
@@ -0,0 +1,52 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_sleep.h"
+#include "driver/rtc_io.h"
+#include "ulp.h"
+
+#include "main.h"
+#include "rtc_wake_stub_channels.h"
+#include "ulp_edges.h"
+#include "ulp_sensor_edges.h"
+
+extern const uint8_t ulp_sensor_edges_bin_start[] asm("_binary_ulp_sensor_edges_bin_start");
+extern const uint8_t ulp_sensor_edges_bin_end[]   asm("_binary_ulp_sensor_edges_bin_end");
+
+// Set once the ULP program runs, RTC data is reset together with the ULP on every reset.
+RTC_DATA_ATTR static bool ulp_running = false;
+
+void ulp_edges_start(void)
+{
+    if (ulp_running) {
+        return;
+    }
+
+    ESP_ERROR_CHECK(ulp_load_binary(0, ulp_sensor_edges_bin_start,
+                                    (ulp_sensor_edges_bin_end - ulp_sensor_edges_bin_start) / sizeof(uint32_t)));
+
+    // Start from the current levels, so a sensor that is already active is not counted
+    for (uint32_t i = 0; i < sensor_channel_count; i++) {
+        (&ulp_channel_io)[i] = sensor_channels[i].rtc_io_num;
+        (&ulp_channel_wake)[i] = sensor_channels[i].flush == SENSOR_FLUSH_IMMEDIATE;
+        (&ulp_channel_level)[i] = rtc_gpio_get_level(sensor_channels[i].pin);
+    }
+    ulp_channel_count = sensor_channel_count;
+    ulp_edges_arm_wakeup(0);
+
+    ESP_ERROR_CHECK(ulp_set_wakeup_period(0, CONFIG_ULP_EDGE_SAMPLE_PERIOD_MS * 1000));
+    ESP_ERROR_CHECK(ulp_run(&ulp_entry - RTC_SLOW_MEM));
+    ulp_running = true;
+    ESP_LOGI("progress", "ULP edge counter started, sampling every %d ms", CONFIG_ULP_EDGE_SAMPLE_PERIOD_MS);
+}
+
+void ulp_edges_prepare_sleep(uint32_t event_count)
+{
+    ulp_edges_arm_wakeup(event_count);
+
+    // The ULP program reads the RTC IOs while the chip sleeps
+    ESP_ERROR_CHECK(esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_ON));
+    ESP_ERROR_CHECK(esp_sleep_enable_ulp_wakeup());
+}
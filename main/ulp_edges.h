@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "rtc_wake_stub_ulp.h"
+
+/**
+ * @brief Loads and starts the ULP edge counter, unless it is already running.
+ *
+ * The program keeps running across deep sleep, so it is only loaded after a reset.
+ * Call after configure_rtc_gpio(), the sensor pins have to be RTC inputs.
+ */
+void ulp_edges_start(void);
+
+/**
+ * @brief Lets the ULP edge counter wake the chip from the next deep sleep.
+ *
+ * @param event_count Number of events stored in the event buffer.
+ */
+void ulp_edges_prepare_sleep(uint32_t event_count);
@@ -0,0 +1,72 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+#include "esp_attr.h"
+
+#include "main.h"
+#include "wake_stats.h"
+
+// Interval to send the wake cost statistics, stored in RTC memory.
+RTC_DATA_ATTR uint32_t WAKE_STATS_INTERVAL_SEC = CONFIG_WAKE_STATS_INTERVAL_SEC;
+
+void wake_stats_record_boot(const boot_report_t *report, int64_t awake_us)
+{
+    wake_stats.app_boots++;
+    wake_stats.phase_us[WAKE_PHASE_STUB] += wake_stats_boot_stub_us;
+    wake_stats.phase_us[WAKE_PHASE_WIFI] += report->wifi_us;
+    wake_stats.phase_us[WAKE_PHASE_CLOCK] += report->clock_us;
+    wake_stats.phase_us[WAKE_PHASE_MQTT] += report->mqtt_us;
+    wake_stats.phase_us[WAKE_PHASE_GAUGE] += report->gauge_us;
+    wake_stats.phase_us[WAKE_PHASE_AWAKE] += awake_us;
+    wake_stats_boot_stub_us = 0;
+
+    // Bucket i holds the boots shorter than 250 ms * 2^i
+    uint32_t bucket = 0;
+    int64_t bound_us = 250000;
+    while (bucket < WAKE_STATS_BUCKETS - 1 && awake_us >= bound_us) {
+        bucket++;
+        bound_us *= 2;
+    }
+    if (wake_stats.awake_histogram[bucket] < UINT16_MAX) {
+        wake_stats.awake_histogram[bucket]++;
+    }
+
+    ESP_LOGI("progress", "Wake stats: %" PRIu32 " stub-only wakes, %" PRIu32 " boots, awake %lld ms",
+             wake_stats.stub_wakes, wake_stats.app_boots, awake_us / 1000);
+}
+
+void wake_stats_record_publish(uint32_t count, uint64_t latency_ms, uint32_t max_latency_ms)
+{
+    wake_stats.published_events += count;
+    wake_stats.publish_latency_ms += latency_ms;
+    if (max_latency_ms > wake_stats.max_publish_latency_ms) {
+        wake_stats.max_publish_latency_ms = max_latency_ms;
+    }
+}
+
+void wake_stats_record_connect_ack(uint32_t latency_ms)
+{
+    wake_stats.connect_acks++;
+    wake_stats.connect_ack_ms += latency_ms;
+    if (latency_ms > wake_stats.max_connect_ack_ms) {
+        wake_stats.max_connect_ack_ms = latency_ms;
+    }
+}
+
+bool wake_stats_due(void)
+{
+    if (WAKE_STATS_INTERVAL_SEC == 0) {
+        return false;
+    }
+    uint64_t now_ms = get_time_since_boot_in_ms();
+    return now_ms - wake_stats.period_start_ms >= (uint64_t)WAKE_STATS_INTERVAL_SEC * 1000;
+}
+
+void wake_stats_reset(void)
+{
+    memset(&wake_stats, 0, sizeof(wake_stats));
+    wake_stats.period_start_ms = get_time_since_boot_in_ms();
+}
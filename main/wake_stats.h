@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "rtc_wake_stub_stats.h"
+#include "boot.h"
+
+/**
+ * @brief Adds the phase timings of the current boot to the wake cost statistics.
+ *
+ * Call right before entering deep sleep.
+ *
+ * @param report   Timing of the boot pipeline.
+ * @param awake_us Time since the application started, in microseconds.
+ */
+void wake_stats_record_boot(const boot_report_t *report, int64_t awake_us);
+
+/**
+ * @brief Adds the publish latency of events acknowledged by the broker.
+ *
+ * @param count          Number of acknowledged events.
+ * @param latency_ms     Time from the trigger to the acknowledgment, summed over the events.
+ * @param max_latency_ms Longest time from a trigger to the acknowledgment.
+ */
+void wake_stats_record_publish(uint32_t count, uint64_t latency_ms, uint32_t max_latency_ms);
+
+/**
+ * @brief Adds the time from the start of the MQTT connection to the first PUBACK of a boot.
+ *
+ * @param latency_ms Time from begin_mqtt() to the first acknowledged publish.
+ */
+void wake_stats_record_connect_ack(uint32_t latency_ms);
+
+/**
+ * @brief Checks if the statistics should be sent, every CONFIG_WAKE_STATS_INTERVAL_SEC.
+ *
+ * @return true if the statistics should be sent.
+ */
+bool wake_stats_due(void);
+
+/**
+ * @brief Starts a new statistics period, after the statistics were delivered.
+ */
+void wake_stats_reset(void);
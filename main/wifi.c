@@ -1,3 +1,5 @@
+#include <string.h>
+#include <inttypes.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
@@ -5,6 +7,9 @@
 
 #include "esp_log.h"
 #include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_netif_net_stack.h"
+#include "lwip/dhcp.h"
 #include "main.h"
 
 /* FreeRTOS event group to signal when we are connected*/
@@ -18,11 +23,138 @@ static EventGroupHandle_t s_wifi_event_group;
 
 static int s_retry_num = 0;
 
+/* Access point and DHCP lease of the last successful connection, kept across deep sleep.
+ * Lets the next wake connect to the known BSSID on the known channel without a scan
+ * and without a DHCP exchange. */
+typedef struct {
+  bool valid;                    // < The AP fields below are set.
+  uint8_t bssid[6];              // < BSSID of the access point.
+  uint8_t channel;               // < Primary channel of the access point.
+  bool lease_valid;              // < The lease fields below are set.
+  esp_netif_ip_info_t ip_info;   // < IP address, netmask and gateway of the DHCP lease.
+  esp_ip4_addr_t dns;            // < Main DNS server of the DHCP lease.
+  uint64_t lease_time_ms;        // < RTC time (in milliseconds) when the lease was obtained.
+  uint32_t lease_renew_sec;      // < Renewal time (T1) of the lease in seconds, 0 if unknown.
+} wifi_fast_connect_cache_t;
+
+static RTC_DATA_ATTR wifi_fast_connect_cache_t s_cache;
+
+// Connection latency of the last wake, kept in RTC memory.
+RTC_DATA_ATTR uint32_t wifi_connect_time_ms = 0;
+RTC_DATA_ATTR bool wifi_fast_connect_used = false;
+
+static wifi_config_t s_wifi_config;
+static esp_netif_t* s_netif;
+static bool s_fast_connect = false;   // Connecting to the cached AP without a scan.
+static bool s_reused_lease = false;   // The cached DHCP lease is configured as a static IP.
+static int64_t s_connect_start_us;
+
+/**
+ * @brief Configures a fixed IP address instead of DHCP.
+ */
+static void set_static_ip(const esp_netif_ip_info_t* ip_info, esp_ip4_addr_t dns) {
+  ESP_ERROR_CHECK(esp_netif_dhcpc_stop(s_netif));
+  ESP_ERROR_CHECK(esp_netif_set_ip_info(s_netif, ip_info));
+  if (dns.addr != 0) {
+    esp_netif_dns_info_t dns_info = {0};
+    dns_info.ip.type = ESP_IPADDR_TYPE_V4;
+    dns_info.ip.u_addr.ip4 = dns;
+    ESP_ERROR_CHECK(esp_netif_set_dns_info(s_netif, ESP_NETIF_DNS_MAIN, &dns_info));
+  }
+}
+
+/**
+ * @brief Applies the configured static IP (WIFI_STATIC_IP) or the cached DHCP lease, if any.
+ */
+static void configure_ip(void) {
+  if (strlen(WIFI_STATIC_IP) > 0) {
+    esp_netif_ip_info_t ip_info = {0};
+    esp_ip4_addr_t dns = {0};
+    esp_netif_str_to_ip4(WIFI_STATIC_IP, &ip_info.ip);
+    esp_netif_str_to_ip4(WIFI_STATIC_NETMASK, &ip_info.netmask);
+    esp_netif_str_to_ip4(WIFI_STATIC_GATEWAY, &ip_info.gw);
+    esp_netif_str_to_ip4(WIFI_STATIC_DNS, &dns);
+    ESP_LOGI("wifi", "using static IP " IPSTR, IP2STR(&ip_info.ip));
+    set_static_ip(&ip_info, dns);
+    return;
+  }
+
+  // The server expects a renewal after T1, the address may be handed out again later
+  uint64_t max_age_sec = CONFIG_WIFI_LEASE_REUSE_SEC;
+  if (s_cache.lease_renew_sec != 0 && s_cache.lease_renew_sec < max_age_sec) {
+    max_age_sec = s_cache.lease_renew_sec;
+  }
+  uint64_t lease_age_ms = get_time_since_boot_in_ms() - s_cache.lease_time_ms;
+  if (CONFIG_WIFI_FAST_CONNECT && s_cache.lease_valid && lease_age_ms < max_age_sec * 1000) {
+    ESP_LOGI("wifi", "reusing DHCP lease " IPSTR " (%llu s old)", IP2STR(&s_cache.ip_info.ip), lease_age_ms / 1000);
+    set_static_ip(&s_cache.ip_info, s_cache.dns);
+    s_reused_lease = true;
+  }
+}
+
+/**
+ * @brief Drops the cached AP and lease and connects again with a full scan and DHCP.
+ */
+static void fall_back_to_full_scan(void) {
+  ESP_LOGI("wifi", "fast connect failed, falling back to a full scan");
+  s_fast_connect = false;
+  s_cache.valid = false;
+  s_wifi_config.sta.bssid_set = false;
+  s_wifi_config.sta.channel = 0;
+  s_wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+  esp_wifi_set_config(WIFI_IF_STA, &s_wifi_config);
+
+  if (s_reused_lease) {
+    s_cache.lease_valid = false;
+    s_reused_lease = false;
+    esp_netif_dhcpc_start(s_netif);
+  }
+}
+
+/**
+ * @brief Returns the renewal time (T1) of the current DHCP lease in seconds, 0 if unknown.
+ */
+static uint32_t dhcp_renewal_time_sec(void) {
+  struct netif* netif = esp_netif_get_netif_impl(s_netif);
+  struct dhcp* dhcp = netif != NULL ? netif_dhcp_data(netif) : NULL;
+  if (dhcp == NULL) {
+    return 0;
+  }
+  // A server may leave out T1, it defaults to half the lease time
+  return dhcp->offered_t1_renew != 0 ? dhcp->offered_t1_renew : dhcp->offered_t0_lease / 2;
+}
+
+/**
+ * @brief Stores the AP and, if it came from DHCP, the lease of the current connection.
+ */
+static void update_cache(const esp_netif_ip_info_t* ip_info) {
+  wifi_ap_record_t ap_info;
+  if (esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK) {
+    memcpy(s_cache.bssid, ap_info.bssid, sizeof(s_cache.bssid));
+    s_cache.channel = ap_info.primary;
+    s_cache.valid = true;
+  }
+
+  if (!s_reused_lease && strlen(WIFI_STATIC_IP) == 0) {
+    esp_netif_dns_info_t dns_info = {0};
+    esp_netif_get_dns_info(s_netif, ESP_NETIF_DNS_MAIN, &dns_info);
+    s_cache.ip_info = *ip_info;
+    s_cache.dns = dns_info.ip.u_addr.ip4;
+    s_cache.lease_time_ms = get_time_since_boot_in_ms();
+    s_cache.lease_renew_sec = dhcp_renewal_time_sec();
+    s_cache.lease_valid = true;
+    ESP_LOGI("wifi", "DHCP lease renewal time %" PRIu32 " s", s_cache.lease_renew_sec);
+  }
+}
+
 static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
   if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
     esp_wifi_connect();
   } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-    if (s_retry_num < 10) {
+    if (s_fast_connect) {
+      fall_back_to_full_scan();
+      esp_wifi_connect();
+    } else if (s_retry_num < 10) {
       esp_wifi_connect();
       s_retry_num++;
       ESP_LOGI("wifi", "retry to connect to the AP");
@@ -33,23 +165,69 @@ static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_
   } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
     ip_event_got_ip_t* event = (ip_event_got_ip_t*)event_data;
     ESP_LOGI("wifi", "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
+    wifi_connect_time_ms = (esp_timer_get_time() - s_connect_start_us) / 1000;
+    wifi_fast_connect_used = s_fast_connect;
+    update_cache(&event->ip_info);
     s_retry_num = 0;
     xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
   }
 }
 
+/**
+ * @brief Reconnects the station of the light sleep event loop whenever it loses the AP.
+ *
+ * Registered after wait_for_wifi() removed event_handler(), without a retry limit.
+ */
+static void keep_connected_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
+  if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+    wifi_event_sta_disconnected_t* event = (wifi_event_sta_disconnected_t*)event_data;
+    ESP_LOGW("wifi", "disconnected from the AP (reason %d), reconnecting", event->reason);
+    esp_wifi_connect();
+  } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+    ip_event_got_ip_t* event = (ip_event_got_ip_t*)event_data;
+    ESP_LOGI("wifi", "reconnected, got ip:" IPSTR, IP2STR(&event->ip_info.ip));
+  }
+}
+
+void wifi_enable_modem_sleep(void) {
+  ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &keep_connected_handler, NULL));
+  ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &keep_connected_handler, NULL));
+  // The AP may have been lost since wait_for_wifi() returned
+  wifi_ap_record_t ap_info;
+  if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK) {
+    ESP_LOGW("wifi", "not connected to the AP, reconnecting");
+    esp_wifi_connect();
+  }
+  // The radio only wakes up for the DTIM beacons, the AP buffers the frames in between
+  ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_MIN_MODEM));
+  ESP_LOGI("wifi", "modem sleep enabled");
+}
+
+void wifi_drop_reused_lease(void) {
+  if (s_reused_lease) {
+    ESP_LOGW("wifi", "reused DHCP lease " IPSTR " may be taken by another host, using DHCP on the next wake",
+             IP2STR(&s_cache.ip_info.ip));
+    s_cache.lease_valid = false;
+  }
+}
 
 void finish_wifi(void){
   esp_wifi_disconnect();
 }
 
 void start_wifi(void) {
+  begin_wifi();
+  wait_for_wifi();
+}
+
+void begin_wifi(void) {
   s_wifi_event_group = xEventGroupCreate();
+  s_connect_start_us = esp_timer_get_time();
 
   ESP_ERROR_CHECK(esp_netif_init());
 
   ESP_ERROR_CHECK(esp_event_loop_create_default());
-  esp_netif_create_default_wifi_sta();
+  s_netif = esp_netif_create_default_wifi_sta();
 
   wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
   ESP_ERROR_CHECK(esp_wifi_init(&cfg));
@@ -66,16 +244,33 @@ void start_wifi(void) {
               .pmf_cfg = {.capable = true, .required = false},
           },
   };
+
+  // Connect straight to the AP of the last wake, skipping the scan
+  s_fast_connect = CONFIG_WIFI_FAST_CONNECT && s_cache.valid;
+  if (s_fast_connect) {
+    ESP_LOGI("wifi", "fast connect to " MACSTR " on channel %d", MAC2STR(s_cache.bssid), s_cache.channel);
+    wifi_config.sta.bssid_set = true;
+    memcpy(wifi_config.sta.bssid, s_cache.bssid, sizeof(wifi_config.sta.bssid));
+    wifi_config.sta.channel = s_cache.channel;
+    wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+  }
+  s_wifi_config = wifi_config;
+
   ESP_LOGI("connecting to:", EXAMPLE_ESP_WIFI_SSID);
   ESP_LOGI("wifi", EXAMPLE_ESP_WIFI_SSID);
   ESP_LOGI("wifi", EXAMPLE_ESP_WIFI_PASS);
 
+  s_reused_lease = false;
+  configure_ip();
+
   ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-  ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
+  ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &s_wifi_config));
   ESP_ERROR_CHECK(esp_wifi_start());
 
   ESP_LOGI("wifi", "wifi_init_sta finished.");
+}
 
+void wait_for_wifi(void) {
   /* Waiting until either the connection is established (WIFI_CONNECTED_BIT) or connection failed for the maximum
    * number of re-tries (WIFI_FAIL_BIT). The bits are set by event_handler() (see above) */
   EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT, pdFALSE, pdFALSE, portMAX_DELAY);
@@ -83,7 +278,7 @@ void start_wifi(void) {
   /* xEventGroupWaitBits() returns the bits before the call returned, hence we can test which event actually
    * happened. */
   if (bits & WIFI_CONNECTED_BIT) {
-    ESP_LOGI("wifi", "connected");
+    ESP_LOGI("wifi", "connected in %" PRIu32 " ms (fast connect: %s)", wifi_connect_time_ms, wifi_fast_connect_used ? "yes" : "no");
 
      // Print IP address
     esp_netif_ip_info_t ip_info;
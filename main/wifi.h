@@ -3,8 +3,53 @@
 #include "freertos/event_groups.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
+#include "esp_attr.h"
 
+// Time (in milliseconds) from begin_wifi() until the station got an IP address, on the last wake.
+extern RTC_DATA_ATTR uint32_t wifi_connect_time_ms;
 
+// True if the last connection was made to the cached access point without a scan.
+extern RTC_DATA_ATTR bool wifi_fast_connect_used;
 
+/**
+ * @brief Starts the Wi-Fi station and waits until it got an IP address.
+ *
+ * Same as begin_wifi() followed by wait_for_wifi().
+ */
 void start_wifi(void);
+
+/**
+ * @brief Initializes and starts the Wi-Fi station without waiting for the connection.
+ *
+ * If the access point of the last wake is cached in RTC memory, connects to its BSSID
+ * and channel without a scan and reuses the cached DHCP lease until its renewal time (T1),
+ * at most CONFIG_WIFI_LEASE_REUSE_SEC.
+ * Falls back to a full scan and DHCP if the targeted connection fails.
+ */
+void begin_wifi(void);
+
+/**
+ * @brief Waits until the station started by begin_wifi() got an IP address.
+ *
+ * Restarts the chip if the connection fails.
+ */
+void wait_for_wifi(void);
+
+/**
+ * @brief Keeps the station connected in DTIM based modem sleep.
+ *
+ * Used by the light sleep event loop: the station reconnects without a retry limit and
+ * the radio sleeps between the DTIM beacons of the access point.
+ */
+void wifi_enable_modem_sleep(void);
+
+/**
+ * @brief Drops the cached DHCP lease if it was reused on this wake.
+ *
+ * Called when the broker or the SNTP server could not be reached. Association works with
+ * an address the DHCP server gave to another host meanwhile, only the IP traffic fails,
+ * so the next wake asks the DHCP server again.
+ */
+void wifi_drop_reused_lease(void);
+
 void finish_wifi(void);
\ No newline at end of file
@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+"""Provisions the `registry` NVS partition of one node.
+
+Every node gets an image with only its own namespace (named by its Wi-Fi station MAC
+address), so a node never holds the MQTT key of another one and the partition size does
+not depend on the number of nodes.
+
+The nodes are listed in a CSV with the header
+
+    mac,id,name,topic,room,battery,key
+
+e.g. `ec:62:60:bc:e8:50,4,Living Room,1/4/data,livingroombedarea,1,<JWT>`.
+
+Generate the image of a node:
+
+    tools/provision_registry.py nodes.csv --mac ec6260bce850 -o registry.bin
+
+Read the MAC address of the node on a serial port, generate its image and flash it:
+
+    tools/provision_registry.py nodes.csv --port /dev/ttyUSB0
+
+Needs an ESP-IDF environment (IDF_PATH, esptool.py).
+"""
+
+import argparse
+import csv
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+PARTITION = 'registry'
+PARTITION_SIZE = 0x6000  # See partitions.csv
+
+# NVS keys of main/device_registry.h
+ENTRY_KEYS = [
+    ('id', 'i32'),
+    ('name', 'string'),
+    ('topic', 'string'),
+    ('room', 'string'),
+    ('battery', 'u8'),
+    ('key', 'string'),
+]
+
+
+def normalize_mac(mac):
+    digits = re.sub(r'[^0-9a-fA-F]', '', mac).lower()
+    if len(digits) != 12:
+        sys.exit(f'Invalid MAC address: {mac}')
+    return digits
+
+
+def idf_tool(*path):
+    idf_path = os.environ.get('IDF_PATH')
+    if not idf_path:
+        sys.exit('IDF_PATH is not set, run the ESP-IDF export script first')
+    return os.path.join(idf_path, 'components', *path)
+
+
+def read_mac(port):
+    output = subprocess.run(['esptool.py', '--port', port, 'read_mac'], check=True,
+                            capture_output=True, text=True).stdout
+    match = re.search(r'MAC:\s*([0-9a-fA-F:]{17})', output)
+    if not match:
+        sys.exit(f'Could not read the MAC address on {port}')
+    return normalize_mac(match.group(1))
+
+
+def load_node(nodes_csv, mac):
+    with open(nodes_csv, newline='') as f:
+        for row in csv.DictReader(f):
+            if normalize_mac(row['mac']) == mac:
+                return row
+    sys.exit(f'{mac} is not listed in {nodes_csv}')
+
+
+def generate(node, mac, output):
+    with tempfile.NamedTemporaryFile('w', suffix='.csv', delete=False, newline='') as f:
+        writer = csv.writer(f)
+        writer.writerow(['key', 'type', 'encoding', 'value'])
+        writer.writerow([mac, 'namespace', '', ''])
+        for key, encoding in ENTRY_KEYS:
+            writer.writerow([key, 'data', encoding, node[key]])
+        node_csv = f.name
+    try:
+        subprocess.run([sys.executable, idf_tool('nvs_flash', 'nvs_partition_generator', 'nvs_partition_gen.py'),
+                        'generate', node_csv, output, hex(PARTITION_SIZE)], check=True)
+    finally:
+        os.remove(node_csv)
+
+
+def flash(port, image):
+    subprocess.run([sys.executable, idf_tool('partition_table', 'parttool.py'), '--port', port,
+                    'write_partition', '--partition-name', PARTITION, '--input', image], check=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('nodes', help='CSV with one row per node')
+    parser.add_argument('--mac', help='MAC address of the node, read from --port if not given')
+    parser.add_argument('--port', help='serial port of the node, the image is flashed if given')
+    parser.add_argument('-o', '--output', help='image file, default registry-<mac>.bin')
+    args = parser.parse_args()
+
+    if not args.mac and not args.port:
+        parser.error('either --mac or --port is needed')
+    mac = normalize_mac(args.mac) if args.mac else read_mac(args.port)
+    output = args.output or f'registry-{mac}.bin'
+
+    generate(load_node(args.nodes, mac), mac, output)
+    print(f'Generated {output} for {mac}')
+    if args.port:
+        flash(args.port, output)
+        print(f'Flashed {output} to the {PARTITION} partition on {args.port}')
+
+
+if __name__ == '__main__':
+    main()